@@ -0,0 +1,1213 @@
+#include "decimator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "quadric.h"
+#include "run-tasks.h"
+
+namespace
+{
+
+const uint32_t NO_VERTEX = uint32_t(-1);
+
+// Weight of the planes through boundary edges, which keep the boundary
+// from shrinking.
+const double BOUNDARY_WEIGHT = 10;
+// Collapses turning the normal of a triangle by more than about 78
+// degrees are skipped.
+const double MIN_NORMAL_COS = 0.2;
+
+const int CELLS_PER_THREAD = 2;
+const size_t MIN_CELL_TRIANGLES = 100000;
+// The cells stop at this multiple of their share of the target, leaving
+// the rest to the final pass, which also sees the cell borders.
+const double CELL_TARGET_SLACK = 2;
+
+enum VertexFlag {
+    VERTEX_LOCKED = 1,
+    VERTEX_BOUNDARY = 2,
+    VERTEX_REMOVED = 4
+};
+
+// The color part of the quadric of a vertex, after Hoppe's quadric for
+// surfaces with attributes. Every triangle interpolates each channel
+// linearly as s(v) = g.v + d, and the error of a color s at v is
+// weight (s - g.v - d)^2. The terms with v only are in the position
+// quadric; here are those with s, the sums of weight g and weight d per
+// channel and of the weights.
+class ColorQuadric {
+public:
+    ColorQuadric()
+        : m_weight(0)
+    {
+        std::fill(m_offsets, m_offsets + 3, 0.0);
+    }
+
+    // A triangle with the colors at its corners, in units of distance,
+    // and the weight of its area. Adds the position terms to quadric.
+    static ColorQuadric triangle(
+            const Vec3* positions,
+            const Vec3* colors,
+            double weight,
+            Quadric& quadric)
+    {
+        ColorQuadric q;
+        const Vec3 e1 = positions[1] - positions[0];
+        const Vec3 e2 = positions[2] - positions[0];
+        const Vec3 n = cross(e1, e2);
+        const double n2 = length2(n);
+        if (n2 == 0)
+            return q;
+
+        // The gradient is in the plane of the triangle, with the color
+        // differences along both edges.
+        const Vec3 across1 = cross(e2, n) * (1 / n2);
+        const Vec3 across2 = cross(n, e1) * (1 / n2);
+        const double c0[3] = {colors[0].x, colors[0].y, colors[0].z};
+        const double c1[3] = {colors[1].x, colors[1].y, colors[1].z};
+        const double c2[3] = {colors[2].x, colors[2].y, colors[2].z};
+        for (int channel = 0; channel < 3; ++channel) {
+            const Vec3 g = across1 * (c1[channel] - c0[channel])
+                           + across2 * (c2[channel] - c0[channel]);
+            const double d = c0[channel] - dot(g, positions[0]);
+            q.m_gradients[channel] = g * weight;
+            q.m_offsets[channel] = d * weight;
+            quadric += Quadric::plane(g, d, weight, 0);
+        }
+        q.m_weight = weight;
+        return q;
+    }
+
+    ColorQuadric& operator+=(const ColorQuadric& q)
+    {
+        for (int i = 0; i < 3; ++i) {
+            m_gradients[i] = m_gradients[i] + q.m_gradients[i];
+            m_offsets[i] += q.m_offsets[i];
+        }
+        m_weight += q.m_weight;
+        return *this;
+    }
+
+    bool isEmpty() const { return m_weight <= 0; }
+
+    // The error of the color terms, to add to the position quadric.
+    double evaluate(const Vec3& v, const Vec3& color) const
+    {
+        const double s[3] = {color.x, color.y, color.z};
+        double error = 0;
+        for (int i = 0; i < 3; ++i) {
+            error += m_weight * s[i] * s[i]
+                     - 2 * s[i] * (dot(m_gradients[i], v) + m_offsets[i]);
+        }
+        return error;
+    }
+
+    // The color with the least error at v.
+    Vec3 findColor(const Vec3& v) const
+    {
+        double s[3];
+        for (int i = 0; i < 3; ++i) {
+            s[i] = (dot(m_gradients[i], v) + m_offsets[i]) / m_weight;
+        }
+        return Vec3(s[0], s[1], s[2]);
+    }
+
+    // What the position quadric loses when every v gets its best color,
+    // so that the sum is minimized by the best position.
+    Quadric getReduction() const
+    {
+        Quadric q;
+        for (int i = 0; i < 3; ++i) {
+            q += Quadric::plane(m_gradients[i], m_offsets[i], -1 / m_weight, 0);
+        }
+        return q;
+    }
+
+private:
+    Vec3 m_gradients[3];
+    double m_offsets[3];
+    double m_weight;
+};
+
+struct Collapse {
+    Vec3 position;
+    // In units of distance, when the colors are decimated too.
+    Vec3 color;
+    // Quadric error, which orders the collapses.
+    double cost;
+    // The error as a distance.
+    double error;
+};
+
+struct Candidate {
+    double cost;
+    uint32_t a;
+    uint32_t b;
+    // Stamps of the ends when the cost was found; the candidate is stale
+    // once either end has changed.
+    uint32_t stampA;
+    uint32_t stampB;
+
+    // Cheapest first in a priority queue.
+    bool operator<(const Candidate& other) const
+    {
+        return cost > other.cost;
+    }
+};
+
+// What the collapses need of the vertices besides their positions. The
+// quadrics are found once on the input and carried through the cells to
+// the final pass, so that every error is measured from the input.
+struct VertexQuadrics {
+    VertexQuadrics()
+        : colorScale(0)
+    {}
+
+    std::vector<Quadric> quadrics;
+    // Empty when the colors aren't decimated.
+    std::vector<ColorQuadric> colorQuadrics;
+    std::vector<uint8_t> flags;
+    // Distance of one color step.
+    double colorScale;
+};
+
+bool isDegenerate(const uint32_t* v)
+{
+    return v[0] == v[1] || v[1] == v[2] || v[2] == v[0];
+}
+
+Vec3 getColor(const TriangleMesh& mesh, uint32_t vertex, double scale)
+{
+    const uint8_t* c = &mesh.colors[3 * vertex];
+    return Vec3(c[0] * scale, c[1] * scale, c[2] * scale);
+}
+
+// Sums the planes of the triangles at their vertices, and with a color
+// weight their colors. Boundary edges, those of one triangle, add planes
+// through them across their triangle and flag their vertices.
+void computeQuadrics(
+        const TriangleMesh& mesh,
+        double colorWeight,
+        VertexQuadrics& vertices)
+{
+    const bool isColored = colorWeight > 0 && !mesh.colors.empty();
+    vertices.quadrics.assign(mesh.getVertexQty(), Quadric());
+    vertices.colorQuadrics.assign(isColored ? mesh.getVertexQty() : 0,
+                                  ColorQuadric());
+    vertices.flags.assign(mesh.getVertexQty(), 0);
+    vertices.colorScale = isColored ? colorWeight / 255 : 0;
+
+    // (edge, triangle) with the edge as (smaller << 32) | larger.
+    std::vector<std::pair<uint64_t, uint32_t> > edges;
+    edges.reserve(mesh.indices.size());
+
+    const float* p = mesh.positions.data();
+    const auto position = [p](uint32_t vertex) {
+        return Vec3(p[3 * vertex], p[3 * vertex + 1], p[3 * vertex + 2]);
+    };
+    const auto normal = [&](const uint32_t* v) {
+        const Vec3 p0 = position(v[0]);
+        return cross(position(v[1]) - p0, position(v[2]) - p0);
+    };
+
+    for (uint32_t t = 0; t < mesh.getTriangleQty(); ++t) {
+        const uint32_t* v = &mesh.indices[3 * t];
+        if (isDegenerate(v))
+            continue;
+        const Vec3 faceNormal = normal(v);
+        const double length = std::sqrt(length2(faceNormal));
+        if (length > 0) {
+            const Vec3 n = faceNormal * (1 / length);
+            const double area = length / 2;
+            Quadric q = Quadric::plane(n, -dot(n, position(v[0])), area, area);
+            if (isColored) {
+                const Vec3 positions[3] = {position(v[0]), position(v[1]), position(v[2])};
+                const Vec3 colors[3] = {
+                    getColor(mesh, v[0], vertices.colorScale),
+                    getColor(mesh, v[1], vertices.colorScale),
+                    getColor(mesh, v[2], vertices.colorScale)
+                };
+                const ColorQuadric c = ColorQuadric::triangle(positions, colors, area, q);
+                for (int i = 0; i < 3; ++i) {
+                    vertices.colorQuadrics[v[i]] += c;
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                vertices.quadrics[v[i]] += q;
+            }
+        }
+        for (int i = 0; i < 3; ++i) {
+            const uint64_t a = v[i];
+            const uint64_t b = v[(i + 1) % 3];
+            edges.push_back(std::make_pair(
+                    std::min(a, b) << 32 | std::max(a, b), t));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size(); ) {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end].first == edges[i].first) {
+            ++end;
+        }
+
+        // Edges of more than two triangles are kept like boundaries.
+        if (end - i != 2) {
+            const uint32_t a = uint32_t(edges[i].first >> 32);
+            const uint32_t b = uint32_t(edges[i].first);
+            const Vec3 edge = position(b) - position(a);
+            const Vec3 planeNormal =
+                cross(edge, normal(&mesh.indices[3 * edges[i].second]));
+            const double length = std::sqrt(length2(planeNormal));
+            if (length > 0) {
+                const Vec3 n = planeNormal * (1 / length);
+                const Quadric q = Quadric::plane(
+                        n, -dot(n, position(a)), BOUNDARY_WEIGHT * length2(edge), 0);
+                vertices.quadrics[a] += q;
+                vertices.quadrics[b] += q;
+            }
+            vertices.flags[a] |= VERTEX_BOUNDARY;
+            vertices.flags[b] |= VERTEX_BOUNDARY;
+        }
+        i = end;
+    }
+}
+
+// The triangles of a vertex are m_refs[start, start + count), which may
+// include deleted ones.
+struct RefRange {
+    size_t start;
+    uint32_t count;
+};
+
+// Serial decimation of one mesh. Triangles keep their input indices and
+// are only marked as deleted; every collapse appends the new triangle list
+// of the kept vertex to m_refs, which is compacted when it has grown.
+class EdgeCollapser {
+public:
+    // Takes the quadrics of the vertices. Locked vertices don't move or
+    // change color, but others may collapse into them.
+    EdgeCollapser(const TriangleMesh& mesh, VertexQuadrics& vertices);
+
+    // Collapses until at most triangleQty triangles are left or no edge
+    // collapses with an error up to maxError.
+    void run(size_t triangleQty, double maxError);
+
+    size_t getTriangleQty() const { return m_triangleQty; }
+    double getMaxError() const { return m_maxError; }
+
+    // Appends the collapses that run() does to history, in the vertices
+    // of the mesh.
+    void setHistory(std::vector<EdgeCollapse>* history) { m_history = history; }
+
+    // The vertices still used, with the input index of each in sources.
+    void getResult(
+            TriangleMesh& mesh,
+            std::vector<uint32_t>& sources,
+            VertexQuadrics& vertices) const;
+
+private:
+    void initRefs();
+    void initCandidates();
+
+    bool isDeleted(uint32_t triangle) const { return m_isDeleted[triangle] != 0; }
+    bool hasVertex(uint32_t triangle, uint32_t vertex) const;
+
+    // Calls function(triangle) for the live triangles of the vertex.
+    template <typename Function>
+    void forEachTriangle(uint32_t vertex, const Function& function) const;
+    // Fills m_neighbours.
+    void findNeighbours(uint32_t vertex);
+
+    bool findCollapse(uint32_t a, uint32_t b, Collapse& collapse) const;
+    bool canCollapse(uint32_t a, uint32_t b, const Vec3& position);
+    bool keepsOrientation(uint32_t vertex, uint32_t other, const Vec3& position) const;
+    void collapse(uint32_t a, uint32_t b, const Collapse& found);
+    void pushCandidates(uint32_t vertex);
+    // The color the vertex has in the result, black without colors.
+    void getByteColor(uint32_t vertex, uint8_t* color) const;
+    void compactRefs();
+
+    const TriangleMesh& m_mesh;
+    std::vector<Vec3> m_positions;
+    std::vector<Quadric> m_quadrics;
+    std::vector<ColorQuadric> m_colorQuadrics;
+    // Colors in units of distance, with color quadrics only.
+    std::vector<Vec3> m_colors;
+    double m_colorScale;
+    std::vector<uint8_t> m_flags;
+    std::vector<uint32_t> m_stamps;
+    std::vector<uint32_t> m_indices;
+    std::vector<uint8_t> m_isDeleted;
+    size_t m_triangleQty;
+
+    std::vector<RefRange> m_refRanges;
+    std::vector<uint32_t> m_refs;
+    size_t m_refLimit;
+
+    // Vertices marked with the current mark are found in this search.
+    std::vector<uint32_t> m_marks;
+    uint32_t m_mark;
+    std::vector<uint32_t> m_neighbours;
+
+    std::priority_queue<Candidate> m_candidates;
+    double m_maxError;
+    std::vector<EdgeCollapse>* m_history;
+};
+
+EdgeCollapser::EdgeCollapser(const TriangleMesh& mesh, VertexQuadrics& vertices)
+    : m_mesh(mesh)
+    , m_positions(mesh.getVertexQty())
+    , m_colorScale(vertices.colorScale)
+    , m_stamps(mesh.getVertexQty(), 0)
+    , m_indices(mesh.indices)
+    , m_isDeleted(mesh.getTriangleQty(), 0)
+    , m_triangleQty(0)
+    , m_refLimit(0)
+    , m_marks(mesh.getVertexQty(), 0)
+    , m_mark(0)
+    , m_maxError(0)
+    , m_history(0)
+{
+    for (size_t i = 0; i < m_positions.size(); ++i) {
+        m_positions[i] = Vec3(mesh.positions[3 * i],
+                              mesh.positions[3 * i + 1],
+                              mesh.positions[3 * i + 2]);
+    }
+    m_quadrics.swap(vertices.quadrics);
+    m_colorQuadrics.swap(vertices.colorQuadrics);
+    m_flags.swap(vertices.flags);
+    if (!m_colorQuadrics.empty()) {
+        m_colors.resize(m_positions.size());
+        for (size_t i = 0; i < m_colors.size(); ++i) {
+            m_colors[i] = getColor(mesh, uint32_t(i), m_colorScale);
+        }
+    }
+
+    for (size_t t = 0; t < m_isDeleted.size(); ++t) {
+        if (isDegenerate(&m_indices[3 * t])) {
+            m_isDeleted[t] = 1;
+        } else {
+            ++m_triangleQty;
+        }
+    }
+
+    initRefs();
+    initCandidates();
+}
+
+void EdgeCollapser::initCandidates()
+{
+    std::vector<Candidate> candidates;
+    for (uint32_t a = 0; a < m_positions.size(); ++a) {
+        findNeighbours(a);
+        for (size_t i = 0; i < m_neighbours.size(); ++i) {
+            Candidate candidate;
+            candidate.a = a;
+            candidate.b = m_neighbours[i];
+            candidate.stampA = 0;
+            candidate.stampB = 0;
+            Collapse collapse;
+            if (candidate.a < candidate.b
+                && findCollapse(candidate.a, candidate.b, collapse))
+            {
+                candidate.cost = collapse.cost;
+                candidates.push_back(candidate);
+            }
+        }
+    }
+    m_candidates = std::priority_queue<Candidate>(
+            std::less<Candidate>(), std::move(candidates));
+}
+
+void EdgeCollapser::initRefs()
+{
+    m_refRanges.resize(m_positions.size());
+    compactRefs();
+}
+
+// Rebuilds m_refs from the live triangles.
+void EdgeCollapser::compactRefs()
+{
+    for (size_t i = 0; i < m_refRanges.size(); ++i) {
+        m_refRanges[i].count = 0;
+    }
+    for (size_t t = 0; t < m_isDeleted.size(); ++t) {
+        if (!isDeleted(uint32_t(t))) {
+            for (int i = 0; i < 3; ++i) {
+                ++m_refRanges[m_indices[3 * t + i]].count;
+            }
+        }
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i < m_refRanges.size(); ++i) {
+        m_refRanges[i].start = start;
+        start += m_refRanges[i].count;
+        m_refRanges[i].count = 0;
+    }
+
+    m_refs.resize(start);
+    for (uint32_t t = 0; t < m_isDeleted.size(); ++t) {
+        if (!isDeleted(t)) {
+            for (int i = 0; i < 3; ++i) {
+                RefRange& range = m_refRanges[m_indices[3 * t + i]];
+                m_refs[range.start + range.count++] = t;
+            }
+        }
+    }
+    m_refLimit = 2 * m_refs.size() + 1024;
+}
+
+bool EdgeCollapser::hasVertex(uint32_t triangle, uint32_t vertex) const
+{
+    const uint32_t* v = &m_indices[3 * triangle];
+    return v[0] == vertex || v[1] == vertex || v[2] == vertex;
+}
+
+template <typename Function>
+void EdgeCollapser::forEachTriangle(uint32_t vertex, const Function& function) const
+{
+    const RefRange& range = m_refRanges[vertex];
+    for (size_t i = range.start; i < range.start + range.count; ++i) {
+        const uint32_t t = m_refs[i];
+        if (!isDeleted(t))
+            function(t);
+    }
+}
+
+void EdgeCollapser::findNeighbours(uint32_t vertex)
+{
+    ++m_mark;
+    m_neighbours.clear();
+    forEachTriangle(vertex, [&](uint32_t t) {
+        for (int i = 0; i < 3; ++i) {
+            const uint32_t v = m_indices[3 * t + i];
+            if (v != vertex && m_marks[v] != m_mark) {
+                m_marks[v] = m_mark;
+                m_neighbours.push_back(v);
+            }
+        }
+    });
+}
+
+// Ill-conditioned minima far from the edge are replaced by the best of
+// the ends and the middle. With colors the position minimizes the error
+// with the best color at every position, and that color is kept within
+// the range of the input.
+bool EdgeCollapser::findCollapse(
+        uint32_t a,
+        uint32_t b,
+        Collapse& collapse) const
+{
+    const bool isALocked = (m_flags[a] & VERTEX_LOCKED) != 0;
+    const bool isBLocked = (m_flags[b] & VERTEX_LOCKED) != 0;
+    if (isALocked && isBLocked)
+        return false;
+
+    Quadric q = m_quadrics[a];
+    q += m_quadrics[b];
+    ColorQuadric colorQuadric;
+    if (!m_colorQuadrics.empty()) {
+        colorQuadric = m_colorQuadrics[a];
+        colorQuadric += m_colorQuadrics[b];
+    }
+
+    const Vec3& pa = m_positions[a];
+    const Vec3& pb = m_positions[b];
+    Vec3& position = collapse.position;
+    if (isALocked) {
+        position = pa;
+    } else if (isBLocked) {
+        position = pb;
+    } else {
+        Quadric reduced = q;
+        if (!colorQuadric.isEmpty())
+            reduced += colorQuadric.getReduction();
+
+        const Vec3 middle = (pa + pb) * 0.5;
+        if (!reduced.findMinimum(position)
+            || length2(position - middle) > length2(pb - pa))
+        {
+            const Vec3 choices[3] = {pa, pb, middle};
+            double best = std::numeric_limits<double>::max();
+            for (int i = 0; i < 3; ++i) {
+                const double error = reduced.evaluate(choices[i]);
+                if (error < best) {
+                    best = error;
+                    position = choices[i];
+                }
+            }
+        }
+    }
+
+    double cost = q.evaluate(position);
+    if (!m_colors.empty()) {
+        if (isBLocked) {
+            collapse.color = m_colors[b];
+        } else if (isALocked || colorQuadric.isEmpty()) {
+            collapse.color = m_colors[a];
+        } else {
+            const Vec3 color = colorQuadric.findColor(position);
+            const double top = 255 * m_colorScale;
+            collapse.color = Vec3(std::max(0.0, std::min(top, color.x)),
+                                  std::max(0.0, std::min(top, color.y)),
+                                  std::max(0.0, std::min(top, color.z)));
+        }
+        cost += colorQuadric.evaluate(position, collapse.color);
+    }
+
+    // Positions that aren't finite never collapse.
+    collapse.cost = std::max(0.0, cost);
+    collapse.error = q.getDistance(cost);
+    return std::isfinite(collapse.cost);
+}
+
+// The ends must share exactly the neighbours across the triangles of the
+// edge, which keeps the mesh manifold, and an inner edge between two
+// boundary vertices would pinch the surface.
+bool EdgeCollapser::canCollapse(uint32_t a, uint32_t b, const Vec3& position)
+{
+    size_t sharedTriangleQty = 0;
+    forEachTriangle(a, [&](uint32_t t) {
+        if (hasVertex(t, b))
+            ++sharedTriangleQty;
+    });
+    if (sharedTriangleQty == 0)
+        return false;
+
+    findNeighbours(a);
+    const uint32_t neighbourOfA = m_mark;
+    ++m_mark;
+    size_t sharedNeighbourQty = 0;
+    forEachTriangle(b, [&](uint32_t t) {
+        for (int i = 0; i < 3; ++i) {
+            const uint32_t v = m_indices[3 * t + i];
+            if (v != a && v != b && m_marks[v] == neighbourOfA) {
+                m_marks[v] = m_mark;
+                ++sharedNeighbourQty;
+            }
+        }
+    });
+    if (sharedNeighbourQty != sharedTriangleQty)
+        return false;
+
+    if (sharedTriangleQty == 2
+        && (m_flags[a] & VERTEX_BOUNDARY) && (m_flags[b] & VERTEX_BOUNDARY))
+    {
+        return false;
+    }
+
+    return keepsOrientation(a, b, position) && keepsOrientation(b, a, position);
+}
+
+// Checks the triangles of the vertex which don't have the other end of
+// the edge, as they are after the vertex moves to the position.
+bool EdgeCollapser::keepsOrientation(
+        uint32_t vertex,
+        uint32_t other,
+        const Vec3& position) const
+{
+    bool isKept = true;
+    forEachTriangle(vertex, [&](uint32_t t) {
+        if (!isKept || hasVertex(t, other))
+            return;
+
+        const uint32_t* v = &m_indices[3 * t];
+        Vec3 p[3] = {m_positions[v[0]], m_positions[v[1]], m_positions[v[2]]};
+        const Vec3 before = cross(p[1] - p[0], p[2] - p[0]);
+        for (int i = 0; i < 3; ++i) {
+            if (v[i] == vertex)
+                p[i] = position;
+        }
+        const Vec3 after = cross(p[1] - p[0], p[2] - p[0]);
+
+        const double beforeLength2 = length2(before);
+        const double afterLength2 = length2(after);
+        if (afterLength2 == 0
+            || (beforeLength2 > 0
+                && dot(before, after)
+                   < MIN_NORMAL_COS * std::sqrt(beforeLength2 * afterLength2)))
+        {
+            isKept = false;
+        }
+    });
+    return isKept;
+}
+
+// b goes into a.
+void EdgeCollapser::collapse(uint32_t a, uint32_t b, const Collapse& found)
+{
+    forEachTriangle(b, [&](uint32_t t) {
+        uint32_t* v = &m_indices[3 * t];
+        if (hasVertex(t, a)) {
+            m_isDeleted[t] = 1;
+            --m_triangleQty;
+        } else {
+            for (int i = 0; i < 3; ++i) {
+                if (v[i] == b)
+                    v[i] = a;
+            }
+        }
+    });
+
+    m_positions[a] = found.position;
+    m_quadrics[a] += m_quadrics[b];
+    if (!m_colors.empty()) {
+        m_colors[a] = found.color;
+        m_colorQuadrics[a] += m_colorQuadrics[b];
+    }
+    m_flags[a] |= m_flags[b] & VERTEX_BOUNDARY;
+    m_flags[b] |= VERTEX_REMOVED;
+    ++m_stamps[a];
+    ++m_stamps[b];
+
+    if (m_history) {
+        EdgeCollapse record;
+        record.a = a;
+        record.b = b;
+        record.position[0] = float(found.position.x);
+        record.position[1] = float(found.position.y);
+        record.position[2] = float(found.position.z);
+        getByteColor(a, record.color);
+        record.error = float(found.error);
+        m_history->push_back(record);
+    }
+
+    const RefRange& rangeA = m_refRanges[a];
+    const RefRange& rangeB = m_refRanges[b];
+    if (m_refs.size() + rangeA.count + rangeB.count > m_refLimit) {
+        compactRefs();
+    } else {
+        const size_t start = m_refs.size();
+        const uint32_t vertices[2] = {a, b};
+        for (int i = 0; i < 2; ++i) {
+            const RefRange range = m_refRanges[vertices[i]];
+            for (size_t j = range.start; j < range.start + range.count; ++j) {
+                const uint32_t t = m_refs[j];
+                if (!isDeleted(t))
+                    m_refs.push_back(t);
+            }
+        }
+        m_refRanges[a].start = start;
+        m_refRanges[a].count = uint32_t(m_refs.size() - start);
+    }
+    m_refRanges[b].count = 0;
+
+    pushCandidates(a);
+}
+
+void EdgeCollapser::pushCandidates(uint32_t vertex)
+{
+    findNeighbours(vertex);
+    for (size_t i = 0; i < m_neighbours.size(); ++i) {
+        Candidate candidate;
+        candidate.a = vertex;
+        candidate.b = m_neighbours[i];
+        candidate.stampA = m_stamps[candidate.a];
+        candidate.stampB = m_stamps[candidate.b];
+        Collapse collapse;
+        if (findCollapse(candidate.a, candidate.b, collapse)) {
+            candidate.cost = collapse.cost;
+            m_candidates.push(candidate);
+        }
+    }
+}
+
+// Collapses over the error are skipped rather than ending the run, since
+// the error is normalized by area and doesn't grow with the cost.
+void EdgeCollapser::run(size_t triangleQty, double maxError)
+{
+    while (m_triangleQty > triangleQty && !m_candidates.empty()) {
+        const Candidate candidate = m_candidates.top();
+        m_candidates.pop();
+
+        uint32_t a = candidate.a;
+        uint32_t b = candidate.b;
+        if ((m_flags[a] & VERTEX_REMOVED) || (m_flags[b] & VERTEX_REMOVED)
+            || m_stamps[a] != candidate.stampA
+            || m_stamps[b] != candidate.stampB)
+        {
+            continue;
+        }
+        if (m_flags[b] & VERTEX_LOCKED)
+            std::swap(a, b);
+
+        Collapse found;
+        if (!findCollapse(a, b, found)
+            || found.error > maxError
+            || !canCollapse(a, b, found.position))
+        {
+            continue;
+        }
+
+        collapse(a, b, found);
+        m_maxError = std::max(m_maxError, found.error);
+    }
+}
+
+void EdgeCollapser::getByteColor(uint32_t vertex, uint8_t* color) const
+{
+    if (!m_colors.empty()) {
+        const Vec3 c = m_colors[vertex] * (1 / m_colorScale);
+        color[0] = uint8_t(std::lround(c.x));
+        color[1] = uint8_t(std::lround(c.y));
+        color[2] = uint8_t(std::lround(c.z));
+    } else if (!m_mesh.colors.empty()) {
+        std::copy(m_mesh.colors.begin() + 3 * vertex,
+                  m_mesh.colors.begin() + 3 * vertex + 3, color);
+    } else {
+        std::fill(color, color + 3, 0);
+    }
+}
+
+void EdgeCollapser::getResult(
+        TriangleMesh& mesh,
+        std::vector<uint32_t>& sources,
+        VertexQuadrics& vertices) const
+{
+    std::vector<uint32_t> newIndices(m_positions.size(), NO_VERTEX);
+    for (size_t t = 0; t < m_isDeleted.size(); ++t) {
+        if (!isDeleted(uint32_t(t))) {
+            for (int i = 0; i < 3; ++i) {
+                newIndices[m_indices[3 * t + i]] = 0;
+            }
+        }
+    }
+
+    const bool hasColors = !m_mesh.colors.empty();
+    mesh.positions.clear();
+    mesh.colors.clear();
+    sources.clear();
+    vertices.quadrics.clear();
+    vertices.colorQuadrics.clear();
+    vertices.flags.clear();
+    vertices.colorScale = m_colorScale;
+    for (size_t i = 0; i < newIndices.size(); ++i) {
+        if (newIndices[i] == NO_VERTEX)
+            continue;
+        newIndices[i] = uint32_t(sources.size());
+        sources.push_back(uint32_t(i));
+        vertices.quadrics.push_back(m_quadrics[i]);
+        vertices.flags.push_back(m_flags[i]);
+        mesh.positions.push_back(float(m_positions[i].x));
+        mesh.positions.push_back(float(m_positions[i].y));
+        mesh.positions.push_back(float(m_positions[i].z));
+        if (!m_colors.empty())
+            vertices.colorQuadrics.push_back(m_colorQuadrics[i]);
+        if (hasColors) {
+            uint8_t color[3];
+            getByteColor(uint32_t(i), color);
+            mesh.colors.insert(mesh.colors.end(), color, color + 3);
+        }
+    }
+
+    mesh.indices.clear();
+    mesh.indices.reserve(3 * m_triangleQty);
+    for (size_t t = 0; t < m_isDeleted.size(); ++t) {
+        if (!isDeleted(uint32_t(t))) {
+            for (int i = 0; i < 3; ++i) {
+                mesh.indices.push_back(newIndices[m_indices[3 * t + i]]);
+            }
+        }
+    }
+}
+
+double getMaxError(const DecimationTarget& target)
+{
+    return target.maxError > 0 ? target.maxError
+                               : std::numeric_limits<double>::infinity();
+}
+
+// Spreads the bits of a 10 bit value to every third bit.
+uint32_t spreadBits(uint32_t x)
+{
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Splits the vertices into cellQty cells of equal size along their Morton
+// order, which keeps the cells compact.
+std::vector<uint32_t> partitionVertices(const TriangleMesh& mesh, size_t cellQty)
+{
+    const size_t vertexQty = mesh.getVertexQty();
+    float min[3], max[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        min[axis] = std::numeric_limits<float>::max();
+        max[axis] = -std::numeric_limits<float>::max();
+    }
+    for (size_t i = 0; i < 3 * vertexQty; ++i) {
+        const float value = mesh.positions[i];
+        if (std::isfinite(value)) {
+            min[i % 3] = std::min(min[i % 3], value);
+            max[i % 3] = std::max(max[i % 3], value);
+        }
+    }
+
+    // The grid is a cube over the largest extent, so that the cells of flat
+    // meshes don't become slices across them.
+    float extent = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        extent = std::max(extent, max[axis] - min[axis]);
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t> > codes(vertexQty);
+    for (size_t i = 0; i < vertexQty; ++i) {
+        uint32_t code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float value = mesh.positions[3 * i + axis];
+            uint32_t cell = 0;
+            if (std::isfinite(value) && extent > 0) {
+                cell = uint32_t(std::min(1023.0f, (value - min[axis]) / extent * 1024));
+            }
+            code |= spreadBits(cell) << axis;
+        }
+        codes[i] = std::make_pair(code, uint32_t(i));
+    }
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<uint32_t> cells(vertexQty);
+    for (size_t i = 0; i < vertexQty; ++i) {
+        cells[codes[i].second] = uint32_t(i * cellQty / vertexQty);
+    }
+    return cells;
+}
+
+struct Cell {
+    TriangleMesh mesh;
+    VertexQuadrics vertices;
+    // Input index of every vertex of the cell.
+    std::vector<uint32_t> inputVertices;
+    size_t targetTriangleQty;
+
+    TriangleMesh result;
+    std::vector<uint32_t> sources;
+    VertexQuadrics resultVertices;
+    double maxError;
+    std::vector<EdgeCollapse> history;
+};
+
+// Copies the vertex once into the merged mesh and returns its index there.
+uint32_t addVertex(
+        const TriangleMesh& from,
+        size_t vertex,
+        TriangleMesh& to)
+{
+    const uint32_t index = uint32_t(to.getVertexQty());
+    to.positions.insert(to.positions.end(),
+                        from.positions.begin() + 3 * vertex,
+                        from.positions.begin() + 3 * vertex + 3);
+    if (!from.colors.empty()) {
+        to.colors.insert(to.colors.end(),
+                         from.colors.begin() + 3 * vertex,
+                         from.colors.begin() + 3 * vertex + 3);
+    }
+    return index;
+}
+
+// Decimates the cells in parallel and merges them with the triangles
+// crossing the cells into one mesh, with the quadrics of its vertices and
+// the input index of each in mergedSources. With history not null the
+// collapses of the cells are appended to it. Those of different cells
+// don't share triangles, so they are merged by error, keeping the order
+// within each cell.
+void decimateCells(
+        const TriangleMesh& input,
+        const VertexQuadrics& inputQuadrics,
+        size_t cellQty,
+        size_t targetTriangleQty,
+        double maxError,
+        int threadQty,
+        TriangleMesh& merged,
+        VertexQuadrics& mergedVertices,
+        std::vector<uint32_t>& mergedSources,
+        std::vector<EdgeCollapse>* history,
+        DecimationStatistics& statistics)
+{
+    const size_t vertexQty = input.getVertexQty();
+    const size_t triangleQty = input.getTriangleQty();
+    const std::vector<uint32_t> vertexCells = partitionVertices(input, cellQty);
+
+    std::vector<uint8_t> isLocked(vertexQty, 0);
+    std::vector<uint32_t> borderTriangles;
+    std::vector<size_t> cellTriangleQtys(cellQty, 0);
+    for (size_t t = 0; t < triangleQty; ++t) {
+        const uint32_t* v = &input.indices[3 * t];
+        const uint32_t cell = vertexCells[v[0]];
+        if (vertexCells[v[1]] == cell && vertexCells[v[2]] == cell) {
+            ++cellTriangleQtys[cell];
+        } else {
+            borderTriangles.push_back(uint32_t(t));
+            for (int i = 0; i < 3; ++i) {
+                isLocked[v[i]] = 1;
+            }
+        }
+    }
+    // The border triangles aren't in the cells, so the link check of a
+    // cell can't see them. The one-ring of every border vertex is locked
+    // as well, so that the collapses of a cell only touch vertices with
+    // all their triangles in the cell.
+    const std::vector<uint8_t> isOnBorder = isLocked;
+    for (size_t t = 0; t < triangleQty; ++t) {
+        const uint32_t* v = &input.indices[3 * t];
+        if (isOnBorder[v[0]] || isOnBorder[v[1]] || isOnBorder[v[2]]) {
+            for (int i = 0; i < 3; ++i) {
+                isLocked[v[i]] = 1;
+            }
+        }
+    }
+
+    std::vector<Cell> cells(cellQty);
+    std::vector<uint32_t> localIndices(vertexQty);
+    for (size_t i = 0; i < vertexQty; ++i) {
+        Cell& cell = cells[vertexCells[i]];
+        localIndices[i] = uint32_t(cell.inputVertices.size());
+        cell.inputVertices.push_back(uint32_t(i));
+        addVertex(input, i, cell.mesh);
+        cell.vertices.quadrics.push_back(inputQuadrics.quadrics[i]);
+        if (!inputQuadrics.colorQuadrics.empty())
+            cell.vertices.colorQuadrics.push_back(inputQuadrics.colorQuadrics[i]);
+        cell.vertices.colorScale = inputQuadrics.colorScale;
+        cell.vertices.flags.push_back(
+                inputQuadrics.flags[i] | (isLocked[i] ? VERTEX_LOCKED : 0));
+        statistics.lockedVertexQty += isLocked[i];
+    }
+    for (size_t c = 0; c < cellQty; ++c) {
+        cells[c].mesh.indices.reserve(3 * cellTriangleQtys[c]);
+        cells[c].targetTriangleQty =
+            size_t(std::llround(CELL_TARGET_SLACK * cellTriangleQtys[c]
+                                * targetTriangleQty / triangleQty));
+    }
+    for (size_t t = 0; t < triangleQty; ++t) {
+        const uint32_t* v = &input.indices[3 * t];
+        const uint32_t cell = vertexCells[v[0]];
+        if (vertexCells[v[1]] == cell && vertexCells[v[2]] == cell) {
+            for (int i = 0; i < 3; ++i) {
+                cells[cell].mesh.indices.push_back(localIndices[v[i]]);
+            }
+        }
+    }
+
+    runTasks(cellQty, threadQty, [&](size_t c) {
+        Cell& cell = cells[c];
+        EdgeCollapser collapser(cell.mesh, cell.vertices);
+        if (history)
+            collapser.setHistory(&cell.history);
+        collapser.run(cell.targetTriangleQty, maxError);
+        collapser.getResult(cell.result, cell.sources, cell.resultVertices);
+        cell.maxError = collapser.getMaxError();
+    });
+
+    // Locked vertices are shared by the cells and the border triangles. The
+    // merged vertices keep the quadrics of the cells, which include those
+    // of the vertices collapsed into them.
+    std::vector<uint32_t> lockedIndices(vertexQty, NO_VERTEX);
+    const auto addMergedVertex = [&](const TriangleMesh& from, size_t vertex,
+                                     const VertexQuadrics& vertices,
+                                     uint32_t inputVertex) {
+        mergedSources.push_back(inputVertex);
+        mergedVertices.quadrics.push_back(vertices.quadrics[vertex]);
+        if (!vertices.colorQuadrics.empty())
+            mergedVertices.colorQuadrics.push_back(vertices.colorQuadrics[vertex]);
+        mergedVertices.flags.push_back(vertices.flags[vertex] & VERTEX_BOUNDARY);
+        return addVertex(from, vertex, merged);
+    };
+    mergedVertices.colorScale = inputQuadrics.colorScale;
+    std::vector<uint32_t> mergedIndices;
+    double cellMaxError = 0;
+    for (size_t c = 0; c < cellQty; ++c) {
+        Cell& cell = cells[c];
+        mergedIndices.resize(cell.sources.size());
+        for (size_t i = 0; i < cell.sources.size(); ++i) {
+            const uint32_t inputVertex = cell.inputVertices[cell.sources[i]];
+            if (!isLocked[inputVertex]) {
+                mergedIndices[i] = addMergedVertex(cell.result, i, cell.resultVertices,
+                                                   inputVertex);
+            } else {
+                if (lockedIndices[inputVertex] == NO_VERTEX) {
+                    lockedIndices[inputVertex] = addMergedVertex(
+                            cell.result, i, cell.resultVertices, inputVertex);
+                }
+                mergedIndices[i] = lockedIndices[inputVertex];
+            }
+        }
+        for (size_t i = 0; i < cell.result.indices.size(); ++i) {
+            merged.indices.push_back(mergedIndices[cell.result.indices[i]]);
+        }
+        cellMaxError = std::max(cellMaxError, cell.maxError);
+        for (size_t i = 0; i < cell.history.size(); ++i) {
+            cell.history[i].a = cell.inputVertices[cell.history[i].a];
+            cell.history[i].b = cell.inputVertices[cell.history[i].b];
+        }
+        cell.mesh = TriangleMesh();
+        cell.vertices = VertexQuadrics();
+        cell.inputVertices.clear();
+        cell.result = TriangleMesh();
+        cell.sources.clear();
+        cell.resultVertices = VertexQuadrics();
+    }
+
+    for (size_t i = 0; i < borderTriangles.size(); ++i) {
+        const uint32_t* v = &input.indices[3 * borderTriangles[i]];
+        for (int j = 0; j < 3; ++j) {
+            if (lockedIndices[v[j]] == NO_VERTEX)
+                lockedIndices[v[j]] = addMergedVertex(input, v[j], inputQuadrics, v[j]);
+            merged.indices.push_back(lockedIndices[v[j]]);
+        }
+    }
+
+    statistics.maxError = cellMaxError;
+
+    if (history) {
+        std::vector<size_t> next(cellQty, 0);
+        for (;;) {
+            size_t best = cellQty;
+            for (size_t c = 0; c < cellQty; ++c) {
+                if (next[c] < cells[c].history.size()
+                    && (best == cellQty
+                        || cells[c].history[next[c]].error
+                           < cells[best].history[next[best]].error))
+                {
+                    best = c;
+                }
+            }
+            if (best == cellQty)
+                break;
+            history->push_back(cells[best].history[next[best]++]);
+        }
+    }
+}
+
+} // anonymous namespace
+
+DecimationTarget::DecimationTarget()
+    : reduction(0)
+    , triangleQty(0)
+    , maxError(0)
+{}
+
+DecimationStatistics::DecimationStatistics()
+    : cellQty(0)
+    , lockedVertexQty(0)
+    , cellTriangleQty(0)
+    , triangleQty(0)
+    , maxError(0)
+    , cellSeconds(0)
+    , finalSeconds(0)
+{}
+
+size_t getTargetTriangleQty(const DecimationTarget& target, size_t triangleQty)
+{
+    if (target.reduction <= 0 && target.triangleQty == 0)
+        return 0;
+
+    size_t qty = triangleQty;
+    if (target.reduction > 0)
+        qty = size_t(std::llround(triangleQty * (1 - target.reduction)));
+    if (target.triangleQty > 0)
+        qty = std::min(qty, target.triangleQty);
+    return qty;
+}
+
+double getMeanEdgeLength(const TriangleMesh& mesh)
+{
+    double sum = 0;
+    size_t qty = 0;
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        const uint32_t a = mesh.indices[i];
+        const uint32_t b = mesh.indices[i % 3 == 2 ? i - 2 : i + 1];
+        if (a >= mesh.getVertexQty() || b >= mesh.getVertexQty())
+            continue;
+        const float* pa = &mesh.positions[3 * a];
+        const float* pb = &mesh.positions[3 * b];
+        const double length = std::sqrt(length2(
+                Vec3(pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2])));
+        if (std::isfinite(length)) {
+            sum += length;
+            ++qty;
+        }
+    }
+    return qty > 0 ? sum / qty : 0;
+}
+
+void decimate(
+        const TriangleMesh& input,
+        const DecimationTarget& target,
+        double colorWeight,
+        int threadQty,
+        TriangleMesh& output,
+        DecimationStatistics* statistics,
+        std::vector<EdgeCollapse>* collapses)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const size_t vertexQty = input.getVertexQty();
+    for (size_t i = 0; i < input.indices.size(); ++i) {
+        if (input.indices[i] >= vertexQty)
+            throw std::out_of_range("Face refers to a missing vertex");
+    }
+
+    const size_t triangleQty = input.getTriangleQty();
+    const size_t targetTriangleQty = getTargetTriangleQty(target, triangleQty);
+    const double maxError = getMaxError(target);
+
+    DecimationStatistics stats;
+    stats.cellQty = 1;
+    if (threadQty > 1) {
+        stats.cellQty = std::max<size_t>(1, std::min<size_t>(
+                size_t(threadQty) * CELLS_PER_THREAD,
+                triangleQty / MIN_CELL_TRIANGLES));
+    }
+
+    VertexQuadrics vertices;
+    computeQuadrics(input, colorWeight, vertices);
+
+    if (collapses)
+        collapses->clear();
+    TriangleMesh merged;
+    std::vector<uint32_t> mergedSources;
+    const TriangleMesh* mesh = &input;
+    if (stats.cellQty > 1) {
+        const Clock::time_point start = Clock::now();
+        VertexQuadrics mergedVertices;
+        decimateCells(input, vertices, stats.cellQty, targetTriangleQty, maxError,
+                      threadQty, merged, mergedVertices, mergedSources, collapses,
+                      stats);
+        std::swap(vertices, mergedVertices);
+        mesh = &merged;
+        stats.cellTriangleQty = merged.getTriangleQty();
+        stats.cellSeconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    const Clock::time_point start = Clock::now();
+    EdgeCollapser collapser(*mesh, vertices);
+    const size_t firstFinalCollapse = collapses ? collapses->size() : 0;
+    collapser.setHistory(collapses);
+    collapser.run(targetTriangleQty, maxError);
+    if (collapses && mesh == &merged) {
+        for (size_t i = firstFinalCollapse; i < collapses->size(); ++i) {
+            (*collapses)[i].a = mergedSources[(*collapses)[i].a];
+            (*collapses)[i].b = mergedSources[(*collapses)[i].b];
+        }
+    }
+    std::vector<uint32_t> sources;
+    collapser.getResult(output, sources, vertices);
+    stats.finalSeconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    stats.triangleQty = output.getTriangleQty();
+    stats.maxError = std::max(stats.maxError, collapser.getMaxError());
+    if (statistics)
+        *statistics = stats;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "triangle-mesh.h"
+
+// When to stop collapsing edges; decimation stops at the first limit
+// reached.
+struct DecimationTarget {
+    DecimationTarget();
+
+    // Fraction of the triangles to remove, as VTK's target reduction.
+    double reduction;
+    // Triangles to keep at most; 0 for no limit.
+    size_t triangleQty;
+    // Largest error of a collapse in mesh units, the area weighted RMS
+    // distance of the new vertex to the planes of the triangles merged
+    // into it; 0 for no limit.
+    double maxError;
+};
+
+struct DecimationStatistics {
+    DecimationStatistics();
+
+    size_t cellQty;
+    size_t lockedVertexQty;
+    // Triangles left after the cells and after the final pass.
+    size_t cellTriangleQty;
+    size_t triangleQty;
+    // Largest error of the collapses done.
+    double maxError;
+    double cellSeconds;
+    double finalSeconds;
+};
+
+// One collapse done by decimate(): b went into a, which moved to the
+// position and took the color. Vertices are those of the input.
+struct EdgeCollapse {
+    uint32_t a;
+    uint32_t b;
+    float position[3];
+    uint8_t color[3];
+    // As in DecimationTarget::maxError.
+    float error;
+};
+
+// Quadric error decimation by edge collapses, cheapest first. Every vertex
+// keeps the sum of the squared distances to the planes of its triangles,
+// and an edge collapses into the point minimizing that error for both
+// ends. Boundaries are kept by planes through boundary edges, and
+// collapses that make the mesh non-manifold or flip a triangle are
+// skipped.
+//
+// With several threads the vertices are split into compact cells by
+// their Morton order. Each cell is decimated on its own with the vertices
+// of triangles crossing the cells locked, and a final pass over the whole
+// mesh then collapses the cell borders down to the target. The quadrics
+// are carried from the cells to the final pass, so that its errors are
+// measured from the input too.
+//
+// With a colorWeight above 0 the quadrics include the vertex colors and
+// every collapse finds a new color too. The weight is the distance in
+// mesh units that a channel changing over its full range costs as much
+// as, and the errors include the weighted color differences. Otherwise
+// each vertex keeps the color it has.
+//
+// With collapses not null, they are filled with the collapses in an
+// order that replays them on the input into the output, about the order
+// of their errors also with several threads.
+void decimate(
+        const TriangleMesh& input,
+        const DecimationTarget& target,
+        double colorWeight,
+        int threadQty,
+        TriangleMesh& output,
+        DecimationStatistics* statistics,
+        std::vector<EdgeCollapse>* collapses);
+
+// Triangles to keep for the target, from the triangles of the input; 0
+// when only the error limits the decimation.
+size_t getTargetTriangleQty(const DecimationTarget& target, size_t triangleQty);
+
+// A color weight in the scale of the mesh.
+double getMeanEdgeLength(const TriangleMesh& mesh);
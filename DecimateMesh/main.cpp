@@ -1,38 +1,875 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 #include <pcl/io/ply_io.h>
 #include <pcl/PolygonMesh.h>
 #include <pcl/surface/vtk_smoothing/vtk_mesh_quadric_decimation.h>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
 
-void PrintHelp()
+#include "batch.h"
+#include "decimator.h"
+#include "mapped-file.h"
+#include "ply-header.h"
+#include "surface-distance.h"
+#include "vertex-clustering.h"
+#include "vertex-splits.h"
+
+typedef pcl::PointXYZRGB Point;
+typedef pcl::PointCloud<Point> PointCloud;
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+const double DEFAULT_REDUCTION = 0.9;
+// Mean edge lengths a full color change costs as much as by default.
+const double DEFAULT_COLOR_WEIGHT = 4;
+// With --refine the clustering keeps this many times the target triangles
+// for the quadric decimation.
+const size_t REFINE_SLACK = 4;
+// Vertices of the input measured against the output in --benchmark.
+const size_t DISTANCE_SAMPLE_QTY = 200000;
+
+struct Options {
+    std::string inputFilename;
+    std::string outputFilename;
+    DecimationTarget target;
+    // Below 0 for the default in mean edge lengths of the input.
+    double colorWeight;
+    unsigned threadQty;
+    bool isUsingVtk;
+    bool isBenchmark;
+    bool isStreaming;
+    bool isRefining;
+    // Empty without --progressive.
+    std::string progressiveFilename;
+    // Empty unless decimating a directory.
+    std::string inputDirectory;
+    std::string outputDirectory;
+    std::string manifestFilename;
+    std::string summaryFilename;
+    uintmax_t memoryBudget;
+};
+
+bool hasColors(const pcl::PCLPointCloud2& cloud)
+{
+    for (size_t i = 0; i < cloud.fields.size(); ++i) {
+        if (cloud.fields[i].name == "rgb" || cloud.fields[i].name == "rgba")
+            return true;
+    }
+    return false;
+}
+
+// Polygons of more than three vertices are split into fans.
+void toTriangleMesh(const pcl::PolygonMesh& polygonMesh, TriangleMesh& mesh)
+{
+    PointCloud cloud;
+    pcl::fromPCLPointCloud2(polygonMesh.cloud, cloud);
+
+    const bool isColored = hasColors(polygonMesh.cloud);
+    mesh.positions.resize(3 * cloud.size());
+    mesh.colors.resize(isColored ? 3 * cloud.size() : 0);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        const Point& point = cloud[i];
+        mesh.positions[3 * i] = point.x;
+        mesh.positions[3 * i + 1] = point.y;
+        mesh.positions[3 * i + 2] = point.z;
+        if (isColored) {
+            mesh.colors[3 * i] = point.r;
+            mesh.colors[3 * i + 1] = point.g;
+            mesh.colors[3 * i + 2] = point.b;
+        }
+    }
+
+    mesh.indices.clear();
+    mesh.indices.reserve(3 * polygonMesh.polygons.size());
+    for (size_t i = 0; i < polygonMesh.polygons.size(); ++i) {
+        const std::vector<uint32_t>& vertices = polygonMesh.polygons[i].vertices;
+        for (size_t j = 2; j < vertices.size(); ++j) {
+            mesh.indices.push_back(vertices[0]);
+            mesh.indices.push_back(vertices[j - 1]);
+            mesh.indices.push_back(vertices[j]);
+        }
+    }
+}
+
+void toPolygonMesh(const TriangleMesh& mesh, pcl::PolygonMesh& polygonMesh)
+{
+    const size_t vertexQty = mesh.getVertexQty();
+    if (mesh.colors.empty()) {
+        pcl::PointCloud<pcl::PointXYZ> cloud;
+        cloud.resize(vertexQty);
+        for (size_t i = 0; i < vertexQty; ++i) {
+            cloud[i].x = mesh.positions[3 * i];
+            cloud[i].y = mesh.positions[3 * i + 1];
+            cloud[i].z = mesh.positions[3 * i + 2];
+        }
+        pcl::toPCLPointCloud2(cloud, polygonMesh.cloud);
+    } else {
+        PointCloud cloud;
+        cloud.resize(vertexQty);
+        for (size_t i = 0; i < vertexQty; ++i) {
+            Point& point = cloud[i];
+            point.x = mesh.positions[3 * i];
+            point.y = mesh.positions[3 * i + 1];
+            point.z = mesh.positions[3 * i + 2];
+            point.r = mesh.colors[3 * i];
+            point.g = mesh.colors[3 * i + 1];
+            point.b = mesh.colors[3 * i + 2];
+        }
+        pcl::toPCLPointCloud2(cloud, polygonMesh.cloud);
+    }
+
+    polygonMesh.polygons.resize(mesh.getTriangleQty());
+    for (size_t i = 0; i < polygonMesh.polygons.size(); ++i) {
+        polygonMesh.polygons[i].vertices.assign(
+                mesh.indices.begin() + 3 * i,
+                mesh.indices.begin() + 3 * i + 3);
+    }
+}
+
+// VTK takes only a reduction; a triangle count is turned into one.
+void decimateVtk(
+        const pcl::PolygonMesh::ConstPtr& inMesh,
+        const DecimationTarget& target,
+        pcl::PolygonMesh& outMesh)
+{
+    double reduction = target.reduction;
+    if (target.triangleQty > 0 && !inMesh->polygons.empty()) {
+        reduction = std::max(reduction,
+                1 - double(target.triangleQty) / inMesh->polygons.size());
+    }
+
+    pcl::MeshQuadricDecimationVTK decimation;
+    decimation.setInputMesh(inMesh);
+    decimation.setTargetReductionFactor(float(reduction));
+    decimation.process(outMesh);
+}
+
+// Times the whole path from one PolygonMesh to the other, as VTK's
+// conversions are part of its time too. With a progressiveFilename the
+// progressive mesh from the output back to the input is written there,
+// which isn't timed.
+double decimateNative(
+        const pcl::PolygonMesh& inMesh,
+        const DecimationTarget& target,
+        double colorWeight,
+        unsigned threadQty,
+        const std::string& progressiveFilename,
+        pcl::PolygonMesh& outMesh,
+        DecimationStatistics& statistics)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    TriangleMesh input;
+    toTriangleMesh(inMesh, input);
+    if (colorWeight < 0)
+        colorWeight = DEFAULT_COLOR_WEIGHT * getMeanEdgeLength(input);
+    TriangleMesh output;
+    std::vector<EdgeCollapse> collapses;
+    decimate(input, target, colorWeight, int(threadQty), output, &statistics,
+             progressiveFilename.empty() ? 0 : &collapses);
+    toPolygonMesh(output, outMesh);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (!progressiveFilename.empty()) {
+        ProgressiveMesh progressive;
+        makeProgressiveMesh(input, collapses, progressive);
+        writeProgressiveMesh(progressiveFilename, progressive);
+        std::cout << "progressive mesh of " << progressive.base.getTriangleQty()
+                  << " triangles and " << progressive.splits.size()
+                  << " vertex splits\n";
+    }
+    return seconds;
+}
+
+void printStatistics(const DecimationStatistics& statistics)
+{
+    if (statistics.cellQty > 1) {
+        std::cout << statistics.cellQty << " cells with "
+                  << statistics.lockedVertexQty << " locked vertices: "
+                  << statistics.cellTriangleQty << " triangles in "
+                  << statistics.cellSeconds << " s\n"
+                  << "final pass: " << statistics.triangleQty
+                  << " triangles in " << statistics.finalSeconds << " s\n";
+    }
+    std::cout << "largest collapse error " << statistics.maxError << '\n';
+}
+
+// Runs VTK, if the target allows, and our decimation on 1 and on all the
+// threads, and prints their times and how far each output is from the
+// input, in position and color. With colors our decimation also runs
+// without them. The output is the one of all the threads.
+void benchmark(
+        const pcl::PolygonMesh::ConstPtr& inMesh,
+        const Options& options,
+        pcl::PolygonMesh& outMesh)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    TriangleMesh input;
+    toTriangleMesh(*inMesh, input);
+
+    std::cout << input.getTriangleQty() << " triangles\n"
+              << "method\tthreads\tseconds\ttriangles\tmax distance\trms distance"
+                 "\trms color\n";
+    const auto printRun = [&](const char* method, unsigned threadQty,
+                              double time, const pcl::PolygonMesh& mesh) {
+        TriangleMesh output;
+        toTriangleMesh(mesh, output);
+        const SurfaceDistance distance =
+            measureSurfaceDistance(input, output, DISTANCE_SAMPLE_QTY);
+        std::cout << method << '\t' << threadQty << '\t' << time << '\t'
+                  << output.getTriangleQty() << '\t'
+                  << distance.maxDistance << '\t' << distance.rmsDistance << '\t'
+                  << distance.rmsColorDifference << '\n';
+    };
+
+    if (options.target.maxError > 0) {
+        std::cout << "vtk\t-\tno error threshold in VTK\n";
+    } else {
+        pcl::PolygonMesh vtkMesh;
+        const Clock::time_point start = Clock::now();
+        decimateVtk(inMesh, options.target, vtkMesh);
+        printRun("vtk", 1,
+                 std::chrono::duration<double>(Clock::now() - start).count(),
+                 vtkMesh);
+    }
+
+    DecimationStatistics statistics;
+    if (!input.colors.empty() && options.colorWeight != 0) {
+        pcl::PolygonMesh plainMesh;
+        const double time = decimateNative(*inMesh, options.target, 0, 1, "",
+                                           plainMesh, statistics);
+        printRun("no color", 1, time, plainMesh);
+    }
+
+    const double serialTime = decimateNative(*inMesh, options.target,
+            options.colorWeight, 1, "", outMesh, statistics);
+    printRun("native", 1, serialTime, outMesh);
+
+    if (options.threadQty > 1) {
+        outMesh = pcl::PolygonMesh();
+        const double time = decimateNative(*inMesh, options.target,
+                options.colorWeight, options.threadQty, "", outMesh, statistics);
+        printRun("native", options.threadQty, time, outMesh);
+    }
+    printStatistics(statistics);
+}
+
+// Clusters the file without loading it to about targetTriangleQty
+// triangles, or with isRefining to REFINE_SLACK times as many and then
+// decimates those to the target. refineStatistics is only filled when
+// refining.
+void clusterFile(
+        const std::string& filename,
+        size_t targetTriangleQty,
+        double maxError,
+        double colorWeight,
+        bool isRefining,
+        unsigned threadQty,
+        TriangleMesh& output,
+        ClusteringStatistics& clustering,
+        DecimationStatistics& refineStatistics)
+{
+    clusterVertices(filename,
+                    isRefining ? REFINE_SLACK * targetTriangleQty
+                               : targetTriangleQty,
+                    output, &clustering);
+    if (!isRefining)
+        return;
+
+    DecimationTarget target;
+    target.triangleQty = targetTriangleQty;
+    target.maxError = maxError;
+    if (colorWeight < 0)
+        colorWeight = DEFAULT_COLOR_WEIGHT * getMeanEdgeLength(output);
+
+    TriangleMesh refined;
+    decimate(output, target, colorWeight, int(threadQty), refined,
+             &refineStatistics, 0);
+    output.positions.swap(refined.positions);
+    output.colors.swap(refined.colors);
+    output.indices.swap(refined.indices);
+}
+
+// Clusters the input without loading it, and with --refine decimates the
+// clusters to the target. Returns false when the target has no triangle
+// count.
+bool decimateStreaming(const Options& options, pcl::PolygonMesh& outMesh)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    PlyHeader header;
+    readPlyHeader(options.inputFilename, header);
+    const size_t targetTriangleQty =
+        getTargetTriangleQty(options.target, header.faceQty());
+    if (targetTriangleQty == 0) {
+        std::cerr << "--streaming needs --reduction or --triangles\n";
+        return false;
+    }
+
+    TriangleMesh output;
+    ClusteringStatistics clustering;
+    DecimationStatistics statistics;
+    clusterFile(options.inputFilename, targetTriangleQty, options.target.maxError,
+                options.colorWeight, options.isRefining, options.threadQty,
+                output, clustering, statistics);
+    std::cout << "size of polygons = " << clustering.inputTriangleQty << '\n'
+              << "clustered with cells of " << clustering.cellSize << "; "
+              << clustering.peakClusterQty << " cells at most, "
+              << clustering.coarseningQty << " times coarser\n";
+    if (options.isRefining)
+        printStatistics(statistics);
+
+    toPolygonMesh(output, outMesh);
+    std::cout << "decimated in "
+              << std::chrono::duration<double>(Clock::now() - start).count()
+              << " s\n";
+    return true;
+}
+
+// Rough peak memory of a decimation in memory, measured on scans with
+// colors and cells: PCL's binary cloud and the PointCloud and TriangleMesh
+// copies of every vertex, and for every face its polygon and what the
+// decimator keeps of it.
+const uintmax_t MEMORY_PER_VERTEX = 2 * sizeof(Point) + 15;
+const uintmax_t MEMORY_PER_FACE = sizeof(pcl::Vertices) + 32 + 350;
+
+// Streamed files keep the clusters and their triangles for about twice
+// the target, and refine REFINE_SLACK times the target in memory.
+const uintmax_t STREAMING_MEMORY_PER_TRIANGLE =
+    400 + REFINE_SLACK * (MEMORY_PER_FACE + MEMORY_PER_VERTEX / 2);
+const uintmax_t STREAMING_BUFFERS = 16 << 20;
+
+// What a file of the batch is decimated to, from the command line or the
+// manifest.
+struct FileSettings {
+    DecimationTarget target;
+    double colorWeight;
+};
+
+struct BatchInput {
+    fs::path path;
+    size_t faceQty;
+    uintmax_t memory;
+    bool isStreaming;
+    FileSettings settings;
+    unsigned threadQty;
+
+    // Largest first, so that the big files don't start last.
+    bool operator<(const BatchInput& other) const
+    {
+        return memory > other.memory;
+    }
+};
+
+// Parses a whole value of "key=value" into value.
+template <typename T>
+bool parseValue(const std::string& text, T& value)
+{
+    std::istringstream stream(text);
+    return (stream >> value) && stream.eof();
+}
+
+// Every line of the manifest is a file name of the input directory and
+// any of reduction=, triangles=, max-error= and color-weight=. A target
+// given there replaces the whole target of the command line. Blank lines
+// and lines starting with # are skipped.
+bool readManifest(
+        const Options& options,
+        std::map<std::string, FileSettings>& manifest)
+{
+    std::ifstream f(options.manifestFilename.c_str());
+    if (!f) {
+        std::cerr << "can't read " << options.manifestFilename << '\n';
+        return false;
+    }
+
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(f, line); ++lineNumber) {
+        std::istringstream words(line);
+        std::string filename;
+        if (!(words >> filename) || filename[0] == '#')
+            continue;
+
+        FileSettings settings;
+        settings.target = options.target;
+        settings.colorWeight = options.colorWeight;
+        bool hasTarget = false;
+        bool isValid = true;
+        std::string word;
+        while (isValid && words >> word) {
+            const size_t equals = word.find('=');
+            const std::string key = word.substr(0, equals);
+            const std::string value =
+                equals == std::string::npos ? "" : word.substr(equals + 1);
+            if (key == "reduction" || key == "triangles" || key == "max-error") {
+                if (!hasTarget)
+                    settings.target = DecimationTarget();
+                hasTarget = true;
+            }
+            if (key == "reduction") {
+                isValid = parseValue(value, settings.target.reduction)
+                          && settings.target.reduction >= 0
+                          && settings.target.reduction < 1;
+            } else if (key == "triangles") {
+                isValid = parseValue(value, settings.target.triangleQty);
+            } else if (key == "max-error") {
+                isValid = parseValue(value, settings.target.maxError)
+                          && settings.target.maxError >= 0;
+            } else if (key == "color-weight") {
+                isValid = parseValue(value, settings.colorWeight)
+                          && settings.colorWeight >= 0;
+            } else {
+                isValid = false;
+            }
+        }
+        if (!isValid) {
+            std::cerr << options.manifestFilename << ':' << lineNumber
+                      << ": bad setting " << word << '\n';
+            return false;
+        }
+        manifest[filename] = settings;
+    }
+    return true;
+}
+
+// Files larger than the budget are streamed when they are binary and the
+// target has a triangle count, and otherwise run alone. Every file gets
+// the share of the threads that it takes of the budget.
+bool estimateMemory(
+        const fs::path& path,
+        const FileSettings& settings,
+        const Options& options,
+        BatchInput& input)
+{
+    try {
+        PlyHeader header;
+        readPlyHeader(path.string(), header);
+        checkTriangleMesh(header, MappedFile(path.string()));
+
+        input.path = path;
+        input.faceQty = header.faceQty();
+        input.settings = settings;
+        input.memory = MEMORY_PER_VERTEX * header.vertexQty()
+                       + MEMORY_PER_FACE * header.faceQty();
+        input.isStreaming = false;
+
+        const size_t targetTriangleQty =
+            getTargetTriangleQty(settings.target, input.faceQty);
+        if (input.memory > options.memoryBudget
+            && header.format == PLY_BINARY_LITTLE_ENDIAN
+            && targetTriangleQty > 0)
+        {
+            input.isStreaming = true;
+            input.memory = STREAMING_MEMORY_PER_TRIANGLE * targetTriangleQty
+                           + STREAMING_BUFFERS;
+        }
+
+        const double share = double(input.memory) / double(options.memoryBudget);
+        input.threadQty = unsigned(std::max(1.0, std::min(
+                double(options.threadQty), std::floor(share * options.threadQty))));
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Skipping " << path << ": " << e.what() << '\n';
+        return false;
+    }
+}
+
+bool collectBatchInputs(const Options& options, std::vector<BatchInput>& inputs)
+{
+    std::map<std::string, FileSettings> manifest;
+    if (!options.manifestFilename.empty() && !readManifest(options, manifest))
+        return false;
+
+    FileSettings defaults;
+    defaults.target = options.target;
+    defaults.colorWeight = options.colorWeight;
+
+    fs::directory_iterator itEnd;
+    for (fs::directory_iterator dirIt(options.inputDirectory);
+         dirIt != itEnd;
+         ++dirIt)
+    {
+        if (!fs::is_regular_file(dirIt->path()))
+            continue;
+
+        const std::string filename = dirIt->path().filename().string();
+        const std::map<std::string, FileSettings>::iterator found =
+            manifest.find(filename);
+        BatchInput input;
+        if (estimateMemory(dirIt->path(),
+                           found == manifest.end() ? defaults : found->second,
+                           options, input))
+        {
+            inputs.push_back(input);
+        }
+        if (found != manifest.end())
+            manifest.erase(found);
+    }
+
+    for (std::map<std::string, FileSettings>::const_iterator it = manifest.begin();
+         it != manifest.end();
+         ++it)
+    {
+        std::cerr << options.manifestFilename << ": no input " << it->first << '\n';
+    }
+
+    std::sort(inputs.begin(), inputs.end());
+    return true;
+}
+
+// Returns the triangles of the output.
+size_t decimateFile(const BatchInput& input, const std::string& outputFilename)
 {
-    std::cerr << "decimate-mesh <input-file> <output-file>\n";
+    const FileSettings& settings = input.settings;
+    pcl::PolygonMesh outMesh;
+    if (input.isStreaming) {
+        TriangleMesh output;
+        ClusteringStatistics clustering;
+        DecimationStatistics statistics;
+        clusterFile(input.path.string(),
+                    getTargetTriangleQty(settings.target, input.faceQty),
+                    settings.target.maxError, settings.colorWeight, true,
+                    input.threadQty, output, clustering, statistics);
+        toPolygonMesh(output, outMesh);
+    } else {
+        pcl::PolygonMesh inMesh;
+        if (pcl::io::loadPLYFile(input.path.string(), inMesh) < 0)
+            throw std::runtime_error("can't load the mesh");
+        DecimationStatistics statistics;
+        decimateNative(inMesh, settings.target, settings.colorWeight,
+                       input.threadQty, "", outMesh, statistics);
+    }
+
+    if (pcl::io::savePLYFileBinary(outputFilename, outMesh) < 0)
+        throw std::runtime_error("can't save " + outputFilename);
+    return outMesh.polygons.size();
 }
 
+void batchWorker(
+        BatchQueue<BatchInput>& queue,
+        MemoryBudget& memoryBudget,
+        const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    BatchInput input;
+    while (queue.pop(input)) {
+        memoryBudget.acquire(input.memory);
+        const Clock::time_point start = Clock::now();
+
+        BatchReport report;
+        report.filename = input.path.filename().string();
+        report.inputTriangleQty = input.faceQty;
+        report.isStreaming = input.isStreaming;
+        report.estimatedMemory = input.memory;
+
+        const fs::path outputPath =
+            fs::path(options.outputDirectory) / input.path.filename();
+        try {
+            report.outputTriangleQty = decimateFile(input, outputPath.string());
+        } catch (const std::exception& e) {
+            report.error = e.what();
+        }
+
+        report.seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        report.peakMemory = getPeakMemory();
+        memoryBudget.release(input.memory);
+
+        std::cerr << report.filename << ": "
+                  << (report.error.empty() ? "done" : report.error)
+                  << " in " << report.seconds << " s\n";
+        queue.addReport(report);
+    }
+}
+
+// Returns false if any file failed.
+bool decimateDirectory(const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    std::vector<BatchInput> inputs;
+    if (!collectBatchInputs(options, inputs))
+        return false;
+    fs::create_directories(options.outputDirectory);
+    std::cerr << inputs.size() << " meshes to decimate with "
+              << options.threadQty << " threads in "
+              << (options.memoryBudget >> 20) << " MB\n";
+
+    BatchQueue<BatchInput> queue(inputs);
+    MemoryBudget memoryBudget(options.memoryBudget);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.threadQty && i < inputs.size(); ++i) {
+        threads.push_back(std::thread(batchWorker, std::ref(queue),
+                                      std::ref(memoryBudget),
+                                      std::cref(options)));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    const std::vector<BatchReport> reports = queue.reports();
+    const double wallSeconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    printBatchSummary(std::cout, reports, wallSeconds);
+    if (!options.summaryFilename.empty()) {
+        std::ofstream f(options.summaryFilename.c_str());
+        printBatchSummary(f, reports, wallSeconds);
+        if (!f) {
+            std::cerr << "can't write " << options.summaryFilename << '\n';
+            return false;
+        }
+    }
+
+    return isBatchDone(reports);
+}
+
+bool initOptions(Options& options, int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    size_t memoryBudgetMB = 0;
+    desc.add_options()
+        ("help", "Print help message")
+        ("input-file",
+         po::value(&options.inputFilename),
+         "Input filename")
+        ("output-file",
+         po::value(&options.outputFilename),
+         "Output filename")
+        ("input-dir",
+         po::value(&options.inputDirectory),
+         "Decimate every PLY file in the directory, several at once")
+        ("output-dir",
+         po::value(&options.outputDirectory),
+         "Directory for the files decimated from --input-dir")
+        ("memory-budget",
+         po::value(&memoryBudgetMB)->default_value(4096),
+         "Memory in MB the files decimated at once from --input-dir may "
+         "take together, as estimated from their headers; larger binary "
+         "files are streamed with --refine")
+        ("manifest",
+         po::value(&options.manifestFilename),
+         "Text file of lines like <file> triangles=<n> for --input-dir, "
+         "with any of reduction=, triangles=, max-error= and "
+         "color-weight= to override the command line for that file")
+        ("summary",
+         po::value(&options.summaryFilename),
+         "Also write the --input-dir summary of triangles, times and "
+         "memory to this file")
+        ("reduction",
+         po::value(&options.target.reduction),
+         "Fraction of the triangles to remove, 0.9 when no target is given")
+        ("triangles",
+         po::value(&options.target.triangleQty),
+         "Number of triangles to keep at most")
+        ("max-error",
+         po::value(&options.target.maxError),
+         "Stop before collapses moving the surface by more than this, "
+         "in mesh units")
+        ("color-weight",
+         po::value(&options.colorWeight),
+         "Distance in mesh units that a color channel changing over its "
+         "full range costs as much as, by default 4 mean edge lengths; "
+         "with 0 the vertices keep their colors instead of getting "
+         "decimated ones")
+        ("threads",
+         po::value(&options.threadQty)->default_value(
+             std::max(1u, std::thread::hardware_concurrency())),
+         "Number of threads decimating cells of the mesh")
+        ("vtk",
+         "Decimate with VTK through PCL instead")
+        ("benchmark",
+         "Compare VTK with our decimation on 1 and on --threads threads "
+         "in time and distance to the input")
+        ("streaming",
+         "Decimate a binary little endian PLY file by vertex clustering in "
+         "one pass without loading it, for meshes that don't fit in memory; "
+         "the target is met roughly")
+        ("refine",
+         "With --streaming, cluster to 4 times the target triangles and "
+         "decimate them to the target by quadric error")
+        ("progressive",
+         po::value(&options.progressiveFilename),
+         "Also write a progressive mesh to this .pmesh file: the output "
+         "and the vertex splits that refine it back to the input, for "
+         "render to load up to a triangle budget")
+        ;
+
+    po::positional_options_description p;
+    p.add("input-file", 1).add("output-file", 1);
+
+    po::variables_map vm;
+
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                    .options(desc)
+                    .positional(p)
+                    .run(),
+                  vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: decimate-mesh [options] <input-file> <output-file>\n"
+                      << "       decimate-mesh [options] --input-dir <dir> "
+                         "--output-dir <dir>\n"
+                      << desc << '\n';
+            return false;
+        }
+
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    if (!vm.count("color-weight"))
+        options.colorWeight = -1;
+    options.isUsingVtk = vm.count("vtk");
+    options.isBenchmark = vm.count("benchmark");
+    options.isStreaming = vm.count("streaming");
+    options.isRefining = vm.count("refine");
+    options.threadQty = std::max(1u, options.threadQty);
+    options.memoryBudget = uintmax_t(memoryBudgetMB) << 20;
+
+    const bool isBatch = vm.count("input-dir") || vm.count("output-dir");
+    if (isBatch
+        ? !vm.count("input-dir") || !vm.count("output-dir")
+        : !vm.count("input-file") || !vm.count("output-file"))
+    {
+        std::cerr << "Give either an input and an output file "
+                     "or --input-dir and --output-dir\n";
+        return false;
+    }
+    if (isBatch
+        ? options.isUsingVtk || options.isBenchmark || options.isStreaming
+          || options.isRefining || !options.progressiveFilename.empty()
+        : vm.count("manifest") || vm.count("summary"))
+    {
+        std::cerr << "--input-dir doesn't work with --vtk, --benchmark, "
+                     "--streaming, --refine or --progressive, and --manifest "
+                     "and --summary need it\n";
+        return false;
+    }
+
+    if (!vm.count("reduction") && !vm.count("triangles") && !vm.count("max-error"))
+        options.target.reduction = DEFAULT_REDUCTION;
+    if (options.target.reduction < 0 || options.target.reduction >= 1) {
+        std::cerr << "--reduction must be from 0 to below 1\n";
+        return false;
+    }
+    if (vm.count("color-weight") && options.colorWeight < 0) {
+        std::cerr << "--color-weight can't be negative\n";
+        return false;
+    }
+    if (options.target.maxError < 0) {
+        std::cerr << "--max-error can't be negative\n";
+        return false;
+    }
+    if (options.isUsingVtk && options.target.maxError > 0) {
+        std::cerr << "--max-error doesn't work with --vtk\n";
+        return false;
+    }
+    if (options.isStreaming
+        ? options.isUsingVtk || options.isBenchmark
+          || (options.target.maxError > 0 && !options.isRefining)
+        : options.isRefining)
+    {
+        std::cerr << "--streaming works with a reduction or a triangle count, "
+                     "and --max-error only with --refine; --refine needs "
+                     "--streaming\n";
+        return false;
+    }
+    if (!options.progressiveFilename.empty()
+        && (options.isUsingVtk || options.isBenchmark || options.isStreaming))
+    {
+        std::cerr << "--progressive doesn't work with --vtk, --benchmark "
+                     "or --streaming\n";
+        return false;
+    }
+
+    return true;
+}
+
+} // anonymous namespace
+
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        PrintHelp();
+    Options options;
+    if (!initOptions(options, argc, argv))
         return EXIT_FAILURE;
+
+    if (!options.inputDirectory.empty())
+        return decimateDirectory(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (options.isStreaming) {
+        pcl::PolygonMesh outputMesh;
+        try {
+            if (!decimateStreaming(options, outputMesh))
+                return EXIT_FAILURE;
+        } catch (const std::exception& e) {
+            std::cerr << options.inputFilename << ": " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+        if (pcl::io::savePLYFileBinary(options.outputFilename, outputMesh) < 0) {
+            std::cerr << "can't save " << options.outputFilename << '\n';
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
     }
-    std::string inputFileName = argv[1];
-    std::string outputFileName = argv[2];
 
     pcl::PolygonMesh::Ptr pInputMesh(new pcl::PolygonMesh);
-    pcl::io::loadPLYFile(inputFileName, *pInputMesh);
+    if (pcl::io::loadPLYFile(options.inputFilename, *pInputMesh) < 0) {
+        std::cerr << "can't load " << options.inputFilename << '\n';
+        return EXIT_FAILURE;
+    }
     std::cout << "size of polygons = "
               << pInputMesh->polygons.size() << '\n';
 
-    pcl::MeshQuadricDecimationVTK decimation;
-    decimation.setInputMesh(pInputMesh);
-    decimation.setTargetReductionFactor(0.9);
-
     pcl::PolygonMesh outputMesh;
-    decimation.process(outputMesh);
+    try {
+        if (options.isBenchmark) {
+            benchmark(pInputMesh, options, outputMesh);
+        } else if (options.isUsingVtk) {
+            decimateVtk(pInputMesh, options.target, outputMesh);
+        } else {
+            DecimationStatistics statistics;
+            const double time = decimateNative(*pInputMesh, options.target,
+                                               options.colorWeight,
+                                               options.threadQty,
+                                               options.progressiveFilename,
+                                               outputMesh, statistics);
+            printStatistics(statistics);
+            std::cout << "decimated in " << time << " s\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << options.inputFilename << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
 
     std::cout << "size of polygons after decimation = "
               << outputMesh.polygons.size() << '\n';
 
-    pcl::io::savePLYFileBinary(outputFileName, outputMesh);
+    if (pcl::io::savePLYFileBinary(options.outputFilename, outputMesh) < 0) {
+        std::cerr << "can't save " << options.outputFilename << '\n';
+        return EXIT_FAILURE;
+    }
 
-    return 0;
+    return EXIT_SUCCESS;
 }
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+struct Vec3 {
+    Vec3()
+        : x(0), y(0), z(0)
+    {}
+
+    Vec3(double x, double y, double z)
+        : x(x), y(y), z(z)
+    {}
+
+    double x;
+    double y;
+    double z;
+};
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b)
+{
+    return Vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+inline Vec3 operator-(const Vec3& a, const Vec3& b)
+{
+    return Vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+inline Vec3 operator*(const Vec3& a, double s)
+{
+    return Vec3(a.x * s, a.y * s, a.z * s);
+}
+
+inline double dot(const Vec3& a, const Vec3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3 cross(const Vec3& a, const Vec3& b)
+{
+    return Vec3(a.y * b.z - a.z * b.y,
+                a.z * b.x - a.x * b.z,
+                a.x * b.y - a.y * b.x);
+}
+
+inline double length2(const Vec3& a)
+{
+    return dot(a, a);
+}
+
+// The error v^T A v + 2 b^T v + c of a position v, with A symmetric, and
+// the area of the triangles whose planes it sums.
+class Quadric {
+public:
+    Quadric()
+        : m_area(0)
+    {
+        std::fill(m_a, m_a + 10, 0.0);
+    }
+
+    // Squared distance to the plane n.v + d = 0 with a unit normal n,
+    // times weight, for triangles of the area. Other n give the squared
+    // linear function (n.v + d)^2.
+    static Quadric plane(const Vec3& n, double d, double weight, double area)
+    {
+        Quadric q;
+        q.m_area = area;
+        q.m_a[0] = weight * n.x * n.x;
+        q.m_a[1] = weight * n.x * n.y;
+        q.m_a[2] = weight * n.x * n.z;
+        q.m_a[3] = weight * n.y * n.y;
+        q.m_a[4] = weight * n.y * n.z;
+        q.m_a[5] = weight * n.z * n.z;
+        q.m_a[6] = weight * n.x * d;
+        q.m_a[7] = weight * n.y * d;
+        q.m_a[8] = weight * n.z * d;
+        q.m_a[9] = weight * d * d;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        for (int i = 0; i < 10; ++i) {
+            m_a[i] += q.m_a[i];
+        }
+        m_area += q.m_area;
+        return *this;
+    }
+
+    double evaluate(const Vec3& v) const
+    {
+        return m_a[0] * v.x * v.x + 2 * m_a[1] * v.x * v.y
+               + 2 * m_a[2] * v.x * v.z + m_a[3] * v.y * v.y
+               + 2 * m_a[4] * v.y * v.z + m_a[5] * v.z * v.z
+               + 2 * (m_a[6] * v.x + m_a[7] * v.y + m_a[8] * v.z)
+               + m_a[9];
+    }
+
+    // An error as area weighted RMS distance.
+    double getDistance(double error) const
+    {
+        return m_area > 0 ? std::sqrt(std::max(0.0, error) / m_area) : 0;
+    }
+
+    // Solves A v = -b; false when A is close to singular, as on flat or
+    // cylindrical parts.
+    bool findMinimum(Vec3& v) const
+    {
+        const double a = m_a[0], b = m_a[1], c = m_a[2];
+        const double d = m_a[3], e = m_a[4], f = m_a[5];
+        const double i00 = d * f - e * e;
+        const double i01 = c * e - b * f;
+        const double i02 = b * e - c * d;
+        const double det = a * i00 + b * i01 + c * i02;
+        const double trace = a + d + f;
+        if (trace <= 0 || std::fabs(det) <= 1e-9 * trace * trace * trace)
+            return false;
+
+        const double i11 = a * f - c * c;
+        const double i12 = b * c - a * e;
+        const double i22 = a * d - b * b;
+        const double b0 = m_a[6], b1 = m_a[7], b2 = m_a[8];
+        v = Vec3(-(i00 * b0 + i01 * b1 + i02 * b2) / det,
+                 -(i01 * b0 + i11 * b1 + i12 * b2) / det,
+                 -(i02 * b0 + i12 * b1 + i22 * b2) / det);
+        return true;
+    }
+
+private:
+    // a11 a12 a13 a22 a23 a33 b1 b2 b3 c
+    double m_a[10];
+    double m_area;
+};
@@ -0,0 +1,87 @@
+#include "surface-distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "triangle-grid.h"
+
+namespace
+{
+
+struct Point {
+    Point() : x(0), y(0), z(0) {}
+    Point(double x, double y, double z) : x(x), y(y), z(z) {}
+
+    double x, y, z;
+};
+
+Point getPosition(const TriangleMesh& mesh, uint32_t vertex)
+{
+    const float* p = &mesh.positions[3 * vertex];
+    return Point(p[0], p[1], p[2]);
+}
+
+bool isFinite(const Point& p)
+{
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+} // anonymous namespace
+
+SurfaceDistance measureSurfaceDistance(
+        const TriangleMesh& from,
+        const TriangleMesh& to,
+        size_t maxSampleQty)
+{
+    const TriangleGrid grid(to);
+
+    const bool hasColors = !from.colors.empty() && !to.colors.empty();
+
+    SurfaceDistance result;
+    result.sampleQty = 0;
+    result.maxDistance = 0;
+    result.rmsColorDifference = 0;
+    double sum2 = 0;
+    double colorSum2 = 0;
+
+    // Vertices of no triangle aren't on the surface.
+    std::vector<uint32_t> used(from.indices);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    const size_t step = std::max<size_t>(1, (used.size() + maxSampleQty - 1)
+                                            / std::max<size_t>(1, maxSampleQty));
+    for (size_t i = 0; i < used.size(); i += step) {
+        const Point p = getPosition(from, used[i]);
+        if (!isFinite(p))
+            continue;
+        const double coords[3] = {p.x, p.y, p.z};
+        NearestPoint nearest;
+        if (!grid.findNearest(coords, nearest))
+            continue;
+        result.maxDistance = std::max(result.maxDistance, std::sqrt(nearest.distance2));
+        sum2 += nearest.distance2;
+        ++result.sampleQty;
+
+        if (hasColors) {
+            const uint32_t* v = &to.indices[3 * nearest.triangle];
+            for (int channel = 0; channel < 3; ++channel) {
+                double color = 0;
+                for (int corner = 0; corner < 3; ++corner) {
+                    color += nearest.weights[corner] * to.colors[3 * v[corner] + channel];
+                }
+                const double difference = color - from.colors[3 * used[i] + channel];
+                colorSum2 += difference * difference;
+            }
+        }
+    }
+    if (result.sampleQty > 0) {
+        result.rmsDistance = std::sqrt(sum2 / result.sampleQty);
+        result.rmsColorDifference = std::sqrt(colorSum2 / (3 * result.sampleQty));
+    } else {
+        result.rmsDistance = 0;
+    }
+    return result;
+}
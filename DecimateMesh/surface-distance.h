@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+#include "triangle-mesh.h"
+
+struct SurfaceDistance {
+    size_t sampleQty;
+    double maxDistance;
+    double rmsDistance;
+    // Per channel from 0 to 255, between the colors of the samples and
+    // those interpolated at their nearest points; 0 unless both meshes
+    // have colors.
+    double rmsColorDifference;
+};
+
+// Distances from up to maxSampleQty vertices of the triangles of from,
+// taken evenly by index, to the nearest triangles of to. For a decimated
+// mesh measured from its input this is how far the surface has moved.
+SurfaceDistance measureSurfaceDistance(
+        const TriangleMesh& from,
+        const TriangleMesh& to,
+        size_t maxSampleQty);
@@ -0,0 +1,518 @@
+#include "vertex-clustering.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped-file.h"
+#include "ply-header.h"
+#include "ply-stream.h"
+#include "quadric.h"
+
+namespace
+{
+
+// Bits of a cell coordinate in a cell key.
+const int CELL_BITS = 21;
+const uint32_t MAX_CELL = (1u << CELL_BITS) - 1;
+
+// Occupied cells per area of a cell face, and triangles per occupied cell
+// after the non-manifold ones are dropped, as measured on scans; the
+// estimate is within a factor of 1.5 of the target.
+const double CELLS_PER_AREA = 0.7;
+const double TRIANGLES_PER_CELL = 2;
+
+// The cells get coarser when there are more than this many per triangle
+// of the target, and at the end while the triangles are more than this
+// many times the target.
+const size_t MAX_CLUSTERS_PER_TRIANGLE = 2;
+const size_t MAX_TRIANGLE_EXCESS = 2;
+
+typedef std::vector<uint32_t> Indices;
+
+Vec3 getPosition(const PlyVertexReader& vertices, size_t index)
+{
+    return Vec3(vertices.coord(index, 0),
+                vertices.coord(index, 1),
+                vertices.coord(index, 2));
+}
+
+Vec3 getColor(const PlyVertexReader& vertices, size_t index)
+{
+    return Vec3(vertices.color(index, 0),
+                vertices.color(index, 1),
+                vertices.color(index, 2));
+}
+
+// Bounds of the finite positions, reading the vertices in order and
+// dropping their pages behind. False without any.
+bool findBounds(const PlyVertexReader& vertices, Vec3& min, Vec3& max)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    min = Vec3(inf, inf, inf);
+    max = Vec3(-inf, -inf, -inf);
+    const size_t qty = vertices.size();
+    vertices.adviseSequential(0, qty);
+
+    for (size_t first = 0; first < qty; first += PLY_FACE_CHUNK_SIZE) {
+        const size_t last = std::min(qty, first + PLY_FACE_CHUNK_SIZE);
+        for (size_t i = first; i < last; ++i) {
+            const Vec3 p = getPosition(vertices, i);
+            if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                continue;
+            min = Vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+            max = Vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+        }
+        vertices.release(first, last);
+    }
+    return min.x <= max.x;
+}
+
+// What the corners in one cell add up to.
+struct Cluster {
+    Cluster()
+        : cornerQty(0)
+    {}
+
+    Cluster& operator+=(const Cluster& other)
+    {
+        quadric += other.quadric;
+        positionSum = positionSum + other.positionSum;
+        colorSum = colorSum + other.colorSum;
+        cornerQty += other.cornerQty;
+        return *this;
+    }
+
+    Quadric quadric;
+    Vec3 positionSum;
+    Vec3 colorSum;
+    uint64_t cornerQty;
+};
+
+// Cluster indices, rotated so that the smallest comes first, and the
+// area of the input triangles over them, negative for the input triangles
+// that have the opposite orientation.
+struct ClusterTriangle {
+    ClusterTriangle(uint32_t a, uint32_t b, uint32_t c, double area)
+        : area(area)
+    {
+        const uint32_t v[3] = {a, b, c};
+        const int first = a < b ? (a < c ? 0 : 2) : (b < c ? 1 : 2);
+        for (int i = 0; i < 3; ++i) {
+            vertices[i] = v[(first + i) % 3];
+        }
+    }
+
+    // Makes the orientation of most of the area the positive one.
+    void orient()
+    {
+        if (area < 0) {
+            std::swap(vertices[1], vertices[2]);
+            area = -area;
+        }
+    }
+
+    bool isDegenerate() const
+    {
+        return vertices[0] == vertices[1] || vertices[1] == vertices[2]
+               || vertices[2] == vertices[0];
+    }
+
+    // Triangles over the same clusters are equal in either orientation.
+    bool operator<(const ClusterTriangle& other) const
+    {
+        return getSetKey() < other.getSetKey();
+    }
+
+    bool operator==(const ClusterTriangle& other) const
+    {
+        return getSetKey() == other.getSetKey();
+    }
+
+    std::pair<uint32_t, uint64_t> getSetKey() const
+    {
+        const uint64_t low = std::min(vertices[1], vertices[2]);
+        const uint64_t high = std::max(vertices[1], vertices[2]);
+        return std::make_pair(vertices[0], low << 32 | high);
+    }
+
+    // Either orientation of the edge from corner i.
+    uint64_t getEdgeKey(int i) const
+    {
+        const uint64_t a = vertices[i];
+        const uint64_t b = vertices[(i + 1) % 3];
+        return std::min(a, b) << 32 | std::max(a, b);
+    }
+
+    uint32_t vertices[3];
+    double area;
+};
+
+// The occupied cells of a grid and the triangles between them.
+class VertexClusterer {
+public:
+    VertexClusterer(const Vec3& min, double cellSize)
+        : m_min(min)
+        , m_cellSize(cellSize)
+        , m_uniqueTriangleQty(0)
+        , m_coarseningQty(0)
+        , m_peakClusterQty(0)
+    {}
+
+    // colors may be null.
+    void addTriangle(const Vec3* positions, const Vec3* colors);
+
+    // Doubles the cells, merging eight into one.
+    void coarsen();
+
+    void removeDuplicates();
+
+    // Drops the triangles that would give an edge more than two, keeping
+    // those over the most input area, so that the quadric decimation can
+    // collapse the result.
+    void removeNonManifoldEdges();
+
+    size_t getClusterQty() const { return m_clusters.size(); }
+    size_t getTriangleQty() const { return m_triangles.size(); }
+    double getCellSize() const { return m_cellSize; }
+    size_t getCoarseningQty() const { return m_coarseningQty; }
+    size_t getPeakClusterQty() const { return m_peakClusterQty; }
+
+    void getResult(bool hasColors, TriangleMesh& mesh) const;
+
+private:
+    uint64_t getKey(const Vec3& p) const;
+    uint32_t findCluster(uint64_t key);
+    Vec3 findPosition(uint32_t cluster) const;
+
+    Vec3 m_min;
+    double m_cellSize;
+    std::unordered_map<uint64_t, uint32_t> m_clusterIndices;
+    std::vector<uint64_t> m_keys;
+    std::vector<Cluster> m_clusters;
+    std::vector<ClusterTriangle> m_triangles;
+    size_t m_uniqueTriangleQty;
+    size_t m_coarseningQty;
+    size_t m_peakClusterQty;
+};
+
+uint64_t VertexClusterer::getKey(const Vec3& p) const
+{
+    const double values[3] = {p.x - m_min.x, p.y - m_min.y, p.z - m_min.z};
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        const double cell = std::floor(values[axis] / m_cellSize);
+        key = key << CELL_BITS
+              | uint64_t(std::max(0.0, std::min(double(MAX_CELL), cell)));
+    }
+    return key;
+}
+
+uint32_t VertexClusterer::findCluster(uint64_t key)
+{
+    const std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> found =
+        m_clusterIndices.insert(std::make_pair(key, uint32_t(m_clusters.size())));
+    if (found.second) {
+        m_keys.push_back(key);
+        m_clusters.push_back(Cluster());
+        m_peakClusterQty = std::max(m_peakClusterQty, m_clusters.size());
+    }
+    return found.first->second;
+}
+
+void VertexClusterer::addTriangle(const Vec3* positions, const Vec3* colors)
+{
+    const Vec3 faceNormal = cross(positions[1] - positions[0],
+                                  positions[2] - positions[0]);
+    const double length = std::sqrt(length2(faceNormal));
+    if (!std::isfinite(length))
+        return;
+
+    Quadric q;
+    if (length > 0) {
+        const Vec3 n = faceNormal * (1 / length);
+        const double area = length / 2;
+        q = Quadric::plane(n, -dot(n, positions[0]), area, area);
+    }
+
+    uint32_t clusters[3];
+    for (int i = 0; i < 3; ++i) {
+        clusters[i] = findCluster(getKey(positions[i]));
+        Cluster& cluster = m_clusters[clusters[i]];
+        cluster.quadric += q;
+        cluster.positionSum = cluster.positionSum + positions[i];
+        if (colors)
+            cluster.colorSum = cluster.colorSum + colors[i];
+        ++cluster.cornerQty;
+    }
+
+    const ClusterTriangle triangle(clusters[0], clusters[1], clusters[2], length / 2);
+    if (!triangle.isDegenerate()) {
+        m_triangles.push_back(triangle);
+        if (m_triangles.size() > 2 * m_uniqueTriangleQty + PLY_FACE_CHUNK_SIZE)
+            removeDuplicates();
+    }
+}
+
+// Merges the triangles over the same clusters into the orientation of
+// most of their area.
+void VertexClusterer::removeDuplicates()
+{
+    std::sort(m_triangles.begin(), m_triangles.end());
+    size_t uniqueQty = 0;
+    for (size_t i = 0; i < m_triangles.size(); ++i) {
+        ClusterTriangle triangle = m_triangles[i];
+        if (triangle.vertices[1] > triangle.vertices[2]) {
+            std::swap(triangle.vertices[1], triangle.vertices[2]);
+            triangle.area = -triangle.area;
+        }
+        if (uniqueQty > 0 && triangle == m_triangles[uniqueQty - 1]) {
+            m_triangles[uniqueQty - 1].area += triangle.area;
+        } else {
+            m_triangles[uniqueQty++] = triangle;
+        }
+    }
+    for (size_t i = 0; i < uniqueQty; ++i) {
+        m_triangles[i].orient();
+    }
+    m_triangles.erase(m_triangles.begin() + uniqueQty, m_triangles.end());
+    m_uniqueTriangleQty = uniqueQty;
+}
+
+void VertexClusterer::removeNonManifoldEdges()
+{
+    std::vector<size_t> order(m_triangles.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return m_triangles[a].area > m_triangles[b].area;
+    });
+
+    std::unordered_map<uint64_t, int> edgeTriangleQtys;
+    std::vector<ClusterTriangle> triangles;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const ClusterTriangle& triangle = m_triangles[order[i]];
+        bool isManifold = true;
+        for (int j = 0; j < 3; ++j) {
+            const std::unordered_map<uint64_t, int>::const_iterator found =
+                edgeTriangleQtys.find(triangle.getEdgeKey(j));
+            if (found != edgeTriangleQtys.end() && found->second >= 2)
+                isManifold = false;
+        }
+        if (!isManifold)
+            continue;
+        for (int j = 0; j < 3; ++j) {
+            ++edgeTriangleQtys[triangle.getEdgeKey(j)];
+        }
+        triangles.push_back(triangle);
+    }
+    m_triangles.swap(triangles);
+    m_uniqueTriangleQty = m_triangles.size();
+}
+
+void VertexClusterer::coarsen()
+{
+    const uint64_t halfMask = (uint64_t(MAX_CELL) >> 1) * ((uint64_t(1) << 2 * CELL_BITS)
+                                                           + (uint64_t(1) << CELL_BITS) + 1);
+    std::vector<uint64_t> keys;
+    std::vector<Cluster> clusters;
+    keys.swap(m_keys);
+    clusters.swap(m_clusters);
+    m_clusterIndices.clear();
+
+    m_cellSize *= 2;
+    ++m_coarseningQty;
+    std::vector<uint32_t> newIndices(clusters.size());
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        newIndices[i] = findCluster((keys[i] >> 1) & halfMask);
+        m_clusters[newIndices[i]] += clusters[i];
+    }
+
+    std::vector<ClusterTriangle> triangles;
+    triangles.swap(m_triangles);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const uint32_t* v = triangles[i].vertices;
+        const ClusterTriangle triangle(newIndices[v[0]], newIndices[v[1]],
+                                       newIndices[v[2]], triangles[i].area);
+        if (!triangle.isDegenerate())
+            m_triangles.push_back(triangle);
+    }
+    removeDuplicates();
+}
+
+// The minimum of the quadric if it is in the cell, else the mean of the
+// corners, as on flat parts where the minimum isn't unique.
+Vec3 VertexClusterer::findPosition(uint32_t cluster) const
+{
+    const Cluster& c = m_clusters[cluster];
+    const Vec3 mean = c.positionSum * (1.0 / c.cornerQty);
+
+    Vec3 position;
+    if (!c.quadric.findMinimum(position))
+        return mean;
+
+    const uint64_t key = m_keys[cluster];
+    const double cells[3] = {
+        double(key >> 2 * CELL_BITS),
+        double((key >> CELL_BITS) & MAX_CELL),
+        double(key & MAX_CELL)
+    };
+    const double mins[3] = {m_min.x, m_min.y, m_min.z};
+    const double values[3] = {position.x, position.y, position.z};
+    for (int axis = 0; axis < 3; ++axis) {
+        const double offset = values[axis] - mins[axis] - cells[axis] * m_cellSize;
+        if (!(offset >= 0 && offset <= m_cellSize))
+            return mean;
+    }
+    return position;
+}
+
+void VertexClusterer::getResult(bool hasColors, TriangleMesh& mesh) const
+{
+    std::vector<uint32_t> newIndices(m_clusters.size(), uint32_t(-1));
+    for (size_t i = 0; i < m_triangles.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            newIndices[m_triangles[i].vertices[j]] = 0;
+        }
+    }
+
+    mesh.positions.clear();
+    mesh.colors.clear();
+    uint32_t vertexQty = 0;
+    for (size_t i = 0; i < m_clusters.size(); ++i) {
+        if (newIndices[i] == uint32_t(-1))
+            continue;
+        newIndices[i] = vertexQty++;
+
+        const Vec3 p = findPosition(uint32_t(i));
+        mesh.positions.push_back(float(p.x));
+        mesh.positions.push_back(float(p.y));
+        mesh.positions.push_back(float(p.z));
+        if (hasColors) {
+            const Vec3 color = m_clusters[i].colorSum * (1.0 / m_clusters[i].cornerQty);
+            mesh.colors.push_back(uint8_t(std::lround(color.x)));
+            mesh.colors.push_back(uint8_t(std::lround(color.y)));
+            mesh.colors.push_back(uint8_t(std::lround(color.z)));
+        }
+    }
+
+    mesh.indices.resize(3 * m_triangles.size());
+    for (size_t i = 0; i < m_triangles.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            mesh.indices[3 * i + j] = newIndices[m_triangles[i].vertices[j]];
+        }
+    }
+}
+
+// Cell size for about triangleQty triangles, from the mean area of the
+// first faces.
+double estimateCellSize(
+        const PlyVertexReader& vertices,
+        const Indices& indices,
+        size_t faceQty,
+        size_t triangleQty,
+        const Vec3& min,
+        const Vec3& max)
+{
+    double area = 0;
+    size_t areaQty = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const Vec3 p0 = getPosition(vertices, indices[i]);
+        const double length = std::sqrt(length2(cross(
+                getPosition(vertices, indices[i + 1]) - p0,
+                getPosition(vertices, indices[i + 2]) - p0)));
+        if (std::isfinite(length)) {
+            area += length / 2;
+            ++areaQty;
+        }
+    }
+
+    const Vec3 extent = max - min;
+    const double largest = std::max(extent.x, std::max(extent.y, extent.z));
+    double cellSize = largest;
+    if (areaQty > 0) {
+        const double totalArea = area / areaQty * faceQty;
+        cellSize = std::min(cellSize, std::sqrt(
+                TRIANGLES_PER_CELL * CELLS_PER_AREA * totalArea / triangleQty));
+    }
+    // Fine enough for the cells to fit the keys.
+    cellSize = std::max(cellSize, largest / MAX_CELL);
+    return cellSize > 0 ? cellSize : 1;
+}
+
+} // anonymous namespace
+
+ClusteringStatistics::ClusteringStatistics()
+    : inputTriangleQty(0)
+    , cellSize(0)
+    , coarseningQty(0)
+    , peakClusterQty(0)
+{}
+
+void clusterVertices(
+        const std::string& filename,
+        size_t triangleQty,
+        TriangleMesh& output,
+        ClusteringStatistics* statistics)
+{
+    MappedFile file(filename);
+
+    PlyHeader header;
+    readPlyHeader(filename, header);
+    if (header.format != PLY_BINARY_LITTLE_ENDIAN)
+        throw PlyError("streaming needs a binary little endian PLY file");
+    checkTriangleMesh(header, file);
+
+    const PlyVertexReader vertices(file, header);
+    PlyFaceReader faces(file, header);
+    const size_t faceQty = header.faceQty();
+    triangleQty = std::max<size_t>(1, triangleQty);
+
+    output = TriangleMesh();
+    Vec3 min, max;
+    if (!findBounds(vertices, min, max))
+        return;
+
+    Indices indices;
+    size_t chunkFaceQty = faces.readChunk(vertices.size(), indices);
+    VertexClusterer clusterer(min, estimateCellSize(
+            vertices, indices, faceQty, triangleQty, min, max));
+
+    const size_t maxClusterQty = MAX_CLUSTERS_PER_TRIANGLE * triangleQty + PLY_FACE_CHUNK_SIZE;
+    const bool hasColors = vertices.hasColor();
+    while (chunkFaceQty > 0) {
+        for (size_t i = 0; i < chunkFaceQty; ++i) {
+            Vec3 positions[3];
+            Vec3 colors[3];
+            for (int k = 0; k < 3; ++k) {
+                positions[k] = getPosition(vertices, indices[3 * i + k]);
+                if (hasColors)
+                    colors[k] = getColor(vertices, indices[3 * i + k]);
+            }
+            clusterer.addTriangle(positions, hasColors ? colors : 0);
+        }
+        while (clusterer.getClusterQty() > maxClusterQty) {
+            clusterer.coarsen();
+        }
+        chunkFaceQty = faces.readChunk(vertices.size(), indices);
+    }
+
+    clusterer.removeDuplicates();
+    while (clusterer.getTriangleQty() > MAX_TRIANGLE_EXCESS * triangleQty) {
+        clusterer.coarsen();
+    }
+    clusterer.removeNonManifoldEdges();
+    clusterer.getResult(hasColors, output);
+
+    if (statistics) {
+        statistics->inputTriangleQty = faceQty;
+        statistics->cellSize = clusterer.getCellSize();
+        statistics->coarseningQty = clusterer.getCoarseningQty();
+        statistics->peakClusterQty = clusterer.getPeakClusterQty();
+    }
+}
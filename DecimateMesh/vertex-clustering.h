@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "triangle-mesh.h"
+
+struct ClusteringStatistics {
+    ClusteringStatistics();
+
+    size_t inputTriangleQty;
+    // Edge of the grid cells in mesh units, after any coarsening.
+    double cellSize;
+    // Times the cells were doubled because there were too many.
+    size_t coarseningQty;
+    size_t peakClusterQty;
+};
+
+// Decimates a binary little endian PLY mesh without loading it, by vertex
+// clustering after Lindstrom's out-of-core simplification. A pass over the
+// vertices finds the bounds, and a single pass over the faces, in chunks,
+// adds the quadric of every triangle to the grid cells of its corners and
+// keeps the triangles with corners in three cells, in the orientation of
+// most of their input area. Every occupied cell becomes one vertex at the
+// minimum of its quadric, with the mean color, and triangles that would
+// give an edge more than two are dropped, which can leave small holes.
+//
+// The cell size is estimated for about triangleQty triangles from the
+// first faces, and the cells are doubled whenever there are too many of
+// them, so that memory follows the output and not the input. The input
+// vertices are read from the mapped file as the faces need them. Throws
+// PlyError or MappedFileError.
+void clusterVertices(
+        const std::string& filename,
+        size_t triangleQty,
+        TriangleMesh& output,
+        ClusteringStatistics* statistics);
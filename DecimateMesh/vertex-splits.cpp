@@ -0,0 +1,189 @@
+#include "vertex-splits.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+const uint32_t NO_INDEX = uint32_t(-1);
+
+// What one collapse removed and moved, in input indices, and what a and
+// b were before it.
+struct ReplayedCollapse {
+    uint32_t a;
+    uint32_t b;
+    float position[3];
+    uint8_t color[3];
+    float newPosition[3];
+    uint8_t newColor[3];
+    std::vector<uint32_t> movedTriangles;
+    std::vector<uint32_t> removedTriangles;
+    // Corners of the removed triangles.
+    std::vector<uint32_t> removedCorners;
+};
+
+bool isDegenerate(const uint32_t* v)
+{
+    return v[0] == v[1] || v[1] == v[2] || v[2] == v[0];
+}
+
+void copyVertex(const TriangleMesh& mesh, uint32_t vertex, float* position, uint8_t* color)
+{
+    std::memcpy(position, &mesh.positions[3 * vertex], 3 * sizeof(float));
+    if (mesh.colors.empty()) {
+        std::fill(color, color + 3, 0);
+    } else {
+        std::memcpy(color, &mesh.colors[3 * vertex], 3);
+    }
+}
+
+// Applies the collapses to mesh, which ends as the decimated mesh with
+// the input numbering.
+void replay(
+        TriangleMesh& mesh,
+        std::vector<uint8_t>& isRemoved,
+        const std::vector<EdgeCollapse>& collapses,
+        std::vector<ReplayedCollapse>& replayed)
+{
+    const size_t vertexQty = mesh.getVertexQty();
+    std::vector<std::vector<uint32_t> > vertexTriangles(vertexQty);
+    for (uint32_t t = 0; t < isRemoved.size(); ++t) {
+        if (!isRemoved[t]) {
+            for (int i = 0; i < 3; ++i) {
+                vertexTriangles[mesh.indices[3 * t + i]].push_back(t);
+            }
+        }
+    }
+
+    const std::runtime_error badCollapse("collapses don't match the mesh");
+    std::vector<uint8_t> isCollapsed(vertexQty, 0);
+    replayed.resize(collapses.size());
+    for (size_t i = 0; i < collapses.size(); ++i) {
+        const EdgeCollapse& collapse = collapses[i];
+        const uint32_t a = collapse.a;
+        const uint32_t b = collapse.b;
+        if (a >= vertexQty || b >= vertexQty || a == b
+            || isCollapsed[a] || isCollapsed[b])
+        {
+            throw badCollapse;
+        }
+
+        ReplayedCollapse& r = replayed[i];
+        r.a = a;
+        r.b = b;
+        copyVertex(mesh, a, r.position, r.color);
+        copyVertex(mesh, b, r.newPosition, r.newColor);
+
+        std::vector<uint32_t>& trianglesOfA = vertexTriangles[a];
+        std::vector<uint32_t>& trianglesOfB = vertexTriangles[b];
+        for (size_t j = 0; j < trianglesOfB.size(); ++j) {
+            const uint32_t t = trianglesOfB[j];
+            if (isRemoved[t])
+                continue;
+            uint32_t* v = &mesh.indices[3 * t];
+            if (v[0] == a || v[1] == a || v[2] == a) {
+                isRemoved[t] = 1;
+                r.removedTriangles.push_back(t);
+                r.removedCorners.insert(r.removedCorners.end(), v, v + 3);
+            } else {
+                *std::find(v, v + 3, b) = a;
+                r.movedTriangles.push_back(t);
+                trianglesOfA.push_back(t);
+            }
+        }
+        std::vector<uint32_t>().swap(trianglesOfB);
+        isCollapsed[b] = 1;
+
+        std::memcpy(&mesh.positions[3 * a], collapse.position, sizeof(collapse.position));
+        if (!mesh.colors.empty())
+            std::memcpy(&mesh.colors[3 * a], collapse.color, sizeof(collapse.color));
+    }
+}
+
+} // anonymous namespace
+
+// The vertices are numbered as they appear in the progressive mesh: those
+// of the base in input order, then one per split. So are the triangles.
+void makeProgressiveMesh(
+        const TriangleMesh& input,
+        const std::vector<EdgeCollapse>& collapses,
+        ProgressiveMesh& mesh)
+{
+    const size_t vertexQty = input.getVertexQty();
+    const size_t triangleQty = input.getTriangleQty();
+
+    TriangleMesh current(input);
+    std::vector<uint8_t> isRemoved(triangleQty, 0);
+    std::vector<uint8_t> isUsed(vertexQty, 0);
+    for (size_t t = 0; t < triangleQty; ++t) {
+        const uint32_t* v = &input.indices[3 * t];
+        if (isDegenerate(v)) {
+            isRemoved[t] = 1;
+        } else {
+            for (int i = 0; i < 3; ++i) {
+                isUsed[v[i]] = 1;
+            }
+        }
+    }
+
+    std::vector<ReplayedCollapse> replayed;
+    replay(current, isRemoved, collapses, replayed);
+
+    for (size_t i = 0; i < replayed.size(); ++i) {
+        isUsed[replayed[i].b] = 0;
+    }
+    std::vector<uint32_t> newVertices(vertexQty, NO_INDEX);
+    TriangleMesh& base = mesh.base;
+    base = TriangleMesh();
+    for (uint32_t v = 0; v < vertexQty; ++v) {
+        if (!isUsed[v])
+            continue;
+        newVertices[v] = uint32_t(base.getVertexQty());
+        base.positions.insert(base.positions.end(),
+                              current.positions.begin() + 3 * v,
+                              current.positions.begin() + 3 * v + 3);
+        if (!current.colors.empty()) {
+            base.colors.insert(base.colors.end(),
+                               current.colors.begin() + 3 * v,
+                               current.colors.begin() + 3 * v + 3);
+        }
+    }
+
+    std::vector<uint32_t> newTriangles(triangleQty, NO_INDEX);
+    uint32_t nextTriangle = 0;
+    for (size_t t = 0; t < triangleQty; ++t) {
+        if (isRemoved[t])
+            continue;
+        newTriangles[t] = nextTriangle++;
+        for (int i = 0; i < 3; ++i) {
+            base.indices.push_back(newVertices[current.indices[3 * t + i]]);
+        }
+    }
+
+    uint32_t nextVertex = uint32_t(base.getVertexQty());
+    mesh.splits.resize(replayed.size());
+    for (size_t i = 0; i < replayed.size(); ++i) {
+        const ReplayedCollapse& r = replayed[replayed.size() - 1 - i];
+        VertexSplit& split = mesh.splits[i];
+        newVertices[r.b] = nextVertex++;
+        split.vertex = newVertices[r.a];
+        std::memcpy(split.position, r.position, sizeof(split.position));
+        std::memcpy(split.color, r.color, sizeof(split.color));
+        std::memcpy(split.newPosition, r.newPosition, sizeof(split.newPosition));
+        std::memcpy(split.newColor, r.newColor, sizeof(split.newColor));
+
+        split.movedTriangles.resize(r.movedTriangles.size());
+        for (size_t j = 0; j < r.movedTriangles.size(); ++j) {
+            split.movedTriangles[j] = newTriangles[r.movedTriangles[j]];
+        }
+        for (size_t j = 0; j < r.removedTriangles.size(); ++j) {
+            newTriangles[r.removedTriangles[j]] = nextTriangle++;
+        }
+        split.newTriangles.resize(r.removedCorners.size());
+        for (size_t j = 0; j < r.removedCorners.size(); ++j) {
+            split.newTriangles[j] = newVertices[r.removedCorners[j]];
+        }
+    }
+}
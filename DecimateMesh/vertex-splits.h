@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+#include "decimator.h"
+#include "progressive-mesh.h"
+#include "triangle-mesh.h"
+
+// Replays the collapses of decimate() on its input and reverses them into
+// vertex splits, from the decimated mesh as the base back to the input.
+// Degenerate triangles and vertices without triangles are left out.
+void makeProgressiveMesh(
+        const TriangleMesh& input,
+        const std::vector<EdgeCollapse>& collapses,
+        ProgressiveMesh& mesh);
@@ -0,0 +1,297 @@
+#include "clusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+namespace
+{
+
+// Small enough to cull the back of a turntable model finely, large enough
+// to keep the glMultiDrawElements range count low.
+const size_t TRIANGLES_PER_CLUSTER = 256;
+
+// The cone is not worth testing when normals spread wider than this.
+const float MIN_CONE_DOT = 0.1f;
+
+const float NO_CONE_CUTOFF = 2.0f;
+
+glm::vec3 vertexAt(const GLfloat* vertices, GLuint index)
+{
+    return glm::vec3(
+            vertices[3 * index],
+            vertices[3 * index + 1],
+            vertices[3 * index + 2]);
+}
+
+// Spreads the lower 10 bits of v so that there are two zero bits between
+// each of them.
+unsigned expandBits(unsigned v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+unsigned quantize(float x)
+{
+    return unsigned(std::min(std::max(x * 1024.0f, 0.0f), 1023.0f));
+}
+
+// p is expected to be inside the unit cube.
+unsigned mortonCode(const glm::vec3& p)
+{
+    return (expandBits(quantize(p.x)) << 2)
+         | (expandBits(quantize(p.y)) << 1)
+         | expandBits(quantize(p.z));
+}
+
+void findBounds(const GLfloat* vertices, size_t vertexQty,
+                glm::vec3& min, glm::vec3& max)
+{
+    min = glm::vec3(std::numeric_limits<float>::max());
+    max = glm::vec3(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < vertexQty; ++i) {
+        glm::vec3 v = vertexAt(vertices, GLuint(i));
+        min = glm::min(min, v);
+        max = glm::max(max, v);
+    }
+}
+
+void sortTrianglesSpatially(
+        const GLfloat* vertices,
+        size_t vertexQty,
+        const GLuint* indices,
+        size_t indexQty,
+        std::vector<GLuint>& elements)
+{
+    glm::vec3 min, max;
+    findBounds(vertices, vertexQty, min, max);
+    glm::vec3 extent = max - min;
+    for (int i = 0; i < 3; ++i) {
+        if (extent[i] <= 0.0f)
+            extent[i] = 1.0f;
+    }
+
+    const size_t triangleQty = indexQty / 3;
+    typedef std::pair<unsigned, size_t> Key;
+    std::vector<Key> keys(triangleQty);
+    for (size_t t = 0; t < triangleQty; ++t) {
+        glm::vec3 centroid = (vertexAt(vertices, indices[3 * t])
+                              + vertexAt(vertices, indices[3 * t + 1])
+                              + vertexAt(vertices, indices[3 * t + 2])) / 3.0f;
+        glm::vec3 p = centroid - min;
+        keys[t] = Key(mortonCode(glm::vec3(p.x / extent.x,
+                                           p.y / extent.y,
+                                           p.z / extent.z)),
+                      t);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<GLuint> sorted(3 * triangleQty);
+    for (size_t t = 0; t < triangleQty; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            sorted[3 * t + k] = indices[3 * keys[t].second + k];
+        }
+    }
+    elements.swap(sorted);
+}
+
+// Scanned meshes don't agree on the winding. The sign of the volume tells
+// whether cross(b - a, c - a) points out of the model.
+float findNormalOrientation(
+        const GLfloat* vertices,
+        size_t vertexQty,
+        const std::vector<GLuint>& elements)
+{
+    glm::vec3 min, max;
+    findBounds(vertices, vertexQty, min, max);
+    const glm::vec3 origin = (min + max) / 2.0f;
+
+    double volume = 0;
+    for (size_t i = 0; i + 2 < elements.size(); i += 3) {
+        glm::vec3 a = vertexAt(vertices, elements[i]) - origin;
+        glm::vec3 b = vertexAt(vertices, elements[i + 1]) - origin;
+        glm::vec3 c = vertexAt(vertices, elements[i + 2]) - origin;
+        volume += glm::dot(a, glm::cross(b, c));
+    }
+    return volume < 0 ? -1.0f : 1.0f;
+}
+
+Cluster makeCluster(
+        const GLfloat* vertices,
+        const std::vector<GLuint>& elements,
+        size_t firstIndex,
+        size_t indexQty,
+        float orientation)
+{
+    Cluster cluster;
+    cluster.firstIndex = firstIndex;
+    cluster.indexQty = indexQty;
+
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(-std::numeric_limits<float>::max());
+    for (size_t i = firstIndex; i < firstIndex + indexQty; ++i) {
+        glm::vec3 v = vertexAt(vertices, elements[i]);
+        min = glm::min(min, v);
+        max = glm::max(max, v);
+    }
+    cluster.center = (min + max) / 2.0f;
+
+    float radius = 0;
+    std::vector<glm::vec3> normals;
+    normals.reserve(indexQty / 3);
+    glm::vec3 normalSum(0.0f);
+    for (size_t i = firstIndex; i < firstIndex + indexQty; i += 3) {
+        glm::vec3 a = vertexAt(vertices, elements[i]);
+        glm::vec3 b = vertexAt(vertices, elements[i + 1]);
+        glm::vec3 c = vertexAt(vertices, elements[i + 2]);
+        radius = std::max(radius, glm::length(a - cluster.center));
+        radius = std::max(radius, glm::length(b - cluster.center));
+        radius = std::max(radius, glm::length(c - cluster.center));
+
+        glm::vec3 n = glm::cross(b - a, c - a);
+        float length = glm::length(n);
+        if (length > 0.0f) {
+            normals.push_back(n * (orientation / length));
+            normalSum = normalSum + normals.back();
+        }
+    }
+    cluster.radius = radius;
+
+    cluster.coneAxis = glm::vec3(0.0f);
+    cluster.coneCutoff = NO_CONE_CUTOFF;
+
+    const float sumLength = glm::length(normalSum);
+    if (normals.empty() || sumLength <= 0.0f)
+        return cluster;
+
+    const glm::vec3 axis = normalSum / sumLength;
+    float minDot = 1.0f;
+    for (size_t i = 0; i < normals.size(); ++i) {
+        minDot = std::min(minDot, glm::dot(normals[i], axis));
+    }
+
+    if (minDot >= MIN_CONE_DOT) {
+        cluster.coneAxis = axis;
+        cluster.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    return cluster;
+}
+
+struct Plane {
+    glm::vec3 normal;
+    float distance;
+};
+
+// Frustum planes in model coordinates, pointing inside (Gribb/Hartmann).
+void extractFrustumPlanes(const glm::mat4& mvp, Plane planes[6])
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        glm::vec4 p[2] = { rows[3] + rows[i], rows[3] - rows[i] };
+        for (int j = 0; j < 2; ++j) {
+            glm::vec3 normal(p[j].x, p[j].y, p[j].z);
+            float length = glm::length(normal);
+            planes[2 * i + j].normal = normal / length;
+            planes[2 * i + j].distance = p[j].w / length;
+        }
+    }
+}
+
+bool isInFrustum(const Cluster& cluster, const Plane planes[6])
+{
+    for (int i = 0; i < 6; ++i) {
+        if (glm::dot(planes[i].normal, cluster.center) + planes[i].distance
+            < -cluster.radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isBackfacing(const Cluster& cluster, const glm::vec3& cameraPosition)
+{
+    if (cluster.coneCutoff > 1.0f)
+        return false;
+
+    glm::vec3 view = cluster.center - cameraPosition;
+    return glm::dot(view, cluster.coneAxis)
+           >= cluster.coneCutoff * glm::length(view) + cluster.radius;
+}
+
+} // anonymous namespace
+
+void buildClusters(
+        const GLfloat* vertices,
+        size_t vertexQty,
+        const GLuint* indices,
+        size_t indexQty,
+        std::vector<GLuint>& elements,
+        Clusters& clusters)
+{
+    clusters.clear();
+    if (indexQty == 0) {
+        elements.clear();
+        return;
+    }
+
+    sortTrianglesSpatially(vertices, vertexQty, indices, indexQty, elements);
+    const float orientation =
+        findNormalOrientation(vertices, vertexQty, elements);
+
+    const size_t clusterSize = 3 * TRIANGLES_PER_CLUSTER;
+    for (size_t first = 0; first < elements.size(); first += clusterSize) {
+        const size_t indexQty = std::min(clusterSize, elements.size() - first);
+        clusters.push_back(
+                makeCluster(vertices, elements, first, indexQty, orientation));
+    }
+}
+
+void findVisibleClusters(
+        const Clusters& clusters,
+        const glm::mat4& mvp,
+        const glm::vec3& cameraPosition,
+        bool cullBackfaces,
+        DrawRanges& ranges)
+{
+    ranges.counts.clear();
+    ranges.offsets.clear();
+    ranges.triangleQty = 0;
+
+    Plane planes[6];
+    extractFrustumPlanes(mvp, planes);
+
+    GLsizei rangeEnd = -1;
+    for (Clusters::const_iterator it = clusters.begin();
+         it != clusters.end();
+         ++it)
+    {
+        if (!isInFrustum(*it, planes)
+            || (cullBackfaces && isBackfacing(*it, cameraPosition)))
+        {
+            continue;
+        }
+
+        if (it->firstIndex == rangeEnd) {
+            ranges.counts.back() += it->indexQty;
+        } else {
+            ranges.counts.push_back(it->indexQty);
+            ranges.offsets.push_back(
+                    (const GLvoid*)(it->firstIndex * sizeof(GLuint)));
+        }
+        rangeEnd = it->firstIndex + it->indexQty;
+        ranges.triangleQty += it->indexQty / 3;
+    }
+}
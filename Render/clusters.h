@@ -0,0 +1,51 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+// A spatially coherent range of triangles in the element buffer with the
+// bounds needed to skip it when it is invisible from the current view.
+struct Cluster {
+    glm::vec3 center;
+    float radius;
+    // All triangle normals are within the cone around coneAxis; the cone
+    // can't cull anything when coneCutoff > 1.
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    GLsizei firstIndex;
+    GLsizei indexQty;
+};
+
+typedef std::vector<Cluster> Clusters;
+
+// Fills elements with the triangles of indices (three indices per
+// triangle) reordered so that nearby triangles form consecutive clusters,
+// and computes cluster bounds. vertices holds x, y, z for each vertex.
+// indices may point into elements.
+void buildClusters(
+        const GLfloat* vertices,
+        size_t vertexQty,
+        const GLuint* indices,
+        size_t indexQty,
+        std::vector<GLuint>& elements,
+        Clusters& clusters);
+
+// Draw ranges of the clusters visible with the given model-view-projection
+// matrix from cameraPosition (in model coordinates), ready for
+// glMultiDrawElements. Adjacent visible clusters are merged into one range.
+struct DrawRanges {
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid*> offsets;
+    size_t triangleQty;
+};
+
+void findVisibleClusters(
+        const Clusters& clusters,
+        const glm::mat4& mvp,
+        const glm::vec3& cameraPosition,
+        bool cullBackfaces,
+        DrawRanges& ranges);
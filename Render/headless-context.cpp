@@ -0,0 +1,223 @@
+#include "headless-context.h"
+
+#include <iostream>
+
+#ifdef HAVE_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <mutex>
+
+namespace
+{
+
+// Prefers the first GPU device, which works without an X server on
+// drivers that don't handle EGL_DEFAULT_DISPLAY headlessly.
+EGLDisplay openDeviceDisplay()
+{
+    PFNEGLQUERYDEVICESEXTPROC queryDevices =
+        (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress(
+                "eglGetPlatformDisplayEXT");
+
+    if (!queryDevices || !getPlatformDisplay)
+        return EGL_NO_DISPLAY;
+
+    EGLDeviceEXT device;
+    EGLint deviceQty = 0;
+    if (!queryDevices(1, &device, &deviceQty) || deviceQty < 1)
+        return EGL_NO_DISPLAY;
+
+    return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, 0);
+}
+
+EGLDisplay initDisplay()
+{
+    EGLDisplay display = openDeviceDisplay();
+    if (EGL_NO_DISPLAY == display)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (EGL_NO_DISPLAY == display || !eglInitialize(display, &major, &minor)) {
+        std::cerr << "Can't initialize EGL display\n";
+        return EGL_NO_DISPLAY;
+    }
+
+    std::cerr << "EGL " << major << '.' << minor << " display initialized\n";
+    return display;
+}
+
+EGLDisplay getDisplay()
+{
+    static std::once_flag initFlag;
+    static EGLDisplay display = EGL_NO_DISPLAY;
+    std::call_once(initFlag, [] { display = initDisplay(); });
+    return display;
+}
+
+bool chooseConfig(EGLDisplay display, EGLint samples, EGLConfig& config)
+{
+    const EGLint attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_SAMPLE_BUFFERS, samples > 0 ? 1 : 0,
+        EGL_SAMPLES, samples,
+        EGL_NONE
+    };
+
+    EGLint configQty = 0;
+    return eglChooseConfig(display, attributes, &config, 1, &configQty)
+           && configQty > 0;
+}
+
+} // anonymous namespace
+
+class HeadlessContextImpl {
+public:
+    HeadlessContextImpl()
+        : m_display(EGL_NO_DISPLAY)
+        , m_surface(EGL_NO_SURFACE)
+        , m_context(EGL_NO_CONTEXT)
+        , m_isShared(false)
+    {}
+
+    ~HeadlessContextImpl()
+    {
+        if (EGL_NO_DISPLAY == m_display)
+            return;
+        if (EGL_NO_CONTEXT != m_context)
+            eglDestroyContext(m_display, m_context);
+        if (EGL_NO_SURFACE != m_surface)
+            eglDestroySurface(m_display, m_surface);
+    }
+
+    bool create(int width, int height, const HeadlessContextImpl* shareWith)
+    {
+        m_display = getDisplay();
+        if (EGL_NO_DISPLAY == m_display)
+            return false;
+
+        // The bound API is per thread.
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cerr << "EGL doesn't support desktop OpenGL\n";
+            return false;
+        }
+
+        // Same multisampling as the GLUT window when the driver has it.
+        EGLConfig config;
+        if (!chooseConfig(m_display, 4, config)
+            && !chooseConfig(m_display, 0, config))
+        {
+            std::cerr << "No suitable EGL config\n";
+            return false;
+        }
+
+        const EGLint surfaceAttributes[] = {
+            EGL_WIDTH, width,
+            EGL_HEIGHT, height,
+            EGL_NONE
+        };
+        m_surface = eglCreatePbufferSurface(m_display, config,
+                                            surfaceAttributes);
+        if (EGL_NO_SURFACE == m_surface) {
+            std::cerr << "Can't create EGL pbuffer surface\n";
+            return false;
+        }
+
+        if (shareWith) {
+            m_context = eglCreateContext(m_display, config,
+                                         shareWith->m_context, 0);
+            m_isShared = EGL_NO_CONTEXT != m_context;
+            if (!m_isShared) {
+                std::cerr << "Can't share EGL context, "
+                             "textures will be loaded separately\n";
+            }
+        }
+
+        if (EGL_NO_CONTEXT == m_context)
+            m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, 0);
+
+        if (EGL_NO_CONTEXT == m_context) {
+            std::cerr << "Can't create EGL context\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool makeCurrent()
+    {
+        return eglMakeCurrent(m_display, m_surface, m_surface, m_context);
+    }
+
+    void release()
+    {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+    }
+
+    bool isShared() const
+    {
+        return m_isShared;
+    }
+
+private:
+    EGLDisplay m_display;
+    EGLSurface m_surface;
+    EGLContext m_context;
+    bool m_isShared;
+};
+
+#else // HAVE_EGL
+
+class HeadlessContextImpl {
+public:
+    bool create(int, int, const HeadlessContextImpl*)
+    {
+        std::cerr << "Headless rendering needs a build with EGL\n";
+        return false;
+    }
+
+    bool makeCurrent() { return false; }
+    void release() {}
+    bool isShared() const { return false; }
+};
+
+#endif // HAVE_EGL
+
+HeadlessContext::HeadlessContext()
+    : m_impl(new HeadlessContextImpl)
+{}
+
+HeadlessContext::~HeadlessContext()
+{}
+
+bool HeadlessContext::create(
+        int width,
+        int height,
+        const HeadlessContext* shareWith)
+{
+    return m_impl->create(width, height,
+                          shareWith ? shareWith->m_impl.get() : 0);
+}
+
+bool HeadlessContext::makeCurrent()
+{
+    return m_impl->makeCurrent();
+}
+
+void HeadlessContext::release()
+{
+    m_impl->release();
+}
+
+bool HeadlessContext::isShared() const
+{
+    return m_impl->isShared();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+
+class HeadlessContextImpl;
+
+// OpenGL context with an offscreen surface, created through EGL without a
+// window system. Each rendering thread owns one; contexts created with a
+// shareWith context see its textures and buffers.
+class HeadlessContext {
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+
+    // Tries to share objects with shareWith first and falls back to an
+    // unshared context if the driver refuses. Check isShared() afterwards.
+    bool create(int width, int height, const HeadlessContext* shareWith);
+
+    bool makeCurrent();
+    void release();
+
+    bool isShared() const;
+
+private:
+    boost::scoped_ptr<HeadlessContextImpl> m_impl;
+};
@@ -5,32 +5,46 @@
 
 using namespace std;
 
-bool saveRGBtoJPEG(
+bool encodeRGBtoJPEG(
         unsigned char *data,
         int width,
         int height,
-        const char* const fileName,
+        std::vector<unsigned char>& jpegBuffer,
         int quality)
 {
     tjhandle tj = tjInitCompress();
     unsigned long jpegSize = 0;
-    unsigned char* jpegBuffer = 0;
+    unsigned char* tjBuffer = 0;
     int result = tjCompress2(
             tj, data, width, 3*width, height, TJPF_RGB,
-            &jpegBuffer, &jpegSize, TJSAMP_444, quality,
+            &tjBuffer, &jpegSize, TJSAMP_444, quality,
             TJFLAG_BOTTOMUP);
-    bool writeResult = false;
     if (0 == result) {
-        ofstream f(fileName, ios::out | ios::binary);
-        f.write((const char*)jpegBuffer, jpegSize);
-        writeResult = f;
-        f.close();
+        jpegBuffer.assign(tjBuffer, tjBuffer + jpegSize);
     }
 
-    tjFree(jpegBuffer);
+    tjFree(tjBuffer);
     tjDestroy(tj);
 
-    return 0 == result && writeResult;
+    return 0 == result;
+}
+
+bool saveRGBtoJPEG(
+        unsigned char *data,
+        int width,
+        int height,
+        const char* const fileName,
+        int quality)
+{
+    vector<unsigned char> jpegBuffer;
+    if (!encodeRGBtoJPEG(data, width, height, jpegBuffer, quality))
+        return false;
+
+    ofstream f(fileName, ios::out | ios::binary);
+    f.write((const char*)jpegBuffer.data(), jpegBuffer.size());
+    f.close();
+
+    return !f.fail();
 }
 
 bool readJPEGtoRGB(
@@ -2,6 +2,13 @@
 
 #include <vector>
 
+bool encodeRGBtoJPEG(
+        unsigned char *data,
+        int width,
+        int height,
+        std::vector<unsigned char>& jpegBuffer,
+        int quality = 100);
+
 bool saveRGBtoJPEG(
         unsigned char *data,
         int width,
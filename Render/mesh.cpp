@@ -1,5 +1,10 @@
 #include "mesh.h"
+#include "clusters.h"
+#include "compressed-mesh.h"
 #include "gl-utils.h"
+#include "mapped-file.h"
+#include "mesh-cache.h"
+#include "progressive-mesh.h"
 #include <pcl/io/ply_io.h>
 #include <pcl/PolygonMesh.h>
 #include <limits>
@@ -24,9 +29,12 @@ struct Box {
 
 class MeshImpl {
 public:
+    MeshImpl();
     ~MeshImpl();
 
     bool loadPLY(const char* filename);
+    bool loadCompressed(const char* filename, int threadQty);
+    bool loadProgressive(const char* filename, size_t maxTriangleQty);
     bool loadCube();
     void render();
     void setMVP(
@@ -35,6 +43,12 @@ public:
             const ProjectionParameters& projectionParameters,
             float rotateYAngle);
 
+    void setClusterCulling(bool isEnabled);
+    void setBackfaceCulling(bool isEnabled);
+    void setMeshCache(bool isEnabled);
+    RenderStatistics getStatistics() const;
+    void resetStatistics();
+
 private:
     void initCubeVertices();
     void initCubeColors();
@@ -44,16 +58,24 @@ private:
     void initVerticesAndColorsFromPCLMesh(const pcl::PolygonMesh& PCLmesh);
     void initElementsFromPCLMesh(const pcl::PolygonMesh& PCLmesh);
 
-    void initBuffers();
+    void initFromTriangleMesh(TriangleMesh& mesh);
+    MeshView getView() const;
+
+    void initBuffers(const MeshView& mesh);
     void initShaders();
 
-    void init();
+    // Uploads the mesh and fills elements with its triangles in cluster
+    // order. The arrays are read in place, so a mesh cache is used right
+    // from its mapping.
+    void init(const MeshView& mesh);
+    void drawElements();
 
-    glm::vec3 findMeshCenter();
-    void findBoundingBox(Box& box);
+    glm::vec3 findMeshCenter(const MeshView& mesh);
+    void findBoundingBox(const MeshView& mesh, Box& box);
 
+    // Unless the mesh comes from a cache.
     std::vector<GLfloat> vertices;
-    std::vector<GLfloat> colors;
+    std::vector<GLubyte> colors;
     std::vector<GLuint> elements;
 
     GLuint m_vboVertices;
@@ -65,6 +87,15 @@ private:
     GLuint m_program;
 
     glm::vec3 m_meshCenter;
+
+    Clusters m_clusters;
+    DrawRanges m_drawRanges;
+    bool m_isClusterCulling;
+    bool m_isBackfaceCulling;
+    bool m_isUsingMeshCache;
+    glm::mat4 m_mvp;
+    glm::vec3 m_cameraPosition;
+    RenderStatistics m_statistics;
 };
 
 MeshNew::MeshNew()
@@ -79,6 +110,16 @@ bool MeshNew::loadPLY(const char* filename)
     return m_impl->loadPLY(filename);
 }
 
+bool MeshNew::loadCompressed(const char* filename, int threadQty)
+{
+    return m_impl->loadCompressed(filename, threadQty);
+}
+
+bool MeshNew::loadProgressive(const char* filename, size_t maxTriangleQty)
+{
+    return m_impl->loadProgressive(filename, maxTriangleQty);
+}
+
 bool MeshNew::loadCube()
 {
     return m_impl->loadCube();
@@ -98,6 +139,31 @@ void MeshNew::setMVP(
     m_impl->setMVP(angle, viewParameters, projectionParameters, rotateYAngle);
 }
 
+void MeshNew::setClusterCulling(bool isEnabled)
+{
+    m_impl->setClusterCulling(isEnabled);
+}
+
+void MeshNew::setBackfaceCulling(bool isEnabled)
+{
+    m_impl->setBackfaceCulling(isEnabled);
+}
+
+void MeshNew::setMeshCache(bool isEnabled)
+{
+    m_impl->setMeshCache(isEnabled);
+}
+
+RenderStatistics MeshNew::getStatistics() const
+{
+    return m_impl->getStatistics();
+}
+
+void MeshNew::resetStatistics()
+{
+    m_impl->resetStatistics();
+}
+
 namespace
 {
 
@@ -120,6 +186,20 @@ size_t sizeInBytes(const std::vector<T>& vec)
 
 } // anonymous namespace
 
+// The GL names are 0 until init, which the destructor ignores.
+MeshImpl::MeshImpl()
+    : m_vboVertices(0)
+    , m_vboColors(0)
+    , m_iboElements(0)
+    , m_program(0)
+    , m_isClusterCulling(true)
+    , m_isBackfaceCulling(false)
+    , m_isUsingMeshCache(true)
+    , m_mvp(1.0f)
+{
+    resetStatistics();
+}
+
 MeshImpl::~MeshImpl()
 {
     glDeleteProgram(m_program);
@@ -128,11 +208,13 @@ MeshImpl::~MeshImpl()
     glDeleteBuffers(1, &m_iboElements);
 }
 
-void MeshImpl::init()
+void MeshImpl::init(const MeshView& mesh)
 {
-    initBuffers();
+    buildClusters(mesh.positions, mesh.vertexQty, mesh.indices, mesh.cornerQty,
+                  elements, m_clusters);
+    initBuffers(mesh);
     initShaders();
-    m_meshCenter = findMeshCenter();
+    m_meshCenter = findMeshCenter(mesh);
 }
 
 bool MeshImpl::loadCube()
@@ -141,7 +223,7 @@ bool MeshImpl::loadCube()
     initCubeColors();
     initCubeElements();
 
-    init();
+    init(getView());
 
     return true;
 }
@@ -149,19 +231,79 @@ bool MeshImpl::loadCube()
 bool MeshImpl::loadPLY(const char* filename)
 {
     std::cerr << "Loading model " << filename << '\n';
+    MeshCache cache;
+    if (m_isUsingMeshCache && cache.open(filename)) {
+        if (cache.getMesh().faceOffsets) {
+            std::cerr << "Only triangle meshes can be rendered\n";
+            return false;
+        }
+        init(cache.getMesh());
+        return true;
+    }
+
     pcl::PolygonMesh::Ptr pInputMesh(new pcl::PolygonMesh);
-    pcl::io::loadPLYFile(filename, *pInputMesh);
+    if (pcl::io::loadPLYFile(filename, *pInputMesh) < 0)
+        return false;
+    for (size_t i = 0; i < pInputMesh->polygons.size(); ++i) {
+        if (pInputMesh->polygons[i].vertices.size() != 3) {
+            std::cerr << "Only triangle meshes can be rendered\n";
+            return false;
+        }
+    }
     initFromPCLMesh(*pInputMesh);
+    if (m_isUsingMeshCache) {
+        cache.write(getView());
+    }
+
+    init(getView());
+
+    return true;
+}
 
-    init();
+bool MeshImpl::loadCompressed(const char* filename, int threadQty)
+{
+    std::cerr << "Loading model " << filename << '\n';
+    TriangleMesh mesh;
+    try {
+        readCompressedMesh(filename, mesh, threadQty);
+    } catch (const CompressedMeshError& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    } catch (const MappedFileError& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+
+    initFromTriangleMesh(mesh);
+    init(getView());
 
     return true;
 }
 
-glm::vec3 MeshImpl::findMeshCenter()
+bool MeshImpl::loadProgressive(const char* filename, size_t maxTriangleQty)
+{
+    std::cerr << "Loading model " << filename << '\n';
+    TriangleMesh mesh;
+    try {
+        readProgressiveMesh(filename, maxTriangleQty, mesh);
+    } catch (const ProgressiveMeshError& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    } catch (const MappedFileError& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+
+    initFromTriangleMesh(mesh);
+    init(getView());
+
+    return true;
+}
+
+glm::vec3 MeshImpl::findMeshCenter(const MeshView& mesh)
 {
     Box box;
-    findBoundingBox(box);
+    findBoundingBox(mesh, box);
 
     return glm::vec3(
             average(box.xmin, box.xmax),
@@ -169,17 +311,17 @@ glm::vec3 MeshImpl::findMeshCenter()
             average(box.zmin, box.zmax));
 }
 
-void MeshImpl::findBoundingBox(Box& box)
+void MeshImpl::findBoundingBox(const MeshView& mesh, Box& box)
 {
     box.xmin = box.ymin = box.zmin = std::numeric_limits<float>::max();
-    box.xmax = box.ymax = box.zmax = std::numeric_limits<float>::min();
+    box.xmax = box.ymax = box.zmax = -std::numeric_limits<float>::max();
 
-    int size = vertices.size();
-    int i = 0;
+    const size_t size = 3 * mesh.vertexQty;
+    size_t i = 0;
     while (i < size) {
-        float x = vertices[i++];
-        float y = vertices[i++];
-        float z = vertices[i++];
+        float x = mesh.positions[i++];
+        float y = mesh.positions[i++];
+        float z = mesh.positions[i++];
 
         updateMinMax(box.xmin, box.xmax, x);
         updateMinMax(box.ymin, box.ymax, y);
@@ -206,17 +348,17 @@ void MeshImpl::initCubeVertices()
 
 void MeshImpl::initCubeColors()
 {
-    GLfloat cubeColors[] = {
+    GLubyte cubeColors[] = {
       // front colors
-      1.0, 0.0, 0.0,
-      0.0, 1.0, 0.0,
-      0.0, 0.0, 1.0,
-      1.0, 1.0, 1.0,
+      255, 0, 0,
+      0, 255, 0,
+      0, 0, 255,
+      255, 255, 255,
       // back colors
-      1.0, 0.0, 0.0,
-      0.0, 1.0, 0.0,
-      0.0, 0.0, 1.0,
-      1.0, 1.0, 1.0,
+      255, 0, 0,
+      0, 255, 0,
+      0, 0, 255,
+      255, 255, 255,
     };
     colors.assign(cubeColors, ARRAY_END(cubeColors));
 }
@@ -265,9 +407,9 @@ void MeshImpl::initVerticesAndColorsFromPCLMesh(const pcl::PolygonMesh& PCLmesh)
         vertices[indexVertex++] = point.x;
         vertices[indexVertex++] = point.y;
         vertices[indexVertex++] = point.z;
-        colors[indexColor++] = float(point.r) / 255;
-        colors[indexColor++] = float(point.g) / 255;
-        colors[indexColor++] = float(point.b) / 255;
+        colors[indexColor++] = point.r;
+        colors[indexColor++] = point.g;
+        colors[indexColor++] = point.b;
     }
 }
 
@@ -292,6 +434,27 @@ void MeshImpl::initFromPCLMesh(const pcl::PolygonMesh& PCLmesh)
     initElementsFromPCLMesh(PCLmesh);
 }
 
+// Takes the arrays of the mesh.
+void MeshImpl::initFromTriangleMesh(TriangleMesh& mesh)
+{
+    vertices.swap(mesh.positions);
+    colors.swap(mesh.colors);
+    elements.swap(mesh.indices);
+}
+
+// The arrays of the mesh when it doesn't come from a cache.
+MeshView MeshImpl::getView() const
+{
+    MeshView mesh;
+    mesh.vertexQty = vertices.size() / 3;
+    mesh.positions = vertices.empty() ? 0 : &vertices[0];
+    mesh.colors = colors.empty() ? 0 : &colors[0];
+    mesh.faceQty = elements.size() / 3;
+    mesh.cornerQty = elements.size();
+    mesh.indices = elements.empty() ? 0 : &elements[0];
+    return mesh;
+}
+
 void MeshImpl::render()
 {
     glUseProgram(m_program);
@@ -311,20 +474,66 @@ void MeshImpl::render()
     glVertexAttribPointer(
       m_attributeColor, // attribute
       3,                 // number of elements per vertex, here (R,G,B)
-      GL_FLOAT,          // the type of each element
-      GL_FALSE,          // take our values as-is
+      GL_UNSIGNED_BYTE,  // the type of each element
+      GL_TRUE,           // map 0..255 to 0..1
       0,                 // no extra data between each position
       0                  // offset of first element
     );
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_iboElements);
-    int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-    glDrawElements(GL_TRIANGLES, size/sizeof(GLuint), GL_UNSIGNED_INT, 0);
+    drawElements();
 
     glDisableVertexAttribArray(m_attributeCoord);
     glDisableVertexAttribArray(m_attributeColor);
 }
 
+void MeshImpl::drawElements()
+{
+    const size_t triangleQty = elements.size() / 3;
+    m_statistics.totalTriangles += triangleQty;
+
+    if (!m_isClusterCulling) {
+        glDrawElements(GL_TRIANGLES, elements.size(), GL_UNSIGNED_INT, 0);
+        m_statistics.drawnTriangles += triangleQty;
+        return;
+    }
+
+    findVisibleClusters(m_clusters, m_mvp, m_cameraPosition,
+                        m_isBackfaceCulling, m_drawRanges);
+    if (!m_drawRanges.counts.empty()) {
+        glMultiDrawElements(GL_TRIANGLES, m_drawRanges.counts.data(),
+                            GL_UNSIGNED_INT, m_drawRanges.offsets.data(),
+                            m_drawRanges.counts.size());
+    }
+    m_statistics.drawnTriangles += m_drawRanges.triangleQty;
+}
+
+void MeshImpl::setClusterCulling(bool isEnabled)
+{
+    m_isClusterCulling = isEnabled;
+}
+
+void MeshImpl::setBackfaceCulling(bool isEnabled)
+{
+    m_isBackfaceCulling = isEnabled;
+}
+
+void MeshImpl::setMeshCache(bool isEnabled)
+{
+    m_isUsingMeshCache = isEnabled;
+}
+
+RenderStatistics MeshImpl::getStatistics() const
+{
+    return m_statistics;
+}
+
+void MeshImpl::resetStatistics()
+{
+    m_statistics.drawnTriangles = 0;
+    m_statistics.totalTriangles = 0;
+}
+
 void MeshImpl::setMVP(
         float angle,
         const ViewParameters& viewParameters,
@@ -349,21 +558,31 @@ void MeshImpl::setMVP(
 
     glm::mat4 mvp = vp * model;
 
+    m_mvp = mvp;
+    m_cameraPosition = glm::vec3(
+            glm::inverse(model) * glm::vec4(viewParameters.eye, 1.0f));
+
     glUseProgram(m_program);
     glUniformMatrix4fv(m_uniformMvp, 1, GL_FALSE, glm::value_ptr(mvp));
 }
 
-void MeshImpl::initBuffers()
+// Meshes without colors are black.
+void MeshImpl::initBuffers(const MeshView& mesh)
 {
+    const size_t coordQty = 3 * mesh.vertexQty;
+
     glGenBuffers(1, &m_vboVertices);
     glBindBuffer(GL_ARRAY_BUFFER, m_vboVertices);
-    glBufferData(GL_ARRAY_BUFFER, sizeInBytes(vertices),
-                 vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, coordQty * sizeof(GLfloat),
+                 mesh.positions, GL_STATIC_DRAW);
 
+    std::vector<GLubyte> black;
+    if (!mesh.colors)
+        black.assign(coordQty, 0);
     glGenBuffers(1, &m_vboColors);
     glBindBuffer(GL_ARRAY_BUFFER, m_vboColors);
-    glBufferData(GL_ARRAY_BUFFER, sizeInBytes(colors),
-                colors.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, coordQty,
+                 mesh.colors ? mesh.colors : black.data(), GL_STATIC_DRAW);
 
     glGenBuffers(1, &m_iboElements);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_iboElements);
@@ -1,14 +1,27 @@
 #include "transform.h"
 #include <boost/scoped_ptr.hpp>
+#include <cstddef>
 
 class MeshImpl;
 
+struct RenderStatistics {
+    size_t drawnTriangles;
+    size_t totalTriangles;
+};
+
 class MeshNew {
 public:
     MeshNew();
     ~MeshNew();
 
     bool loadPLY(const char* filename);
+    // Decodes a .cmesh file written by obfuscate --compress on threadQty
+    // threads.
+    bool loadCompressed(const char* filename, int threadQty);
+    // Loads a .pmesh file written by decimate-mesh --progressive with at
+    // most maxTriangleQty triangles, or its base mesh if that has more;
+    // 0 loads the full mesh.
+    bool loadProgressive(const char* filename, size_t maxTriangleQty);
     bool loadCube();
     void render();
     void setMVP(
@@ -17,6 +30,23 @@ public:
             const ProjectionParameters& projectionParameters,
             float rotateYAngle);
 
+    // Skips triangle clusters outside the view frustum. Enabled by default.
+    void setClusterCulling(bool isEnabled);
+
+    // Also skips clusters facing away from the camera, which is only right
+    // for closed, consistently oriented meshes: the front is told by the
+    // sign of the volume, and the back of an open scan may be visible.
+    // Disabled by default.
+    void setBackfaceCulling(bool isEnabled);
+
+    // Loads PLY files from their .mcache files and writes them when
+    // missing. Enabled by default.
+    void setMeshCache(bool isEnabled);
+
+    // Triangles submitted by render() since the last reset.
+    RenderStatistics getStatistics() const;
+    void resetStatistics();
+
 private:
     boost::scoped_ptr<MeshImpl> m_impl;
 };
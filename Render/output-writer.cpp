@@ -0,0 +1,410 @@
+#include "output-writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+// The renderer blocks when this much encoded data waits for the disk.
+const size_t MAX_QUEUED_BYTES = 256 * 1024 * 1024;
+
+// Quantity of files submitted to io_uring at once.
+const size_t URING_BATCH_SIZE = 64;
+
+// How long a broken ring is waited for the writes the kernel already has.
+const std::chrono::seconds DRAIN_TIMEOUT(5);
+
+struct WriteJob {
+    std::string filename;
+    std::vector<unsigned char> data;
+};
+
+typedef std::vector<WriteJob> WriteJobs;
+
+bool writeFileStream(const WriteJob& job)
+{
+    std::ofstream f(job.filename.c_str(), std::ios::out | std::ios::binary);
+    f.write((const char*)job.data.data(), job.data.size());
+    f.close();
+    return !f.fail();
+}
+
+#ifdef HAVE_LIBURING
+
+class Ring {
+public:
+    Ring() : m_isInitialized(false), m_isBroken(false) {}
+    ~Ring()
+    {
+        if (m_isInitialized)
+            io_uring_queue_exit(&m_ring);
+    }
+
+    bool init()
+    {
+        const int result = io_uring_queue_init(URING_BATCH_SIZE, &m_ring, 0);
+        if (result < 0) {
+            std::cerr << "Can't initialize io_uring: " << strerror(-result)
+                      << ", falling back to writer threads\n";
+            return false;
+        }
+        m_isInitialized = true;
+        return true;
+    }
+
+    // After a failed wait the ring isn't used any more.
+    bool isBroken() const { return m_isBroken; }
+
+    // Returns the number of failed files. The files left unfinished by a
+    // failed wait are written again with streams.
+    size_t writeBatch(WriteJobs& jobs);
+
+private:
+    void queueWrite(const WriteJob& job, int fd, size_t offset, size_t index);
+    bool drain(std::vector<size_t>& written, std::vector<bool>& isInFlight);
+
+    io_uring m_ring;
+    bool m_isInitialized;
+    bool m_isBroken;
+    // Buffers of writes that the kernel may still read after a drain
+    // timed out, kept as long as the ring.
+    std::vector<std::vector<unsigned char> > m_strandedBuffers;
+};
+
+void Ring::queueWrite(const WriteJob& job, int fd, size_t offset, size_t index)
+{
+    io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    io_uring_prep_write(sqe, fd, job.data.data() + offset,
+                        job.data.size() - offset, offset);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(index));
+}
+
+// Takes the completions of the writes the kernel already has, waiting at
+// most DRAIN_TIMEOUT for them. Writes never submitted stay in the queue of
+// the broken ring. Returns false when some writes are still in flight.
+bool Ring::drain(std::vector<size_t>& written, std::vector<bool>& isInFlight)
+{
+    const size_t queued = std::count(isInFlight.begin(), isInFlight.end(), true);
+    size_t inFlight = queued - std::min<size_t>(queued, io_uring_sq_ready(&m_ring));
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+    while (inFlight > 0) {
+        io_uring_cqe* cqe = 0;
+        if (io_uring_peek_cqe(&m_ring, &cqe) < 0 || !cqe) {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        const size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+        if (cqe->res > 0)
+            written[i] += cqe->res;
+        isInFlight[i] = false;
+        io_uring_cqe_seen(&m_ring, cqe);
+        --inFlight;
+    }
+    return true;
+}
+
+size_t Ring::writeBatch(WriteJobs& jobs)
+{
+    std::vector<int> fds(jobs.size(), -1);
+    std::vector<size_t> written(jobs.size(), 0);
+    std::vector<bool> isInFlight(jobs.size(), false);
+    std::vector<bool> isFailed(jobs.size(), false);
+    size_t failures = 0;
+    size_t pending = 0;
+    bool isDrained = true;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        fds[i] = open(jobs[i].filename.c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fds[i] < 0) {
+            std::cerr << "Can't open file " << jobs[i].filename << ": "
+                      << strerror(errno) << '\n';
+            isFailed[i] = true;
+            ++failures;
+        } else if (!jobs[i].data.empty()) {
+            queueWrite(jobs[i], fds[i], 0, i);
+            isInFlight[i] = true;
+            ++pending;
+        }
+    }
+
+    while (pending > 0) {
+        io_uring_submit(&m_ring);
+
+        io_uring_cqe* cqe = 0;
+        const int result = io_uring_wait_cqe(&m_ring, &cqe);
+        if (result < 0) {
+            if (-result == EINTR)
+                continue;
+            std::cerr << "io_uring wait failed: " << strerror(-result)
+                      << ", writing without it\n";
+            m_isBroken = true;
+            isDrained = drain(written, isInFlight);
+            break;
+        }
+
+        const size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+        const int res = cqe->res;
+        io_uring_cqe_seen(&m_ring, cqe);
+        isInFlight[i] = false;
+        --pending;
+
+        if (res <= 0) {
+            std::cerr << "Can't write file " << jobs[i].filename << ": "
+                      << strerror(res < 0 ? -res : EIO) << '\n';
+            isFailed[i] = true;
+            ++failures;
+            continue;
+        }
+
+        written[i] += res;
+        if (written[i] < jobs[i].data.size()) {
+            queueWrite(jobs[i], fds[i], written[i], i);
+            isInFlight[i] = true;
+            ++pending;
+        }
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i] >= 0 && close(fds[i]) != 0) {
+            std::cerr << "Can't close file " << jobs[i].filename << '\n';
+            isFailed[i] = true;
+            ++failures;
+        }
+    }
+
+    if (!isDrained) {
+        std::cerr << "io_uring writes still in flight after "
+                  << DRAIN_TIMEOUT.count() << " s\n";
+    }
+    for (size_t i = 0; m_isBroken && i < jobs.size(); ++i) {
+        if (isFailed[i] || written[i] == jobs[i].data.size())
+            continue;
+        // Late writes of the ring put the same bytes at the same offsets.
+        if (!writeFileStream(jobs[i])) {
+            std::cerr << "Can't write file " << jobs[i].filename << '\n';
+            ++failures;
+        }
+        if (isInFlight[i]) {
+            m_strandedBuffers.push_back(std::vector<unsigned char>());
+            m_strandedBuffers.back().swap(jobs[i].data);
+        }
+    }
+
+    return failures;
+}
+
+#endif // HAVE_LIBURING
+
+} // anonymous namespace
+
+class OutputWriterImpl {
+public:
+    explicit OutputWriterImpl(int threadQty);
+    ~OutputWriterImpl();
+
+    void write(const std::string& filename, std::vector<unsigned char>& data);
+    size_t flush();
+
+private:
+    void workerLoop();
+    bool takeJobs(WriteJobs& jobs);
+    void finishJobs(size_t jobQty, size_t bytes, size_t failures);
+
+    size_t m_batchSize;
+#ifdef HAVE_LIBURING
+    // Null when io_uring isn't available.
+    boost::scoped_ptr<Ring> m_ring;
+#endif
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queueChanged;
+    std::deque<WriteJob> m_queue;
+    size_t m_queuedBytes;
+    size_t m_jobsInProgress;
+    size_t m_failures;
+    bool m_isStopping;
+};
+
+OutputWriterImpl::OutputWriterImpl(int threadQty)
+    : m_batchSize(1)
+    , m_queuedBytes(0)
+    , m_jobsInProgress(0)
+    , m_failures(0)
+    , m_isStopping(false)
+{
+#ifdef HAVE_LIBURING
+    // A single submitting thread keeps the whole batch in flight. Without
+    // a working ring the writer threads are used.
+    m_ring.reset(new Ring);
+    if (m_ring->init()) {
+        m_batchSize = URING_BATCH_SIZE;
+        threadQty = 1;
+    } else {
+        m_ring.reset();
+    }
+#endif
+
+    if (threadQty < 1)
+        threadQty = 1;
+
+    for (int i = 0; i < threadQty; ++i) {
+        m_threads.push_back(std::thread(&OutputWriterImpl::workerLoop, this));
+    }
+}
+
+OutputWriterImpl::~OutputWriterImpl()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isStopping = true;
+        m_queueChanged.notify_all();
+    }
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_threads[i].join();
+    }
+}
+
+void OutputWriterImpl::write(
+        const std::string& filename,
+        std::vector<unsigned char>& data)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queueChanged.wait(lock, [this] {
+        return m_queuedBytes < MAX_QUEUED_BYTES;
+    });
+
+    m_queue.push_back(WriteJob());
+    WriteJob& job = m_queue.back();
+    job.filename = filename;
+    job.data.swap(data);
+    m_queuedBytes += job.data.size();
+
+    m_queueChanged.notify_all();
+}
+
+size_t OutputWriterImpl::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queueChanged.wait(lock, [this] {
+        return m_queue.empty() && m_jobsInProgress == 0;
+    });
+
+    size_t failures = 0;
+    std::swap(failures, m_failures);
+    return failures;
+}
+
+bool OutputWriterImpl::takeJobs(WriteJobs& jobs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queueChanged.wait(lock, [this] {
+        return m_isStopping || !m_queue.empty();
+    });
+
+    if (m_queue.empty())
+        return false;
+
+    while (!m_queue.empty() && jobs.size() < m_batchSize) {
+        jobs.push_back(WriteJob());
+        jobs.back().filename.swap(m_queue.front().filename);
+        jobs.back().data.swap(m_queue.front().data);
+        m_queue.pop_front();
+    }
+    m_jobsInProgress += jobs.size();
+
+    return true;
+}
+
+void OutputWriterImpl::finishJobs(size_t jobQty, size_t bytes, size_t failures)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queuedBytes -= bytes;
+    m_jobsInProgress -= jobQty;
+    m_failures += failures;
+    m_queueChanged.notify_all();
+}
+
+void OutputWriterImpl::workerLoop()
+{
+    WriteJobs jobs;
+    while (takeJobs(jobs)) {
+        size_t failures = 0;
+        // The ring may keep the buffers of a batch it failed on.
+        size_t bytes = 0;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            bytes += jobs[i].data.size();
+        }
+
+#ifdef HAVE_LIBURING
+        if (m_ring && !m_ring->isBroken()) {
+            failures = m_ring->writeBatch(jobs);
+        } else
+#endif
+        {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                if (!writeFileStream(jobs[i])) {
+                    std::cerr << "Can't write file " << jobs[i].filename << '\n';
+                    ++failures;
+                }
+            }
+        }
+
+        finishJobs(jobs.size(), bytes, failures);
+        jobs.clear();
+    }
+}
+
+OutputWriter::OutputWriter(int threadQty)
+    : m_impl(new OutputWriterImpl(threadQty))
+{}
+
+OutputWriter::~OutputWriter()
+{}
+
+bool OutputWriter::createDirectories(const std::string& path)
+{
+    boost::system::error_code error;
+    fs::create_directories(path, error);
+    if (error) {
+        std::cerr << "Can't create directory " << path << ": "
+                  << error.message() << '\n';
+        return false;
+    }
+    return true;
+}
+
+void OutputWriter::write(
+        const std::string& filename,
+        std::vector<unsigned char>& data)
+{
+    m_impl->write(filename, data);
+}
+
+size_t OutputWriter::flush()
+{
+    return m_impl->flush();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+#include <string>
+#include <vector>
+
+class OutputWriterImpl;
+
+// Writes finished output files (encoded pictures) in the background, so the
+// rendering thread never waits for the filesystem. Queued buffers are
+// written in batches through io_uring when the renderer is built with
+// liburing, otherwise by a pool of writer threads.
+class OutputWriter {
+public:
+    explicit OutputWriter(int threadQty);
+    ~OutputWriter();
+
+    // Creates a directory with its parents synchronously. Intended to be
+    // called for all output directories before rendering starts.
+    bool createDirectories(const std::string& path);
+
+    // Queues a file to be written. The contents of the buffer are taken
+    // over and the buffer is left empty. Blocks while too much data is
+    // waiting to be written.
+    void write(const std::string& filename, std::vector<unsigned char>& data);
+
+    // Waits until everything queued so far is on disk. Returns the number
+    // of files that could not be written since the previous call.
+    size_t flush();
+
+private:
+    boost::scoped_ptr<OutputWriterImpl> m_impl;
+};
@@ -1,15 +1,27 @@
+#include "compressed-mesh.h"
+#include "headless-context.h"
 #include "image.h"
+#include "mapped-file.h"
 #include "mesh.h"
+#include "output-writer.h"
+#include "ply-header.h"
+#include "progressive-mesh.h"
 #include "skybox.h"
+#include "video.h"
 
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
+#include <mutex>
+#include <thread>
 
 #include <boost/scoped_ptr.hpp>
 #include <boost/program_options.hpp>
@@ -18,9 +30,17 @@
 #define GLM_FORCE_RADIANS
 #include <glm/trigonometric.hpp>
 
-boost::scoped_ptr<ISkybox> gSkybox1;
-boost::scoped_ptr<ISkybox> gSkybox2;
-boost::scoped_ptr<ISkybox> gEmptySkybox;
+// Skyboxes belong to a GL context, so every rendering thread has its own.
+struct Skyboxes {
+    boost::scoped_ptr<ISkybox> skybox1;
+    boost::scoped_ptr<ISkybox> skybox2;
+    boost::scoped_ptr<ISkybox> emptySkybox;
+};
+
+Skyboxes gSkyboxes;
+boost::scoped_ptr<OutputWriter> gOutputWriter;
+// Inputs skipped because they couldn't be loaded.
+std::atomic<size_t> gFailedInputQty(0);
 
 ViewParameters gViewParameters;
 ProjectionParameters gProjectionParameters;
@@ -36,10 +56,20 @@ struct Options
     std::string skybox1Name;
     std::string skybox2Name;
     std::string noSkyboxName;
+    std::string videoCodec;
+    std::string ffmpegPath;
     bool isCubeModel;
+    bool isVideoOutput;
+    bool isClusterCulling;
+    bool isBackfaceCulling;
+    bool isUsingMeshCache;
     int screenWidth;
     int screenHeight;
     int pictureQty;
+    int videoFps;
+    int writerThreadQty;
+    int renderThreadQty;
+    size_t maxTriangleQty;
     float fovyDegrees;
     float initialAngleDegrees;
     float eyeX;
@@ -69,24 +99,67 @@ std::string generateFilename(int i)
     return s.str();
 }
 
-void saveImage(int i, const fs::path& outpath)
+void readFrame(std::vector<GLubyte>& image)
 {
-    static std::vector<GLubyte> image(
-            gOptions.screenWidth * gOptions.screenHeight * 3, 1);
+    image.resize(gOptions.screenWidth * gOptions.screenHeight * 3);
 
     glReadPixels(0, 0, gOptions.screenWidth, gOptions.screenHeight,
                  GL_RGB, GL_UNSIGNED_BYTE, image.data());
+}
 
-    fs::path path = outpath / generateFilename(i);
+void saveImage(int i, const fs::path& outpath, std::vector<GLubyte>& image)
+{
+    std::vector<unsigned char> jpeg;
 
-    std::cerr << "Writing a file " << path << '\n';
+    readFrame(image);
 
-    if (!saveRGBtoJPEG(
+    fs::path path = outpath / generateFilename(i);
+
+    if (!encodeRGBtoJPEG(
                 image.data(), gOptions.screenWidth,
-                gOptions.screenHeight, path.string().c_str()))
+                gOptions.screenHeight, jpeg))
     {
-        std::cerr << "Can't write file " << path << '\n';
+        std::cerr << "Can't encode file " << path << '\n';
+        return;
     }
+
+    std::cerr << "Writing a file " << path << '\n';
+    gOutputWriter->write(path.string(), jpeg);
+}
+
+bool isHeadless()
+{
+    return gOptions.renderThreadQty > 0;
+}
+
+void swapBuffers()
+{
+    if (!isHeadless())
+        glutSwapBuffers();
+}
+
+typedef std::chrono::steady_clock Clock;
+
+void reportTiming(
+        MeshNew& mesh,
+        const fs::path& output,
+        int pictureQty,
+        Clock::time_point startTime)
+{
+    const double seconds = std::chrono::duration<double>(
+            Clock::now() - startTime).count();
+    const RenderStatistics statistics = mesh.getStatistics();
+    const double culledPercent = statistics.totalTriangles == 0 ? 0.0
+        : 100.0 * (statistics.totalTriangles - statistics.drawnTriangles)
+          / statistics.totalTriangles;
+
+    std::ostringstream culled;
+    culled << std::fixed << std::setprecision(1) << culledPercent;
+
+    std::cerr << "Rendered " << pictureQty << " pictures to " << output
+              << " in " << seconds << " s ("
+              << 1000.0 * seconds / pictureQty << " ms per picture), "
+              << "culled " << culled.str() << "% of triangles\n";
 }
 
 void draw(MeshNew& mesh, ISkybox& skybox)
@@ -103,54 +176,339 @@ void render(
         int pictureQty,
         const fs::path& outpath)
 {
-    fs::create_directory(outpath);
+    const Clock::time_point startTime = Clock::now();
+    mesh.resetStatistics();
+
+    std::vector<GLubyte> image;
     for (int i = 0; i < pictureQty; ++i) {
         setParams(mesh, i, pictureQty, skybox);
         draw(mesh, skybox);
-        saveImage(i, outpath);
-        glutSwapBuffers();
+        saveImage(i, outpath, image);
+        swapBuffers();
     }
+
+    reportTiming(mesh, outpath, pictureQty, startTime);
 }
 
-void renderMesh(MeshNew& mesh, const std::string& inputFilename)
+void renderVideo(
+        MeshNew& mesh,
+        ISkybox& skybox,
+        int pictureQty,
+        const fs::path& videoPath)
 {
-    fs::path outpath(gOptions.outputDirectory);
-    std::string lastDirName = inputFilename + "-dir";
+    VideoParameters parameters;
+    parameters.width = gOptions.screenWidth;
+    parameters.height = gOptions.screenHeight;
+    parameters.fps = gOptions.videoFps;
+    parameters.codec = gOptions.videoCodec;
+    parameters.ffmpegPath = gOptions.ffmpegPath;
+
+    VideoEncoder encoder(parameters);
+    if (!encoder.open(videoPath.string()))
+        return;
 
-    render(mesh, *gSkybox1, gOptions.pictureQty,
-           outpath / gOptions.skybox1Name / lastDirName);
-    render(mesh, *gSkybox2, gOptions.pictureQty,
-           outpath / gOptions.skybox2Name / lastDirName);
-    render(mesh, *gEmptySkybox, gOptions.pictureQty,
-           outpath / gOptions.noSkyboxName / lastDirName);
+    std::cerr << "Writing a video " << videoPath << '\n';
+
+    const Clock::time_point startTime = Clock::now();
+    mesh.resetStatistics();
+
+    std::vector<GLubyte> frame;
+    for (int i = 0; i < pictureQty; ++i) {
+        setParams(mesh, i, pictureQty, skybox);
+        draw(mesh, skybox);
+        readFrame(frame);
+        encoder.addFrame(frame);
+        swapBuffers();
+    }
+
+    if (!encoder.close()) {
+        std::cerr << "Can't write video " << videoPath << '\n';
+    }
+
+    reportTiming(mesh, videoPath, pictureQty, startTime);
+}
+
+fs::path picturesDirectory(
+        const std::string& skyboxName,
+        const std::string& inputFilename)
+{
+    return fs::path(gOptions.outputDirectory) / skyboxName
+           / (inputFilename + "-dir");
 }
 
-void renderMeshesFromDirectory()
+void createOutputDirectories(const std::string& inputFilename)
+{
+    if (gOptions.isVideoOutput)
+        return;
+
+    gOutputWriter->createDirectories(
+            picturesDirectory(gOptions.skybox1Name, inputFilename).string());
+    gOutputWriter->createDirectories(
+            picturesDirectory(gOptions.skybox2Name, inputFilename).string());
+    gOutputWriter->createDirectories(
+            picturesDirectory(gOptions.noSkyboxName, inputFilename).string());
+}
+
+void renderMesh(
+        MeshNew& mesh,
+        ISkybox& skybox,
+        const std::string& skyboxName,
+        const std::string& inputFilename)
 {
+    if (gOptions.isVideoOutput) {
+        fs::path outpath = fs::path(gOptions.outputDirectory) / skyboxName;
+        renderVideo(mesh, skybox, gOptions.pictureQty,
+                    outpath / (inputFilename + ".mp4"));
+    } else {
+        render(mesh, skybox, gOptions.pictureQty,
+               picturesDirectory(skyboxName, inputFilename));
+    }
+}
+
+void renderMesh(
+        MeshNew& mesh,
+        Skyboxes& skyboxes,
+        const std::string& inputFilename)
+{
+    renderMesh(mesh, *skyboxes.skybox1, gOptions.skybox1Name, inputFilename);
+    renderMesh(mesh, *skyboxes.skybox2, gOptions.skybox2Name, inputFilename);
+    renderMesh(mesh, *skyboxes.emptySkybox, gOptions.noSkyboxName,
+               inputFilename);
+}
+
+// Rough throughput of a render box. Only used to order the batch and to
+// predict its duration.
+const double LOAD_SECONDS_PER_BYTE = 1.0 / (100 * 1024 * 1024);
+const double FRAME_SECONDS = 0.01;
+const double DRAW_SECONDS_PER_TRIANGLE = 1.0 / 500e6;
+
+struct ScheduledInput {
+    fs::path path;
+    double cost;
+
+    bool operator<(const ScheduledInput& other) const
+    {
+        if (cost != other.cost)
+            return cost > other.cost;
+        return path < other.path;
+    }
+};
+
+double estimateRenderCost(uintmax_t loadBytes, uintmax_t faceQty)
+{
+    const int frameQty = 3 * gOptions.pictureQty;
+    return LOAD_SECONDS_PER_BYTE * loadBytes
+           + frameQty * (FRAME_SECONDS + DRAW_SECONDS_PER_TRIANGLE * faceQty);
+}
+
+bool isCompressedMesh(const fs::path& path)
+{
+    return path.extension() == ".cmesh";
+}
+
+bool isProgressiveMesh(const fs::path& path)
+{
+    return path.extension() == ".pmesh";
+}
+
+// Compressed meshes are costed by the size of their decoded arrays, which
+// is about what a binary PLY file of the mesh takes. Progressive meshes
+// are read up to the triangle budget, so only that part of the file is.
+double estimateRenderCost(const fs::path& path)
+{
+    if (isCompressedMesh(path)) {
+        const CompressedMeshInfo info = readCompressedMeshInfo(path.string());
+        return estimateRenderCost(15 * info.vertexQty + 12 * info.faceQty,
+                                  info.faceQty);
+    }
+    if (isProgressiveMesh(path)) {
+        const ProgressiveMeshInfo info = readProgressiveMeshInfo(path.string());
+        uintmax_t faceQty = info.triangleQty;
+        if (gOptions.maxTriangleQty > 0) {
+            faceQty = std::min<uintmax_t>(faceQty, std::max<uintmax_t>(
+                    gOptions.maxTriangleQty, info.baseTriangleQty));
+        }
+        const uintmax_t fileSize = fs::file_size(path);
+        return estimateRenderCost(
+                info.triangleQty > 0 ? fileSize * faceQty / info.triangleQty : fileSize,
+                faceQty);
+    }
+
+    PlyHeader header;
+    readPlyHeader(path.string(), header);
+    const MappedFile file(path.string());
+    checkTriangleMesh(header, file);
+    return estimateRenderCost(file.size(), header.faceQty());
+}
+
+// Inputs are taken largest first by the next free thread.
+double predictBatchDuration(
+        const std::vector<ScheduledInput>& inputs,
+        int threadQty)
+{
+    std::vector<double> threadTimes(std::max(threadQty, 1), 0.0);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        *std::min_element(threadTimes.begin(), threadTimes.end())
+            += inputs[i].cost;
+    }
+    return *std::max_element(threadTimes.begin(), threadTimes.end());
+}
+
+// Reads only the PLY headers to reject unusable files before anything is
+// rendered, and orders the rest largest first so that a huge scan doesn't
+// start last and keep one thread busy while the others are idle.
+std::vector<fs::path> scheduleInputs(const std::vector<fs::path>& paths)
+{
+    std::vector<ScheduledInput> inputs;
+    double totalCost = 0;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        // Mesh caches of the inputs live next to them.
+        if (!fs::is_regular_file(paths[i])
+            || paths[i].extension() == ".mcache")
+        {
+            continue;
+        }
+
+        try {
+            ScheduledInput input;
+            input.path = paths[i];
+            input.cost = estimateRenderCost(paths[i]);
+            inputs.push_back(input);
+            totalCost += input.cost;
+        } catch (const PlyError& e) {
+            std::cerr << "Skipping " << paths[i] << ": " << e.what() << '\n';
+        } catch (const CompressedMeshError& e) {
+            std::cerr << "Skipping " << paths[i] << ": " << e.what() << '\n';
+        } catch (const ProgressiveMeshError& e) {
+            std::cerr << "Skipping " << paths[i] << ": " << e.what() << '\n';
+        } catch (const fs::filesystem_error& e) {
+            std::cerr << "Skipping " << paths[i] << ": " << e.what() << '\n';
+        } catch (const MappedFileError& e) {
+            std::cerr << "Skipping " << paths[i] << ": " << e.what() << '\n';
+        }
+    }
+
+    std::sort(inputs.begin(), inputs.end());
+
+    const int threadQty = std::max(gOptions.renderThreadQty, 1);
+    std::cerr << inputs.size() << " meshes to render, predicted time "
+              << predictBatchDuration(inputs, threadQty) << " s with "
+              << threadQty << " threads (" << totalCost
+              << " s of work)\n";
+
+    std::vector<fs::path> scheduled;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        scheduled.push_back(inputs[i].path);
+    }
+    return scheduled;
+}
+
+std::vector<fs::path> collectInputs()
+{
+    std::vector<fs::path> inputs;
+
+    if (gOptions.isCubeModel) {
+        inputs.push_back("test-cube");
+        return inputs;
+    }
+
     fs::directory_iterator itEnd;
     for (fs::directory_iterator dirIt(gOptions.inputDirectory);
          dirIt != itEnd;
          ++dirIt)
     {
-        boost::scoped_ptr<MeshNew> mesh(new MeshNew);
-        mesh->loadPLY(dirIt->path().string().c_str());
-        renderMesh(*mesh, dirIt->path().filename().string());
+        inputs.push_back(dirIt->path());
+    }
+
+    return scheduleInputs(inputs);
+}
+
+// Rendering threads load their meshes at the same time, so they share the
+// cores for decoding.
+int getDecodeThreadQty()
+{
+    const int coreQty = std::max(1u, std::thread::hardware_concurrency());
+    return std::max(1, coreQty / std::max(gOptions.renderThreadQty, 1));
+}
+
+bool loadMesh(MeshNew& mesh, const fs::path& input)
+{
+    mesh.setClusterCulling(gOptions.isClusterCulling);
+    mesh.setBackfaceCulling(gOptions.isBackfaceCulling);
+    mesh.setMeshCache(gOptions.isUsingMeshCache);
+
+    if (gOptions.isCubeModel)
+        return mesh.loadCube();
+    else if (isCompressedMesh(input))
+        return mesh.loadCompressed(input.string().c_str(), getDecodeThreadQty());
+    else if (isProgressiveMesh(input))
+        return mesh.loadProgressive(input.string().c_str(), gOptions.maxTriangleQty);
+    else
+        return mesh.loadPLY(input.string().c_str());
+}
+
+void renderInput(Skyboxes& skyboxes, const fs::path& input)
+{
+    boost::scoped_ptr<MeshNew> mesh(new MeshNew);
+    if (!loadMesh(*mesh, input)) {
+        std::cerr << "Can't load " << input << ", skipped\n";
+        ++gFailedInputQty;
+        return;
+    }
+    renderMesh(*mesh, skyboxes, input.filename().string());
+}
+
+void reportFailures()
+{
+    const size_t failures = gOutputWriter->flush();
+    if (failures > 0) {
+        std::cerr << failures << " files could not be written\n";
+    }
+    if (gFailedInputQty > 0) {
+        std::cerr << gFailedInputQty << " inputs could not be loaded\n";
     }
 }
 
 void onDisplay()
 {
-    if (gOptions.isCubeModel) {
-        boost::scoped_ptr<MeshNew> mesh(new MeshNew);
-        mesh->loadCube();
-        renderMesh(*mesh, "test-cube");
-    } else {
-        renderMeshesFromDirectory();
+    std::vector<fs::path> inputs = collectInputs();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        createOutputDirectories(inputs[i].filename().string());
     }
 
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        renderInput(gSkyboxes, inputs[i]);
+    }
+
+    reportFailures();
+
     glutLeaveMainLoop();
 }
 
+// Meshes waiting to be rendered, shared by the rendering threads.
+class InputQueue {
+public:
+    explicit InputQueue(const std::vector<fs::path>& inputs)
+        : m_inputs(inputs)
+        , m_next(0)
+    {}
+
+    bool pop(fs::path& input)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_next == m_inputs.size())
+            return false;
+        input = m_inputs[m_next++];
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<fs::path> m_inputs;
+    size_t m_next;
+};
+
 void initGlut(int argc, char** argv)
 {
     glutInit(&argc, argv);
@@ -168,6 +526,125 @@ void initGL()
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 }
 
+bool initGLEW()
+{
+    glewExperimental = GL_TRUE;
+    GLenum res = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // Headless contexts have no GLX display to query.
+    if (GLEW_ERROR_NO_GLX_DISPLAY == res)
+        res = glewContextInit();
+#endif
+    if (res != GLEW_OK) {
+        std::cerr << "Error: '" << glewGetErrorString(res) << "'\n";
+        return false;
+    }
+    return true;
+}
+
+void loadSkyboxes(Skyboxes& skyboxes)
+{
+    skyboxes.skybox1.reset(new Skybox);
+    skyboxes.skybox2.reset(new Skybox);
+    skyboxes.emptySkybox.reset(new EmptySkybox);
+
+    skyboxes.skybox1->load(gOptions.skybox1Directory);
+    skyboxes.skybox2->load(gOptions.skybox2Directory);
+    skyboxes.emptySkybox->load("");
+}
+
+void shareSkyboxes(const Skyboxes& source, Skyboxes& skyboxes)
+{
+    skyboxes.skybox1.reset(source.skybox1->createShared());
+    skyboxes.skybox2.reset(source.skybox2->createShared());
+    skyboxes.emptySkybox.reset(source.emptySkybox->createShared());
+}
+
+void releaseSkyboxes(Skyboxes& skyboxes)
+{
+    skyboxes.skybox1.reset();
+    skyboxes.skybox2.reset();
+    skyboxes.emptySkybox.reset();
+}
+
+// Counts itself in startedQty once it has a context.
+void renderWorker(int workerNumber, const HeadlessContext* rootContext,
+                  InputQueue& queue, std::atomic<int>& startedQty)
+{
+    HeadlessContext context;
+    if (!context.create(gOptions.screenWidth, gOptions.screenHeight,
+                        rootContext)
+        || !context.makeCurrent())
+    {
+        std::cerr << "Rendering thread " << workerNumber
+                  << " can't get a GL context\n";
+        return;
+    }
+    ++startedQty;
+
+    initGL();
+
+    Skyboxes skyboxes;
+    if (context.isShared())
+        shareSkyboxes(gSkyboxes, skyboxes);
+    else
+        loadSkyboxes(skyboxes);
+
+    fs::path input;
+    while (queue.pop(input)) {
+        renderInput(skyboxes, input);
+    }
+
+    releaseSkyboxes(skyboxes);
+    context.release();
+}
+
+// Renders with several threads, each owning a headless context, its own
+// meshes and skyboxes. Skybox textures are uploaded once in the root context
+// and shared with the rendering contexts.
+bool renderHeadless()
+{
+    HeadlessContext rootContext;
+    if (!rootContext.create(1, 1, 0) || !rootContext.makeCurrent()) {
+        std::cerr << "Can't create a headless GL context\n";
+        return false;
+    }
+
+    if (!initGLEW())
+        return false;
+
+    loadSkyboxes(gSkyboxes);
+    // The rendering contexts must see complete textures.
+    glFinish();
+
+    std::vector<fs::path> inputs = collectInputs();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        createOutputDirectories(inputs[i].filename().string());
+    }
+
+    InputQueue queue(inputs);
+    std::atomic<int> startedQty(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < gOptions.renderThreadQty; ++i) {
+        workers.push_back(std::thread(renderWorker, i, &rootContext,
+                                      std::ref(queue), std::ref(startedQty)));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    reportFailures();
+
+    releaseSkyboxes(gSkyboxes);
+    rootContext.release();
+
+    if (startedQty == 0) {
+        std::cerr << "No rendering thread got a GL context\n";
+        return false;
+    }
+    return gFailedInputQty == 0;
+}
+
 std::string skyboxDirectoryToName(const std::string& dirname)
 {
     fs::path path(dirname);
@@ -202,7 +679,8 @@ bool initOptions(Options& opts, int argc, char** argv)
          po::value<string>(&opts.noSkyboxName)->default_value("noskybox"),
          "Output directory name for renders without skybox")
         ("cube",
-         "Whether to use test cube model instead of reading from .ply files")
+         "Whether to use test cube model instead of reading from .ply, "
+         ".cmesh and .pmesh files")
         ("screen-width",
          po::value<int>(&opts.screenWidth)->default_value(800),
          "Screen width")
@@ -212,6 +690,38 @@ bool initOptions(Options& opts, int argc, char** argv)
         ("picture-qty",
          po::value<int>(&opts.pictureQty)->default_value(10),
          "Quantity of pictures to generate for each model")
+        ("video",
+         "Encode one video per model and skybox instead of writing pictures")
+        ("video-fps",
+         po::value<int>(&opts.videoFps)->default_value(25),
+         "Frame rate of the output videos")
+        ("video-codec",
+         po::value<string>(&opts.videoCodec)->default_value("libx264"),
+         "ffmpeg video codec for the output videos")
+        ("ffmpeg",
+         po::value<string>(&opts.ffmpegPath)->default_value("ffmpeg"),
+         "Path to the ffmpeg executable used for video encoding")
+        ("writer-threads",
+         po::value<int>(&opts.writerThreadQty)->default_value(4),
+         "Quantity of threads writing pictures when io_uring is unavailable")
+        ("render-threads",
+         po::value<int>(&opts.renderThreadQty)->default_value(0),
+         "Render without a window using that many threads, each with its "
+         "own headless GL context; 0 renders in a GLUT window")
+        ("cluster-culling",
+         po::value<bool>(&opts.isClusterCulling)->default_value(true),
+         "Skip triangle clusters outside the view")
+        ("backface-culling",
+         po::value<bool>(&opts.isBackfaceCulling)->default_value(false),
+         "With --cluster-culling, also skip clusters facing away from the "
+         "camera; only for closed, consistently oriented meshes")
+        ("max-triangles",
+         po::value<size_t>(&opts.maxTriangleQty)->default_value(0),
+         "Read .pmesh progressive meshes only up to this many triangles "
+         "for previews; 0 reads them whole")
+        ("no-cache",
+         "Parse the models even if they have up to date .mcache files, "
+         "and don't write them")
         ("fovy-degrees",
          po::value<float>(&opts.fovyDegrees)->default_value(50.0f),
          "Camera's fovy")
@@ -247,6 +757,8 @@ bool initOptions(Options& opts, int argc, char** argv)
 
     po::notify(vm);
     opts.isCubeModel = vm.count("cube");
+    opts.isVideoOutput = vm.count("video");
+    opts.isUsingMeshCache = !vm.count("no-cache");
     opts.skybox1Name = skyboxDirectoryToName(opts.skybox1Directory);
     opts.skybox2Name = skyboxDirectoryToName(opts.skybox2Directory);
 
@@ -258,18 +770,7 @@ int main(int argc, char** argv)
     if (!initOptions(gOptions, argc, argv))
         return EXIT_FAILURE;
 
-    initGlut(argc, argv);
-    initGL();
-
-    GLenum res = glewInit();
-    if (res != GLEW_OK) {
-        std::cerr << "Error: '" << glewGetErrorString(res) << "'\n";
-        return EXIT_FAILURE;
-    }
-
-    gSkybox1.reset(new Skybox);
-    gSkybox2.reset(new Skybox);
-    gEmptySkybox.reset(new EmptySkybox);
+    gOutputWriter.reset(new OutputWriter(gOptions.writerThreadQty));
 
     gViewParameters.eye = glm::vec3(
             gOptions.eyeX,
@@ -287,17 +788,24 @@ int main(int argc, char** argv)
     gProjectionParameters.zNear = 0.1f;
     gProjectionParameters.zFar = 50.0f;
 
-    gSkybox1->load(gOptions.skybox1Directory);
-    gSkybox2->load(gOptions.skybox2Directory);
-    gEmptySkybox->load("");
-
     fs::path outDir(gOptions.outputDirectory);
     fs::create_directory(outDir);
     fs::create_directory(outDir / gOptions.skybox1Name);
     fs::create_directory(outDir / gOptions.skybox2Name);
     fs::create_directory(outDir / gOptions.noSkyboxName);
 
+    if (isHeadless())
+        return renderHeadless() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    initGlut(argc, argv);
+    initGL();
+
+    if (!initGLEW())
+        return EXIT_FAILURE;
+
+    loadSkyboxes(gSkyboxes);
+
     glutMainLoop();
 
-    return EXIT_SUCCESS;
+    return gFailedInputQty == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
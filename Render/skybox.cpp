@@ -40,6 +40,16 @@ bool Skybox::load(const std::string& path)
     return true;
 }
 
+ISkybox* Skybox::createShared() const
+{
+    Skybox* skybox = new Skybox;
+    skybox->loadProgram();
+    skybox->initVertices();
+    skybox->m_textureID = m_textureID;
+
+    return skybox;
+}
+
 void Skybox::initVertices()
 {
     // std::cerr << "Loading skybox vertices\n";
@@ -278,6 +288,11 @@ bool EmptySkybox::load(const std::string& path)
     return true;
 }
 
+ISkybox* EmptySkybox::createShared() const
+{
+    return new EmptySkybox;
+}
+
 void EmptySkybox::render()
 {}
 
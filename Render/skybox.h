@@ -8,7 +8,12 @@ class ProjectionParameters;
 
 class ISkybox {
 public:
+    virtual ~ISkybox() {}
+
     virtual bool load(const std::string& path) = 0;
+    // Creates a skybox for the current context which uses the textures of
+    // this one. The contexts must share objects.
+    virtual ISkybox* createShared() const = 0;
     virtual void render() = 0;
     virtual void setMVP(
             float angle,
@@ -21,6 +26,7 @@ public:
     ~Skybox();
 
     bool load(const std::string& path);
+    ISkybox* createShared() const;
     void render();
     void setMVP(
             float angle,
@@ -42,6 +48,7 @@ private:
 class EmptySkybox : public ISkybox {
 public:
     bool load(const std::string& path);
+    ISkybox* createShared() const;
     void render();
     void setMVP(
             float angle,
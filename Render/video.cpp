@@ -0,0 +1,208 @@
+#include "video.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define PIPE_WRITE_MODE "wb"
+#else
+#include <csignal>
+#define PIPE_WRITE_MODE "w"
+#endif
+
+namespace
+{
+
+// Enough to keep the encoder busy while the next frames are rendered
+// without holding a whole turntable in memory.
+const size_t MAX_QUEUED_FRAMES = 8;
+
+std::string quote(const std::string& s)
+{
+    std::string result = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"' || s[i] == '\\' || s[i] == '$' || s[i] == '`')
+            result += '\\';
+        result += s[i];
+    }
+    return result + '"';
+}
+
+} // anonymous namespace
+
+class VideoEncoderImpl {
+public:
+    explicit VideoEncoderImpl(const VideoParameters& parameters);
+    ~VideoEncoderImpl();
+
+    bool open(const std::string& filename);
+    void addFrame(std::vector<unsigned char>& rgbFrame);
+    bool close();
+
+private:
+    typedef std::vector<unsigned char> Frame;
+
+    std::string buildCommand(const std::string& filename) const;
+    void encodeLoop();
+
+    VideoParameters m_parameters;
+    FILE* m_pipe;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queueChanged;
+    std::deque<Frame> m_queue;
+    std::deque<Frame> m_freeFrames;
+    bool m_finished;
+    bool m_writeFailed;
+};
+
+VideoEncoderImpl::VideoEncoderImpl(const VideoParameters& parameters)
+    : m_parameters(parameters)
+    , m_pipe(0)
+    , m_finished(false)
+    , m_writeFailed(false)
+{}
+
+VideoEncoderImpl::~VideoEncoderImpl()
+{
+    close();
+}
+
+std::string VideoEncoderImpl::buildCommand(const std::string& filename) const
+{
+    // glReadPixels returns rows bottom-up, so the picture is flipped by
+    // ffmpeg. yuv420p needs even dimensions.
+    std::ostringstream s;
+    s << quote(m_parameters.ffmpegPath)
+      << " -loglevel error -y"
+      << " -f rawvideo -pixel_format rgb24"
+      << " -video_size " << m_parameters.width << 'x' << m_parameters.height
+      << " -framerate " << m_parameters.fps
+      << " -i -"
+      << " -vf \"vflip,scale=trunc(iw/2)*2:trunc(ih/2)*2\""
+      << " -c:v " << m_parameters.codec
+      << " -pix_fmt yuv420p "
+      << quote(filename);
+    return s.str();
+}
+
+bool VideoEncoderImpl::open(const std::string& filename)
+{
+    const std::string command = buildCommand(filename);
+    std::cerr << "Starting encoder: " << command << '\n';
+
+#ifndef _WIN32
+    // A crashed ffmpeg must be reported by close(), not kill the renderer.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    m_pipe = popen(command.c_str(), PIPE_WRITE_MODE);
+    if (!m_pipe) {
+        std::cerr << "Can't start " << m_parameters.ffmpegPath << '\n';
+        return false;
+    }
+
+    m_finished = false;
+    m_writeFailed = false;
+    m_thread = std::thread(&VideoEncoderImpl::encodeLoop, this);
+
+    return true;
+}
+
+void VideoEncoderImpl::addFrame(std::vector<unsigned char>& rgbFrame)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queueChanged.wait(lock, [this] {
+        return m_queue.size() < MAX_QUEUED_FRAMES;
+    });
+
+    m_queue.push_back(Frame());
+    m_queue.back().swap(rgbFrame);
+
+    if (!m_freeFrames.empty()) {
+        rgbFrame.swap(m_freeFrames.front());
+        m_freeFrames.pop_front();
+    }
+    rgbFrame.resize(m_queue.back().size());
+
+    m_queueChanged.notify_all();
+}
+
+void VideoEncoderImpl::encodeLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_queueChanged.wait(lock, [this] {
+            return m_finished || !m_queue.empty();
+        });
+        if (m_queue.empty())
+            break;
+
+        Frame frame;
+        frame.swap(m_queue.front());
+        m_queue.pop_front();
+        m_queueChanged.notify_all();
+
+        lock.unlock();
+        const bool ok = m_writeFailed
+            || frame.size() == fwrite(frame.data(), 1, frame.size(), m_pipe);
+        lock.lock();
+
+        if (!ok)
+            m_writeFailed = true;
+        m_freeFrames.push_back(Frame());
+        m_freeFrames.back().swap(frame);
+    }
+}
+
+bool VideoEncoderImpl::close()
+{
+    if (!m_pipe)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+        m_queueChanged.notify_all();
+    }
+    m_thread.join();
+
+    const int status = pclose(m_pipe);
+    m_pipe = 0;
+
+    if (m_writeFailed || status != 0) {
+        std::cerr << "Video encoding failed, ffmpeg status " << status << '\n';
+        return false;
+    }
+    return true;
+}
+
+VideoEncoder::VideoEncoder(const VideoParameters& parameters)
+    : m_impl(new VideoEncoderImpl(parameters))
+{}
+
+VideoEncoder::~VideoEncoder()
+{}
+
+bool VideoEncoder::open(const std::string& filename)
+{
+    return m_impl->open(filename);
+}
+
+void VideoEncoder::addFrame(std::vector<unsigned char>& rgbFrame)
+{
+    m_impl->addFrame(rgbFrame);
+}
+
+bool VideoEncoder::close()
+{
+    return m_impl->close();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+#include <string>
+#include <vector>
+
+class VideoEncoderImpl;
+
+struct VideoParameters {
+    int width;
+    int height;
+    int fps;
+    std::string codec;
+    std::string ffmpegPath;
+};
+
+// Streams raw bottom-up RGB frames (as returned by glReadPixels) to an ffmpeg
+// subprocess. Frames are written to the pipe on a separate thread, so
+// encoding overlaps rendering of the next frames.
+class VideoEncoder {
+public:
+    explicit VideoEncoder(const VideoParameters& parameters);
+    ~VideoEncoder();
+
+    bool open(const std::string& filename);
+
+    // Hands the frame over to the encoder thread. The contents of the
+    // argument are swapped with a recycled buffer of the same size, so the
+    // caller can read the next frame into it without reallocation.
+    void addFrame(std::vector<unsigned char>& rgbFrame);
+
+    // Waits for all queued frames to be encoded. Returns false if ffmpeg
+    // could not be started, a write failed, or ffmpeg exited with an error.
+    bool close();
+
+private:
+    boost::scoped_ptr<VideoEncoderImpl> m_impl;
+};
@@ -0,0 +1,85 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <ostream>
+
+#include <sys/resource.h>
+
+MemoryBudget::MemoryBudget(uintmax_t budget)
+    : m_budget(budget)
+    , m_used(0)
+{}
+
+void MemoryBudget::acquire(uintmax_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_used > 0 && m_used + bytes > m_budget) {
+        m_released.wait(lock);
+    }
+    m_used += bytes;
+}
+
+void MemoryBudget::release(uintmax_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used -= bytes;
+    m_released.notify_all();
+}
+
+BatchReport::BatchReport()
+    : inputTriangleQty(0)
+    , outputTriangleQty(0)
+    , isStreaming(false)
+    , seconds(0)
+    , estimatedMemory(0)
+    , peakMemory(0)
+{}
+
+uintmax_t getPeakMemory()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return uintmax_t(usage.ru_maxrss) << 10;
+}
+
+void printBatchSummary(
+        std::ostream& out,
+        std::vector<BatchReport> reports,
+        double wallSeconds)
+{
+    std::sort(reports.begin(), reports.end());
+
+    double totalSeconds = 0;
+    size_t failureQty = 0;
+
+    out << "seconds\tinput triangles\toutput triangles\tmode\testimated MB"
+           "\tpeak MB\tfile\n";
+    for (size_t i = 0; i < reports.size(); ++i) {
+        const BatchReport& report = reports[i];
+        out << report.seconds << '\t' << report.inputTriangleQty << '\t'
+            << report.outputTriangleQty << '\t'
+            << (report.isStreaming ? "streaming" : "memory") << '\t'
+            << (report.estimatedMemory >> 20) << '\t'
+            << (report.peakMemory >> 20) << '\t' << report.filename;
+        if (!report.error.empty()) {
+            out << "\tfailed: " << report.error;
+            ++failureQty;
+        }
+        out << '\n';
+        totalSeconds += report.seconds;
+    }
+
+    out << reports.size() << " files, " << failureQty << " failed, "
+        << wallSeconds << " s wall time, " << totalSeconds
+        << " s of work\n";
+}
+
+bool isBatchDone(const std::vector<BatchReport>& reports)
+{
+    for (size_t i = 0; i < reports.size(); ++i) {
+        if (!reports[i].error.empty())
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Memory reserved by the files being processed. A file that doesn't fit
+// waits until enough memory is released, and one larger than the whole
+// budget runs alone.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uintmax_t budget);
+
+    void acquire(uintmax_t bytes);
+    void release(uintmax_t bytes);
+
+    uintmax_t getBudget() const { return m_budget; }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    const uintmax_t m_budget;
+    uintmax_t m_used;
+};
+
+// What happened to one file of a batch.
+struct BatchReport {
+    BatchReport();
+
+    std::string filename;
+    size_t inputTriangleQty;
+    size_t outputTriangleQty;
+    bool isStreaming;
+    double seconds;
+    uintmax_t estimatedMemory;
+    // Of the whole process when the file was done.
+    uintmax_t peakMemory;
+    std::string error;
+
+    bool operator<(const BatchReport& other) const
+    {
+        return filename < other.filename;
+    }
+};
+
+// Inputs waiting to be processed and the reports of those done, shared
+// by the batch threads.
+template <typename Input>
+class BatchQueue {
+public:
+    explicit BatchQueue(const std::vector<Input>& inputs)
+        : m_inputs(inputs)
+        , m_next(0)
+    {}
+
+    bool pop(Input& input)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_next == m_inputs.size())
+            return false;
+        input = m_inputs[m_next++];
+        return true;
+    }
+
+    void addReport(const BatchReport& report)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reports.push_back(report);
+    }
+
+    std::vector<BatchReport> reports() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_reports;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    const std::vector<Input> m_inputs;
+    size_t m_next;
+    std::vector<BatchReport> m_reports;
+};
+
+// Peak resident memory of the process so far, 0 when unknown.
+uintmax_t getPeakMemory();
+
+// A line per file, sorted by name, and the totals.
+void printBatchSummary(
+        std::ostream& out,
+        std::vector<BatchReport> reports,
+        double wallSeconds);
+
+// True when no file failed.
+bool isBatchDone(const std::vector<BatchReport>& reports);
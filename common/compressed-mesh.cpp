@@ -0,0 +1,531 @@
+#include "compressed-mesh.h"
+
+#include "mapped-file.h"
+#include "run-tasks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+
+const char MAGIC[8] = {'C', 'M', 'E', 'S', 'H', '\r', '\n', '\x1a'};
+const uint32_t VERSION = 2;
+// Reads differently on a machine with another byte order.
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+const uint32_t HAS_COLORS = 1;
+
+// Planes of the 32 bit words.
+const int PLANE_QTY = 4;
+const int SYMBOL_QTY = 256;
+
+// rANS with probabilities in 1/4096 and a 32 bit state renormalized by
+// bytes, two states interleaved over one byte stream.
+const uint32_t SCALE_BITS = 12;
+const uint32_t SCALE = 1 << SCALE_BITS;
+const uint32_t STATE_LOW = 1u << 23;
+// No symbol is coded in less than -log2(15/16) bits, so that a stream
+// can't decode to more than about 100 symbols a byte, and the counts of a
+// file are checked against its size before anything is allocated.
+const uint32_t MAX_FREQUENCY = SCALE - SCALE / 16;
+const uint64_t MAX_SYMBOLS_PER_BYTE = 128;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t positionBits;
+    uint32_t flags;
+    uint64_t vertexQty;
+    uint64_t faceQty;
+    float min[3];
+    float step[3];
+};
+
+// Every stream of the file is one of these followed by the frequencies of
+// its symbols and the coded bytes.
+struct StreamHeader {
+    uint64_t symbolQty;
+    uint64_t codedSize;
+};
+
+typedef uint16_t Frequencies[SYMBOL_QTY];
+
+// A byte stream to code or decoded.
+struct Stream {
+    std::vector<uint8_t> symbols;
+    Frequencies frequencies;
+    std::vector<uint8_t> coded;
+    const uint8_t* codedData;
+    size_t codedSize;
+    bool isValid;
+};
+
+uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ uint32_t(int32_t(delta) >> 31);
+}
+
+uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+// Scales the counts of the symbols to frequencies summing to SCALE, keeping
+// every present symbol at 1 or more and none above MAX_FREQUENCY.
+void normalizeFrequencies(const std::vector<uint8_t>& symbols, Frequencies frequencies)
+{
+    uint64_t counts[SYMBOL_QTY] = {};
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        ++counts[symbols[i]];
+    }
+
+    uint32_t sum = 0;
+    int mostFrequent = 0;
+    for (int s = 0; s < SYMBOL_QTY; ++s) {
+        uint32_t frequency = 0;
+        if (counts[s] > 0) {
+            frequency = uint32_t(std::max<uint64_t>(
+                    1, counts[s] * SCALE / symbols.size()));
+        }
+        frequencies[s] = uint16_t(frequency);
+        sum += frequency;
+        if (counts[s] > counts[mostFrequent])
+            mostFrequent = s;
+    }
+
+    while (sum > SCALE) {
+        const int s = int(std::max_element(frequencies, frequencies + SYMBOL_QTY)
+                          - frequencies);
+        --frequencies[s];
+        --sum;
+    }
+    frequencies[mostFrequent] += uint16_t(SCALE - sum);
+    if (frequencies[mostFrequent] > MAX_FREQUENCY) {
+        frequencies[(mostFrequent + 1) % SYMBOL_QTY] +=
+            uint16_t(frequencies[mostFrequent] - MAX_FREQUENCY);
+        frequencies[mostFrequent] = uint16_t(MAX_FREQUENCY);
+    }
+}
+
+void getStarts(const Frequencies frequencies, uint32_t starts[SYMBOL_QTY])
+{
+    uint32_t start = 0;
+    for (int s = 0; s < SYMBOL_QTY; ++s) {
+        starts[s] = start;
+        start += frequencies[s];
+    }
+}
+
+void encode(Stream& stream)
+{
+    const std::vector<uint8_t>& symbols = stream.symbols;
+    normalizeFrequencies(symbols, stream.frequencies);
+    uint32_t starts[SYMBOL_QTY];
+    getStarts(stream.frequencies, starts);
+
+    // At most 12 bits a symbol, written from the end.
+    std::vector<uint8_t> buffer(symbols.size() * 2 + 16);
+    uint8_t* const end = buffer.data() + buffer.size();
+    uint8_t* p = end;
+
+    uint32_t states[2] = {STATE_LOW, STATE_LOW};
+    for (size_t i = symbols.size(); i-- > 0; ) {
+        uint32_t& x = states[i & 1];
+        const uint32_t frequency = stream.frequencies[symbols[i]];
+        const uint32_t xMax = ((STATE_LOW >> SCALE_BITS) << 8) * frequency;
+        while (x >= xMax) {
+            *--p = uint8_t(x);
+            x >>= 8;
+        }
+        x = ((x / frequency) << SCALE_BITS) + x % frequency + starts[symbols[i]];
+    }
+    for (int s = 1; s >= 0; --s) {
+        p -= 4;
+        for (int b = 0; b < 4; ++b) {
+            p[b] = uint8_t(states[s] >> (8 * b));
+        }
+    }
+
+    stream.coded.assign(p, end);
+}
+
+uint32_t readState(const uint8_t* p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8
+           | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+inline uint8_t decodeSymbol(
+        uint32_t& x,
+        const uint8_t slotSymbols[SCALE],
+        const Frequencies frequencies,
+        const uint32_t starts[SYMBOL_QTY])
+{
+    const uint32_t slot = x & (SCALE - 1);
+    const uint8_t symbol = slotSymbols[slot];
+    x = frequencies[symbol] * (x >> SCALE_BITS) + slot - starts[symbol];
+    return symbol;
+}
+
+inline bool renormalize(uint32_t& x, const uint8_t*& p, const uint8_t* end)
+{
+    while (x < STATE_LOW) {
+        if (p == end)
+            return false;
+        x = (x << 8) | *p++;
+    }
+    return true;
+}
+
+void decode(Stream& stream)
+{
+    stream.isValid = false;
+
+    uint32_t starts[SYMBOL_QTY];
+    getStarts(stream.frequencies, starts);
+    if (starts[SYMBOL_QTY - 1] + stream.frequencies[SYMBOL_QTY - 1] != SCALE
+        || *std::max_element(stream.frequencies, stream.frequencies + SYMBOL_QTY)
+           > MAX_FREQUENCY)
+    {
+        return;
+    }
+
+    uint8_t slotSymbols[SCALE];
+    for (int s = 0; s < SYMBOL_QTY; ++s) {
+        std::fill(slotSymbols + starts[s],
+                  slotSymbols + starts[s] + stream.frequencies[s],
+                  uint8_t(s));
+    }
+
+    const uint8_t* p = stream.codedData;
+    const uint8_t* const end = p + stream.codedSize;
+    if (stream.codedSize < 8)
+        return;
+    uint32_t x0 = readState(p);
+    uint32_t x1 = readState(p + 4);
+    p += 8;
+
+    // The states take turns, so each pair of symbols is decoded from two
+    // independent chains.
+    uint8_t* const out = stream.symbols.data();
+    const size_t symbolQty = stream.symbols.size();
+    for (size_t i = 0; i < symbolQty; i += 2) {
+        out[i] = decodeSymbol(x0, slotSymbols, stream.frequencies, starts);
+        if (i + 1 < symbolQty)
+            out[i + 1] = decodeSymbol(x1, slotSymbols, stream.frequencies, starts);
+        if (!renormalize(x0, p, end) || !renormalize(x1, p, end))
+            return;
+    }
+    stream.isValid = true;
+}
+
+// Streams first to first + 3 get the bytes of the words, least
+// significant first.
+void splitIntoPlanes(
+        const std::vector<uint32_t>& words,
+        std::vector<Stream>& streams,
+        size_t first)
+{
+    for (int plane = 0; plane < PLANE_QTY; ++plane) {
+        std::vector<uint8_t>& symbols = streams[first + plane].symbols;
+        symbols.resize(words.size());
+        for (size_t i = 0; i < words.size(); ++i) {
+            symbols[i] = uint8_t(words[i] >> (8 * plane));
+        }
+    }
+}
+
+// Sums up the deltas split into streams first to first + 3.
+class DeltaReader {
+public:
+    DeltaReader(const std::vector<Stream>& streams, size_t first)
+        : m_value(0)
+    {
+        for (int plane = 0; plane < PLANE_QTY; ++plane) {
+            m_planes[plane] = streams[first + plane].symbols.data();
+        }
+    }
+
+    uint32_t next(size_t i)
+    {
+        const uint32_t delta = uint32_t(m_planes[0][i])
+                               | uint32_t(m_planes[1][i]) << 8
+                               | uint32_t(m_planes[2][i]) << 16
+                               | uint32_t(m_planes[3][i]) << 24;
+        m_value += unzigzag(delta);
+        return m_value;
+    }
+
+private:
+    const uint8_t* m_planes[PLANE_QTY];
+    uint32_t m_value;
+};
+
+// Stream layout: the planes of the x, y and z deltas, the r, g and b
+// deltas when there are colors, and the planes of the index deltas.
+size_t getStreamQty(bool hasColors)
+{
+    return 3 * PLANE_QTY + (hasColors ? 3 : 0) + PLANE_QTY;
+}
+
+// The largest quantized value stands for non-finite coordinates.
+uint32_t getMaxQuantized(int positionBits)
+{
+    return (uint32_t(1) << positionBits) - 2;
+}
+
+void quantizeAxis(
+        const MeshView& mesh,
+        int axis,
+        int positionBits,
+        Header& header,
+        std::vector<uint32_t>& deltas)
+{
+    float min = std::numeric_limits<float>::max();
+    float max = -std::numeric_limits<float>::max();
+    for (size_t i = 0; i < mesh.vertexQty; ++i) {
+        const float value = mesh.positions[3 * i + axis];
+        if (std::isfinite(value)) {
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+    }
+    if (min > max)
+        min = max = 0;
+
+    const uint32_t maxQuantized = getMaxQuantized(positionBits);
+    // Quantized with the step as it's stored, so that decoding doesn't
+    // drift at high values.
+    const float step = float((double(max) - min) / maxQuantized);
+    header.min[axis] = min;
+    header.step[axis] = step;
+
+    deltas.resize(mesh.vertexQty);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < mesh.vertexQty; ++i) {
+        const float value = mesh.positions[3 * i + axis];
+        uint32_t quantized = maxQuantized + 1;
+        if (std::isfinite(value)) {
+            quantized = 0;
+            if (step > 0) {
+                const double scaled = std::floor((value - double(min)) / step + 0.5);
+                quantized = uint32_t(std::min(scaled, double(maxQuantized)));
+            }
+        }
+        deltas[i] = zigzag(quantized - previous);
+        previous = quantized;
+    }
+}
+
+bool isValid(const Header& header)
+{
+    return std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+           && header.version == VERSION
+           && header.byteOrderMark == BYTE_ORDER_MARK
+           && header.positionBits >= uint32_t(MIN_POSITION_BITS)
+           && header.positionBits <= uint32_t(MAX_POSITION_BITS)
+           && header.vertexQty <= std::numeric_limits<uint32_t>::max()
+           && header.faceQty <= std::numeric_limits<uint64_t>::max() / 3;
+}
+
+void writeBytes(std::ofstream& f, const void* data, size_t size)
+{
+    f.write(static_cast<const char*>(data), std::streamsize(size));
+}
+
+} // anonymous namespace
+
+void writeCompressedMesh(
+        const std::string& filename,
+        const MeshView& mesh,
+        int positionBits,
+        int threadQty)
+{
+    if (positionBits < MIN_POSITION_BITS || positionBits > MAX_POSITION_BITS)
+        throw CompressedMeshError("position bits must be from 8 to 24");
+    if (mesh.faceOffsets || mesh.cornerQty != 3 * mesh.faceQty)
+        throw CompressedMeshError("only triangle meshes can be compressed");
+    if (mesh.vertexQty > std::numeric_limits<uint32_t>::max())
+        throw CompressedMeshError("too many vertices to compress");
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.positionBits = uint32_t(positionBits);
+    header.flags = mesh.colors ? HAS_COLORS : 0;
+    header.vertexQty = mesh.vertexQty;
+    header.faceQty = mesh.faceQty;
+
+    const bool hasColors = mesh.colors != 0;
+    std::vector<Stream> streams(getStreamQty(hasColors));
+
+    std::vector<uint32_t> words;
+    for (int axis = 0; axis < 3; ++axis) {
+        quantizeAxis(mesh, axis, positionBits, header, words);
+        splitIntoPlanes(words, streams, PLANE_QTY * axis);
+    }
+
+    size_t next = 3 * PLANE_QTY;
+    if (hasColors) {
+        for (int channel = 0; channel < 3; ++channel, ++next) {
+            std::vector<uint8_t>& symbols = streams[next].symbols;
+            symbols.resize(mesh.vertexQty);
+            uint8_t previous = 0;
+            for (size_t i = 0; i < mesh.vertexQty; ++i) {
+                const uint8_t color = mesh.colors[3 * i + channel];
+                symbols[i] = uint8_t(color - previous);
+                previous = color;
+            }
+        }
+    }
+
+    words.resize(mesh.cornerQty);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < mesh.cornerQty; ++i) {
+        if (mesh.indices[i] >= mesh.vertexQty)
+            throw CompressedMeshError("vertex index out of range");
+        words[i] = zigzag(mesh.indices[i] - previous);
+        previous = mesh.indices[i];
+    }
+    splitIntoPlanes(words, streams, next);
+    std::vector<uint32_t>().swap(words);
+
+    runTasks(streams.size(), threadQty, [&](size_t i) {
+        encode(streams[i]);
+        std::vector<uint8_t>().swap(streams[i].symbols);
+    });
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    writeBytes(f, &header, sizeof(header));
+    for (size_t i = 0; i < streams.size(); ++i) {
+        StreamHeader streamHeader;
+        streamHeader.symbolQty = i < next ? mesh.vertexQty : mesh.cornerQty;
+        streamHeader.codedSize = streams[i].coded.size();
+        writeBytes(f, &streamHeader, sizeof(streamHeader));
+        writeBytes(f, streams[i].frequencies, sizeof(Frequencies));
+        writeBytes(f, streams[i].coded.data(), streams[i].coded.size());
+    }
+    f.close();
+    if (f.fail())
+        throw CompressedMeshError("can't write " + filename);
+}
+
+void readCompressedMesh(
+        const std::string& filename,
+        TriangleMesh& mesh,
+        int threadQty)
+{
+    const MappedFile file(filename);
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(file.data());
+    const uint8_t* const end = p + file.size();
+    const CompressedMeshError brokenFile(filename + " is not a valid compressed mesh");
+
+    if (file.size() < sizeof(Header))
+        throw brokenFile;
+    Header header;
+    std::memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+    if (!isValid(header))
+        throw brokenFile;
+
+    const bool hasColors = (header.flags & HAS_COLORS) != 0;
+    const size_t vertexQty = size_t(header.vertexQty);
+    const size_t cornerQty = size_t(3 * header.faceQty);
+    std::vector<Stream> streams(getStreamQty(hasColors));
+    const size_t indexStreams = streams.size() - PLANE_QTY;
+
+    for (size_t i = 0; i < streams.size(); ++i) {
+        StreamHeader streamHeader;
+        if (size_t(end - p) < sizeof(streamHeader) + sizeof(Frequencies))
+            throw brokenFile;
+        std::memcpy(&streamHeader, p, sizeof(streamHeader));
+        p += sizeof(streamHeader);
+        std::memcpy(streams[i].frequencies, p, sizeof(Frequencies));
+        p += sizeof(Frequencies);
+
+        const size_t symbolQty = i < indexStreams ? vertexQty : cornerQty;
+        if (streamHeader.symbolQty != symbolQty
+            || streamHeader.codedSize > uint64_t(end - p)
+            || symbolQty / MAX_SYMBOLS_PER_BYTE > streamHeader.codedSize)
+        {
+            throw brokenFile;
+        }
+        streams[i].symbols.resize(symbolQty);
+        streams[i].codedData = p;
+        streams[i].codedSize = size_t(streamHeader.codedSize);
+        p += streams[i].codedSize;
+    }
+
+    runTasks(streams.size(), threadQty, [&](size_t i) {
+        decode(streams[i]);
+    });
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (!streams[i].isValid)
+            throw brokenFile;
+    }
+
+    mesh.positions.resize(3 * vertexQty);
+    mesh.colors.resize(hasColors ? 3 * vertexQty : 0);
+    mesh.indices.resize(cornerQty);
+
+    // Each axis, the colors and the indices are summed up on their own.
+    std::atomic<bool> isValid(true);
+    runTasks(5, threadQty, [&](size_t task) {
+        if (task < 3) {
+            const uint32_t nonFinite = getMaxQuantized(header.positionBits) + 1;
+            const float min = header.min[task];
+            const float step = header.step[task];
+            float* const positions = mesh.positions.data() + task;
+            DeltaReader reader(streams, PLANE_QTY * task);
+            for (size_t i = 0; i < vertexQty; ++i) {
+                const uint32_t quantized = reader.next(i);
+                positions[3 * i] = quantized == nonFinite
+                                   ? std::numeric_limits<float>::quiet_NaN()
+                                   : min + float(quantized) * step;
+            }
+        } else if (task == 3) {
+            for (int channel = 0; hasColors && channel < 3; ++channel) {
+                const uint8_t* deltas = streams[3 * PLANE_QTY + channel].symbols.data();
+                uint8_t color = 0;
+                for (size_t i = 0; i < vertexQty; ++i) {
+                    color = uint8_t(color + deltas[i]);
+                    mesh.colors[3 * i + channel] = color;
+                }
+            }
+        } else {
+            DeltaReader reader(streams, indexStreams);
+            for (size_t i = 0; i < cornerQty; ++i) {
+                const uint32_t index = reader.next(i);
+                if (index >= vertexQty)
+                    isValid = false;
+                mesh.indices[i] = index;
+            }
+        }
+    });
+    if (!isValid)
+        throw brokenFile;
+}
+
+CompressedMeshInfo readCompressedMeshInfo(const std::string& filename)
+{
+    Header header;
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!f.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || !isValid(header))
+    {
+        throw CompressedMeshError(filename + " is not a valid compressed mesh");
+    }
+
+    CompressedMeshInfo info;
+    info.vertexQty = header.vertexQty;
+    info.faceQty = header.faceQty;
+    return info;
+}
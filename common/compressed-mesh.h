@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "mesh-cache.h"
+#include "triangle-mesh.h"
+
+class CompressedMeshError : public std::runtime_error
+{
+public:
+    explicit CompressedMeshError(const std::string& message)
+        : std::runtime_error(message)
+    {}
+};
+
+const int MIN_POSITION_BITS = 8;
+const int MAX_POSITION_BITS = 24;
+const int DEFAULT_POSITION_BITS = 16;
+
+// Writes a triangle mesh as a .cmesh file. Positions are quantized to
+// positionBits bits per axis within the bounding box, and non-finite ones
+// are kept as NaN. Colors and faces are lossless. Every array is delta
+// coded, split into byte planes and entropy coded with rANS, the planes on
+// threadQty threads. Throws CompressedMeshError.
+void writeCompressedMesh(
+        const std::string& filename,
+        const MeshView& mesh,
+        int positionBits,
+        int threadQty);
+
+// Counts of a compressed mesh, read from its header only.
+struct CompressedMeshInfo {
+    uint64_t vertexQty;
+    uint64_t faceQty;
+};
+
+// The streams are decoded on threadQty threads. Throws CompressedMeshError
+// or MappedFileError.
+void readCompressedMesh(
+        const std::string& filename,
+        TriangleMesh& mesh,
+        int threadQty);
+
+// Throws CompressedMeshError.
+CompressedMeshInfo readCompressedMeshInfo(const std::string& filename);
@@ -0,0 +1,150 @@
+#include "mapped-file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifdef _WIN32
+
+MappedFileError systemError(const std::string& what, const std::string& filename)
+{
+    return MappedFileError(what + ' ' + filename + ": error "
+                           + std::to_string(GetLastError()));
+}
+
+#else // _WIN32
+
+MappedFileError systemError(const std::string& what, const std::string& filename)
+{
+    return MappedFileError(what + ' ' + filename + ": " + std::strerror(errno));
+}
+
+// Page aligned subrange of the mapping covering as much of
+// [offset, offset + size) as possible.
+bool alignRange(size_t mappedSize, size_t& offset, size_t& size)
+{
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    if (offset >= mappedSize)
+        return false;
+    size = std::min(size, mappedSize - offset);
+
+    const size_t begin = offset / pageSize * pageSize;
+    const size_t end = offset + size;
+    offset = begin;
+    size = end - begin;
+    return size > 0;
+}
+
+#endif // _WIN32
+
+} // anonymous namespace
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename)
+    : m_data(0)
+    , m_size(0)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (INVALID_HANDLE_VALUE == file)
+        throw systemError("can't open", filename);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw systemError("can't stat", filename);
+    }
+
+    m_size = size_t(size.QuadPart);
+    if (m_size > 0) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        const void* data =
+            mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+        if (mapping)
+            CloseHandle(mapping);
+        if (!data) {
+            CloseHandle(file);
+            throw systemError("can't map", filename);
+        }
+        m_data = static_cast<const char*>(data);
+    }
+
+    // The view keeps the file.
+    CloseHandle(file);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+}
+
+// Hints only, which Windows does without.
+void MappedFile::adviseSequential(size_t, size_t) const
+{}
+
+void MappedFile::release(size_t, size_t) const
+{}
+
+#else // _WIN32
+
+MappedFile::MappedFile(const std::string& filename)
+    : m_data(0)
+    , m_size(0)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw systemError("can't open", filename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw systemError("can't stat", filename);
+    }
+
+    m_size = st.st_size;
+    if (m_size > 0) {
+        void* data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == data) {
+            close(fd);
+            throw systemError("can't map", filename);
+        }
+        m_data = static_cast<const char*>(data);
+    }
+
+    // The mapping keeps the file.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+}
+
+void MappedFile::adviseSequential(size_t offset, size_t size) const
+{
+    if (alignRange(m_size, offset, size))
+        madvise(const_cast<char*>(m_data) + offset, size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+    if (alignRange(m_size, offset, size))
+        madvise(const_cast<char*>(m_data) + offset, size, MADV_DONTNEED);
+}
+
+#endif // _WIN32
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+class MappedFileError : public std::runtime_error
+{
+public:
+    explicit MappedFileError(const std::string& message)
+        : std::runtime_error(message)
+    {}
+};
+
+// A file mapped read-only into memory. Pages are read on first access and
+// stay reclaimable by the kernel, so a mapping larger than RAM is fine.
+class MappedFile {
+public:
+    // Throws MappedFileError when the file can't be opened or mapped.
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    // Hints that [offset, offset + size) will be read in order.
+    void adviseSequential(size_t offset, size_t size) const;
+
+    // Drops the pages of [offset, offset + size) from memory; they are
+    // read from the file again if accessed later.
+    void release(size_t offset, size_t size) const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* m_data;
+    size_t m_size;
+};
@@ -0,0 +1,347 @@
+#include "mesh-cache.h"
+
+#include "mapped-file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+const char MAGIC[8] = {'M', 'C', 'A', 'C', 'H', 'E', '\r', '\n'};
+const uint32_t VERSION = 1;
+// Reads differently on a machine with another byte order.
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+const uint64_t SECTION_ALIGNMENT = 64;
+const size_t HASH_SAMPLE_SIZE = 1 << 16;
+
+enum Section {
+    SECTION_POSITIONS,
+    SECTION_COLORS,
+    SECTION_TEXTURE_COORDS,
+    SECTION_NORMALS,
+    SECTION_FACE_OFFSETS,
+    SECTION_INDICES,
+    SECTION_TEXTURE_INDICES,
+    SECTION_NORMAL_INDICES,
+    SECTION_MTLLIB,
+    SECTION_USEMTL,
+    SECTION_QTY
+};
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// The file starts with the header, and every section starts at a multiple
+// of SECTION_ALIGNMENT after it.
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    MeshSourceKey source;
+    uint64_t vertexQty;
+    uint64_t textureCoordQty;
+    uint64_t normalQty;
+    uint64_t faceQty;
+    uint64_t cornerQty;
+    SectionEntry sections[SECTION_QTY];
+};
+
+uint64_t align(uint64_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT
+           * SECTION_ALIGNMENT;
+}
+
+// FNV-1a.
+uint64_t hashBytes(uint64_t hash, const char* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= uint8_t(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// The hash covers the beginning, the middle and the end of the source,
+// which is enough to notice a rewritten file that kept its size and time
+// without reading gigabytes on every run.
+bool getSourceKey(const std::string& filename, MeshSourceKey& key)
+{
+    boost::system::error_code error;
+    key.size = fs::file_size(filename, error);
+    if (error)
+        return false;
+    key.time = fs::last_write_time(filename, error);
+    if (error)
+        return false;
+
+    try {
+        const MappedFile file(filename);
+        const size_t sampleSize = std::min(file.size(), HASH_SAMPLE_SIZE);
+        const size_t offsets[3] = {
+            0,
+            (file.size() - sampleSize) / 2,
+            file.size() - sampleSize
+        };
+
+        key.hash = 14695981039346656037ull;
+        for (size_t i = 0; i < 3; ++i) {
+            key.hash = hashBytes(key.hash, file.data() + offsets[i], sampleSize);
+        }
+    } catch (const MappedFileError&) {
+        return false;
+    }
+    return true;
+}
+
+bool isSameSource(const MeshSourceKey& a, const MeshSourceKey& b)
+{
+    return a.size == b.size && a.time == b.time && a.hash == b.hash;
+}
+
+// Sizes the sections may have for the counts of the header; optional
+// sections may also be empty.
+void getSectionSizes(
+        const Header& header,
+        uint64_t sizes[SECTION_QTY],
+        bool isOptional[SECTION_QTY])
+{
+    std::fill(isOptional, isOptional + SECTION_QTY, true);
+    isOptional[SECTION_POSITIONS] = false;
+    isOptional[SECTION_TEXTURE_COORDS] = false;
+    isOptional[SECTION_NORMALS] = false;
+    isOptional[SECTION_INDICES] = false;
+
+    sizes[SECTION_POSITIONS] = 3 * sizeof(float) * header.vertexQty;
+    sizes[SECTION_COLORS] = 3 * header.vertexQty;
+    sizes[SECTION_TEXTURE_COORDS] = 2 * sizeof(float) * header.textureCoordQty;
+    sizes[SECTION_NORMALS] = 3 * sizeof(float) * header.normalQty;
+    sizes[SECTION_FACE_OFFSETS] = sizeof(uint64_t) * (header.faceQty + 1);
+    sizes[SECTION_INDICES] = sizeof(uint32_t) * header.cornerQty;
+    sizes[SECTION_TEXTURE_INDICES] = sizeof(uint32_t) * header.cornerQty;
+    sizes[SECTION_NORMAL_INDICES] = sizeof(uint32_t) * header.cornerQty;
+    // Any length.
+    sizes[SECTION_MTLLIB] = header.sections[SECTION_MTLLIB].size;
+    sizes[SECTION_USEMTL] = header.sections[SECTION_USEMTL].size;
+}
+
+bool isValid(const Header& header, size_t fileSize)
+{
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+        || header.version != VERSION
+        || header.byteOrderMark != BYTE_ORDER_MARK)
+    {
+        return false;
+    }
+
+    uint64_t sizes[SECTION_QTY];
+    bool isOptional[SECTION_QTY];
+    getSectionSizes(header, sizes, isOptional);
+
+    for (int i = 0; i < SECTION_QTY; ++i) {
+        const SectionEntry& section = header.sections[i];
+        if (section.offset % SECTION_ALIGNMENT != 0
+            || section.offset > fileSize
+            || section.size > fileSize - section.offset
+            || (section.size != sizes[i]
+                && !(isOptional[i] && section.size == 0)))
+        {
+            return false;
+        }
+    }
+
+    return header.sections[SECTION_FACE_OFFSETS].size != 0
+           || header.cornerQty == 3 * header.faceQty;
+}
+
+template <typename T>
+const T* getSection(const MappedFile& file, const Header& header, Section section)
+{
+    const SectionEntry& entry = header.sections[section];
+    return entry.size == 0
+           ? 0 : reinterpret_cast<const T*>(file.data() + entry.offset);
+}
+
+std::string getString(const MappedFile& file, const Header& header, Section section)
+{
+    const SectionEntry& entry = header.sections[section];
+    return std::string(file.data() + entry.offset, entry.size);
+}
+
+} // anonymous namespace
+
+MeshView::MeshView()
+    : vertexQty(0)
+    , positions(0)
+    , colors(0)
+    , textureCoordQty(0)
+    , textureCoords(0)
+    , normalQty(0)
+    , normals(0)
+    , faceQty(0)
+    , faceOffsets(0)
+    , cornerQty(0)
+    , indices(0)
+    , textureIndices(0)
+    , normalIndices(0)
+{}
+
+MeshCache::MeshCache()
+    : m_hasSource(false)
+{}
+
+MeshCache::~MeshCache()
+{}
+
+bool MeshCache::open(const std::string& sourceFilename)
+{
+    m_mesh = MeshView();
+    m_file.reset();
+
+    m_sourceFilename = sourceFilename;
+    m_hasSource = getSourceKey(sourceFilename, m_source);
+
+    const std::string filename = getMeshCacheFilename(sourceFilename);
+    boost::system::error_code error;
+    if (!m_hasSource || !fs::exists(filename, error))
+        return false;
+
+    try {
+        m_file.reset(new MappedFile(filename));
+    } catch (const MappedFileError& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+
+    Header header;
+    if (m_file->size() < sizeof(header)) {
+        std::cerr << "Ignoring broken mesh cache " << filename << '\n';
+        m_file.reset();
+        return false;
+    }
+    std::memcpy(&header, m_file->data(), sizeof(header));
+
+    if (!isValid(header, m_file->size())) {
+        std::cerr << "Ignoring broken mesh cache " << filename << '\n';
+        m_file.reset();
+        return false;
+    }
+    if (!isSameSource(header.source, m_source)) {
+        m_file.reset();
+        return false;
+    }
+
+    const MappedFile& file = *m_file;
+    m_mesh.vertexQty = header.vertexQty;
+    m_mesh.positions = getSection<float>(file, header, SECTION_POSITIONS);
+    m_mesh.colors = getSection<uint8_t>(file, header, SECTION_COLORS);
+    m_mesh.textureCoordQty = header.textureCoordQty;
+    m_mesh.textureCoords = getSection<float>(file, header, SECTION_TEXTURE_COORDS);
+    m_mesh.normalQty = header.normalQty;
+    m_mesh.normals = getSection<float>(file, header, SECTION_NORMALS);
+    m_mesh.faceQty = header.faceQty;
+    m_mesh.faceOffsets = getSection<uint64_t>(file, header, SECTION_FACE_OFFSETS);
+    m_mesh.cornerQty = header.cornerQty;
+    m_mesh.indices = getSection<uint32_t>(file, header, SECTION_INDICES);
+    m_mesh.textureIndices =
+        getSection<uint32_t>(file, header, SECTION_TEXTURE_INDICES);
+    m_mesh.normalIndices =
+        getSection<uint32_t>(file, header, SECTION_NORMAL_INDICES);
+    m_mesh.mtllib = getString(file, header, SECTION_MTLLIB);
+    m_mesh.usemtl = getString(file, header, SECTION_USEMTL);
+    return true;
+}
+
+// Written under a temporary name and renamed, so that runs sharing an
+// input never see a half written cache.
+bool MeshCache::write(const MeshView& mesh) const
+{
+    const std::string filename = getMeshCacheFilename(m_sourceFilename);
+    if (!m_hasSource) {
+        std::cerr << "Can't write mesh cache " << filename << '\n';
+        return false;
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.source = m_source;
+    header.vertexQty = mesh.vertexQty;
+    header.textureCoordQty = mesh.textureCoordQty;
+    header.normalQty = mesh.normalQty;
+    header.faceQty = mesh.faceQty;
+    header.cornerQty = mesh.cornerQty;
+
+    const void* data[SECTION_QTY] = {
+        mesh.positions,
+        mesh.colors,
+        mesh.textureCoords,
+        mesh.normals,
+        mesh.faceOffsets,
+        mesh.indices,
+        mesh.textureIndices,
+        mesh.normalIndices,
+        mesh.mtllib.data(),
+        mesh.usemtl.data()
+    };
+    header.sections[SECTION_MTLLIB].size = mesh.mtllib.size();
+    header.sections[SECTION_USEMTL].size = mesh.usemtl.size();
+
+    uint64_t sizes[SECTION_QTY];
+    bool isOptional[SECTION_QTY];
+    getSectionSizes(header, sizes, isOptional);
+
+    uint64_t offset = align(sizeof(header));
+    for (int i = 0; i < SECTION_QTY; ++i) {
+        header.sections[i].offset = offset;
+        header.sections[i].size = data[i] ? sizes[i] : 0;
+        offset = align(offset + header.sections[i].size);
+    }
+
+    const fs::path partPath =
+        fs::unique_path(filename + ".%%%%%%%%.part");
+    std::ofstream f(partPath.string().c_str(),
+                    std::ios::out | std::ios::binary);
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const std::vector<char> padding(SECTION_ALIGNMENT, 0);
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < SECTION_QTY && f; ++i) {
+        const SectionEntry& section = header.sections[i];
+        f.write(&padding[0], section.offset - written);
+        f.write(static_cast<const char*>(data[i]), section.size);
+        written = section.offset + section.size;
+    }
+    f.close();
+
+    boost::system::error_code error;
+    bool isWritten = !f.fail();
+    if (isWritten) {
+        fs::rename(partPath, filename, error);
+        isWritten = !error;
+    }
+    if (!isWritten) {
+        std::cerr << "Can't write mesh cache " << filename << '\n';
+        fs::remove(partPath, error);
+        return false;
+    }
+    return true;
+}
+
+std::string getMeshCacheFilename(const std::string& sourceFilename)
+{
+    return sourceFilename + ".mcache";
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile;
+
+// The arrays of a mesh. Missing arrays are null and their counts zero.
+struct MeshView {
+    MeshView();
+
+    size_t vertexQty;
+    const float* positions;         // x, y, z of every vertex
+    const uint8_t* colors;          // r, g, b of every vertex
+
+    size_t textureCoordQty;
+    const float* textureCoords;     // u, v
+    size_t normalQty;
+    const float* normals;           // x, y, z
+
+    // Face i has the corners [faceOffsets[i], faceOffsets[i + 1]), or the
+    // corners 3i to 3i + 2 when there are no offsets.
+    size_t faceQty;
+    const uint64_t* faceOffsets;
+    size_t cornerQty;
+    const uint32_t* indices;
+    // uint32_t(-1) for corners without a texture or normal index.
+    const uint32_t* textureIndices;
+    const uint32_t* normalIndices;
+
+    // Empty when missing.
+    std::string mtllib;
+    std::string usemtl;
+};
+
+// What a cache is tied to: the size, modification time and a hash of
+// samples of the source.
+struct MeshSourceKey {
+    uint64_t size;
+    int64_t time;
+    uint64_t hash;
+};
+
+// A parsed mesh kept next to its source file as <source>.mcache. The
+// arrays are stored as they are in memory, so an opened cache is used
+// right from the mapping. The cache is ignored once the source changes.
+class MeshCache {
+public:
+    MeshCache();
+    ~MeshCache();
+
+    // False when the source has no cache, or it's stale or broken. The
+    // source key is taken here, before the caller parses the source.
+    bool open(const std::string& sourceFilename);
+
+    // Points into the mapping, valid while the cache is open.
+    const MeshView& getMesh() const { return m_mesh; }
+
+    // Writes the cache of the source given to open(), tied to the source
+    // as it was then, so that a source changed while being parsed leaves
+    // a stale cache rather than a wrong one. Failures are reported to
+    // std::cerr only, since the cache is made again on the next run
+    // anyway. Returns false when the cache isn't written.
+    bool write(const MeshView& mesh) const;
+
+private:
+    boost::scoped_ptr<MappedFile> m_file;
+    MeshView m_mesh;
+    std::string m_sourceFilename;
+    MeshSourceKey m_source;
+    bool m_hasSource;
+};
+
+std::string getMeshCacheFilename(const std::string& sourceFilename);
@@ -0,0 +1,233 @@
+#include "obfuscation-kernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+// Neither kernel may use fused multiply-add: it would change the last bit
+// compared to the plain float and double code the results must match.
+
+namespace
+{
+
+float norm(float x, float y, float z)
+{
+    return std::sqrt(x * x + y * y + z * z);
+}
+
+void calcScalar(
+        const TriangleBatch& triangles,
+        ObfuscationRounding rounding,
+        ObfuscationPoints& points)
+{
+    const float (&a)[3][OBFUSCATION_BATCH_SIZE] = triangles.corners[0];
+    const float (&b)[3][OBFUSCATION_BATCH_SIZE] = triangles.corners[1];
+    const float (&c)[3][OBFUSCATION_BATCH_SIZE] = triangles.corners[2];
+
+    for (size_t i = 0; i < OBFUSCATION_BATCH_SIZE; ++i) {
+        float u[3], v[3], t[3];
+        for (int k = 0; k < 3; ++k) {
+            u[k] = b[k][i] - a[k][i];
+            v[k] = c[k][i] - a[k][i];
+            t[k] = c[k][i] - b[k][i];
+        }
+
+        float n[3];
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+
+        const double l = 0.5 * std::min(norm(u[0], u[1], u[2]),
+                                        std::min(norm(v[0], v[1], v[2]),
+                                                 norm(t[0], t[1], t[2])));
+        const double normN = norm(n[0], n[1], n[2]);
+        points.isValid[i] = !(normN == 0);
+
+        for (int k = 0; k < 3; ++k) {
+            const float sum = a[k][i] + b[k][i] + c[k][i];
+            if (rounding == ROUND_EVERY_STEP) {
+                const float center = sum / 3.0;
+                const float ln = l * n[k];
+                const float offset = ln / normN;
+                points.m[k][i] = center - offset;
+            } else {
+                const float center = sum / 3.0f;
+                points.m[k][i] = center - l * n[k] / normN;
+            }
+            points.d[k][i] = (a[k][i] + b[k][i]) / 2.0f;
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+struct Doubles {
+    __m256d lo;
+    __m256d hi;
+};
+
+AVX2_TARGET inline Doubles toDoubles(__m256 x)
+{
+    Doubles r;
+    r.lo = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+    r.hi = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+    return r;
+}
+
+AVX2_TARGET inline __m256 toFloats(const Doubles& x)
+{
+    return _mm256_insertf128_ps(
+            _mm256_castps128_ps256(_mm256_cvtpd_ps(x.lo)),
+            _mm256_cvtpd_ps(x.hi), 1);
+}
+
+AVX2_TARGET inline Doubles mul(const Doubles& x, const Doubles& y)
+{
+    Doubles r;
+    r.lo = _mm256_mul_pd(x.lo, y.lo);
+    r.hi = _mm256_mul_pd(x.hi, y.hi);
+    return r;
+}
+
+AVX2_TARGET inline Doubles div(const Doubles& x, const Doubles& y)
+{
+    Doubles r;
+    r.lo = _mm256_div_pd(x.lo, y.lo);
+    r.hi = _mm256_div_pd(x.hi, y.hi);
+    return r;
+}
+
+AVX2_TARGET inline Doubles sub(const Doubles& x, const Doubles& y)
+{
+    Doubles r;
+    r.lo = _mm256_sub_pd(x.lo, y.lo);
+    r.hi = _mm256_sub_pd(x.hi, y.hi);
+    return r;
+}
+
+AVX2_TARGET inline Doubles broadcast(double x)
+{
+    Doubles r;
+    r.lo = r.hi = _mm256_set1_pd(x);
+    return r;
+}
+
+AVX2_TARGET inline __m256 norm(const __m256 x[3])
+{
+    return _mm256_sqrt_ps(_mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(x[0], x[0]), _mm256_mul_ps(x[1], x[1])),
+            _mm256_mul_ps(x[2], x[2])));
+}
+
+AVX2_TARGET void calcAvx2(
+        const TriangleBatch& triangles,
+        ObfuscationRounding rounding,
+        ObfuscationPoints& points)
+{
+    __m256 a[3], b[3], c[3], u[3], v[3], t[3];
+    for (int k = 0; k < 3; ++k) {
+        a[k] = _mm256_loadu_ps(triangles.corners[0][k]);
+        b[k] = _mm256_loadu_ps(triangles.corners[1][k]);
+        c[k] = _mm256_loadu_ps(triangles.corners[2][k]);
+        u[k] = _mm256_sub_ps(b[k], a[k]);
+        v[k] = _mm256_sub_ps(c[k], a[k]);
+        t[k] = _mm256_sub_ps(c[k], b[k]);
+    }
+
+    __m256 n[3];
+    n[0] = _mm256_sub_ps(_mm256_mul_ps(u[1], v[2]), _mm256_mul_ps(u[2], v[1]));
+    n[1] = _mm256_sub_ps(_mm256_mul_ps(u[2], v[0]), _mm256_mul_ps(u[0], v[2]));
+    n[2] = _mm256_sub_ps(_mm256_mul_ps(u[0], v[1]), _mm256_mul_ps(u[1], v[0]));
+
+    // _mm256_min_ps(x, y) is (x < y ? x : y) and std::min(x, y) is
+    // (y < x ? y : x), so the arguments are swapped to keep NaN handling.
+    const __m256 minEdge = _mm256_min_ps(_mm256_min_ps(norm(t), norm(v)),
+                                         norm(u));
+    const Doubles l = mul(broadcast(0.5), toDoubles(minEdge));
+
+    const __m256 normN = norm(n);
+    const Doubles normND = toDoubles(normN);
+    const int validMask = _mm256_movemask_ps(
+            _mm256_cmp_ps(normN, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+    for (size_t i = 0; i < OBFUSCATION_BATCH_SIZE; ++i) {
+        points.isValid[i] = (validMask >> i) & 1;
+    }
+
+    const __m256 half = _mm256_set1_ps(0.5f);
+    for (int k = 0; k < 3; ++k) {
+        const __m256 sum = _mm256_add_ps(_mm256_add_ps(a[k], b[k]), c[k]);
+        __m256 m;
+        if (rounding == ROUND_EVERY_STEP) {
+            const __m256 center = toFloats(div(toDoubles(sum), broadcast(3.0)));
+            const __m256 ln = toFloats(mul(l, toDoubles(n[k])));
+            const __m256 offset = toFloats(div(toDoubles(ln), normND));
+            m = _mm256_sub_ps(center, offset);
+        } else {
+            const __m256 center = _mm256_div_ps(sum, _mm256_set1_ps(3.0f));
+            m = toFloats(sub(toDoubles(center),
+                             div(mul(l, toDoubles(n[k])), normND)));
+        }
+        _mm256_storeu_ps(points.m[k], m);
+        // Halving is exact, so it can be a multiplication.
+        _mm256_storeu_ps(points.d[k],
+                         _mm256_mul_ps(_mm256_add_ps(a[k], b[k]), half));
+    }
+}
+
+ObfuscationKernel detectKernel()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2")
+        ? OBFUSCATION_KERNEL_AVX2
+        : OBFUSCATION_KERNEL_SCALAR;
+}
+
+#else // HAVE_AVX2_KERNEL
+
+ObfuscationKernel detectKernel()
+{
+    return OBFUSCATION_KERNEL_SCALAR;
+}
+
+#endif // HAVE_AVX2_KERNEL
+
+} // anonymous namespace
+
+ObfuscationKernel bestObfuscationKernel()
+{
+    static const ObfuscationKernel kernel = detectKernel();
+    return kernel;
+}
+
+const char* obfuscationKernelName(ObfuscationKernel kernel)
+{
+    switch (kernel) {
+    case OBFUSCATION_KERNEL_SCALAR:
+        return "scalar";
+    case OBFUSCATION_KERNEL_AVX2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+void calcObfuscationPoints(
+        const TriangleBatch& triangles,
+        ObfuscationRounding rounding,
+        ObfuscationPoints& points,
+        ObfuscationKernel kernel)
+{
+#ifdef HAVE_AVX2_KERNEL
+    if (kernel == OBFUSCATION_KERNEL_AVX2) {
+        calcAvx2(triangles, rounding, points);
+        return;
+    }
+#endif
+    calcScalar(triangles, rounding, points);
+}
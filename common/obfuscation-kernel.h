@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+// Both obfuscators add two points to a triangle abc: m, in front of the
+// centroid at half the shortest edge along the normal, and d, the middle
+// of ab. This kernel computes them for a batch of triangles stored as
+// structure of arrays.
+
+const size_t OBFUSCATION_BATCH_SIZE = 8;
+
+struct TriangleBatch {
+    // corners[k][axis][i] is coordinate axis of corner k of triangle i.
+    float corners[3][3][OBFUSCATION_BATCH_SIZE];
+};
+
+struct ObfuscationPoints {
+    float m[3][OBFUSCATION_BATCH_SIZE];
+    float d[3][OBFUSCATION_BATCH_SIZE];
+    // False when the normal has zero length, m is not finite then.
+    bool isValid[OBFUSCATION_BATCH_SIZE];
+};
+
+// The obfuscators round intermediate values differently, and their output
+// must not change with the kernel.
+enum ObfuscationRounding {
+    // pcl::PointXYZRGB arithmetic in obfuscate: every step that goes
+    // through double is rounded back to float.
+    ROUND_EVERY_STEP,
+    // ublas expressions in obfuscate-with-texture: the centroid and the
+    // normal are float, m is computed from them in double and rounded once.
+    ROUND_RESULT_ONLY
+};
+
+enum ObfuscationKernel {
+    OBFUSCATION_KERNEL_SCALAR,
+    OBFUSCATION_KERNEL_AVX2
+};
+
+// The fastest kernel this CPU runs, detected once.
+ObfuscationKernel bestObfuscationKernel();
+
+const char* obfuscationKernelName(ObfuscationKernel kernel);
+
+// All kernels give bit-identical results.
+void calcObfuscationPoints(
+        const TriangleBatch& triangles,
+        ObfuscationRounding rounding,
+        ObfuscationPoints& points,
+        ObfuscationKernel kernel = bestObfuscationKernel());
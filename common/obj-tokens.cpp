@@ -0,0 +1,93 @@
+#include "obj-tokens.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+
+namespace
+{
+
+ObjError badToken(const char* what, ObjToken token)
+{
+    return ObjError(std::string("bad ") + what + " '" + std::string(token) + "'");
+}
+
+uint32_t parseIndex(ObjToken token, size_t qty)
+{
+    const bool isRelative = !token.empty() && token[0] == '-';
+    if (isRelative) {
+        token.remove_prefix(1);
+    }
+
+    uint64_t value = 0;
+    const char* end = token.data() + token.size();
+    const std::from_chars_result result =
+        std::from_chars(token.data(), end, value);
+    if (result.ec != std::errc() || result.ptr != end || value == 0)
+        throw badToken("index", token);
+
+    if (isRelative) {
+        if (value > qty)
+            throw badToken("relative index", token);
+        return uint32_t(qty - value);
+    }
+    if (value > OBJ_NO_INDEX)
+        throw badToken("index", token);
+    return uint32_t(value - 1);
+}
+
+} // anonymous namespace
+
+float parseObjFloat(ObjToken token)
+{
+    if (!token.empty() && token[0] == '+') {
+        token.remove_prefix(1);
+    }
+
+    float value = 0;
+    const char* end = token.data() + token.size();
+    const std::from_chars_result result =
+        std::from_chars(token.data(), end, value);
+    if (result.ptr != end
+        || (result.ec != std::errc()
+            && result.ec != std::errc::result_out_of_range))
+    {
+        throw badToken("number", token);
+    }
+    if (result.ec == std::errc())
+        return value;
+
+    // from_chars leaves out of range values unset.
+    const std::string text(token);
+    value = std::strtof(text.c_str(), 0);
+    if (std::isinf(value))
+        throw badToken("number", token);
+    return value;
+}
+
+ObjCorner parseObjCorner(
+        ObjToken token,
+        size_t vertexQty,
+        size_t textureQty,
+        size_t normalQty)
+{
+    ObjCorner corner;
+    corner.textureIndex = OBJ_NO_INDEX;
+    corner.normalIndex = OBJ_NO_INDEX;
+
+    const size_t slash = token.find('/');
+    corner.index = parseIndex(token.substr(0, slash), vertexQty);
+    if (slash == ObjToken::npos)
+        return corner;
+
+    token.remove_prefix(slash + 1);
+    const size_t secondSlash = token.find('/');
+    const ObjToken texture = token.substr(0, secondSlash);
+    if (!texture.empty()) {
+        corner.textureIndex = parseIndex(texture, textureQty);
+    }
+    if (secondSlash != ObjToken::npos) {
+        corner.normalIndex = parseIndex(token.substr(secondSlash + 1), normalQty);
+    }
+    return corner;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// The tokens and numbers of OBJ lines, read in place from a mapped file
+// with std::from_chars. Needs C++17.
+
+class ObjError : public std::runtime_error
+{
+public:
+    explicit ObjError(const std::string& message)
+        : std::runtime_error(message)
+    {}
+};
+
+typedef std::string_view ObjToken;
+
+// Stands for a missing texture or normal index.
+const uint32_t OBJ_NO_INDEX = uint32_t(-1);
+
+// Tokens of a line separated by spaces and tabs, pointing into the file.
+class ObjLineTokens {
+public:
+    ObjLineTokens(const char* begin, const char* end)
+        : m_position(begin)
+        , m_end(end)
+    {}
+
+    bool next(ObjToken& token)
+    {
+        while (m_position != m_end && isBlank(*m_position)) {
+            ++m_position;
+        }
+        if (m_position == m_end)
+            return false;
+
+        const char* begin = m_position;
+        while (m_position != m_end && !isBlank(*m_position)) {
+            ++m_position;
+        }
+        token = ObjToken(begin, m_position - begin);
+        return true;
+    }
+
+private:
+    static bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    const char* m_position;
+    const char* m_end;
+};
+
+// Calls function(begin, end) for every line without its line break.
+template <typename Function>
+void forEachObjLine(const char* begin, const char* end, const Function& function)
+{
+    while (begin != end) {
+        const char* lineEnd = static_cast<const char*>(
+                std::memchr(begin, '\n', end - begin));
+        const char* next = lineEnd ? lineEnd + 1 : end;
+        if (!lineEnd)
+            lineEnd = end;
+        if (lineEnd != begin && lineEnd[-1] == '\r')
+            --lineEnd;
+
+        function(begin, lineEnd);
+        begin = next;
+    }
+}
+
+// Underflow reads as zero or a denormal, like with strtof; overflow and
+// anything that isn't a number throw ObjError.
+float parseObjFloat(ObjToken token);
+
+// The corner of a face, v/vt/vn, v/vt, v//vn or v, with indices from 0.
+// OBJ indices start from 1, and negative ones count back from the last
+// element defined before the face, of which there are vertexQty,
+// textureQty and normalQty. Indices after those are left to the caller
+// to check. Throws ObjError.
+struct ObjCorner {
+    uint32_t index;
+    uint32_t textureIndex;
+    uint32_t normalIndex;
+};
+
+ObjCorner parseObjCorner(
+        ObjToken token,
+        size_t vertexQty,
+        size_t textureQty,
+        size_t normalQty);
@@ -0,0 +1,420 @@
+#include "ply-header.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "mapped-file.h"
+
+namespace
+{
+
+PlyType parseType(const std::string& name)
+{
+    if (name == "char" || name == "int8")
+        return PLY_INT8;
+    if (name == "uchar" || name == "uint8")
+        return PLY_UINT8;
+    if (name == "short" || name == "int16")
+        return PLY_INT16;
+    if (name == "ushort" || name == "uint16")
+        return PLY_UINT16;
+    if (name == "int" || name == "int32")
+        return PLY_INT32;
+    if (name == "uint" || name == "uint32")
+        return PLY_UINT32;
+    if (name == "float" || name == "float32")
+        return PLY_FLOAT32;
+    if (name == "double" || name == "float64")
+        return PLY_FLOAT64;
+    throw PlyError("unknown PLY property type " + name);
+}
+
+void cutCarriageReturn(std::string& line)
+{
+    if (!line.empty() && line[line.size() - 1] == '\r')
+        line.resize(line.size() - 1);
+}
+
+const char* FACE_INDICES_NAMES[] = { "vertex_indices", "vertex_index", 0 };
+
+bool isSpace(char c)
+{
+    return std::isspace((unsigned char) c) != 0;
+}
+
+// Skips to the end of the next whitespace separated token; false when
+// there is none.
+bool skipToken(const char*& p, const char* end, const char** token = 0)
+{
+    while (p != end && isSpace(*p)) {
+        ++p;
+    }
+    if (p == end)
+        return false;
+    if (token)
+        *token = p;
+    while (p != end && !isSpace(*p)) {
+        ++p;
+    }
+    return true;
+}
+
+// Reads a list count token.
+bool readCount(const char*& p, const char* end, size_t& count)
+{
+    const char* token;
+    if (!skipToken(p, end, &token))
+        return false;
+    count = 0;
+    for (const char* c = token; c != p; ++c) {
+        if (*c < '0' || *c > '9')
+            return false;
+        count = 10 * count + size_t(*c - '0');
+    }
+    return true;
+}
+
+// Walks the records of an ASCII file up to the end of the faces, which
+// must all have three indices.
+void checkAsciiTriangles(const PlyHeader& header, const char* p, const char* end)
+{
+    const PlyError truncated("file is truncated");
+    for (size_t i = 0; i < header.elements.size(); ++i) {
+        const PlyElement& element = header.elements[i];
+        const bool isFace = element.name == "face";
+        const int indicesProperty = isFace ? findFaceIndices(element) : -1;
+        for (size_t record = 0; record < element.count; ++record) {
+            for (size_t j = 0; j < element.properties.size(); ++j) {
+                if (!element.properties[j].isList) {
+                    if (!skipToken(p, end))
+                        throw truncated;
+                    continue;
+                }
+                size_t count;
+                if (!readCount(p, end, count))
+                    throw truncated;
+                if (int(j) == indicesProperty && count != 3)
+                    throw PlyError("faces are not all triangles");
+                for (size_t k = 0; k < count; ++k) {
+                    if (!skipToken(p, end))
+                        throw truncated;
+                }
+            }
+        }
+        if (isFace)
+            return;
+    }
+}
+
+} // anonymous namespace
+
+size_t plyTypeSize(PlyType type)
+{
+    switch (type) {
+    case PLY_INT8:
+    case PLY_UINT8:
+        return 1;
+    case PLY_INT16:
+    case PLY_UINT16:
+        return 2;
+    case PLY_INT32:
+    case PLY_UINT32:
+    case PLY_FLOAT32:
+        return 4;
+    case PLY_FLOAT64:
+        return 8;
+    }
+    return 0;
+}
+
+const char* plyTypeName(PlyType type)
+{
+    switch (type) {
+    case PLY_INT8:
+        return "char";
+    case PLY_UINT8:
+        return "uchar";
+    case PLY_INT16:
+        return "short";
+    case PLY_UINT16:
+        return "ushort";
+    case PLY_INT32:
+        return "int";
+    case PLY_UINT32:
+        return "uint";
+    case PLY_FLOAT32:
+        return "float";
+    case PLY_FLOAT64:
+        return "double";
+    }
+    return "";
+}
+
+namespace
+{
+
+template <typename T>
+T load(const char* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+} // anonymous namespace
+
+double readPlyValue(const char* p, PlyType type)
+{
+    switch (type) {
+    case PLY_INT8:
+        return load<int8_t>(p);
+    case PLY_UINT8:
+        return load<uint8_t>(p);
+    case PLY_INT16:
+        return load<int16_t>(p);
+    case PLY_UINT16:
+        return load<uint16_t>(p);
+    case PLY_INT32:
+        return load<int32_t>(p);
+    case PLY_UINT32:
+        return load<uint32_t>(p);
+    case PLY_FLOAT32:
+        return load<float>(p);
+    case PLY_FLOAT64:
+        return load<double>(p);
+    }
+    return 0;
+}
+
+int findFaceIndices(const PlyElement& face)
+{
+    for (const char** name = FACE_INDICES_NAMES; *name; ++name) {
+        int index = face.findProperty(*name);
+        if (index >= 0 && face.properties[index].isList)
+            return index;
+    }
+    return -1;
+}
+
+int PlyElement::findProperty(const std::string& propertyName) const
+{
+    for (size_t i = 0; i < properties.size(); ++i) {
+        if (properties[i].name == propertyName)
+            return i;
+    }
+    return -1;
+}
+
+size_t PlyElement::fixedRecordSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < properties.size(); ++i) {
+        if (properties[i].isList)
+            return 0;
+        size += plyTypeSize(properties[i].type);
+    }
+    return size;
+}
+
+const PlyElement* PlyHeader::findElement(const std::string& name) const
+{
+    for (size_t i = 0; i < elements.size(); ++i) {
+        if (elements[i].name == name)
+            return &elements[i];
+    }
+    return 0;
+}
+
+size_t PlyHeader::elementOffset(const std::string& name) const
+{
+    size_t offset = size;
+    for (size_t i = 0; i < elements.size() && elements[i].name != name; ++i) {
+        offset += elements[i].count * elements[i].fixedRecordSize();
+    }
+    return offset;
+}
+
+size_t PlyHeader::vertexQty() const
+{
+    const PlyElement* vertex = findElement("vertex");
+    return vertex ? vertex->count : 0;
+}
+
+size_t PlyHeader::faceQty() const
+{
+    const PlyElement* face = findElement("face");
+    return face ? face->count : 0;
+}
+
+void readPlyHeader(std::istream& s, PlyHeader& header)
+{
+    header = PlyHeader();
+    header.format = PLY_ASCII;
+
+    std::string line;
+    if (!std::getline(s, line))
+        throw PlyError("empty file");
+    cutCarriageReturn(line);
+    if (line != "ply")
+        throw PlyError("not a PLY file");
+
+    size_t size = line.size() + 1;
+    bool hasFormat = false;
+
+    for (;;) {
+        if (!std::getline(s, line))
+            throw PlyError("unexpected end of PLY header");
+        size += line.size() + 1;
+        cutCarriageReturn(line);
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+
+        if (keyword == "end_header") {
+            break;
+        } else if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format == "ascii")
+                header.format = PLY_ASCII;
+            else if (format == "binary_little_endian")
+                header.format = PLY_BINARY_LITTLE_ENDIAN;
+            else if (format == "binary_big_endian")
+                header.format = PLY_BINARY_BIG_ENDIAN;
+            else
+                throw PlyError("unknown PLY format " + format);
+            hasFormat = true;
+        } else if (keyword == "element") {
+            PlyElement element;
+            if (!(tokens >> element.name >> element.count))
+                throw PlyError("malformed element line: " + line);
+            header.elements.push_back(element);
+        } else if (keyword == "property") {
+            if (header.elements.empty())
+                throw PlyError("property before any element: " + line);
+
+            PlyProperty property;
+            std::string type;
+            tokens >> type;
+            if (type == "list") {
+                std::string countType;
+                tokens >> countType >> type;
+                property.isList = true;
+                property.countType = parseType(countType);
+            } else {
+                property.isList = false;
+                property.countType = PLY_UINT8;
+            }
+            property.type = parseType(type);
+            if (!(tokens >> property.name))
+                throw PlyError("malformed property line: " + line);
+            header.elements.back().properties.push_back(property);
+        } else if (keyword != "comment" && keyword != "obj_info"
+                   && !keyword.empty())
+        {
+            throw PlyError("unknown PLY header line: " + line);
+        }
+    }
+
+    if (!hasFormat)
+        throw PlyError("PLY header has no format line");
+
+    header.size = size;
+}
+
+void readPlyHeader(const std::string& filename, PlyHeader& header)
+{
+    std::ifstream s(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!s)
+        throw PlyError("can't open " + filename);
+    readPlyHeader(s, header);
+}
+
+void writePlyHeader(std::ostream& s, const PlyHeader& header)
+{
+    static const char* FORMAT_NAMES[] = {
+        "ascii",
+        "binary_little_endian",
+        "binary_big_endian"
+    };
+
+    s << "ply\n"
+      << "format " << FORMAT_NAMES[header.format] << " 1.0\n";
+    for (size_t i = 0; i < header.elements.size(); ++i) {
+        const PlyElement& element = header.elements[i];
+        s << "element " << element.name << ' ' << element.count << '\n';
+        for (size_t j = 0; j < element.properties.size(); ++j) {
+            const PlyProperty& property = element.properties[j];
+            s << "property ";
+            if (property.isList)
+                s << "list " << plyTypeName(property.countType) << ' ';
+            s << plyTypeName(property.type) << ' ' << property.name << '\n';
+        }
+    }
+    s << "end_header\n";
+}
+
+void checkTriangleMesh(const PlyHeader& header, const MappedFile& file)
+{
+    const PlyElement* vertex = header.findElement("vertex");
+    if (!vertex)
+        throw PlyError("no vertex element");
+    if (vertex->findProperty("x") < 0 || vertex->findProperty("y") < 0
+        || vertex->findProperty("z") < 0)
+    {
+        throw PlyError("vertices have no x, y, z");
+    }
+
+    const PlyElement* face = header.findElement("face");
+    if (!face)
+        throw PlyError("no face element");
+
+    const int indicesProperty = findFaceIndices(*face);
+    if (indicesProperty < 0)
+        throw PlyError("faces have no vertex index list");
+
+    if (header.size > file.size())
+        throw PlyError("file is truncated");
+    if (header.format == PLY_ASCII) {
+        checkAsciiTriangles(header, file.data() + header.size,
+                            file.data() + file.size());
+        return;
+    }
+
+    // Faces are triangles only if the file is as large as it would be
+    // with three indices in every list. Only whitespace may follow the
+    // last element, as some writers end files with a newline; faces with
+    // more corners would leave their binary indices there.
+    uintmax_t expectedSize = header.size;
+    for (size_t i = 0; i < header.elements.size(); ++i) {
+        const PlyElement& element = header.elements[i];
+        if (&element == face) {
+            size_t recordSize = 0;
+            for (size_t j = 0; j < face->properties.size(); ++j) {
+                const PlyProperty& property = face->properties[j];
+                if (property.isList && int(j) != indicesProperty)
+                    return;
+                recordSize += property.isList
+                    ? plyTypeSize(property.countType)
+                      + 3 * plyTypeSize(property.type)
+                    : plyTypeSize(property.type);
+            }
+            expectedSize += uintmax_t(face->count) * recordSize;
+        } else {
+            const size_t recordSize = element.fixedRecordSize();
+            if (recordSize == 0 && element.count > 0 && !element.properties.empty())
+                return;
+            expectedSize += uintmax_t(element.count) * recordSize;
+        }
+    }
+
+    if (file.size() < expectedSize)
+        throw PlyError("file is truncated or has non-triangle faces");
+    for (size_t i = size_t(expectedSize); i < file.size(); ++i) {
+        if (!isSpace(file.data()[i]))
+            throw PlyError("file has non-triangle faces or trailing data");
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+class PlyError : public std::runtime_error
+{
+public:
+    explicit PlyError(const std::string& message)
+        : std::runtime_error(message)
+    {}
+};
+
+enum PlyFormat {
+    PLY_ASCII,
+    PLY_BINARY_LITTLE_ENDIAN,
+    PLY_BINARY_BIG_ENDIAN
+};
+
+enum PlyType {
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64
+};
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    bool isList;
+    PlyType countType;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+
+    // Index of the property or -1.
+    int findProperty(const std::string& name) const;
+
+    // Size of one record in a binary file, 0 if the element has lists.
+    size_t fixedRecordSize() const;
+};
+
+struct PlyHeader {
+    PlyFormat format;
+    std::vector<PlyElement> elements;
+    // Offset of the first data byte in the file.
+    size_t size;
+
+    const PlyElement* findElement(const std::string& name) const;
+
+    // Offset of the element's data in a binary file; only valid when all
+    // preceding elements have fixed size records.
+    size_t elementOffset(const std::string& name) const;
+
+    size_t vertexQty() const;
+    size_t faceQty() const;
+};
+
+size_t plyTypeSize(PlyType type);
+const char* plyTypeName(PlyType type);
+
+// Index of the vertex index list of a face element or -1.
+int findFaceIndices(const PlyElement& face);
+
+// Value of a binary little endian property stored at p.
+double readPlyValue(const char* p, PlyType type);
+
+// Reads only the header; the stream is left at the first data byte.
+// Throws PlyError on malformed headers.
+void readPlyHeader(std::istream& s, PlyHeader& header);
+void readPlyHeader(const std::string& filename, PlyHeader& header);
+
+// Writes the header up to and including end_header.
+void writePlyHeader(std::ostream& s, const PlyHeader& header);
+
+// Checks that the file describes a triangle mesh: a vertex element with
+// x, y, z and a face element with a vertex index list. Binary files whose
+// records can be sized from the header must have the size of triangles in
+// every face, give or take trailing whitespace; the face lists of ASCII
+// files are read up to the last face. Throws PlyError with the reason
+// otherwise.
+void checkTriangleMesh(const PlyHeader& header, const MappedFile& file);
@@ -0,0 +1,217 @@
+#include "ply-mesh.h"
+
+#include "mapped-file.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+const char* COORD_NAMES[] = { "x", "y", "z" };
+const char* COLOR_NAMES[] = { "red", "green", "blue" };
+
+// Walks the records of the mapped file and throws past its end.
+class RecordReader {
+public:
+    RecordReader(const MappedFile& file, size_t offset)
+        : m_p(file.data() + offset)
+        , m_end(file.data() + file.size())
+    {}
+
+    const char* take(size_t size)
+    {
+        if (size_t(m_end - m_p) < size)
+            throw PlyError("file is truncated");
+        const char* p = m_p;
+        m_p += size;
+        return p;
+    }
+
+    double read(PlyType type)
+    {
+        return readPlyValue(take(plyTypeSize(type)), type);
+    }
+
+    // Skips one value of a property, or all of a list.
+    void skip(const PlyProperty& property)
+    {
+        if (property.isList) {
+            const size_t count = size_t(read(property.countType));
+            take(count * plyTypeSize(property.type));
+        } else {
+            take(plyTypeSize(property.type));
+        }
+    }
+
+private:
+    const char* m_p;
+    const char* m_end;
+};
+
+void readVertices(const PlyElement& vertex, RecordReader& reader, TriangleMesh& mesh)
+{
+    int coords[3];
+    for (int i = 0; i < 3; ++i) {
+        coords[i] = vertex.findProperty(COORD_NAMES[i]);
+        if (coords[i] < 0 || vertex.properties[coords[i]].isList)
+            throw PlyError(std::string("vertices have no ") + COORD_NAMES[i]);
+    }
+    int colors[3];
+    bool hasColors = true;
+    for (int i = 0; i < 3; ++i) {
+        colors[i] = vertex.findProperty(COLOR_NAMES[i]);
+        if (colors[i] < 0 || vertex.properties[colors[i]].isList
+            || vertex.properties[colors[i]].type != PLY_UINT8)
+        {
+            hasColors = false;
+        }
+    }
+
+    mesh.positions.resize(3 * vertex.count);
+    mesh.colors.resize(hasColors ? 3 * vertex.count : 0);
+    for (size_t v = 0; v < vertex.count; ++v) {
+        for (size_t p = 0; p < vertex.properties.size(); ++p) {
+            const PlyProperty& property = vertex.properties[p];
+            if (property.isList) {
+                reader.skip(property);
+                continue;
+            }
+            const double value = reader.read(property.type);
+            for (int i = 0; i < 3; ++i) {
+                if (int(p) == coords[i])
+                    mesh.positions[3 * v + i] = float(value);
+                if (hasColors && int(p) == colors[i])
+                    mesh.colors[3 * v + i] = uint8_t(value);
+            }
+        }
+    }
+}
+
+void readFaces(const PlyElement& face, RecordReader& reader, TriangleMesh& mesh)
+{
+    const int indicesProperty = findFaceIndices(face);
+    if (indicesProperty < 0)
+        throw PlyError("faces have no vertex indices");
+
+    const size_t vertexQty = mesh.getVertexQty();
+    mesh.indices.reserve(3 * face.count);
+    std::vector<uint32_t> polygon;
+    for (size_t f = 0; f < face.count; ++f) {
+        for (size_t p = 0; p < face.properties.size(); ++p) {
+            const PlyProperty& property = face.properties[p];
+            if (int(p) != indicesProperty) {
+                reader.skip(property);
+                continue;
+            }
+
+            polygon.resize(size_t(reader.read(property.countType)));
+            for (size_t i = 0; i < polygon.size(); ++i) {
+                const double index = reader.read(property.type);
+                if (index < 0 || index >= vertexQty)
+                    throw PlyError("face refers to a missing vertex");
+                polygon[i] = uint32_t(index);
+            }
+            for (size_t i = 2; i < polygon.size(); ++i) {
+                mesh.indices.push_back(polygon[0]);
+                mesh.indices.push_back(polygon[i - 1]);
+                mesh.indices.push_back(polygon[i]);
+            }
+        }
+    }
+}
+
+PlyProperty makeProperty(const char* name, PlyType type)
+{
+    PlyProperty property;
+    property.name = name;
+    property.type = type;
+    property.isList = false;
+    property.countType = PLY_UINT8;
+    return property;
+}
+
+} // anonymous namespace
+
+void readPlyMesh(const std::string& filename, TriangleMesh& mesh)
+{
+    PlyHeader header;
+    readPlyHeader(filename, header);
+    if (header.format != PLY_BINARY_LITTLE_ENDIAN)
+        throw PlyError(filename + " is not a binary little endian PLY file");
+    if (!header.findElement("vertex") || !header.findElement("face"))
+        throw PlyError(filename + " has no vertices or faces");
+
+    const MappedFile file(filename);
+    file.adviseSequential(header.size, file.size() - header.size);
+    RecordReader reader(file, header.size);
+    mesh = TriangleMesh();
+    for (size_t i = 0; i < header.elements.size(); ++i) {
+        const PlyElement& element = header.elements[i];
+        if (element.name == "vertex") {
+            readVertices(element, reader, mesh);
+        } else if (element.name == "face") {
+            readFaces(element, reader, mesh);
+            break;
+        } else {
+            for (size_t r = 0; r < element.count; ++r) {
+                for (size_t p = 0; p < element.properties.size(); ++p) {
+                    reader.skip(element.properties[p]);
+                }
+            }
+        }
+    }
+}
+
+void writePlyMesh(const std::string& filename, const TriangleMesh& mesh)
+{
+    const bool hasColors = !mesh.colors.empty();
+    PlyHeader header;
+    header.format = PLY_BINARY_LITTLE_ENDIAN;
+    header.size = 0;
+
+    PlyElement vertex;
+    vertex.name = "vertex";
+    vertex.count = mesh.getVertexQty();
+    for (int i = 0; i < 3; ++i) {
+        vertex.properties.push_back(makeProperty(COORD_NAMES[i], PLY_FLOAT32));
+    }
+    if (hasColors) {
+        for (int i = 0; i < 3; ++i) {
+            vertex.properties.push_back(makeProperty(COLOR_NAMES[i], PLY_UINT8));
+        }
+    }
+    PlyElement face;
+    face.name = "face";
+    face.count = mesh.getTriangleQty();
+    face.properties.push_back(makeProperty("vertex_indices", PLY_INT32));
+    face.properties.back().isList = true;
+    header.elements.push_back(vertex);
+    header.elements.push_back(face);
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    writePlyHeader(f, header);
+    std::vector<char> records(vertex.count * (hasColors ? 15 : 12));
+    char* p = records.data();
+    for (size_t v = 0; v < vertex.count; ++v) {
+        std::memcpy(p, &mesh.positions[3 * v], 12);
+        p += 12;
+        if (hasColors) {
+            std::memcpy(p, &mesh.colors[3 * v], 3);
+            p += 3;
+        }
+    }
+    f.write(records.data(), std::streamsize(records.size()));
+
+    records.resize(face.count * 13);
+    p = records.data();
+    for (size_t t = 0; t < face.count; ++t) {
+        *p++ = 3;
+        std::memcpy(p, &mesh.indices[3 * t], 12);
+        p += 12;
+    }
+    f.write(records.data(), std::streamsize(records.size()));
+    f.close();
+    if (f.fail())
+        throw PlyError("can't write " + filename);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include "ply-header.h"
+#include "triangle-mesh.h"
+
+// Reads a binary little endian PLY file: the x, y, z of the vertices,
+// their red, green and blue when all three are bytes, and the faces, with
+// polygons split into triangle fans. Other elements and properties are
+// skipped. Throws PlyError or MappedFileError.
+void readPlyMesh(const std::string& filename, TriangleMesh& mesh);
+
+// Writes a binary little endian PLY file with float positions, byte
+// colors when the mesh has them and int triangles. Throws PlyError when
+// the file can't be written.
+void writePlyMesh(const std::string& filename, const TriangleMesh& mesh);
@@ -0,0 +1,138 @@
+#include "ply-stream.h"
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+
+const char* COLOR_NAMES[] = { "red", "green", "blue" };
+
+} // anonymous namespace
+
+PlyVertexReader::PlyVertexReader(const MappedFile& file, const PlyHeader& header)
+    : m_file(file)
+    , m_hasColor(true)
+{
+    const PlyElement* vertex = header.findElement("vertex");
+    if (!vertex)
+        throw PlyError("file has no vertices");
+    m_begin = header.elementOffset("vertex");
+    m_recordSize = vertex->fixedRecordSize();
+    m_qty = vertex->count;
+
+    if (m_recordSize == 0)
+        throw PlyError("vertices have list properties");
+    if (m_begin > file.size() || m_qty > (file.size() - m_begin) / m_recordSize)
+        throw PlyError("file is truncated");
+
+    for (int i = 0; i < 6; ++i) {
+        const std::string name = i < 3
+            ? std::string(1, "xyz"[i])
+            : std::string(COLOR_NAMES[i - 3]);
+
+        const int index = vertex->findProperty(name);
+        if (i < 3 && index < 0)
+            throw PlyError("vertices have no " + name);
+        // Only byte colors are read, like in PCL.
+        if (index < 0 || (i >= 3 && vertex->properties[index].type != PLY_UINT8)) {
+            m_hasColor = false;
+            continue;
+        }
+
+        m_offsets[i] = 0;
+        for (int j = 0; j < index; ++j) {
+            m_offsets[i] += plyTypeSize(vertex->properties[j].type);
+        }
+        m_types[i] = vertex->properties[index].type;
+    }
+}
+
+void PlyVertexReader::adviseSequential(size_t first, size_t last) const
+{
+    m_file.adviseSequential(m_begin + first * m_recordSize, (last - first) * m_recordSize);
+}
+
+void PlyVertexReader::release(size_t first, size_t last) const
+{
+    m_file.release(m_begin + first * m_recordSize, (last - first) * m_recordSize);
+}
+
+PlyFaceReader::PlyFaceReader(const MappedFile& file, const PlyHeader& header)
+    : m_file(file)
+    , m_face(*header.findElement("face"))
+    , m_indicesProperty(findFaceIndices(m_face))
+{
+    for (size_t i = 0; i < header.elements.size(); ++i) {
+        const PlyElement& element = header.elements[i];
+        if (element.name == "face")
+            break;
+        if (element.count > 0 && element.fixedRecordSize() == 0)
+            throw PlyError("element " + element.name
+                           + " before faces has list properties");
+    }
+    if (m_indicesProperty < 0)
+        throw PlyError("faces have no vertex indices");
+
+    m_begin = header.elementOffset("face");
+    if (m_begin > file.size())
+        throw PlyError("file is truncated");
+    rewind();
+}
+
+void PlyFaceReader::rewind()
+{
+    m_position = m_begin;
+    m_faceIndex = 0;
+    m_file.adviseSequential(m_begin, m_file.size() - m_begin);
+}
+
+size_t PlyFaceReader::readChunk(size_t vertexQty, std::vector<uint32_t>& indices)
+{
+    const size_t chunkBegin = m_position;
+    const size_t faceQty = std::min(PLY_FACE_CHUNK_SIZE, m_face.count - m_faceIndex);
+    indices.resize(3 * faceQty);
+
+    for (size_t i = 0; i < faceQty; ++i) {
+        for (size_t p = 0; p < m_face.properties.size(); ++p) {
+            const PlyProperty& property = m_face.properties[p];
+            if (!property.isList) {
+                skip(plyTypeSize(property.type));
+                continue;
+            }
+
+            const size_t count = read(property.countType);
+            if (int(p) != m_indicesProperty) {
+                skip(count * plyTypeSize(property.type));
+                continue;
+            }
+
+            if (count != 3)
+                throw PlyError("Non-triangle faces are not supported");
+            for (int k = 0; k < 3; ++k) {
+                const double index = read(property.type);
+                if (index < 0 || index >= vertexQty)
+                    throw PlyError("face refers to a missing vertex");
+                indices[3 * i + k] = index;
+            }
+        }
+    }
+
+    m_faceIndex += faceQty;
+    m_file.release(chunkBegin, m_position - chunkBegin);
+    return faceQty;
+}
+
+void PlyFaceReader::skip(size_t size)
+{
+    if (size > m_file.size() - m_position)
+        throw PlyError("file is truncated");
+    m_position += size;
+}
+
+double PlyFaceReader::read(PlyType type)
+{
+    const size_t position = m_position;
+    skip(plyTypeSize(type));
+    return readPlyValue(m_file.data() + position, type);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mapped-file.h"
+#include "ply-header.h"
+
+// Faces PlyFaceReader::readChunk reads at most at once.
+const size_t PLY_FACE_CHUNK_SIZE = 1 << 16;
+
+// Vertex records of a binary little endian PLY file, read right in the
+// mapped file. The vertices must have x, y and z; colors are read when
+// they have red, green and blue bytes, like in PCL. Throws PlyError when
+// the vertices have list properties or no position, or the file is
+// truncated.
+class PlyVertexReader {
+public:
+    PlyVertexReader(const MappedFile& file, const PlyHeader& header);
+
+    size_t size() const { return m_qty; }
+    bool hasColor() const { return m_hasColor; }
+
+    double coord(size_t index, int axis) const
+    {
+        return readPlyValue(record(index) + m_offsets[axis], m_types[axis]);
+    }
+
+    // Only with hasColor().
+    double color(size_t index, int channel) const
+    {
+        return readPlyValue(record(index) + m_offsets[3 + channel], m_types[3 + channel]);
+    }
+
+    // Hints that the vertices [first, last) will be read in order, or
+    // drops their pages.
+    void adviseSequential(size_t first, size_t last) const;
+    void release(size_t first, size_t last) const;
+
+private:
+    const char* record(size_t index) const
+    {
+        return m_file.data() + m_begin + index * m_recordSize;
+    }
+
+    const MappedFile& m_file;
+    size_t m_begin;
+    size_t m_recordSize;
+    size_t m_qty;
+    // x, y, z, red, green, blue
+    size_t m_offsets[6];
+    PlyType m_types[6];
+    bool m_hasColor;
+};
+
+// Reads the face records of a binary little endian PLY file in chunks and
+// drops every chunk's pages after it is parsed, so that the face data
+// never stays resident. Elements before the faces must have fixed size
+// records, for the faces to be found without parsing them. Throws
+// PlyError.
+class PlyFaceReader {
+public:
+    PlyFaceReader(const MappedFile& file, const PlyHeader& header);
+
+    // Starts over from the first face.
+    void rewind();
+
+    // Reads up to PLY_FACE_CHUNK_SIZE faces, three indices each, and
+    // returns the number of faces read, 0 at the end.
+    size_t readChunk(size_t vertexQty, std::vector<uint32_t>& indices);
+
+private:
+    void skip(size_t size);
+    double read(PlyType type);
+
+    const MappedFile& m_file;
+    const PlyElement& m_face;
+    const int m_indicesProperty;
+    size_t m_begin;
+    size_t m_position;
+    size_t m_faceIndex;
+};
@@ -0,0 +1,275 @@
+#include "progressive-mesh.h"
+
+#include "mapped-file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+
+const char MAGIC[8] = {'P', 'M', 'E', 'S', 'H', '\r', '\n', '\x1a'};
+const uint32_t VERSION = 1;
+// Reads differently on a machine with another byte order.
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+const uint32_t HAS_COLORS = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t baseVertexQty;
+    uint64_t baseTriangleQty;
+    uint64_t splitQty;
+    // Of the full mesh, after every split.
+    uint64_t vertexQty;
+    uint64_t triangleQty;
+};
+
+// Every split is one of these, followed by the color and the new color
+// when the mesh has colors, the moved triangles and the corners of the new
+// triangles.
+struct SplitHeader {
+    uint32_t vertex;
+    uint16_t movedTriangleQty;
+    uint16_t newTriangleQty;
+    float position[3];
+    float newPosition[3];
+};
+
+bool isValid(const Header& header)
+{
+    return std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+           && header.version == VERSION
+           && header.byteOrderMark == BYTE_ORDER_MARK
+           && header.vertexQty <= std::numeric_limits<uint32_t>::max()
+           && header.triangleQty <= std::numeric_limits<uint32_t>::max()
+           && header.baseVertexQty <= header.vertexQty
+           && header.baseTriangleQty <= header.triangleQty;
+}
+
+void writeBytes(std::ofstream& f, const void* data, size_t size)
+{
+    f.write(static_cast<const char*>(data), std::streamsize(size));
+}
+
+// Reads size bytes at p and advances it, or returns false past the end.
+bool readBytes(const char*& p, const char* end, void* data, size_t size)
+{
+    if (size_t(end - p) < size)
+        return false;
+    if (size > 0)
+        std::memcpy(data, p, size);
+    p += size;
+    return true;
+}
+
+} // anonymous namespace
+
+void writeProgressiveMesh(const std::string& filename, const ProgressiveMesh& mesh)
+{
+    const TriangleMesh& base = mesh.base;
+    const bool hasColors = !base.colors.empty();
+    if (hasColors && base.colors.size() != base.positions.size())
+        throw ProgressiveMeshError("colors don't match the vertices");
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.flags = hasColors ? HAS_COLORS : 0;
+    header.baseVertexQty = base.getVertexQty();
+    header.baseTriangleQty = base.getTriangleQty();
+    header.splitQty = mesh.splits.size();
+
+    // Check the splits in the order they apply.
+    uint64_t vertexQty = header.baseVertexQty;
+    uint64_t triangleQty = header.baseTriangleQty;
+    for (size_t i = 0; i < base.indices.size(); ++i) {
+        if (base.indices[i] >= vertexQty)
+            throw ProgressiveMeshError("vertex index out of range");
+    }
+    for (size_t i = 0; i < mesh.splits.size(); ++i) {
+        const VertexSplit& split = mesh.splits[i];
+        const size_t newTriangleQty = split.newTriangles.size() / 3;
+        if (split.movedTriangles.size() > std::numeric_limits<uint16_t>::max()
+            || newTriangleQty > std::numeric_limits<uint16_t>::max()
+            || split.newTriangles.size() % 3 != 0)
+        {
+            throw ProgressiveMeshError("a vertex has too many triangles");
+        }
+        if (split.vertex >= vertexQty)
+            throw ProgressiveMeshError("vertex index out of range");
+        for (size_t j = 0; j < split.movedTriangles.size(); ++j) {
+            if (split.movedTriangles[j] >= triangleQty)
+                throw ProgressiveMeshError("triangle index out of range");
+        }
+        ++vertexQty;
+        for (size_t j = 0; j < split.newTriangles.size(); ++j) {
+            if (split.newTriangles[j] >= vertexQty)
+                throw ProgressiveMeshError("vertex index out of range");
+        }
+        triangleQty += newTriangleQty;
+    }
+    if (vertexQty > std::numeric_limits<uint32_t>::max()
+        || triangleQty > std::numeric_limits<uint32_t>::max())
+    {
+        throw ProgressiveMeshError("too many vertices or triangles");
+    }
+    header.vertexQty = vertexQty;
+    header.triangleQty = triangleQty;
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    writeBytes(f, &header, sizeof(header));
+    writeBytes(f, base.positions.data(), base.positions.size() * sizeof(float));
+    writeBytes(f, base.colors.data(), base.colors.size());
+    writeBytes(f, base.indices.data(), base.indices.size() * sizeof(uint32_t));
+    for (size_t i = 0; i < mesh.splits.size(); ++i) {
+        const VertexSplit& split = mesh.splits[i];
+        SplitHeader splitHeader;
+        splitHeader.vertex = split.vertex;
+        splitHeader.movedTriangleQty = uint16_t(split.movedTriangles.size());
+        splitHeader.newTriangleQty = uint16_t(split.newTriangles.size() / 3);
+        std::memcpy(splitHeader.position, split.position, sizeof(split.position));
+        std::memcpy(splitHeader.newPosition, split.newPosition,
+                    sizeof(split.newPosition));
+        writeBytes(f, &splitHeader, sizeof(splitHeader));
+        if (hasColors) {
+            writeBytes(f, split.color, sizeof(split.color));
+            writeBytes(f, split.newColor, sizeof(split.newColor));
+        }
+        writeBytes(f, split.movedTriangles.data(),
+                   split.movedTriangles.size() * sizeof(uint32_t));
+        writeBytes(f, split.newTriangles.data(),
+                   split.newTriangles.size() * sizeof(uint32_t));
+    }
+    f.close();
+    if (f.fail())
+        throw ProgressiveMeshError("can't write " + filename);
+}
+
+// A split that doesn't fit the budget ends the reading, and so does a
+// file cut after a whole split, since what was read is a valid mesh.
+void readProgressiveMesh(
+        const std::string& filename,
+        size_t maxTriangleQty,
+        TriangleMesh& mesh)
+{
+    const MappedFile file(filename);
+    const char* p = file.data();
+    const char* const end = p + file.size();
+    const ProgressiveMeshError brokenFile(filename + " is not a valid progressive mesh");
+
+    Header header;
+    if (!readBytes(p, end, &header, sizeof(header)) || !isValid(header))
+        throw brokenFile;
+
+    const bool hasColors = (header.flags & HAS_COLORS) != 0;
+    const size_t baseVertexQty = size_t(header.baseVertexQty);
+    const size_t baseTriangleQty = size_t(header.baseTriangleQty);
+    if (maxTriangleQty == 0)
+        maxTriangleQty = size_t(header.triangleQty);
+    size_t reserveQty = std::min(size_t(header.triangleQty),
+                                 std::max(maxTriangleQty, baseTriangleQty));
+
+    // The counts are at most 32 bits, so the sizes don't overflow.
+    const uint64_t vertexSize = 3 * sizeof(float) + (hasColors ? 3 : 0);
+    const uint64_t triangleSize = 3 * sizeof(uint32_t);
+    if (header.baseVertexQty * vertexSize + header.baseTriangleQty * triangleSize
+        > uint64_t(end - p))
+    {
+        throw brokenFile;
+    }
+
+    mesh.positions.resize(3 * baseVertexQty);
+    mesh.colors.resize(hasColors ? 3 * baseVertexQty : 0);
+    mesh.indices.resize(3 * baseTriangleQty);
+    if (!readBytes(p, end, mesh.positions.data(), mesh.positions.size() * sizeof(float))
+        || !readBytes(p, end, mesh.colors.data(), mesh.colors.size())
+        || !readBytes(p, end, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t)))
+    {
+        throw brokenFile;
+    }
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        if (mesh.indices[i] >= baseVertexQty)
+            throw brokenFile;
+    }
+    // Every triangle a split adds takes its indices in the file.
+    reserveQty = std::min(reserveQty,
+                          baseTriangleQty + size_t(end - p) / triangleSize);
+    mesh.indices.reserve(3 * reserveQty);
+
+    std::vector<uint32_t> moved;
+    for (uint64_t i = 0; i < header.splitQty; ++i) {
+        SplitHeader split;
+        uint8_t colors[6];
+        if (!readBytes(p, end, &split, sizeof(split))
+            || (hasColors && !readBytes(p, end, colors, sizeof(colors))))
+        {
+            break;
+        }
+        const size_t triangleQty = mesh.getTriangleQty() + split.newTriangleQty;
+        if (triangleQty > maxTriangleQty
+            || size_t(end - p) < (split.movedTriangleQty + 3 * split.newTriangleQty)
+                                 * sizeof(uint32_t))
+        {
+            break;
+        }
+
+        const size_t vertexQty = mesh.getVertexQty();
+        const uint32_t newVertex = uint32_t(vertexQty);
+        if (split.vertex >= vertexQty)
+            throw brokenFile;
+        moved.resize(split.movedTriangleQty);
+        readBytes(p, end, moved.data(), moved.size() * sizeof(uint32_t));
+        for (size_t j = 0; j < split.movedTriangleQty; ++j) {
+            if (moved[j] >= mesh.getTriangleQty())
+                throw brokenFile;
+            uint32_t* v = &mesh.indices[3 * moved[j]];
+            uint32_t* corner = std::find(v, v + 3, split.vertex);
+            if (corner == v + 3)
+                throw brokenFile;
+            *corner = newVertex;
+        }
+        const size_t firstCorner = mesh.indices.size();
+        mesh.indices.resize(firstCorner + 3 * split.newTriangleQty);
+        readBytes(p, end, &mesh.indices[firstCorner],
+                  3 * split.newTriangleQty * sizeof(uint32_t));
+        for (size_t j = firstCorner; j < mesh.indices.size(); ++j) {
+            if (mesh.indices[j] > newVertex)
+                throw brokenFile;
+        }
+
+        std::memcpy(&mesh.positions[3 * split.vertex], split.position,
+                    sizeof(split.position));
+        mesh.positions.insert(mesh.positions.end(), split.newPosition,
+                              split.newPosition + 3);
+        if (hasColors) {
+            std::memcpy(&mesh.colors[3 * split.vertex], colors, 3);
+            mesh.colors.insert(mesh.colors.end(), colors + 3, colors + 6);
+        }
+    }
+}
+
+ProgressiveMeshInfo readProgressiveMeshInfo(const std::string& filename)
+{
+    Header header;
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!f.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || !isValid(header))
+    {
+        throw ProgressiveMeshError(filename + " is not a valid progressive mesh");
+    }
+
+    ProgressiveMeshInfo info;
+    info.baseTriangleQty = header.baseTriangleQty;
+    info.vertexQty = header.vertexQty;
+    info.triangleQty = header.triangleQty;
+    return info;
+}
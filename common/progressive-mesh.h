@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "triangle-mesh.h"
+
+class ProgressiveMeshError : public std::runtime_error
+{
+public:
+    explicit ProgressiveMeshError(const std::string& message)
+        : std::runtime_error(message)
+    {}
+};
+
+// Undoes one edge collapse. The vertex gets back its position and color,
+// a new vertex is added next to it, the moved triangles take the new
+// vertex in place of the vertex, and the new triangles are added.
+struct VertexSplit {
+    uint32_t vertex;
+    float position[3];
+    uint8_t color[3];
+    float newPosition[3];
+    uint8_t newColor[3];
+    std::vector<uint32_t> movedTriangles;
+    // 3 corners per triangle.
+    std::vector<uint32_t> newTriangles;
+};
+
+// A coarse base mesh and the vertex splits that refine it back to the
+// full mesh. The vertex and triangles a split adds are numbered after
+// those of the base and of the splits before it, so that the base with
+// any number of the first splits is a valid mesh.
+struct ProgressiveMesh {
+    TriangleMesh base;
+    std::vector<VertexSplit> splits;
+};
+
+// Writes a .pmesh file: a header, the base mesh as flat arrays, then the
+// splits in order. Throws ProgressiveMeshError.
+void writeProgressiveMesh(const std::string& filename, const ProgressiveMesh& mesh);
+
+// Reads the base mesh and applies the splits in order for as long as the
+// mesh stays within maxTriangleQty triangles, or all of them when it is 0.
+// The file is mapped and read only up to the last split applied. Throws
+// ProgressiveMeshError or MappedFileError.
+void readProgressiveMesh(
+        const std::string& filename,
+        size_t maxTriangleQty,
+        TriangleMesh& mesh);
+
+// Counts of a progressive mesh, read from its header only.
+struct ProgressiveMeshInfo {
+    uint64_t baseTriangleQty;
+    uint64_t vertexQty;
+    uint64_t triangleQty;
+};
+
+// Throws ProgressiveMeshError.
+ProgressiveMeshInfo readProgressiveMeshInfo(const std::string& filename);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs function(i) for i in [0, taskQty) on up to threadQty threads, the
+// calling one included. Tasks are taken in order by the next free thread.
+template <typename Function>
+void runTasks(size_t taskQty, int threadQty, const Function& function)
+{
+    std::atomic<size_t> next(0);
+    const auto work = [&]() {
+        for (size_t i = next++; i < taskQty; i = next++) {
+            function(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    const size_t threadsToStart = std::min(size_t(std::max(threadQty, 1)), taskQty);
+    for (size_t i = 1; i < threadsToStart; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
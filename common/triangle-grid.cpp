@@ -0,0 +1,230 @@
+#include "triangle-grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+struct Point {
+    Point() : x(0), y(0), z(0) {}
+    Point(double x, double y, double z) : x(x), y(y), z(z) {}
+
+    double x, y, z;
+};
+
+Point operator-(const Point& a, const Point& b) { return Point(a.x - b.x, a.y - b.y, a.z - b.z); }
+Point operator+(const Point& a, const Point& b) { return Point(a.x + b.x, a.y + b.y, a.z + b.z); }
+Point operator*(const Point& a, double s) { return Point(a.x * s, a.y * s, a.z * s); }
+double dot(const Point& a, const Point& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+Point getPosition(const TriangleMesh& mesh, uint32_t vertex)
+{
+    const float* p = &mesh.positions[3 * vertex];
+    return Point(p[0], p[1], p[2]);
+}
+
+bool isFinite(const Point& p)
+{
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+// Barycentric weights of the point of the triangle abc nearest to p, by
+// the region of the triangle p projects to.
+void findNearestWeights(
+        const Point& p,
+        const Point& a,
+        const Point& b,
+        const Point& c,
+        double* weights)
+{
+    const Point ab = b - a;
+    const Point ac = c - a;
+    const Point ap = p - a;
+    const double d1 = dot(ab, ap);
+    const double d2 = dot(ac, ap);
+    const Point bp = p - b;
+    const double d3 = dot(ab, bp);
+    const double d4 = dot(ac, bp);
+    const Point cp = p - c;
+    const double d5 = dot(ab, cp);
+    const double d6 = dot(ac, cp);
+    const double va = d3 * d6 - d5 * d4;
+    const double vb = d5 * d2 - d1 * d6;
+    const double vc = d1 * d4 - d3 * d2;
+
+    double v = 0;
+    double w = 0;
+    if (d1 <= 0 && d2 <= 0) {
+    } else if (d3 >= 0 && d4 <= d3) {
+        v = 1;
+    } else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        v = d1 / (d1 - d3);
+    } else if (d6 >= 0 && d5 <= d6) {
+        w = 1;
+    } else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        w = d2 / (d2 - d6);
+    } else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        v = 1 - w;
+    } else {
+        const double denominator = 1 / (va + vb + vc);
+        v = vb * denominator;
+        w = vc * denominator;
+    }
+    weights[0] = 1 - v - w;
+    weights[1] = v;
+    weights[2] = w;
+}
+
+} // anonymous namespace
+
+TriangleGrid::TriangleGrid(const TriangleMesh& mesh)
+    : m_mesh(mesh)
+    , m_cellSize(0)
+    , m_resolution(1)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    Point min(inf, inf, inf);
+    Point max(-inf, -inf, -inf);
+    for (size_t i = 0; i < mesh.getVertexQty(); ++i) {
+        const Point p = getPosition(mesh, uint32_t(i));
+        if (!isFinite(p))
+            continue;
+        min = Point(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Point(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    if (!(min.x <= max.x))
+        return;
+
+    // About as many occupied cells as triangles on a surface.
+    const double extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    m_resolution = std::max(1, std::min(1024,
+            int(std::ceil(std::sqrt(double(mesh.getTriangleQty()))))));
+    m_cellSize = std::max(extent, 1e-12) / m_resolution;
+    m_min[0] = min.x;
+    m_min[1] = min.y;
+    m_min[2] = min.z;
+
+    for (uint32_t t = 0; t < mesh.getTriangleQty(); ++t) {
+        int from[3] = {m_resolution, m_resolution, m_resolution};
+        int to[3] = {-1, -1, -1};
+        bool isValid = true;
+        for (int i = 0; i < 3; ++i) {
+            const Point p = getPosition(mesh, mesh.indices[3 * t + i]);
+            isValid = isValid && isFinite(p);
+            const double values[3] = {p.x, p.y, p.z};
+            for (int axis = 0; axis < 3; ++axis) {
+                const int cell = getCell(values[axis], axis);
+                from[axis] = std::min(from[axis], cell);
+                to[axis] = std::max(to[axis], cell);
+            }
+        }
+        if (!isValid)
+            continue;
+        for (int x = from[0]; x <= to[0]; ++x) {
+            for (int y = from[1]; y <= to[1]; ++y) {
+                for (int z = from[2]; z <= to[2]; ++z) {
+                    m_entries.push_back(std::make_pair(getKey(x, y, z), t));
+                }
+            }
+        }
+    }
+    std::sort(m_entries.begin(), m_entries.end());
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        if (i == 0 || m_entries[i].first != m_entries[i - 1].first)
+            m_cellStarts[m_entries[i].first] = i;
+    }
+}
+
+int TriangleGrid::getCell(double value, int axis) const
+{
+    const double cell = std::floor((value - m_min[axis]) / m_cellSize);
+    return int(std::max(0.0, std::min(double(m_resolution - 1), cell)));
+}
+
+uint64_t TriangleGrid::getKey(int x, int y, int z) const
+{
+    return (uint64_t(x) << 40) | (uint64_t(y) << 20) | uint64_t(z);
+}
+
+void TriangleGrid::visitCell(int x, int y, int z, const double* p, NearestPoint& best) const
+{
+    if (x < 0 || y < 0 || z < 0
+        || x >= m_resolution || y >= m_resolution || z >= m_resolution)
+    {
+        return;
+    }
+    // Cells no nearer than the best triangle found are skipped.
+    const int cell[3] = {x, y, z};
+    double boxDistance2 = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        const double low = m_min[axis] + cell[axis] * m_cellSize;
+        const double gap = std::max(low - p[axis], p[axis] - (low + m_cellSize));
+        if (gap > 0)
+            boxDistance2 += gap * gap;
+    }
+    if (boxDistance2 >= best.distance2)
+        return;
+
+    const uint64_t key = getKey(x, y, z);
+    const std::unordered_map<uint64_t, size_t>::const_iterator start = m_cellStarts.find(key);
+    if (start == m_cellStarts.end())
+        return;
+    std::vector<std::pair<uint64_t, uint32_t> >::const_iterator it =
+        m_entries.begin() + start->second;
+    for (; it != m_entries.end() && it->first == key; ++it) {
+        const uint32_t* v = &m_mesh.indices[3 * it->second];
+        const Point corners[3] = {
+            getPosition(m_mesh, v[0]),
+            getPosition(m_mesh, v[1]),
+            getPosition(m_mesh, v[2])
+        };
+        const Point point(p[0], p[1], p[2]);
+        double weights[3];
+        findNearestWeights(point, corners[0], corners[1], corners[2], weights);
+        const Point offset = corners[0] * weights[0] + corners[1] * weights[1]
+                             + corners[2] * weights[2] - point;
+        const double distance2 = dot(offset, offset);
+        if (distance2 < best.distance2) {
+            best.distance2 = distance2;
+            best.triangle = it->second;
+            std::copy(weights, weights + 3, best.weights);
+        }
+    }
+}
+
+bool TriangleGrid::findNearest(const double* p, NearestPoint& best) const
+{
+    best.distance2 = std::numeric_limits<double>::infinity();
+    if (m_entries.empty())
+        return false;
+
+    // Searches shells of cells around the cell of p until no cell further
+    // out can be nearer than the best triangle found.
+    const int cx = getCell(p[0], 0);
+    const int cy = getCell(p[1], 1);
+    const int cz = getCell(p[2], 2);
+    for (int r = 0; r <= m_resolution; ++r) {
+        for (int x = cx - r; x <= cx + r; ++x) {
+            for (int y = cy - r; y <= cy + r; ++y) {
+                const bool isOnShell = x == cx - r || x == cx + r
+                                    || y == cy - r || y == cy + r;
+                if (isOnShell) {
+                    for (int z = cz - r; z <= cz + r; ++z) {
+                        visitCell(x, y, z, p, best);
+                    }
+                } else {
+                    visitCell(x, y, cz - r, p, best);
+                    if (r > 0)
+                        visitCell(x, y, cz + r, p, best);
+                }
+            }
+        }
+        const double reach = r * m_cellSize;
+        if (best.distance2 <= reach * reach)
+            break;
+    }
+    return std::isfinite(best.distance2);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "triangle-mesh.h"
+
+// The point of a mesh nearest to another point.
+struct NearestPoint {
+    double distance2;
+    uint32_t triangle;
+    // Barycentric, of the corners of the triangle.
+    double weights[3];
+};
+
+// The triangles of a mesh in a sparse grid of cubes, each listed in every
+// cube its bounding box touches. The mesh must outlive the grid, and
+// queries can run on several threads at once.
+class TriangleGrid {
+public:
+    explicit TriangleGrid(const TriangleMesh& mesh);
+
+    // The nearest point of the triangles to the x, y, z of p; false
+    // without any.
+    bool findNearest(const double* p, NearestPoint& nearest) const;
+
+private:
+    int getCell(double value, int axis) const;
+    uint64_t getKey(int x, int y, int z) const;
+    void visitCell(int x, int y, int z, const double* p, NearestPoint& best) const;
+
+    const TriangleMesh& m_mesh;
+    double m_min[3];
+    double m_cellSize;
+    int m_resolution;
+    // (cell key, triangle), sorted.
+    std::vector<std::pair<uint64_t, uint32_t> > m_entries;
+    // Index of the first entry of every cell with triangles.
+    std::unordered_map<uint64_t, size_t> m_cellStarts;
+};
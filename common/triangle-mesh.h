@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A triangle mesh as flat arrays.
+struct TriangleMesh {
+    std::vector<float> positions;   // x, y, z of every vertex
+    std::vector<uint8_t> colors;    // r, g, b of every vertex, or empty
+    std::vector<uint32_t> indices;  // 3 per triangle
+
+    size_t getVertexQty() const { return positions.size() / 3; }
+    size_t getTriangleQty() const { return indices.size() / 3; }
+};
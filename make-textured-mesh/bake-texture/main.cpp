@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "ply-mesh.h"
+#include "texture-baker.h"
+#include "texture-writer.h"
+#include "uv-mesh.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+struct Options {
+    std::string inputFilename;
+    std::string outputFilename;
+    std::string sourceFilename;
+    BakeSettings settings;
+    int jpegQuality;
+};
+
+// A PLY file, or an OBJ file with vertex colors.
+void readSourceMesh(const std::string& filename, TriangleMesh& mesh)
+{
+    if (fs::path(filename).extension() == ".obj") {
+        UvMesh uvMesh;
+        readObj(filename, uvMesh);
+        mesh = uvMesh.mesh;
+    } else {
+        readPlyMesh(filename, mesh);
+    }
+}
+
+void bake(const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    UvMesh mesh;
+    readObj(options.inputFilename, mesh);
+    TriangleMesh source;
+    if (!options.sourceFilename.empty())
+        readSourceMesh(options.sourceFilename, source);
+
+    const Clock::time_point start = Clock::now();
+    Texture texture;
+    bakeTexture(mesh, options.sourceFilename.empty() ? 0 : &source,
+                options.settings, texture);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "baked " << mesh.mesh.getTriangleQty() << " triangles into "
+              << texture.width << "x" << texture.height << " in " << seconds << " s\n";
+
+    writeTexture(options.outputFilename, texture, options.jpegQuality);
+}
+
+bool initOptions(Options& options, int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help", "Print help message")
+        ("input-file",
+         po::value(&options.inputFilename),
+         "OBJ file with texture coordinates")
+        ("output-file",
+         po::value(&options.outputFilename),
+         "Texture file, JPEG for .jpg and .jpeg and PNG otherwise")
+        ("source",
+         po::value(&options.sourceFilename),
+         "PLY or OBJ mesh with vertex colors, usually finer than the input, "
+         "to take the colors from at the nearest points; by default the "
+         "vertex colors of the input are baked")
+        ("width",
+         po::value(&options.settings.width)->default_value(2048),
+         "Width of the texture in pixels")
+        ("height",
+         po::value(&options.settings.height)->default_value(2048),
+         "Height of the texture in pixels")
+        ("padding",
+         po::value(&options.settings.padding)->default_value(4),
+         "Pixels around the charts filled with the colors at their edges, "
+         "against seams showing when the texture is filtered")
+        ("jpeg-quality",
+         po::value(&options.jpegQuality)->default_value(95),
+         "Quality of JPEG textures from 1 to 100")
+        ("threads",
+         po::value(&options.settings.threadQty)->default_value(
+             int(std::max(1u, std::thread::hardware_concurrency()))),
+         "Number of threads baking")
+        ;
+
+    po::positional_options_description p;
+    p.add("input-file", 1).add("output-file", 1);
+
+    po::variables_map vm;
+
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                    .options(desc)
+                    .positional(p)
+                    .run(),
+                  vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: bake-texture [options] <input-file> <output-file>\n"
+                      << desc << '\n';
+            return false;
+        }
+
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    if (!vm.count("input-file") || !vm.count("output-file")) {
+        std::cerr << "Give an input and an output file\n";
+        return false;
+    }
+    if (options.settings.width == 0 || options.settings.height == 0) {
+        std::cerr << "--width and --height must be above 0\n";
+        return false;
+    }
+    if (options.jpegQuality < 1 || options.jpegQuality > 100) {
+        std::cerr << "--jpeg-quality must be from 1 to 100\n";
+        return false;
+    }
+    options.settings.threadQty = std::max(1, options.settings.threadQty);
+    return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!initOptions(options, argc, argv))
+        return EXIT_FAILURE;
+
+    try {
+        bake(options);
+    } catch (const std::exception& e) {
+        std::cerr << options.inputFilename << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#include "atlas.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <OGF/cells/map/map.h>
+#include <OGF/cells/map/map_attributes.h>
+#include <OGF/cells/map/map_builder.h>
+#include <OGF/cells/map_algos/atlas_generator.h>
+
+namespace
+{
+
+const int NO_VERTEX = -1;
+
+typedef std::tuple<float, float, float> Position;
+
+void runAtlasGenerator(OGF::Map* map)
+{
+    OGF::AtlasGenerator generator(map);
+    generator.set_unglue_hardedges(false);
+    generator.set_auto_cut(true);
+    generator.set_auto_cut_cylinders(true);
+    generator.set_parameterizer("LSCM");
+    generator.set_max_overlap_ratio(0.0001);
+    generator.set_max_scaling(120.0);
+    generator.set_min_fill_ratio(0.25);
+    generator.set_pack(true);
+    generator.set_splitter("VSASmooth");
+    generator.apply();
+}
+
+// Builds the map from the vertices used by triangles, in input order, and
+// tags every map vertex with its input index.
+void buildMap(const TriangleMesh& mesh, OGF::Map& map)
+{
+    std::vector<uint8_t> isUsed(mesh.getVertexQty(), 0);
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        isUsed[mesh.indices[i]] = 1;
+    }
+    std::vector<int> mapVertices(mesh.getVertexQty(), NO_VERTEX);
+    std::vector<int> inputVertices;
+    for (size_t v = 0; v < isUsed.size(); ++v) {
+        if (isUsed[v]) {
+            mapVertices[v] = int(inputVertices.size());
+            inputVertices.push_back(int(v));
+        }
+    }
+
+    OGF::MapBuilder builder(&map);
+    builder.begin_surface();
+    for (size_t i = 0; i < inputVertices.size(); ++i) {
+        const float* p = &mesh.positions[3 * inputVertices[i]];
+        builder.add_vertex(OGF::Point3d(p[0], p[1], p[2]));
+    }
+    for (size_t t = 0; t < mesh.getTriangleQty(); ++t) {
+        builder.begin_facet();
+        for (int i = 0; i < 3; ++i) {
+            builder.add_vertex_to_facet(mapVertices[mesh.indices[3 * t + i]]);
+        }
+        builder.end_facet();
+    }
+    builder.end_surface();
+
+    // The map keeps its vertices in the order they were added. Vertices
+    // that the builder duplicates to make the map manifold come after
+    // those and are found by their position.
+    OGF::MapVertexAttribute<int> inputIndex(&map, "input_index");
+    std::map<Position, int> positionIndices;
+    size_t i = 0;
+    FOR_EACH_VERTEX(OGF::Map, &map, it) {
+        if (i < inputVertices.size()) {
+            inputIndex[it] = inputVertices[i++];
+            continue;
+        }
+        if (positionIndices.empty()) {
+            for (size_t j = 0; j < inputVertices.size(); ++j) {
+                const float* p = &mesh.positions[3 * inputVertices[j]];
+                positionIndices[Position(p[0], p[1], p[2])] = inputVertices[j];
+            }
+        }
+        const OGF::Point3d& p = it->point();
+        const std::map<Position, int>::const_iterator found = positionIndices.find(
+                Position(float(p.x()), float(p.y()), float(p.z())));
+        inputIndex[it] = found == positionIndices.end() ? NO_VERTEX : found->second;
+    }
+}
+
+// Scales the texture coordinates into the unit square, keeping their
+// aspect ratio, in case the packer leaves them outside.
+void fitToUnitSquare(std::vector<float>& texCoords)
+{
+    float min[2] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float max[2] = { -min[0], -min[1] };
+    for (size_t i = 0; i < texCoords.size(); ++i) {
+        min[i % 2] = std::min(min[i % 2], texCoords[i]);
+        max[i % 2] = std::max(max[i % 2], texCoords[i]);
+    }
+    const float size = std::max(max[0] - min[0], max[1] - min[1]);
+    if (size <= 0)
+        return;
+    if (min[0] >= 0 && min[1] >= 0 && max[0] <= 1 && max[1] <= 1)
+        return;
+    for (size_t i = 0; i < texCoords.size(); ++i) {
+        texCoords[i] = (texCoords[i] - min[i % 2]) / size;
+    }
+}
+
+} // anonymous namespace
+
+void generateAtlas(const TriangleMesh& mesh, UvMesh& output)
+{
+    if (mesh.getTriangleQty() == 0)
+        throw std::runtime_error("the mesh has no triangles");
+
+    OGF::Map map;
+    buildMap(mesh, map);
+    runAtlasGenerator(&map);
+
+    output = UvMesh();
+    TriangleMesh& outMesh = output.mesh;
+    const bool hasColors = !mesh.colors.empty();
+    OGF::MapVertexAttribute<int> inputIndex(&map, "input_index");
+    OGF::MapVertexAttribute<int> outputIndex(&map, "output_index");
+    FOR_EACH_VERTEX(OGF::Map, &map, it) {
+        const int input = inputIndex[it];
+        outputIndex[it] = int(outMesh.getVertexQty());
+        const OGF::Point3d& p = it->point();
+        outMesh.positions.push_back(float(p.x()));
+        outMesh.positions.push_back(float(p.y()));
+        outMesh.positions.push_back(float(p.z()));
+        if (hasColors) {
+            for (int i = 0; i < 3; ++i) {
+                outMesh.colors.push_back(input == NO_VERTEX ? 0 : mesh.colors[3 * input + i]);
+            }
+        }
+    }
+
+    // Halfedges around a vertex in one chart share their texture vertex.
+    std::map<const OGF::Map::TexVertex*, uint32_t> texIndices;
+    std::vector<uint32_t> corners;
+    std::vector<uint32_t> texCorners;
+    FOR_EACH_FACET(OGF::Map, &map, it) {
+        corners.clear();
+        texCorners.clear();
+        OGF::Map::Halfedge* h = it->halfedge();
+        do {
+            const OGF::Map::TexVertex* texVertex = h->tex_vertex();
+            std::map<const OGF::Map::TexVertex*, uint32_t>::const_iterator found
+                = texIndices.find(texVertex);
+            if (found == texIndices.end()) {
+                found = texIndices.insert(std::make_pair(
+                        texVertex, uint32_t(output.getTexVertexQty()))).first;
+                output.texCoords.push_back(float(h->tex_coord().x()));
+                output.texCoords.push_back(float(h->tex_coord().y()));
+            }
+            corners.push_back(uint32_t(outputIndex[h->vertex()]));
+            texCorners.push_back(found->second);
+            h = h->next();
+        } while (h != it->halfedge());
+
+        for (size_t i = 2; i < corners.size(); ++i) {
+            outMesh.indices.push_back(corners[0]);
+            outMesh.indices.push_back(corners[i - 1]);
+            outMesh.indices.push_back(corners[i]);
+            output.texIndices.push_back(texCorners[0]);
+            output.texIndices.push_back(texCorners[i - 1]);
+            output.texIndices.push_back(texCorners[i]);
+        }
+    }
+    fitToUnitSquare(output.texCoords);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "triangle-mesh.h"
+#include "uv-mesh.h"
+
+// Cuts the mesh into charts, parameterizes them and packs them into the
+// unit square with Graphite's AtlasGenerator, with the settings of
+// make-uv. Vertices without triangles are dropped and the others keep
+// their positions and colors. Throws std::runtime_error when the mesh has
+// no triangles.
+void generateAtlas(const TriangleMesh& mesh, UvMesh& output);
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "atlas.h"
+#include "decimator.h"
+#include "ply-mesh.h"
+#include "texture-baker.h"
+#include "texture-writer.h"
+#include "uv-mesh.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+// As decimate-and-make-texture.
+const double DEFAULT_REDUCTION = 0.95;
+// In mean edge lengths, as decimate-mesh.
+const double DEFAULT_COLOR_WEIGHT = 4;
+const int JPEG_QUALITY = 95;
+
+struct Options {
+    std::string inputFilename;
+    std::string outputFilename;
+    DecimationTarget target;
+    double colorWeight;
+    unsigned threadQty;
+    size_t textureSize;
+    size_t padding;
+    bool isWritingJpeg;
+    bool isBakingVertexColors;
+    bool isKeepingIntermediate;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Prints how long every stage took as it ends, and the total.
+class StageTimer {
+public:
+    StageTimer()
+        : m_start(Clock::now())
+        , m_stageStart(m_start)
+    {}
+
+    void finish(const std::string& stage, const std::string& result)
+    {
+        const Clock::time_point now = Clock::now();
+        std::cout << stage << ": " << seconds(m_stageStart, now) << " s";
+        if (!result.empty())
+            std::cout << ", " << result;
+        std::cout << std::endl;
+        m_stageStart = now;
+    }
+
+    void printTotal() const
+    {
+        std::cout << "total: " << seconds(m_start, Clock::now()) << " s\n";
+    }
+
+private:
+    static double seconds(Clock::time_point begin, Clock::time_point end)
+    {
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    Clock::time_point m_start;
+    Clock::time_point m_stageStart;
+};
+
+std::string countTriangles(size_t triangleQty)
+{
+    return std::to_string(triangleQty) + " triangles";
+}
+
+// Every stage takes the mesh of the one before in memory. Intermediate
+// meshes are only written with --keep-intermediate, under the names the
+// make-textured-mesh scripts gave them. The input is kept until the
+// colors are transferred from it, unless the decimated vertex colors are
+// baked instead.
+void makeTexturedMesh(const Options& options)
+{
+    const fs::path outputPath(options.outputFilename);
+    const std::string root = (outputPath.parent_path() / outputPath.stem()).string();
+    StageTimer timer;
+
+    TriangleMesh input;
+    readPlyMesh(options.inputFilename, input);
+    if (input.colors.empty())
+        throw std::runtime_error("the input has no vertex colors");
+    timer.finish("load", countTriangles(input.getTriangleQty()));
+
+    TriangleMesh decimated;
+    double colorWeight = options.colorWeight;
+    if (colorWeight < 0)
+        colorWeight = DEFAULT_COLOR_WEIGHT * getMeanEdgeLength(input);
+    DecimationStatistics statistics;
+    decimate(input, options.target, colorWeight, int(options.threadQty),
+             decimated, &statistics, 0);
+    if (options.isBakingVertexColors)
+        input = TriangleMesh();
+    timer.finish("decimate", countTriangles(decimated.getTriangleQty()));
+    if (options.isKeepingIntermediate) {
+        writePlyMesh(root + "-decimated.ply", decimated);
+        timer.finish("write " + root + "-decimated.ply", "");
+    }
+
+    UvMesh uvMesh;
+    generateAtlas(decimated, uvMesh);
+    decimated = TriangleMesh();
+    timer.finish("atlas", std::to_string(uvMesh.getTexVertexQty())
+                          + " texture vertices");
+    if (options.isKeepingIntermediate) {
+        writeObj(root + "-uv.obj", uvMesh, "");
+        timer.finish("write " + root + "-uv.obj", "");
+    }
+
+    BakeSettings settings;
+    settings.width = options.textureSize;
+    settings.height = options.textureSize;
+    settings.padding = options.padding;
+    settings.threadQty = int(options.threadQty);
+    Texture texture;
+    bakeTexture(uvMesh, options.isBakingVertexColors ? 0 : &input, settings, texture);
+    timer.finish("bake", std::to_string(texture.width) + "x"
+                         + std::to_string(texture.height));
+
+    const std::string textureFilename = root + (options.isWritingJpeg ? ".jpg" : ".png");
+    writeTexture(textureFilename, texture, JPEG_QUALITY);
+    writeObj(options.outputFilename, uvMesh, textureFilename);
+    timer.finish("write", "");
+    timer.printTotal();
+}
+
+bool initOptions(Options& options, int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help", "Print help message")
+        ("input-file",
+         po::value(&options.inputFilename),
+         "Input PLY file with vertex colors")
+        ("output-file",
+         po::value(&options.outputFilename),
+         "Output OBJ file; the material and the texture are written next "
+         "to it")
+        ("reduction",
+         po::value(&options.target.reduction),
+         "Fraction of the triangles to remove, 0.95 when no target is given")
+        ("triangles",
+         po::value(&options.target.triangleQty),
+         "Number of triangles to keep at most")
+        ("max-error",
+         po::value(&options.target.maxError),
+         "Stop decimating before collapses moving the surface by more than "
+         "this, in mesh units")
+        ("color-weight",
+         po::value(&options.colorWeight),
+         "Distance in mesh units that a color channel changing over its "
+         "full range costs as much as in decimation, by default 4 mean "
+         "edge lengths")
+        ("threads",
+         po::value(&options.threadQty)->default_value(
+             std::max(1u, std::thread::hardware_concurrency())),
+         "Number of threads decimating and baking")
+        ("texture-size",
+         po::value(&options.textureSize)->default_value(2048),
+         "Width and height of the texture in pixels")
+        ("padding",
+         po::value(&options.padding)->default_value(4),
+         "Pixels around the charts filled with the colors at their edges, "
+         "against seams showing when the texture is filtered")
+        ("jpeg",
+         "Write the texture as JPEG instead of PNG")
+        ("bake-vertex-colors",
+         "Bake the decimated vertex colors instead of transferring the "
+         "colors of the input, which takes less memory and time")
+        ("keep-intermediate",
+         "Also write the decimated mesh to <output>-decimated.ply and the "
+         "mesh with texture coordinates to <output>-uv.obj")
+        ;
+
+    po::positional_options_description p;
+    p.add("input-file", 1).add("output-file", 1);
+
+    po::variables_map vm;
+
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                    .options(desc)
+                    .positional(p)
+                    .run(),
+                  vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: make-textured-mesh [options] <input-file> <output-file>\n"
+                      << desc << '\n';
+            return false;
+        }
+
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    if (!vm.count("input-file") || !vm.count("output-file")) {
+        std::cerr << "Give an input and an output file\n";
+        return false;
+    }
+    if (fs::path(options.outputFilename).extension() != ".obj") {
+        std::cerr << "The output file must be an OBJ file\n";
+        return false;
+    }
+    if (!vm.count("color-weight"))
+        options.colorWeight = -1;
+    options.isWritingJpeg = vm.count("jpeg");
+    options.isBakingVertexColors = vm.count("bake-vertex-colors");
+    options.isKeepingIntermediate = vm.count("keep-intermediate");
+    options.threadQty = std::max(1u, options.threadQty);
+
+    if (!vm.count("reduction") && !vm.count("triangles") && !vm.count("max-error"))
+        options.target.reduction = DEFAULT_REDUCTION;
+    if (options.target.reduction < 0 || options.target.reduction >= 1) {
+        std::cerr << "--reduction must be from 0 to below 1\n";
+        return false;
+    }
+    if (vm.count("color-weight") && options.colorWeight < 0) {
+        std::cerr << "--color-weight can't be negative\n";
+        return false;
+    }
+    if (options.target.maxError < 0) {
+        std::cerr << "--max-error can't be negative\n";
+        return false;
+    }
+    if (options.textureSize == 0) {
+        std::cerr << "--texture-size must be above 0\n";
+        return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!initOptions(options, argc, argv))
+        return EXIT_FAILURE;
+
+    try {
+        makeTexturedMesh(options);
+    } catch (const std::exception& e) {
+        std::cerr << options.inputFilename << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
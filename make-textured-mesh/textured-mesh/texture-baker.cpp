@@ -0,0 +1,274 @@
+#include "texture-baker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "run-tasks.h"
+#include "triangle-grid.h"
+
+namespace
+{
+
+// Bands per thread, so that threads finishing early take more.
+const size_t BANDS_PER_THREAD = 8;
+
+// Texture coordinates of a triangle's corners in pixels.
+struct PixelTriangle {
+    double x[3];
+    double y[3];
+};
+
+// What the threads share while baking.
+struct Baking {
+    Baking(const UvMesh& mesh, const TriangleMesh* source, Texture& texture)
+        : mesh(mesh)
+        , source(source)
+        , grid(source ? new TriangleGrid(*source) : 0)
+        , texture(texture)
+        , isCovered(texture.width * texture.height, 0)
+    {}
+
+    const UvMesh& mesh;
+    const TriangleMesh* source;
+    boost::scoped_ptr<const TriangleGrid> grid;
+    Texture& texture;
+    std::vector<uint8_t> isCovered;
+    size_t bandHeight;
+    // Triangles overlapping the rows of every band.
+    std::vector<std::vector<uint32_t> > bandTriangles;
+};
+
+PixelTriangle getPixelTriangle(const UvMesh& mesh, size_t triangle, const Texture& texture)
+{
+    PixelTriangle result;
+    for (int i = 0; i < 3; ++i) {
+        const float* uv = &mesh.texCoords[2 * mesh.texIndices[3 * triangle + i]];
+        result.x[i] = uv[0] * double(texture.width);
+        result.y[i] = (1 - uv[1]) * double(texture.height);
+    }
+    return result;
+}
+
+bool isFinite(const PixelTriangle& triangle)
+{
+    for (int i = 0; i < 3; ++i) {
+        if (!std::isfinite(triangle.x[i]) || !std::isfinite(triangle.y[i]))
+            return false;
+    }
+    return true;
+}
+
+// Rows or columns of the pixels with centers from min to max, clamped to
+// the size; first > last when there are none.
+void getPixelRange(double min, double max, size_t size, long& first, long& last)
+{
+    first = std::max(0L, long(std::ceil(min - 0.5)));
+    last = std::min(long(size) - 1, long(std::floor(max - 0.5)));
+}
+
+// False when the pixel has no nearest point on the source mesh.
+bool getColor(
+        const Baking& baking,
+        size_t triangle,
+        const double* weights,
+        uint8_t* pixel)
+{
+    const TriangleMesh& mesh = baking.mesh.mesh;
+    const uint32_t* v = &mesh.indices[3 * triangle];
+    const TriangleMesh* colorMesh = &mesh;
+    double sourceWeights[3];
+    if (baking.grid) {
+        double p[3] = {0, 0, 0};
+        for (int corner = 0; corner < 3; ++corner) {
+            for (int axis = 0; axis < 3; ++axis) {
+                p[axis] += weights[corner] * mesh.positions[3 * v[corner] + axis];
+            }
+        }
+        NearestPoint nearest;
+        if (!baking.grid->findNearest(p, nearest))
+            return false;
+        colorMesh = baking.source;
+        v = &colorMesh->indices[3 * nearest.triangle];
+        std::copy(nearest.weights, nearest.weights + 3, sourceWeights);
+        weights = sourceWeights;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        double value = 0;
+        for (int corner = 0; corner < 3; ++corner) {
+            value += weights[corner] * colorMesh->colors[3 * v[corner] + c];
+        }
+        pixel[c] = uint8_t(std::min(255.0, std::max(0.0, value + 0.5)));
+    }
+    return true;
+}
+
+// Rasterizes the triangle into the rows [firstRow, lastRow].
+void rasterize(Baking& baking, size_t triangle, long firstRow, long lastRow)
+{
+    Texture& texture = baking.texture;
+    const PixelTriangle t = getPixelTriangle(baking.mesh, triangle, texture);
+    if (!isFinite(t))
+        return;
+    const double* x = t.x;
+    const double* y = t.y;
+    const double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0)
+        return;
+
+    long triangleFirstRow;
+    long triangleLastRow;
+    getPixelRange(std::min(y[0], std::min(y[1], y[2])), std::max(y[0], std::max(y[1], y[2])),
+            texture.height, triangleFirstRow, triangleLastRow);
+    firstRow = std::max(firstRow, triangleFirstRow);
+    lastRow = std::min(lastRow, triangleLastRow);
+    long firstColumn;
+    long lastColumn;
+    getPixelRange(std::min(x[0], std::min(x[1], x[2])), std::max(x[0], std::max(x[1], x[2])),
+            texture.width, firstColumn, lastColumn);
+
+    for (long row = firstRow; row <= lastRow; ++row) {
+        const double py = row + 0.5;
+        for (long column = firstColumn; column <= lastColumn; ++column) {
+            const double px = column + 0.5;
+            double weights[3];
+            for (int i = 0; i < 3; ++i) {
+                const int j = (i + 1) % 3;
+                const int k = (i + 2) % 3;
+                weights[i] = ((x[j] - px) * (y[k] - py) - (x[k] - px) * (y[j] - py)) / area;
+            }
+            if (weights[0] < 0 || weights[1] < 0 || weights[2] < 0)
+                continue;
+
+            const size_t index = row * texture.width + column;
+            if (getColor(baking, triangle, weights, &texture.pixels[3 * index]))
+                baking.isCovered[index] = 1;
+        }
+    }
+}
+
+void bakeBand(Baking& baking, size_t band)
+{
+    const long firstRow = long(band * baking.bandHeight);
+    const long lastRow = long(std::min(baking.texture.height,
+                                       (band + 1) * baking.bandHeight)) - 1;
+    const std::vector<uint32_t>& triangles = baking.bandTriangles[band];
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        rasterize(baking, triangles[i], firstRow, lastRow);
+    }
+}
+
+// Gives every uncovered pixel of the rows [firstRow, lastRow] next to a
+// covered one the mean color of its covered neighbors, reading the
+// coverage before this ring.
+void padRows(
+        Texture& texture,
+        const std::vector<uint8_t>& isCovered,
+        std::vector<uint8_t>& isPadded,
+        size_t firstRow,
+        size_t lastRow)
+{
+    const long width = long(texture.width);
+    const long height = long(texture.height);
+    for (long row = long(firstRow); row <= long(lastRow); ++row) {
+        for (long column = 0; column < width; ++column) {
+            const size_t index = row * width + column;
+            if (isCovered[index])
+                continue;
+
+            unsigned sum[3] = {0, 0, 0};
+            unsigned qty = 0;
+            for (long y = std::max(0L, row - 1); y <= std::min(height - 1, row + 1); ++y) {
+                for (long x = std::max(0L, column - 1); x <= std::min(width - 1, column + 1); ++x) {
+                    const size_t neighbor = y * width + x;
+                    if (!isCovered[neighbor])
+                        continue;
+                    for (int c = 0; c < 3; ++c) {
+                        sum[c] += texture.pixels[3 * neighbor + c];
+                    }
+                    ++qty;
+                }
+            }
+            if (qty == 0)
+                continue;
+            for (int c = 0; c < 3; ++c) {
+                texture.pixels[3 * index + c] = uint8_t((sum[c] + qty / 2) / qty);
+            }
+            isPadded[index] = 1;
+        }
+    }
+}
+
+// Pads one ring of pixels at a time, each ring by threadQty threads
+// taking the bands of the baking.
+void pad(Baking& baking, size_t padding, int threadQty)
+{
+    Texture& texture = baking.texture;
+    const size_t bandQty = baking.bandTriangles.size();
+    for (size_t ring = 0; ring < padding; ++ring) {
+        std::vector<uint8_t> isPadded(baking.isCovered);
+        runTasks(bandQty, threadQty, [&](size_t band) {
+            const size_t first = band * baking.bandHeight;
+            const size_t last = std::min(texture.height, first + baking.bandHeight) - 1;
+            padRows(texture, baking.isCovered, isPadded, first, last);
+        });
+        baking.isCovered.swap(isPadded);
+    }
+}
+
+} // anonymous namespace
+
+BakeSettings::BakeSettings()
+    : width(2048)
+    , height(2048)
+    , padding(4)
+    , threadQty(1)
+{}
+
+void bakeTexture(
+        const UvMesh& mesh,
+        const TriangleMesh* source,
+        const BakeSettings& settings,
+        Texture& texture)
+{
+    if (source ? source->colors.empty() : mesh.mesh.colors.empty())
+        throw std::runtime_error("no vertex colors to bake");
+
+    texture.width = settings.width;
+    texture.height = settings.height;
+    texture.pixels.assign(3 * texture.width * texture.height, 0);
+    if (texture.pixels.empty())
+        return;
+
+    const int threadQty = std::max(1, settings.threadQty);
+    Baking baking(mesh, source, texture);
+    const size_t bandQty = std::min(texture.height, threadQty * BANDS_PER_THREAD);
+    baking.bandHeight = (texture.height + bandQty - 1) / bandQty;
+    baking.bandTriangles.resize((texture.height + baking.bandHeight - 1) / baking.bandHeight);
+    for (size_t t = 0; t < mesh.mesh.getTriangleQty(); ++t) {
+        const PixelTriangle triangle = getPixelTriangle(mesh, t, texture);
+        // Non-finite coordinates would make the rows overflow.
+        if (!isFinite(triangle))
+            continue;
+        long firstRow;
+        long lastRow;
+        getPixelRange(std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2])),
+                std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2])),
+                texture.height, firstRow, lastRow);
+        for (long band = firstRow / long(baking.bandHeight);
+             firstRow <= lastRow && band <= lastRow / long(baking.bandHeight);
+             ++band)
+        {
+            baking.bandTriangles[band].push_back(uint32_t(t));
+        }
+    }
+
+    runTasks(baking.bandTriangles.size(), threadQty, [&](size_t band) {
+        bakeBand(baking, band);
+    });
+
+    pad(baking, settings.padding, threadQty);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "triangle-mesh.h"
+#include "uv-mesh.h"
+
+// An RGB image of 3 bytes per pixel, rows from the top, so that texture
+// coordinate v = 1 is the first row.
+struct Texture {
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> pixels;
+};
+
+struct BakeSettings {
+    BakeSettings();
+
+    size_t width;
+    size_t height;
+    // Rings of pixels around the charts that get the colors of the chart
+    // pixels next to them, so that filtering and mipmapping don't mix in
+    // the background at chart seams.
+    size_t padding;
+    int threadQty;
+};
+
+// Fills every pixel with its center in a triangle in texture space. With
+// source null the vertex colors of the triangle are interpolated
+// barycentrically; otherwise the pixel's point on the mesh is looked up
+// on the nearest triangle of source, whose vertex colors are interpolated
+// there, to transfer the colors of a finer mesh. The charts are then
+// padded, and pixels further out stay black.
+//
+// The rows are split into bands baked by threadQty threads, each band
+// rasterizing the triangles that overlap it, so that the result doesn't
+// depend on the threads. Throws std::runtime_error when the mesh or the
+// source has no colors.
+void bakeTexture(
+        const UvMesh& mesh,
+        const TriangleMesh* source,
+        const BakeSettings& settings,
+        Texture& texture);
@@ -0,0 +1,67 @@
+#include "texture-writer.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <png.h>
+#include <turbojpeg.h>
+
+namespace
+{
+
+void writeJpeg(const std::string& filename, const Texture& texture, int quality)
+{
+    tjhandle tj = tjInitCompress();
+    unsigned long jpegSize = 0;
+    unsigned char* tjBuffer = 0;
+    // Older turbojpeg versions take the pixels as not const.
+    const int result = tjCompress2(
+            tj, const_cast<unsigned char*>(texture.pixels.data()), int(texture.width), int(3 * texture.width),
+            int(texture.height), TJPF_RGB, &tjBuffer, &jpegSize, TJSAMP_444,
+            quality, 0);
+    std::vector<char> jpegBuffer;
+    const std::string error = result == 0 ? "" : tjGetErrorStr();
+    if (result == 0)
+        jpegBuffer.assign(tjBuffer, tjBuffer + jpegSize);
+    tjFree(tjBuffer);
+    tjDestroy(tj);
+    if (result != 0)
+        throw std::runtime_error("can't encode " + filename + ": " + error);
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    f.write(jpegBuffer.data(), std::streamsize(jpegBuffer.size()));
+    f.close();
+    if (f.fail())
+        throw std::runtime_error("can't write " + filename);
+}
+
+void writePng(const std::string& filename, const Texture& texture)
+{
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = png_uint_32(texture.width);
+    image.height = png_uint_32(texture.height);
+    image.format = PNG_FORMAT_RGB;
+    if (!png_image_write_to_file(&image, filename.c_str(), 0, texture.pixels.data(),
+                                 png_int_32(3 * texture.width), 0))
+    {
+        throw std::runtime_error("can't write " + filename + ": " + image.message);
+    }
+}
+
+} // anonymous namespace
+
+void writeTexture(const std::string& filename, const Texture& texture, int jpegQuality)
+{
+    if (boost::algorithm::iends_with(filename, ".jpg")
+        || boost::algorithm::iends_with(filename, ".jpeg"))
+    {
+        writeJpeg(filename, texture, jpegQuality);
+    } else {
+        writePng(filename, texture);
+    }
+}
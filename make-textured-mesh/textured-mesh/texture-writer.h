@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+#include "texture-baker.h"
+
+// Writes the texture as a JPEG file with turbojpeg when the name ends with
+// .jpg or .jpeg, and as a PNG file with libpng otherwise. Throws
+// std::runtime_error when it can't.
+void writeTexture(const std::string& filename, const Texture& texture, int jpegQuality);
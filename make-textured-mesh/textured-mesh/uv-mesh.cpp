@@ -0,0 +1,186 @@
+#include "uv-mesh.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "mapped-file.h"
+#include "obj-tokens.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+// Lines are formatted into a buffer written in blocks of about this size.
+const size_t BLOCK_SIZE = 1 << 20;
+// Longer than any line written.
+const size_t MAX_LINE_SIZE = 128;
+
+void flush(std::ofstream& f, std::string& block)
+{
+    f.write(block.data(), std::streamsize(block.size()));
+    block.clear();
+}
+
+// Reads up to maxQty numbers from the tokens and returns how many there
+// are.
+size_t parseNumbers(ObjLineTokens& tokens, float* values, size_t maxQty)
+{
+    size_t qty = 0;
+    ObjToken token;
+    while (tokens.next(token)) {
+        if (qty < maxQty) {
+            values[qty] = parseObjFloat(token);
+        }
+        ++qty;
+    }
+    return qty;
+}
+
+} // anonymous namespace
+
+void readObj(const std::string& filename, UvMesh& mesh)
+{
+    const MappedFile file(filename);
+    file.adviseSequential(0, file.size());
+
+    mesh = UvMesh();
+    std::vector<float>& positions = mesh.mesh.positions;
+    std::vector<uint8_t>& colors = mesh.mesh.colors;
+    bool hasColors = true;
+    bool isMissingTexIndex = false;
+    size_t normalQty = 0;
+    std::vector<ObjCorner> corners;
+    forEachObjLine(file.data(), file.data() + file.size(),
+        [&](const char* begin, const char* end)
+        {
+            ObjLineTokens tokens(begin, end);
+            ObjToken type;
+            if (!tokens.next(type))
+                return;
+
+            if (type == "v") {
+                float values[6];
+                const size_t qty = parseNumbers(tokens, values, 6);
+                if (qty < 3)
+                    throw ObjError("bad vertex: " + std::string(begin, end));
+                positions.insert(positions.end(), values, values + 3);
+                hasColors = hasColors && qty == 6;
+                if (hasColors) {
+                    for (int i = 3; i < 6; ++i) {
+                        colors.push_back(uint8_t(
+                                std::min(1.0f, std::max(0.0f, values[i])) * 255 + 0.5f));
+                    }
+                }
+            } else if (type == "vt") {
+                float values[2];
+                if (parseNumbers(tokens, values, 2) < 2)
+                    throw ObjError("bad texture vertex: " + std::string(begin, end));
+                mesh.texCoords.insert(mesh.texCoords.end(), values, values + 2);
+            } else if (type == "vn") {
+                ++normalQty;
+            } else if (type == "f") {
+                const size_t vertexQty = mesh.mesh.getVertexQty();
+                const size_t texVertexQty = mesh.getTexVertexQty();
+                corners.clear();
+                ObjToken token;
+                while (tokens.next(token)) {
+                    const ObjCorner corner =
+                        parseObjCorner(token, vertexQty, texVertexQty, normalQty);
+                    if (corner.index >= vertexQty
+                        || (corner.textureIndex != OBJ_NO_INDEX
+                            && corner.textureIndex >= texVertexQty))
+                    {
+                        throw ObjError("face refers to a missing vertex");
+                    }
+                    isMissingTexIndex = isMissingTexIndex
+                                        || corner.textureIndex == OBJ_NO_INDEX;
+                    corners.push_back(corner);
+                }
+                for (size_t i = 2; i < corners.size(); ++i) {
+                    const ObjCorner* triangle[3] = {
+                        &corners[0], &corners[i - 1], &corners[i]
+                    };
+                    for (int k = 0; k < 3; ++k) {
+                        mesh.mesh.indices.push_back(triangle[k]->index);
+                        mesh.texIndices.push_back(triangle[k]->textureIndex);
+                    }
+                }
+            }
+        });
+    if (!hasColors)
+        colors.clear();
+
+    // Corners without texture coordinates share a last one at 0, 0.
+    if (isMissingTexIndex) {
+        const uint32_t missingTexIndex = uint32_t(mesh.getTexVertexQty());
+        mesh.texCoords.push_back(0);
+        mesh.texCoords.push_back(0);
+        std::replace(mesh.texIndices.begin(), mesh.texIndices.end(),
+                     OBJ_NO_INDEX, missingTexIndex);
+    }
+}
+
+void writeObj(
+        const std::string& filename,
+        const UvMesh& mesh,
+        const std::string& textureFilename)
+{
+    const fs::path path(filename);
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary);
+    std::string block;
+    block.reserve(BLOCK_SIZE + MAX_LINE_SIZE);
+
+    if (!textureFilename.empty()) {
+        const fs::path mtlPath = fs::path(path).replace_extension(".mtl");
+        std::ofstream mtl(mtlPath.string().c_str());
+        mtl << "newmtl material_0\n"
+            << "Ka 1 1 1\n"
+            << "Kd 1 1 1\n"
+            << "Ks 0 0 0\n"
+            << "illum 1\n"
+            << "map_Kd " << fs::path(textureFilename).filename().string() << '\n';
+        mtl.close();
+        if (mtl.fail())
+            throw std::runtime_error("can't write " + mtlPath.string());
+        block += "mtllib " + mtlPath.filename().string() + "\n";
+    }
+
+    const std::vector<float>& positions = mesh.mesh.positions;
+    for (size_t v = 0; v < mesh.mesh.getVertexQty(); ++v) {
+        char line[MAX_LINE_SIZE];
+        block.append(line, std::snprintf(line, sizeof(line), "v %.7g %.7g %.7g\n",
+                positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]));
+        if (block.size() >= BLOCK_SIZE)
+            flush(f, block);
+    }
+    for (size_t t = 0; t < mesh.getTexVertexQty(); ++t) {
+        char line[MAX_LINE_SIZE];
+        block.append(line, std::snprintf(line, sizeof(line), "vt %.7g %.7g\n",
+                mesh.texCoords[2 * t], mesh.texCoords[2 * t + 1]));
+        if (block.size() >= BLOCK_SIZE)
+            flush(f, block);
+    }
+
+    if (!textureFilename.empty())
+        block += "usemtl material_0\n";
+    const std::vector<uint32_t>& indices = mesh.mesh.indices;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        // OBJ indices start at 1.
+        char line[MAX_LINE_SIZE];
+        block.append(line, std::snprintf(line, sizeof(line), "f %u/%u %u/%u %u/%u\n",
+                indices[i] + 1, mesh.texIndices[i] + 1,
+                indices[i + 1] + 1, mesh.texIndices[i + 1] + 1,
+                indices[i + 2] + 1, mesh.texIndices[i + 2] + 1));
+        if (block.size() >= BLOCK_SIZE)
+            flush(f, block);
+    }
+    flush(f, block);
+    f.close();
+    if (f.fail())
+        throw std::runtime_error("can't write " + filename);
+}
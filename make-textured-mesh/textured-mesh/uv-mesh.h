@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "triangle-mesh.h"
+
+// A triangle mesh with texture coordinates. The corners of a triangle
+// index the vertices through mesh.indices and the texture coordinates
+// through texIndices, so that a vertex on a chart seam has one texture
+// coordinate in every chart.
+struct UvMesh {
+    TriangleMesh mesh;
+    std::vector<float> texCoords;      // u, v of every texture vertex
+    std::vector<uint32_t> texIndices;  // 3 per triangle
+
+    size_t getTexVertexQty() const { return texCoords.size() / 2; }
+};
+
+// Reads the vertices, texture coordinates and faces of an OBJ file, with
+// polygons split into triangle fans. Tokens, numbers and indices follow
+// the rules of obj-tokens.h; lines other than v, vt, vn and f are
+// skipped, since the inputs come from other tools with groups, smoothing
+// and materials. Vertex colors are read when every vertex has them, as
+// r, g, b from 0 to 1 after its position the way MeshLab writes them.
+// Faces without texture coordinates get the coordinates 0, 0. Throws
+// ObjError or MappedFileError.
+void readObj(const std::string& filename, UvMesh& mesh);
+
+// Writes an OBJ file with the texture coordinates, and with
+// textureFilename not empty a material library next to it, of the same
+// name with .mtl, that maps the texture. Throws std::runtime_error when
+// the files can't be written.
+void writeObj(
+        const std::string& filename,
+        const UvMesh& mesh,
+        const std::string& textureFilename);
@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include "obfuscation-kernel.h"
+
+// Measures how many triangles per second every obfuscation kernel this CPU
+// runs handles, and checks that they agree with the scalar one.
+
+namespace
+{
+
+const size_t BATCH_QTY = 1 << 14;
+const int REPEAT_QTY = 100;
+
+float randomCoord()
+{
+    return 200.0f * std::rand() / RAND_MAX - 100.0f;
+}
+
+void makeTriangles(std::vector<TriangleBatch>& batches)
+{
+    std::srand(1);
+    batches.resize(BATCH_QTY);
+    for (size_t i = 0; i < batches.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (size_t j = 0; j < OBFUSCATION_BATCH_SIZE; ++j) {
+                    batches[i].corners[k][axis][j] = randomCoord();
+                }
+            }
+        }
+    }
+}
+
+double measure(
+        const std::vector<TriangleBatch>& batches,
+        ObfuscationRounding rounding,
+        ObfuscationKernel kernel,
+        std::vector<ObfuscationPoints>& points)
+{
+    points.resize(batches.size());
+    const std::clock_t start = std::clock();
+    for (int r = 0; r < REPEAT_QTY; ++r) {
+        for (size_t i = 0; i < batches.size(); ++i) {
+            calcObfuscationPoints(batches[i], rounding, points[i], kernel);
+        }
+    }
+    const double seconds = double(std::clock() - start) / CLOCKS_PER_SEC;
+    return REPEAT_QTY * batches.size() * OBFUSCATION_BATCH_SIZE / seconds;
+}
+
+bool isSame(const std::vector<ObfuscationPoints>& points1,
+            const std::vector<ObfuscationPoints>& points2)
+{
+    for (size_t i = 0; i < points1.size(); ++i) {
+        const ObfuscationPoints& p = points1[i];
+        const ObfuscationPoints& q = points2[i];
+        if (std::memcmp(p.m, q.m, sizeof(p.m)) != 0
+            || std::memcmp(p.d, q.d, sizeof(p.d)) != 0
+            || std::memcmp(p.isValid, q.isValid, sizeof(p.isValid)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    std::vector<TriangleBatch> batches;
+    makeTriangles(batches);
+
+    const ObfuscationRounding roundings[] = {
+        ROUND_EVERY_STEP,
+        ROUND_RESULT_ONLY
+    };
+    const char* roundingNames[] = {
+        "round every step (obfuscate)",
+        "round result only (obfuscate-with-texture)"
+    };
+
+    std::vector<ObfuscationKernel> kernels;
+    kernels.push_back(OBFUSCATION_KERNEL_SCALAR);
+    if (bestObfuscationKernel() != OBFUSCATION_KERNEL_SCALAR)
+        kernels.push_back(bestObfuscationKernel());
+
+    bool isIdentical = true;
+
+    for (int r = 0; r < 2; ++r) {
+        std::cout << roundingNames[r] << '\n';
+
+        std::vector<ObfuscationPoints> scalarPoints;
+        std::vector<ObfuscationPoints> points;
+        for (size_t k = 0; k < kernels.size(); ++k) {
+            const double rate = measure(batches, roundings[r], kernels[k],
+                                        k == 0 ? scalarPoints : points);
+            std::cout << "    " << obfuscationKernelName(kernels[k]) << ": "
+                      << rate / 1e6 << " M triangles/s";
+            if (k > 0 && !isSame(scalarPoints, points)) {
+                std::cout << ", differs from scalar";
+                isIdentical = false;
+            }
+            std::cout << '\n';
+        }
+    }
+
+    return isIdentical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
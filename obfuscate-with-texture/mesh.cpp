@@ -0,0 +1,705 @@
+#include "mesh.h"
+
+#include "mapped-file.h"
+#include "mesh-cache.h"
+#include "obj-tokens.h"
+#include "run-tasks.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fstream>
+
+using boost::optional;
+
+namespace
+{
+
+// Smaller parts of a file aren't worth a thread.
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+enum LineType {
+    LINE_EMPTY,
+    LINE_VERTEX,
+    LINE_VERTEX_TEXTURE,
+    LINE_NORMAL,
+    LINE_FACE,
+    LINE_MTLLIB,
+    LINE_USEMTL
+};
+
+struct ElementCounts {
+    size_t coords;
+    size_t textureCoords;
+    size_t normals;
+    size_t faces;
+    size_t corners;
+    // Faces that aren't triangles.
+    size_t polygons;
+};
+
+// A part of the file made of whole lines.
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    // Elements defined in the chunk, then the indices of its first
+    // elements in the mesh.
+    ElementCounts counts;
+    ElementCounts firsts;
+
+    optional<std::string> mtllib;
+    optional<std::string> usemtl;
+
+    std::exception_ptr error;
+};
+
+LineType getLineType(const char* begin, const char* end)
+{
+    ObjToken first;
+    if (!ObjLineTokens(begin, end).next(first) || first[0] == '#')
+        return LINE_EMPTY;
+
+    if (first == "v")
+        return LINE_VERTEX;
+    if (first == "vt")
+        return LINE_VERTEX_TEXTURE;
+    if (first == "vn")
+        return LINE_NORMAL;
+    if (first == "f")
+        return LINE_FACE;
+    if (first == "mtllib")
+        return LINE_MTLLIB;
+    if (first == "usemtl")
+        return LINE_USEMTL;
+
+    throw std::runtime_error("unknown line type\n" + std::string(begin, end));
+}
+
+// Indices of the corner from 0, negative ones relative to the elements
+// defined before the face.
+Vertex parseFaceVertex(ObjToken token, const ElementCounts& defined)
+{
+    const ObjCorner corner = parseObjCorner(
+            token, defined.coords, defined.textureCoords, defined.normals);
+    Vertex vertex;
+    vertex.index = corner.index;
+    vertex.textureIndex = corner.textureIndex;
+    vertex.normalIndex = corner.normalIndex;
+    return vertex;
+}
+
+// Reads up to size numbers after the line type, returns how many
+// numbers the line has.
+template <size_t size, typename Vector>
+size_t parseNumbers(ObjLineTokens& tokens, Vector& v)
+{
+    size_t qty = 0;
+    ObjToken token;
+    while (tokens.next(token)) {
+        if (qty < size) {
+            v[qty] = parseObjFloat(token);
+        }
+        ++qty;
+    }
+    return qty;
+}
+
+void countElements(ObjChunk& chunk)
+{
+    chunk.counts = ElementCounts();
+    forEachObjLine(chunk.begin, chunk.end,
+        [&](const char* begin, const char* end)
+        {
+            switch (getLineType(begin, end)) {
+            case LINE_VERTEX:
+                ++chunk.counts.coords;
+                break;
+            case LINE_VERTEX_TEXTURE:
+                ++chunk.counts.textureCoords;
+                break;
+            case LINE_NORMAL:
+                ++chunk.counts.normals;
+                break;
+            case LINE_FACE: {
+                ObjLineTokens tokens(begin, end);
+                ObjToken token;
+                tokens.next(token);
+                size_t cornerQty = 0;
+                while (tokens.next(token)) {
+                    ++cornerQty;
+                }
+                ++chunk.counts.faces;
+                chunk.counts.corners += cornerQty;
+                if (cornerQty != 3) {
+                    ++chunk.counts.polygons;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        });
+}
+
+// Fills the elements of the chunk in place, starting from its firsts.
+void parseChunk(ObjChunk& chunk, Mesh& mesh)
+{
+    ElementCounts next = chunk.firsts;
+    forEachObjLine(chunk.begin, chunk.end,
+        [&](const char* begin, const char* end)
+        {
+            const LineType type = getLineType(begin, end);
+            if (type == LINE_EMPTY)
+                return;
+
+            ObjLineTokens tokens(begin, end);
+            ObjToken token;
+            tokens.next(token);
+
+            switch (type) {
+            case LINE_VERTEX: {
+                const size_t qty =
+                    parseNumbers<3>(tokens, mesh.m_coords[next.coords++]);
+                PRECONDITION(qty >= 3);
+                if (qty == 6) { // v x y z r g b
+                    throw notImplemented();
+                }
+                break;
+            }
+            case LINE_VERTEX_TEXTURE:
+                PRECONDITION(parseNumbers<2>(
+                        tokens, mesh.m_textureCoords[next.textureCoords++]) >= 2);
+                break;
+            case LINE_NORMAL:
+                PRECONDITION(parseNumbers<3>(
+                        tokens, mesh.m_normalCoords[next.normals++]) >= 3);
+                break;
+            case LINE_FACE: {
+                const size_t firstCorner = next.corners;
+                mesh.m_faces.setFirstCorner(next.faces++, firstCorner);
+                while (tokens.next(token)) {
+                    mesh.m_faces.setCorner(next.corners++, parseFaceVertex(token, next));
+                }
+                PRECONDITION(next.corners != firstCorner);
+                break;
+            }
+            case LINE_MTLLIB:
+                PRECONDITION(tokens.next(token));
+                chunk.mtllib = std::string(token);
+                break;
+            case LINE_USEMTL:
+                PRECONDITION(tokens.next(token));
+                chunk.usemtl = std::string(token);
+                break;
+            default:
+                break;
+            }
+        });
+}
+
+// Cuts the file into about threadQty parts ending at line breaks.
+std::vector<ObjChunk> splitIntoChunks(const char* data, size_t size, int threadQty)
+{
+    const size_t chunkQty = std::max<size_t>(1,
+        std::min<size_t>(std::max(threadQty, 1), size / MIN_CHUNK_SIZE));
+
+    std::vector<ObjChunk> chunks;
+    const char* begin = data;
+    const char* const end = data + size;
+    for (size_t i = 1; i <= chunkQty && begin != end; ++i) {
+        const char* chunkEnd = end;
+        if (i < chunkQty) {
+            chunkEnd = std::max(begin, data + size / chunkQty * i);
+            const void* lineBreak = std::memchr(chunkEnd, '\n', end - chunkEnd);
+            chunkEnd = lineBreak ? static_cast<const char*>(lineBreak) + 1 : end;
+        }
+
+        ObjChunk chunk = ObjChunk();
+        chunk.begin = begin;
+        chunk.end = chunkEnd;
+        chunks.push_back(chunk);
+        begin = chunkEnd;
+    }
+    return chunks;
+}
+
+// Runs function on every chunk on its own thread. Rethrows the error of
+// the first failed chunk, which is the error a serial parse would report.
+template <typename Function>
+void runOnChunks(std::vector<ObjChunk>& chunks, const Function& function)
+{
+    runTasks(chunks.size(), int(chunks.size()), [&](size_t i) {
+        try {
+            function(chunks[i]);
+        } catch (...) {
+            chunks[i].error = std::current_exception();
+        }
+    });
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].error) {
+            std::rethrow_exception(chunks[i].error);
+        }
+    }
+}
+
+// Lines formatted by one thread at a time.
+const size_t LINES_PER_BLOCK = 1 << 16;
+
+// Shortest text that reads back as the same float.
+template <typename Vector>
+void appendNumbers(std::string& s, const Vector& v, size_t size)
+{
+    char text[32];
+    for (size_t i = 0; i < size; ++i) {
+        const std::to_chars_result result =
+            std::to_chars(text, text + sizeof(text), float(v[i]));
+        s += ' ';
+        s.append(text, result.ptr);
+    }
+}
+
+void appendIndex(std::string& s, Index index)
+{
+    char text[24];
+    const std::to_chars_result result =
+        std::to_chars(text, text + sizeof(text), uint64_t(index) + 1);
+    s.append(text, result.ptr);
+}
+
+// Writes the lines of the elements [0, size) formatted by
+// format(buffer, begin, end). threadQty blocks are formatted at a time
+// while the blocks before them are written.
+template <typename Format>
+void writeInBlocks(
+        std::ostream& s,
+        size_t size,
+        int threadQty,
+        const Format& format)
+{
+    const size_t blocksPerRound = std::max(threadQty, 1);
+    std::vector<std::string> current(blocksPerRound);
+    std::vector<std::string> next(blocksPerRound);
+
+    // Formats the block firstBlock + i into buffers[i].
+    const auto formatBlock = [&](
+            std::vector<std::string>& buffers, size_t firstBlock, size_t i)
+    {
+        buffers[i].clear();
+        const size_t begin = (firstBlock + i) * LINES_PER_BLOCK;
+        if (begin < size) {
+            format(buffers[i], begin, std::min(size, begin + LINES_PER_BLOCK));
+        }
+    };
+
+    runTasks(blocksPerRound, int(blocksPerRound), [&](size_t i) {
+        formatBlock(current, 0, i);
+    });
+    for (size_t first = 0; first * LINES_PER_BLOCK < size; first += blocksPerRound) {
+        // The first task writes this round while the others format the
+        // next one.
+        runTasks(blocksPerRound + 1, int(blocksPerRound + 1), [&](size_t task) {
+            if (task > 0) {
+                formatBlock(next, first + blocksPerRound, task - 1);
+                return;
+            }
+            for (size_t i = 0; i < current.size(); ++i) {
+                s.write(current[i].data(), current[i].size());
+            }
+        });
+        current.swap(next);
+    }
+}
+
+void dropIfMissing(std::vector<Index>& indices)
+{
+    if (std::count(indices.begin(), indices.end(), NO_INDEX)
+        == std::ptrdiff_t(indices.size()))
+    {
+        std::vector<Index>().swap(indices);
+    }
+}
+
+// The indices are only stored from the first one that isn't missing on.
+void addOptionalIndex(std::vector<Index>& indices, size_t cornerQty, Index index)
+{
+    if (index != NO_INDEX || !indices.empty()) {
+        indices.resize(cornerQty, NO_INDEX);
+        indices.push_back(index);
+    }
+}
+
+} // anonymous namespace
+
+size_t Faces::size() const
+{
+    return m_offsets.empty() ? m_indices.size() / 3 : m_offsets.size() - 1;
+}
+
+size_t Faces::getFirstCorner(size_t face) const
+{
+    return m_offsets.empty() ? 3 * face : m_offsets[face];
+}
+
+size_t Faces::getCornerQty(size_t face) const
+{
+    return m_offsets.empty() ? 3 : m_offsets[face + 1] - m_offsets[face];
+}
+
+Vertex Faces::getCorner(size_t corner) const
+{
+    Vertex vertex;
+    vertex.index = m_indices[corner];
+    if (!m_textureIndices.empty()) {
+        vertex.textureIndex = m_textureIndices[corner];
+    }
+    if (!m_normalIndices.empty()) {
+        vertex.normalIndex = m_normalIndices[corner];
+    }
+    return vertex;
+}
+
+void Faces::resize(size_t faceQty, size_t cornerQty, bool areTriangles)
+{
+    m_offsets.clear();
+    if (!areTriangles) {
+        m_offsets.resize(faceQty + 1);
+        m_offsets.back() = cornerQty;
+    }
+    m_indices.assign(cornerQty, 0);
+    m_textureIndices.assign(cornerQty, NO_INDEX);
+    m_normalIndices.assign(cornerQty, NO_INDEX);
+}
+
+void Faces::setFirstCorner(size_t face, size_t corner)
+{
+    if (!m_offsets.empty()) {
+        m_offsets[face] = corner;
+    }
+}
+
+void Faces::setCorner(size_t corner, const Vertex& vertex)
+{
+    m_indices[corner] = vertex.index;
+    m_textureIndices[corner] = vertex.textureIndex;
+    m_normalIndices[corner] = vertex.normalIndex;
+}
+
+void Faces::dropMissingIndices()
+{
+    dropIfMissing(m_textureIndices);
+    dropIfMissing(m_normalIndices);
+}
+
+void Faces::reserveTriangles(size_t faceQty)
+{
+    m_indices.reserve(3 * faceQty);
+}
+
+void Faces::addTriangle(const Vertex& a, const Vertex& b, const Vertex& c)
+{
+    addCorner(a);
+    addCorner(b);
+    addCorner(c);
+    if (!m_offsets.empty()) {
+        m_offsets.push_back(m_indices.size());
+    }
+}
+
+void Faces::addCorner(const Vertex& vertex)
+{
+    addOptionalIndex(m_textureIndices, m_indices.size(), vertex.textureIndex);
+    addOptionalIndex(m_normalIndices, m_indices.size(), vertex.normalIndex);
+    m_indices.push_back(vertex.index);
+}
+
+const uint64_t* Faces::getOffsets() const
+{
+    return m_offsets.empty() ? 0 : &m_offsets[0];
+}
+
+const Index* Faces::getIndices() const
+{
+    return m_indices.empty() ? 0 : &m_indices[0];
+}
+
+const Index* Faces::getTextureIndices() const
+{
+    return m_textureIndices.empty() ? 0 : &m_textureIndices[0];
+}
+
+const Index* Faces::getNormalIndices() const
+{
+    return m_normalIndices.empty() ? 0 : &m_normalIndices[0];
+}
+
+void Faces::assign(
+        size_t faceQty,
+        const uint64_t* offsets,
+        size_t cornerQty,
+        const Index* indices,
+        const Index* textureIndices,
+        const Index* normalIndices)
+{
+    m_offsets.clear();
+    if (offsets) {
+        m_offsets.assign(offsets, offsets + faceQty + 1);
+    }
+    m_indices.assign(indices, indices + cornerQty);
+    m_textureIndices.clear();
+    if (textureIndices) {
+        m_textureIndices.assign(textureIndices, textureIndices + cornerQty);
+    }
+    m_normalIndices.clear();
+    if (normalIndices) {
+        m_normalIndices.assign(normalIndices, normalIndices + cornerQty);
+    }
+}
+
+size_t Faces::getMemoryUsage() const
+{
+    return m_offsets.capacity() * sizeof(uint64_t)
+           + (m_indices.capacity() + m_textureIndices.capacity()
+              + m_normalIndices.capacity()) * sizeof(Index);
+}
+
+std::runtime_error parsingError()
+{
+    return std::runtime_error("OBJ parsing error");
+}
+
+std::runtime_error notImplemented()
+{
+    return std::runtime_error("Not implemented");
+}
+
+// Lines are counted first, so that every chunk can parse its elements
+// right into their places in the mesh.
+void Mesh::readOBJ(const std::string& filename, int threadQty)
+{
+    const MappedFile file(filename);
+    file.adviseSequential(0, file.size());
+
+    std::vector<ObjChunk> chunks =
+        splitIntoChunks(file.data(), file.size(), threadQty);
+    runOnChunks(chunks, countElements);
+
+    ElementCounts total = ElementCounts();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        chunks[i].firsts = total;
+        total.coords += chunks[i].counts.coords;
+        total.textureCoords += chunks[i].counts.textureCoords;
+        total.normals += chunks[i].counts.normals;
+        total.faces += chunks[i].counts.faces;
+        total.corners += chunks[i].counts.corners;
+        total.polygons += chunks[i].counts.polygons;
+    }
+
+    Mesh mesh;
+    mesh.m_coords.resize(total.coords);
+    mesh.m_textureCoords.resize(total.textureCoords);
+    mesh.m_normalCoords.resize(total.normals);
+    mesh.m_faces.resize(total.faces, total.corners, total.polygons == 0);
+
+    runOnChunks(chunks,
+        [&](ObjChunk& chunk)
+        {
+            parseChunk(chunk, mesh);
+        });
+    mesh.m_faces.dropMissingIndices();
+
+    // The last mtllib and usemtl in the file win.
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].mtllib) {
+            mesh.m_mtllib = chunks[i].mtllib;
+        }
+        if (chunks[i].usemtl) {
+            mesh.m_usemtl = chunks[i].usemtl;
+        }
+    }
+
+    swap(mesh);
+}
+
+void Mesh::writeOBJ(const std::string& filename, int threadQty)
+{
+    PRECONDITION(!m_colors || m_colors->size() == m_coords.size());
+
+    std::ofstream fs(filename.c_str());
+    if (m_mtllib) {
+        fs << "mtllib " << *m_mtllib << "\n\n";
+    }
+
+    writeInBlocks(fs, m_coords.size(), threadQty,
+        [this](std::string& s, size_t begin, size_t end)
+        {
+            formatCoords(s, begin, end);
+        });
+    writeInBlocks(fs, m_normalCoords.size(), threadQty,
+        [this](std::string& s, size_t begin, size_t end)
+        {
+            formatNormals(s, begin, end);
+        });
+    fs << '\n';
+    writeInBlocks(fs, m_textureCoords.size(), threadQty,
+        [this](std::string& s, size_t begin, size_t end)
+        {
+            formatTextureCoords(s, begin, end);
+        });
+    if (m_usemtl) {
+        fs << '\n' << "usemtl " << *m_usemtl << '\n';
+    }
+    writeInBlocks(fs, m_faces.size(), threadQty,
+        [this](std::string& s, size_t begin, size_t end)
+        {
+            formatFaces(s, begin, end);
+        });
+
+    fs.close();
+    if (!fs)
+        throw std::runtime_error("can't write " + filename);
+}
+
+void Mesh::formatCoords(std::string& s, size_t begin, size_t end) const
+{
+    for (size_t i = begin; i < end; ++i) {
+        const Vector3f& v = m_coords[i];
+        s += 'v';
+        appendNumbers(s, v, 3);
+        if (m_colors) {
+            appendNumbers(s, (*m_colors)[i], 3);
+        }
+        s += '\n';
+    }
+}
+
+void Mesh::formatNormals(std::string& s, size_t begin, size_t end) const
+{
+    for (size_t i = begin; i < end; ++i) {
+        s += "vn";
+        appendNumbers(s, m_normalCoords[i], 3);
+        s += '\n';
+    }
+}
+
+void Mesh::formatTextureCoords(std::string& s, size_t begin, size_t end) const
+{
+    for (size_t i = begin; i < end; ++i) {
+        s += "vt";
+        appendNumbers(s, m_textureCoords[i], 2);
+        s += '\n';
+    }
+}
+
+void Mesh::formatFaces(std::string& s, size_t begin, size_t end) const
+{
+    for (size_t i = begin; i < end; ++i) {
+        s += 'f';
+        const size_t firstCorner = m_faces.getFirstCorner(i);
+        const size_t cornerQty = m_faces.getCornerQty(i);
+        for (size_t j = firstCorner; j < firstCorner + cornerQty; ++j) {
+            const Vertex vertex = m_faces.getCorner(j);
+            s += ' ';
+            appendIndex(s, vertex.index);
+            if (vertex.textureIndex != NO_INDEX
+                || vertex.normalIndex != NO_INDEX)
+            {
+                s += '/';
+                if (vertex.textureIndex != NO_INDEX) {
+                    appendIndex(s, vertex.textureIndex);
+                }
+            }
+            if (vertex.normalIndex != NO_INDEX) {
+                s += '/';
+                appendIndex(s, vertex.normalIndex);
+            }
+        }
+        s += '\n';
+    }
+}
+
+template <typename Vector>
+void copyFromArray(std::vector<Vector>& vectors, const float* data, size_t qty)
+{
+    const size_t size = Vector().size();
+    vectors.resize(qty);
+    for (size_t i = 0; i < qty; ++i) {
+        std::copy(data + size * i, data + size * (i + 1), vectors[i].begin());
+    }
+}
+
+template <typename Vector>
+std::vector<float> copyToArray(const std::vector<Vector>& vectors)
+{
+    std::vector<float> data;
+    data.reserve(Vector().size() * vectors.size());
+    for (size_t i = 0; i < vectors.size(); ++i) {
+        data.insert(data.end(), vectors[i].begin(), vectors[i].end());
+    }
+    return data;
+}
+
+bool Mesh::readCache(MeshCache& cache, const std::string& filename)
+{
+    if (!cache.open(filename))
+        return false;
+
+    const MeshView& view = cache.getMesh();
+    Mesh mesh;
+    copyFromArray(mesh.m_coords, view.positions, view.vertexQty);
+    copyFromArray(mesh.m_textureCoords, view.textureCoords, view.textureCoordQty);
+    copyFromArray(mesh.m_normalCoords, view.normals, view.normalQty);
+    mesh.m_faces.assign(view.faceQty, view.faceOffsets, view.cornerQty,
+                        view.indices, view.textureIndices, view.normalIndices);
+    if (!view.mtllib.empty()) {
+        mesh.m_mtllib = view.mtllib;
+    }
+    if (!view.usemtl.empty()) {
+        mesh.m_usemtl = view.usemtl;
+    }
+
+    swap(mesh);
+    return true;
+}
+
+void Mesh::writeCache(const MeshCache& cache) const
+{
+    const std::vector<float> coords = copyToArray(m_coords);
+    const std::vector<float> textureCoords = copyToArray(m_textureCoords);
+    const std::vector<float> normals = copyToArray(m_normalCoords);
+
+    MeshView view;
+    view.vertexQty = m_coords.size();
+    view.positions = coords.empty() ? 0 : &coords[0];
+    view.textureCoordQty = m_textureCoords.size();
+    view.textureCoords = textureCoords.empty() ? 0 : &textureCoords[0];
+    view.normalQty = m_normalCoords.size();
+    view.normals = normals.empty() ? 0 : &normals[0];
+    view.faceQty = m_faces.size();
+    view.faceOffsets = m_faces.getOffsets();
+    view.cornerQty = m_faces.getTotalCornerQty();
+    view.indices = m_faces.getIndices();
+    view.textureIndices = m_faces.getTextureIndices();
+    view.normalIndices = m_faces.getNormalIndices();
+    view.mtllib = m_mtllib.get_value_or("");
+    view.usemtl = m_usemtl.get_value_or("");
+
+    cache.write(view);
+}
+
+void Mesh::swap(Mesh& m)
+{
+    std::swap(m_coords, m.m_coords);
+    std::swap(m_textureCoords, m.m_textureCoords);
+    std::swap(m_normalCoords, m.m_normalCoords);
+    std::swap(m_faces, m.m_faces);
+    std::swap(m_mtllib, m.m_mtllib);
+    std::swap(m_usemtl, m.m_usemtl);
+}
+
+const Vector3f& Mesh::getVertexCoord(Index index) const
+{
+    return m_coords[index];
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <boost/numeric/ublas/vector.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class MeshCache;
+
+typedef boost::numeric::ublas::c_vector<float, 3> Vector3f;
+typedef boost::numeric::ublas::c_vector<float, 2> Vector2f;
+typedef uint32_t Index;
+
+// Stands for a missing texture or normal index.
+const Index NO_INDEX = Index(-1);
+
+struct Vertex {
+    Vertex()
+        : index(0)
+        , textureIndex(NO_INDEX)
+        , normalIndex(NO_INDEX)
+    {}
+
+    Index index;
+    Index textureIndex;
+    Index normalIndex;
+};
+
+// Faces stored as flat arrays of the vertices of all faces, the corners,
+// in face order. Faces of a triangle mesh take 12 bytes per corner or less
+// and no allocations of their own: the offsets of the faces are only kept
+// when some face isn't a triangle, and texture or normal indices only
+// when some corner has them.
+class Faces {
+public:
+    size_t size() const;
+    bool areTriangles() const { return m_offsets.empty(); }
+
+    size_t getFirstCorner(size_t face) const;
+    size_t getCornerQty(size_t face) const;
+    Vertex getCorner(size_t corner) const;
+
+    // Makes room for faceQty faces with cornerQty corners in all, which
+    // are then filled with setFirstCorner and setCorner.
+    void resize(size_t faceQty, size_t cornerQty, bool areTriangles);
+    void setFirstCorner(size_t face, size_t corner);
+    void setCorner(size_t corner, const Vertex& vertex);
+
+    // Frees the texture or normal indices if no corner has them.
+    void dropMissingIndices();
+
+    void reserveTriangles(size_t faceQty);
+    void addTriangle(const Vertex& a, const Vertex& b, const Vertex& c);
+
+    size_t getMemoryUsage() const;
+
+    // The flat arrays, null when the faces don't keep them.
+    size_t getTotalCornerQty() const { return m_indices.size(); }
+    const uint64_t* getOffsets() const;
+    const Index* getIndices() const;
+    const Index* getTextureIndices() const;
+    const Index* getNormalIndices() const;
+
+    // Copies faces given as such arrays.
+    void assign(
+            size_t faceQty,
+            const uint64_t* offsets,
+            size_t cornerQty,
+            const Index* indices,
+            const Index* textureIndices,
+            const Index* normalIndices);
+
+private:
+    void addCorner(const Vertex& vertex);
+
+    // Face i has the corners [m_offsets[i], m_offsets[i + 1]).
+    std::vector<uint64_t> m_offsets;
+    std::vector<Index> m_indices;
+    std::vector<Index> m_textureIndices;
+    std::vector<Index> m_normalIndices;
+};
+
+class Mesh {
+public:
+    // The file is mapped and parsed by threadQty threads, each taking a
+    // part of it split at line boundaries.
+    void readOBJ(const std::string& filename, int threadQty);
+    // Blocks of lines are formatted by threadQty threads and written in
+    // order. Throws std::runtime_error when the file can't be written.
+    void writeOBJ(const std::string& filename, int threadQty);
+
+    // Reads the mesh from the cache of the OBJ file; false when it has no
+    // up to date cache. The cache keeps the key of the OBJ file as it was
+    // before parsing, for writeCache after it.
+    bool readCache(MeshCache& cache, const std::string& filename);
+    void writeCache(const MeshCache& cache) const;
+
+    void swap(Mesh& m);
+
+    const Vector3f& getVertexCoord(Index index) const;
+
+private:
+    // Append the lines of the elements [begin, end) to s.
+    void formatCoords(std::string& s, size_t begin, size_t end) const;
+    void formatNormals(std::string& s, size_t begin, size_t end) const;
+    void formatTextureCoords(std::string& s, size_t begin, size_t end) const;
+    void formatFaces(std::string& s, size_t begin, size_t end) const;
+
+public:
+    std::vector<Vector3f> m_coords;
+    std::vector<Vector2f> m_textureCoords;
+    std::vector<Vector3f> m_normalCoords;
+    Faces m_faces;
+    boost::optional<std::vector<Vector3f> > m_colors;
+
+    boost::optional<std::string> m_mtllib;
+    boost::optional<std::string> m_usemtl;
+};
+
+std::runtime_error parsingError();
+std::runtime_error notImplemented();
+
+#define PRECONDITION(expression) \
+    if (! (expression)) { \
+        std::cerr << "Precondition failed in file " << __FILE__ \
+                  << " at line " << __LINE__ << std::endl; \
+        throw parsingError(); \
+    }
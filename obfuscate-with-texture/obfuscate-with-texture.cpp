@@ -1,70 +1,22 @@
-#include <boost/numeric/ublas/vector.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/optional.hpp>
 #include <boost/program_options.hpp>
-#include <boost/exception/all.hpp>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <vector>
-#include <fstream>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 #include <limits>
 
-using boost::numeric::ublas::c_vector;
-using boost::lexical_cast;
-using boost::optional;
-using std::string;
-
-typedef c_vector<float, 3> Vector3f;
-typedef c_vector<float, 2> Vector2f;
-typedef size_t Index;
-
-struct Vertex {
-    Index index;
-    optional<Index> textureIndex;
-    optional<Index> normalIndex;
-};
-
-typedef std::vector<Vertex> Vertices;
-typedef std::vector<std::string> Tokens;
-typedef std::vector<int> IndexMap;
+#include "mesh.h"
+#include "mesh-cache.h"
+#include "obfuscation-kernel.h"
+#include "run-tasks.h"
 
-class Mesh {
-public:
-    void readOBJ(const std::string& filename);
-    void writeOBJ(const std::string& filename);
-    void swap(Mesh& m);
-
-    const Vector3f& getVertexCoord(Index index) const;
+using std::string;
 
-private:
-    void parseLine(std::string line);
-    void parseVertex(const Tokens& tokens);
-    void parseVertexTexture(const Tokens& tokens);
-    void parseNormal(const Tokens& tokens);
-    void parseFace(const Tokens& tokens);
-    void parseMtllib(const Tokens& tokens);
-    void parseUsemtl(const Tokens& tokens);
-
-    void writeCoords(std::ostream& s);
-    void writeNormals(std::ostream& s);
-    void writeTextureCoords(std::ostream& s);
-    void writeFaces(std::ostream& s);
-
-public:
-    std::vector<Vector3f> m_coords;
-    std::vector<Vector2f> m_textureCoords;
-    std::vector<Vector3f> m_normalCoords;
-    std::vector<Vertices> m_faces;
-    optional<std::vector<Vector3f> > m_colors;
-
-    optional<std::string> m_mtllib;
-    optional<std::string> m_usemtl;
-};
+typedef std::vector<Index> IndexMap;
 
 struct Options {
     string inputFilename;
@@ -73,401 +25,400 @@ struct Options {
     double addingFraction;
     int vertexAddingModulo;
     int vertexCopyingModulo;
+    int threadQty;
+    bool isUsingCache;
 };
 
-std::runtime_error parsingError()
+bool shouldCopyVertex(const Options& options, size_t reuseCounter)
 {
-    return std::runtime_error("OBJ parsing error");
+    return options.vertexCopyingModulo != std::numeric_limits<int>::max()
+           && reuseCounter % options.vertexCopyingModulo == 0;
 }
 
-std::runtime_error notImplemented()
+// Number of the reuses [begin, end) of the whole mesh that are copied.
+size_t countCopies(const Options& options, size_t begin, size_t end)
 {
-    return std::runtime_error("Not implemented");
-}
+    if (options.vertexCopyingModulo == std::numeric_limits<int>::max())
+        return 0;
 
-#define PRECONDITION(expression) \
-    if (! (expression)) { \
-        std::cerr << "Precondition failed in file " << __FILE__ \
-                  << " at line " << __LINE__ << std::endl; \
-        throw parsingError(); \
-    }
+    const size_t modulo = options.vertexCopyingModulo;
+    return (end + modulo - 1) / modulo - (begin + modulo - 1) / modulo;
+}
 
-void Mesh::readOBJ(const std::string& filename)
+bool shouldAddVertices(const Options& options, size_t faceCounter)
 {
-    std::ifstream fs(filename.c_str());
-    std::string line;
-    while (std::getline(fs, line)) {
-        parseLine(line);
-    }
+    return options.vertexAddingModulo != std::numeric_limits<int>::max()
+           && faceCounter % options.vertexAddingModulo == 0;
 }
 
-void cutIfLast(std::string& s, char c)
+void set_face(Faces& faces,
+              size_t face,
+              const Vertex& vertex1,
+              const Vertex& vertex2,
+              const Vertex& vertex3)
 {
-    if (s.size() > 0) {
-        const char back = s[s.size() - 1];
-        if (back == c) {
-            s.resize(s.size() - 1);
-        }
-    }
+    faces.setCorner(3 * face, vertex1);
+    faces.setCorner(3 * face + 1, vertex2);
+    faces.setCorner(3 * face + 2, vertex3);
 }
 
-void Mesh::parseLine(std::string line)
+std::ostream& operator<<(std::ostream& s, const Vector3f v)
 {
-    using boost::starts_with;
-    using boost::is_any_of;
-    using boost::split;
-
-    // TODO: remove this workaround
-    cutIfLast(line, '\r');
-
-    if (line.empty() ) {
-        return;
-    }
-
-    if (!boost::starts_with(line, "#")) {
-        Tokens tokens;
-        boost::split(tokens, line, is_any_of("\t "), boost::token_compress_on);
-        const std::string first = tokens.front();
-        if (first == "v") {
-            parseVertex(tokens);
-        } else if (first == "vt") {
-            parseVertexTexture(tokens);
-        } else if (first == "vn") {
-            parseNormal(tokens);
-        } else if (first == "f") {
-            parseFace(tokens);
-        } else if (first == "mtllib") {
-            parseMtllib(tokens);
-        } else if (first == "usemtl") {
-            parseUsemtl(tokens);
-        } else {
-            throw std::runtime_error("unknown line type\n" + line);
-        }
-    }
+    return s << v[0] << ' ' << v[1] << ' ' << v[2];
 }
 
-Vector3f readVector3f(const Tokens& tokens, int from = 1)
+Vector3f makeVector3f(const float coords[3][OBFUSCATION_BATCH_SIZE], size_t i)
 {
-    PRECONDITION(tokens.size() > 3);
-
     Vector3f v;
-    for (int i = 0; i < 3; ++i) {
-        v[i] = lexical_cast<float>(tokens[i+from]);
-    }
+    v[0] = coords[0][i];
+    v[1] = coords[1][i];
+    v[2] = coords[2][i];
     return v;
 }
 
-void Mesh::parseVertex(const Tokens& tokens)
-{
-    m_coords.push_back(readVector3f(tokens));
-
-    if (tokens.size() == 7) { // v x y z r g b
-        throw notImplemented();
-        if (!m_colors) {
-            m_colors = std::vector<Vector3f>();
+// Fills the batch with the faces from first on, taking every stride-th
+// face. Faces that transform rejects are left zero for it to report.
+void fillTriangleBatch(
+        const Mesh& mesh,
+        size_t first,
+        size_t stride,
+        TriangleBatch& triangles)
+{
+    triangles = TriangleBatch();
+    for (size_t j = 0; j < OBFUSCATION_BATCH_SIZE; ++j) {
+        const size_t face = first + j * stride;
+        if (face >= mesh.m_faces.size())
+            break;
+
+        if (mesh.m_faces.getCornerQty(face) != 3)
+            continue;
+
+        const size_t firstCorner = mesh.m_faces.getFirstCorner(face);
+        for (int k = 0; k < 3; ++k) {
+            const Index index = mesh.m_faces.getCorner(firstCorner + k).index;
+            if (index >= mesh.m_coords.size())
+                break;
+            const Vector3f& v = mesh.getVertexCoord(index);
+            triangles.corners[k][0][j] = v[0];
+            triangles.corners[k][1][j] = v[1];
+            triangles.corners[k][2][j] = v[2];
         }
-        m_colors->push_back(readVector3f(tokens, 4));
     }
 }
 
-void Mesh::parseVertexTexture(const Tokens& tokens)
+// Blocks splitting [0, size) into one per thread, run with runTasks.
+size_t getBlockSize(size_t size, int threadQty)
 {
-    PRECONDITION(tokens.size() > 2);
-
-    Vector2f v;
-    for (int i = 0; i < 2; ++i) {
-        v[i] = lexical_cast<float>(tokens[i+1]);
-    }
-    m_textureCoords.push_back(v);
+    const size_t blockQty = std::max(threadQty, 1);
+    return std::max<size_t>(1, (size + blockQty - 1) / blockQty);
 }
 
-void Mesh::parseNormal(const Tokens& tokens)
+size_t getBlockQty(size_t size, size_t blockSize)
 {
-    m_normalCoords.push_back(readVector3f(tokens));
+    return (size + blockSize - 1) / blockSize;
 }
 
-void Mesh::parseFace(const Tokens& tokens)
-{
-    PRECONDITION(tokens.size() > 1);
-    m_faces.push_back(Vertices());
-    Vertices& vertices = m_faces.back();
-    for (Tokens::const_iterator it = ++tokens.begin(); it != tokens.end(); ++it)
-    {
-        Tokens indicesStr;
-        split(indicesStr, *it, boost::is_any_of("/"));
-
-        Vertex vertex;
-        vertex.index = lexical_cast<Index>(indicesStr[0]) - 1;
-        if (indicesStr.size() > 1) {
-            vertex.textureIndex = lexical_cast<Index>(indicesStr[1]) - 1;
-            if (indicesStr.size() > 2) {
-                vertex.normalIndex = lexical_cast<Index>(indicesStr[2]) - 1;
-            }
-        }
+// Where the output of a block of input faces goes.
+struct FaceBlock {
+    // Corners that are the first use of their input vertex.
+    size_t firstUseQty;
+    // Faces that get new vertices.
+    size_t addingQty;
 
-        vertices.push_back(vertex);
-    }
-}
+    // Corners of the faces before the block that reuse a vertex.
+    size_t reusesBefore;
+    size_t firstNewVertex;
+    size_t firstNewFace;
+};
 
-void Mesh::parseMtllib(const Tokens& tokens)
-{
-    PRECONDITION(tokens.size() > 1);
-    m_mtllib = tokens[1];
-}
+// The serial transform decided everything with counters running over the
+// faces. Here every decision comes from the position of the face instead:
+// a corner either is the first use of its input vertex, which is always
+// copied, or the n-th reuse in the whole mesh, which is copied when n is a
+// multiple of the copying modulo. The n-th face gets new vertices when n is
+// a multiple of the adding modulo. Counting those per block of faces gives
+// each block the place of its output, so the blocks are transformed
+// concurrently and the output is the same as the serial one.
+class Transformer {
+public:
+    Transformer(const Mesh& inMesh, const Options& options)
+        : m_inMesh(inMesh)
+        , m_faces(inMesh.m_faces)
+        , m_options(options)
+        , m_blockSize(getBlockSize(m_faces.size(), options.threadQty))
+        , m_blocks(std::max<size_t>(1,
+              (m_faces.size() + m_blockSize - 1) / m_blockSize))
+    {}
+
+    void run(Mesh& outMesh)
+    {
+        PRECONDITION(m_faces.areTriangles());
+
+        findFirstUses();
+        calcNewPoints();
+        countOutput(outMesh);
+
+        runTasks(m_blocks.size(), m_options.threadQty,
+            [this](size_t block)
+            {
+                mapFirstUses(block);
+            });
+        runTasks(m_blocks.size(), m_options.threadQty,
+            [this, &outMesh](size_t block)
+            {
+                transformBlock(block, outMesh);
+            });
+
+        outMesh.m_faces.dropMissingIndices();
+    }
 
-void Mesh::parseUsemtl(const Tokens& tokens)
-{
-    PRECONDITION(tokens.size() > 1);
-    m_usemtl = tokens[1];
-}
+private:
+    static const size_t NO_CORNER = size_t(-1);
 
-void Mesh::writeOBJ(const std::string& filename)
-{
-    std::ofstream fs(filename.c_str());
-    if (m_mtllib) {
-        fs << "mtllib " << *m_mtllib << "\n\n";
+    // Faces of a block.
+    size_t getBlockBegin(size_t block) const
+    {
+        return std::min(m_faces.size(), block * m_blockSize);
     }
-    writeCoords(fs);
-    writeNormals(fs);
-    writeTextureCoords(fs);
-    if (m_usemtl) {
-        fs << '\n' << "usemtl " << *m_usemtl << '\n';
+
+    size_t getBlockEnd(size_t block) const
+    {
+        return std::min(m_faces.size(), (block + 1) * m_blockSize);
     }
-    writeFaces(fs);
-}
 
-void Mesh::writeCoords(std::ostream& s)
-{
-    PRECONDITION(!m_colors || m_colors->size() == m_coords.size());
-    for (size_t i = 0; i < m_coords.size(); ++i) {
-        const Vector3f& v = m_coords[i];
-        s << "v " << v[0] << ' ' << v[1] << ' ' << v[2];
-        if (m_colors) {
-            const Vector3f& c = (*m_colors)[i];
-            s << ' ' << c[0] << ' ' << c[1] << ' ' << c[2];
-        }
-        s << '\n';
+    void findFirstUses()
+    {
+        const size_t vertexQty = m_inMesh.m_coords.size();
+        std::vector<std::atomic<size_t> > firstUses(vertexQty);
+        const size_t vertexBlockSize = getBlockSize(vertexQty, m_options.threadQty);
+        runTasks(getBlockQty(vertexQty, vertexBlockSize), m_options.threadQty,
+            [&](size_t block)
+            {
+                const size_t begin = block * vertexBlockSize;
+                const size_t end = std::min(vertexQty, begin + vertexBlockSize);
+                for (size_t i = begin; i < end; ++i) {
+                    firstUses[i].store(NO_CORNER, std::memory_order_relaxed);
+                }
+            });
+        m_firstUses.swap(firstUses);
+
+        const size_t cornerQty = 3 * m_faces.size();
+        std::atomic<bool> isIndexBad(false);
+        const size_t cornerBlockSize = getBlockSize(cornerQty, m_options.threadQty);
+        runTasks(getBlockQty(cornerQty, cornerBlockSize), m_options.threadQty,
+            [&](size_t block)
+            {
+                const size_t begin = block * cornerBlockSize;
+                const size_t end = std::min(cornerQty, begin + cornerBlockSize);
+                for (size_t corner = begin; corner < end; ++corner) {
+                    const Index index = m_faces.getCorner(corner).index;
+                    if (index >= vertexQty) {
+                        isIndexBad = true;
+                        continue;
+                    }
+
+                    std::atomic<size_t>& firstUse = m_firstUses[index];
+                    size_t current = firstUse.load(std::memory_order_relaxed);
+                    while (corner < current
+                           && !firstUse.compare_exchange_weak(
+                                  current, corner, std::memory_order_relaxed))
+                    {}
+                }
+            });
+
+        if (isIndexBad)
+            throw std::out_of_range("Face refers to a missing vertex");
+
+        m_oldIndexToNew.resize(vertexQty);
     }
-}
 
-void Mesh::writeNormals(std::ostream& s)
-{
-    for (size_t i = 0; i < m_normalCoords.size(); ++i) {
-        const Vector3f& v = m_normalCoords[i];
-        s << "vn" << v[0] << ' ' << v[1] << ' ' << v[2];
+    // The i-th face that gets new vertices takes them from the lane
+    // i % OBFUSCATION_BATCH_SIZE of the batch i / OBFUSCATION_BATCH_SIZE.
+    void calcNewPoints()
+    {
+        if (m_options.vertexAddingModulo == std::numeric_limits<int>::max())
+            return;
+
+        const size_t stride = m_options.vertexAddingModulo;
+        const size_t addingQty = (m_faces.size() + stride - 1) / stride;
+        m_newPoints.resize(
+            (addingQty + OBFUSCATION_BATCH_SIZE - 1) / OBFUSCATION_BATCH_SIZE);
+
+        const size_t batchQty = m_newPoints.size();
+        const size_t blockSize = getBlockSize(batchQty, m_options.threadQty);
+        runTasks(getBlockQty(batchQty, blockSize), m_options.threadQty,
+            [this, stride, batchQty, blockSize](size_t block)
+            {
+                const size_t begin = block * blockSize;
+                const size_t end = std::min(batchQty, begin + blockSize);
+                TriangleBatch triangles;
+                for (size_t i = begin; i < end; ++i) {
+                    fillTriangleBatch(m_inMesh,
+                                      i * OBFUSCATION_BATCH_SIZE * stride,
+                                      stride, triangles);
+                    calcObfuscationPoints(triangles, ROUND_RESULT_ONLY,
+                                          m_newPoints[i]);
+                }
+            });
     }
-    s << '\n';
-}
 
-void Mesh::writeTextureCoords(std::ostream& s)
-{
-    for (size_t i = 0; i < m_textureCoords.size(); ++i) {
-        const Vector2f& v = m_textureCoords[i];
-        s << "vt " << v[0] << ' ' << v[1] << '\n';
+    // Sizes the output and gives every block its place in it.
+    void countOutput(Mesh& outMesh)
+    {
+        runTasks(m_blocks.size(), m_options.threadQty,
+            [this](size_t blockIndex)
+            {
+                FaceBlock& block = m_blocks[blockIndex];
+                const size_t end = getBlockEnd(blockIndex);
+                for (size_t face = getBlockBegin(blockIndex); face < end; ++face) {
+                    for (size_t corner = 3 * face; corner < 3 * face + 3; ++corner) {
+                        if (isFirstUse(corner)) {
+                            ++block.firstUseQty;
+                        }
+                    }
+                    if (getNewPoints(face)) {
+                        ++block.addingQty;
+                    }
+                }
+            });
+
+        size_t reuseQty = 0;
+        size_t vertexQty = 0;
+        size_t faceQty = 0;
+        for (size_t i = 0; i < m_blocks.size(); ++i) {
+            FaceBlock& block = m_blocks[i];
+            const size_t blockFaceQty = getBlockEnd(i) - getBlockBegin(i);
+            const size_t blockReuseQty = 3 * blockFaceQty - block.firstUseQty;
+
+            block.reusesBefore = reuseQty;
+            block.firstNewVertex = vertexQty;
+            block.firstNewFace = faceQty;
+
+            vertexQty += block.firstUseQty
+                         + countCopies(m_options, reuseQty,
+                                       reuseQty + blockReuseQty)
+                         + 2 * block.addingQty;
+            faceQty += blockFaceQty + 4 * block.addingQty;
+            reuseQty += blockReuseQty;
+        }
+
+        outMesh.m_coords.resize(vertexQty);
+        outMesh.m_faces.resize(faceQty, 3 * faceQty, true);
     }
-}
 
-void Mesh::writeFaces(std::ostream& s)
-{
-    for (size_t i = 0; i < m_faces.size(); ++i) {
-        s << "f";
-        const Vertices& vertices = m_faces[i];
-        for (size_t j = 0; j < vertices.size(); ++j) {
-            const Vertex& vertex = vertices[j];
-            s << ' ' << vertex.index + 1;
-            if (vertex.textureIndex) {
-                s << '/' << *vertex.textureIndex + 1;
-                if (vertex.normalIndex) {
-                    s << '/' << *vertex.normalIndex + 1;
+    // Gives numbers to the output vertices of first uses, which later
+    // reuses in any block refer to.
+    void mapFirstUses(size_t blockIndex)
+    {
+        const FaceBlock& block = m_blocks[blockIndex];
+        const size_t end = getBlockEnd(blockIndex);
+        size_t newVertex = block.firstNewVertex;
+        size_t reuseCounter = block.reusesBefore;
+
+        for (size_t face = getBlockBegin(blockIndex); face < end; ++face) {
+            for (size_t corner = 3 * face; corner < 3 * face + 3; ++corner) {
+                if (isFirstUse(corner)) {
+                    m_oldIndexToNew[m_faces.getCorner(corner).index] = newVertex++;
+                } else if (shouldCopyVertex(m_options, reuseCounter++)) {
+                    ++newVertex;
                 }
             }
+            if (getNewPoints(face)) {
+                newVertex += 2;
+            }
         }
-        s << '\n';
     }
-}
 
-void Mesh::swap(Mesh& m)
-{
-    std::swap(m_coords, m.m_coords);
-    std::swap(m_textureCoords, m.m_textureCoords);
-    std::swap(m_normalCoords, m.m_normalCoords);
-    std::swap(m_faces, m.m_faces);
-    std::swap(m_mtllib, m.m_mtllib);
-    std::swap(m_usemtl, m.m_usemtl);
-}
-
-const Vector3f& Mesh::getVertexCoord(Index index) const
-{
-    return m_coords[index];
-}
-
-Vector3f cross_product(const Vector3f& u, const Vector3f& v)
-{
-    Vector3f r;
-    r[0] = u[1] * v[2] - u[2] * v[1];
-    r[1] = u[2] * v[0] - u[0] * v[2];
-    r[2] = u[0] * v[1] - u[1] * v[0];
-    return r;
-}
-
-optional<Vector3f> CalcM(
-        const Vector3f& a,
-        const Vector3f& b,
-        const Vector3f& c)
-{
-    using boost::numeric::ublas::norm_2;
-
-    Vector3f center = (a + b + c) / 3;
-
-    Vector3f u = b - a;
-    Vector3f v = c - a;
-    Vector3f t = c - b;
-
-    Vector3f n = cross_product(u, v);
-    double l = 0.5 * std::min(norm_2(u),
-                              std::min(norm_2(v), norm_2(t)));
-    double normN = norm_2(n);
-
-    if (normN <= std::numeric_limits<double>::min())
-        return boost::none;
-    else
-        return Vector3f(center - l * n / norm_2(n));
-}
-
-Vector3f CalcD(const Vector3f& a, const Vector3f& b, const Vector3f& c)
-{
-    return (a + b) / 2;
-}
-
-Index addVertexCoord(Mesh& mesh, const Vector3f& v)
-{
-     mesh.m_coords.push_back(v);
-     return mesh.m_coords.size() - 1;
-}
+    void transformBlock(size_t blockIndex, Mesh& outMesh) const
+    {
+        const FaceBlock& block = m_blocks[blockIndex];
+        const size_t end = getBlockEnd(blockIndex);
+        size_t newVertex = block.firstNewVertex;
+        size_t newFace = block.firstNewFace;
+        size_t reuseCounter = block.reusesBefore;
+
+        for (size_t face = getBlockBegin(blockIndex); face < end; ++face) {
+            Vertex vertices[3];
+            for (size_t k = 0; k < 3; ++k) {
+                const size_t corner = 3 * face + k;
+                vertices[k] = m_faces.getCorner(corner);
+                const Index oldIndex = vertices[k].index;
+
+                if (isFirstUse(corner)
+                    || shouldCopyVertex(m_options, reuseCounter++))
+                {
+                    outMesh.m_coords[newVertex] =
+                        m_inMesh.getVertexCoord(oldIndex);
+                    vertices[k].index = newVertex++;
+                } else {
+                    vertices[k].index = m_oldIndexToNew[oldIndex];
+                }
+            }
 
-bool shouldCopyVertex(const Options& options, int vertexCopyCounter)
-{
-    return options.vertexCopyingModulo != std::numeric_limits<int>::max()
-           && vertexCopyCounter % options.vertexCopyingModulo == 0;
-}
+            const Vertex& vertexA = vertices[0];
+            const Vertex& vertexB = vertices[1];
+            const Vertex& vertexC = vertices[2];
+            set_face(outMesh.m_faces, newFace++, vertexA, vertexB, vertexC);
+
+            const ObfuscationPoints* points = getNewPoints(face);
+            if (!points)
+                continue;
+
+            const size_t lane =
+                face / m_options.vertexAddingModulo % OBFUSCATION_BATCH_SIZE;
+            Vertex vertexM;
+            Vertex vertexD;
+            vertexM.index = newVertex;
+            outMesh.m_coords[newVertex++] = makeVector3f(points->m, lane);
+            vertexD.index = newVertex;
+            outMesh.m_coords[newVertex++] = makeVector3f(points->d, lane);
+
+            if (vertexA.textureIndex != NO_INDEX) {
+                vertexM.textureIndex = 0;
+                vertexD.textureIndex = 0;
+            }
 
-Index addVertex(
-        Mesh& mesh,
-        const Mesh& inMesh,
-        Index oldIndex,
-        IndexMap& oldIndexToNew,
-        int& vertexCopyCounter,
-        const Options& options)
-{
-    if (oldIndexToNew.at(oldIndex) == -1) {
-        return oldIndexToNew[oldIndex] = addVertexCoord(
-                mesh, inMesh.getVertexCoord(oldIndex));
-    } else {
-        if (shouldCopyVertex(options, vertexCopyCounter++)) {
-            return addVertexCoord(mesh, inMesh.getVertexCoord(oldIndex));
-        } else {
-            return oldIndexToNew[oldIndex];
+            set_face(outMesh.m_faces, newFace++, vertexA, vertexM, vertexB);
+            set_face(outMesh.m_faces, newFace++, vertexB, vertexM, vertexC);
+            set_face(outMesh.m_faces, newFace++, vertexC, vertexM, vertexA);
+            set_face(outMesh.m_faces, newFace++, vertexD, vertexM, vertexC);
         }
     }
-}
-
-Vertex copyVertex(Mesh& mesh, const Mesh& inMesh, const Vertex& oldVertex,
-                  IndexMap& oldIndexToNew, int& vertexCopyCounter, const Options&
-                  options)
-{
-    Vertex newVertex(oldVertex);
-    newVertex.index = addVertex(
-            mesh, inMesh, oldVertex.index, oldIndexToNew, vertexCopyCounter, options);
-    return newVertex;
-}
-
-void add_face(Mesh& mesh,
-              const Vertex& vertex1,
-              const Vertex& vertex2,
-              const Vertex& vertex3)
-{
-    mesh.m_faces.push_back(Vertices());
-    Vertices& vertices = mesh.m_faces.back();
-
-    vertices.push_back(vertex1);
-    vertices.push_back(vertex2);
-    vertices.push_back(vertex3);
-}
 
-bool shouldAddVertices(const Options& options, int faceCounter)
-{
-    return options.vertexAddingModulo != std::numeric_limits<int>::max()
-           && faceCounter % options.vertexAddingModulo == 0;
-}
-
-std::ostream& operator<<(std::ostream& s, const Vector3f v)
-{
-    return s << v[0] << ' ' << v[1] << ' ' << v[2];
-}
-
-void addNewVertices(
-        Mesh& mesh,
-        const Vertex& vertexA, const Vertex& vertexB, const Vertex& vertexC)
-{
-    const Vector3f& a = mesh.getVertexCoord(vertexA.index);
-    const Vector3f& b = mesh.getVertexCoord(vertexB.index);
-    const Vector3f& c = mesh.getVertexCoord(vertexC.index);
-
-    optional<Vector3f> m = CalcM(a, b, c);
-
-    if (!m) {
-        return;
+    bool isFirstUse(size_t corner) const
+    {
+        return m_firstUses[m_faces.getCorner(corner).index].load(
+                std::memory_order_relaxed) == corner;
     }
 
-    Vector3f d = CalcD(a, b, c);
-
-    Vertex vertexM;
-    Vertex vertexD;
-
-    vertexM.index = addVertexCoord(mesh, *m);
-    vertexD.index = addVertexCoord(mesh, d);
+    // The batch with the new points of the face, if it gets them.
+    const ObfuscationPoints* getNewPoints(size_t face) const
+    {
+        if (!shouldAddVertices(m_options, face))
+            return 0;
 
-    if (vertexA.textureIndex) {
-        vertexM.textureIndex = 0;
-        vertexD.textureIndex = 0;
+        const size_t i = face / m_options.vertexAddingModulo;
+        const ObfuscationPoints& points = m_newPoints[i / OBFUSCATION_BATCH_SIZE];
+        return points.isValid[i % OBFUSCATION_BATCH_SIZE] ? &points : 0;
     }
 
-    add_face(mesh, vertexA, vertexM, vertexB);
-    add_face(mesh, vertexB, vertexM, vertexC);
-    add_face(mesh, vertexC, vertexM, vertexA);
-    add_face(mesh, vertexD, vertexM, vertexC);
-}
+    const Mesh& m_inMesh;
+    const Faces& m_faces;
+    const Options& m_options;
+
+    const size_t m_blockSize;
+    std::vector<FaceBlock> m_blocks;
+    // The first corner that uses each input vertex.
+    std::vector<std::atomic<size_t> > m_firstUses;
+    std::vector<ObfuscationPoints> m_newPoints;
+    IndexMap m_oldIndexToNew;
+};
 
 void transform(const Mesh& inMesh, Mesh& outMesh, const Options& options)
 {
     // TODO: implement copying of colors
     Mesh mesh;
-    typedef std::vector<Vertices>::const_iterator It;
-
-    int faceCounter = 0;
-    int vertexCopyCounter = 0;
-    IndexMap oldIndexToNew(inMesh.m_coords.size(), -1);
-
-    for (It it = inMesh.m_faces.begin(); it != inMesh.m_faces.end(); ++it) {
-        PRECONDITION(it->size() == 3);
-
-        const Vertices& vertices = *it;
-
-        Vertex vertexA = copyVertex(mesh, inMesh, vertices[0], oldIndexToNew,
-                vertexCopyCounter, options);
-        Vertex vertexB = copyVertex(mesh, inMesh, vertices[1], oldIndexToNew,
-                vertexCopyCounter, options);
-        Vertex vertexC = copyVertex(mesh, inMesh, vertices[2], oldIndexToNew,
-                vertexCopyCounter, options);
-
-        add_face(mesh, vertexA, vertexB, vertexC);
-
-        if (shouldAddVertices(options, faceCounter)) {
-            addNewVertices(mesh, vertexA, vertexB, vertexC);
-        }
-
-        ++faceCounter;
-    }
+    Transformer(inMesh, options).run(mesh);
 
     mesh.m_textureCoords = inMesh.m_textureCoords;
     mesh.m_normalCoords = inMesh.m_normalCoords;
@@ -504,6 +455,13 @@ bool initOptions(Options& options, int argc, char** argv)
         ("adding-fraction",
          po::value(&options.addingFraction)->default_value(1.0),
          "Adding fraction, in percents")
+        ("threads",
+         po::value(&options.threadQty)->default_value(
+             int(std::max(1u, std::thread::hardware_concurrency()))),
+         "Threads for reading, transforming and writing meshes")
+        ("no-cache",
+         "Parse the input even if it has an up to date .mcache file, "
+         "and don't write one")
         ;
 
     po::positional_options_description p;
@@ -529,12 +487,26 @@ bool initOptions(Options& options, int argc, char** argv)
         return false;
     }
 
+    options.isUsingCache = !vm.count("no-cache");
     options.vertexAddingModulo = fractionToModulo(options.addingFraction);
     options.vertexCopyingModulo = fractionToModulo(options.copyingFraction);
 
     return true;
 }
 
+// Parses the input once and then reads it from its cache.
+void readInput(Mesh& mesh, const Options& options)
+{
+    MeshCache cache;
+    if (options.isUsingCache && mesh.readCache(cache, options.inputFilename))
+        return;
+
+    mesh.readOBJ(options.inputFilename, options.threadQty);
+    if (options.isUsingCache) {
+        mesh.writeCache(cache);
+    }
+}
+
 int main(int argc, char** argv)
 {
     Options options;
@@ -544,13 +516,21 @@ int main(int argc, char** argv)
     std::cout << "input-file: " << options.inputFilename << '\n'
               << "output-file: " << options.outputFilename << '\n';
 
-    Mesh inputMesh;
-    inputMesh.readOBJ(options.inputFilename);
+    try {
+        Mesh inputMesh;
+        readInput(inputMesh, options);
+        std::cout << "faces: " << inputMesh.m_faces.size() << ", "
+                  << inputMesh.m_faces.getMemoryUsage() / (1 << 20)
+                  << " MB\n";
 
-    Mesh outputMesh;
-    transform(inputMesh, outputMesh, options);
+        Mesh outputMesh;
+        transform(inputMesh, outputMesh, options);
 
-    outputMesh.writeOBJ(options.outputFilename);
+        outputMesh.writeOBJ(options.outputFilename, options.threadQty);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
 
     return 0;
 }
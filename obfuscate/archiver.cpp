@@ -0,0 +1,401 @@
+#include "archiver.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "batch.h"
+
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+// Same as 7z -mx=9.
+const uint32_t LZMA_PRESET = 9;
+
+const size_t TAR_BLOCK_SIZE = 512;
+const size_t COPY_BUFFER_SIZE = 1 << 20;
+
+struct ArchiveJob {
+    std::string name;
+    std::vector<std::string> filenames;
+};
+
+void putOctal(char* field, size_t fieldSize, uintmax_t value)
+{
+    // Base-256 when the value doesn't fit, as GNU tar does for large files.
+    if (fieldSize > 1 && value >> (3 * (fieldSize - 1)) != 0) {
+        for (size_t i = fieldSize; i-- > 1; value >>= 8) {
+            field[i] = char(value & 0xFF);
+        }
+        field[0] = char(0x80);
+        return;
+    }
+
+    field[fieldSize - 1] = '\0';
+    for (size_t i = fieldSize - 1; i-- > 0; value >>= 3) {
+        field[i] = char('0' + (value & 7));
+    }
+}
+
+// ustar header of a regular file.
+bool makeTarHeader(
+        const std::string& name,
+        uintmax_t size,
+        time_t mtime,
+        char header[TAR_BLOCK_SIZE])
+{
+    std::memset(header, 0, TAR_BLOCK_SIZE);
+    if (name.size() > 100)
+        return false;
+
+    std::memcpy(header, name.data(), name.size());
+    putOctal(header + 100, 8, 0644);
+    putOctal(header + 108, 8, 0);
+    putOctal(header + 116, 8, 0);
+    putOctal(header + 124, 12, size);
+    putOctal(header + 136, 12, mtime);
+    header[156] = '0';
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+
+    std::memset(header + 148, ' ', 8);
+    unsigned checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        checksum += (unsigned char) header[i];
+    }
+    putOctal(header + 148, 7, checksum);
+    return true;
+}
+
+#ifdef HAVE_LIBLZMA
+
+lzma_mt getEncoderOptions(int threadQty)
+{
+    lzma_mt mt;
+    std::memset(&mt, 0, sizeof(mt));
+    mt.threads = std::max(threadQty, 1);
+    mt.preset = LZMA_PRESET;
+    mt.check = LZMA_CHECK_CRC64;
+    return mt;
+}
+
+// Of the encoder with threadQty threads, UINT64_MAX when unknown.
+uintmax_t getEncoderMemory(int threadQty)
+{
+    const lzma_mt mt = getEncoderOptions(threadQty);
+    return lzma_stream_encoder_mt_memusage(&mt);
+}
+
+// An .xz file written through the multithreaded LZMA2 encoder.
+class XzFile {
+public:
+    XzFile()
+        : m_buffer(COPY_BUFFER_SIZE)
+    {
+        const lzma_stream init = LZMA_STREAM_INIT;
+        m_stream = init;
+    }
+
+    ~XzFile()
+    {
+        lzma_end(&m_stream);
+    }
+
+    bool open(const std::string& filename, int threadQty)
+    {
+        const lzma_mt mt = getEncoderOptions(threadQty);
+        if (lzma_stream_encoder_mt(&m_stream, &mt) != LZMA_OK)
+            return false;
+
+        m_file.open(filename.c_str(), std::ios::out | std::ios::binary);
+        return m_file.good();
+    }
+
+    bool write(const char* data, size_t size)
+    {
+        return code(data, size, LZMA_RUN);
+    }
+
+    bool close()
+    {
+        const bool isFinished = code(0, 0, LZMA_FINISH);
+        m_file.close();
+        return isFinished && !m_file.fail();
+    }
+
+private:
+    bool code(const char* data, size_t size, lzma_action action)
+    {
+        m_stream.next_in = (const uint8_t*) data;
+        m_stream.avail_in = size;
+
+        for (;;) {
+            m_stream.next_out = &m_buffer[0];
+            m_stream.avail_out = m_buffer.size();
+
+            const lzma_ret result = lzma_code(&m_stream, action);
+            m_file.write((const char*) &m_buffer[0],
+                         m_buffer.size() - m_stream.avail_out);
+            if (!m_file)
+                return false;
+
+            if (result == LZMA_STREAM_END)
+                return true;
+            if (result != LZMA_OK)
+                return false;
+            if (action == LZMA_RUN && m_stream.avail_in == 0)
+                return true;
+        }
+    }
+
+    lzma_stream m_stream;
+    std::vector<uint8_t> m_buffer;
+    std::ofstream m_file;
+};
+
+bool appendFile(XzFile& xz, const std::string& filename, std::vector<char>& buffer)
+{
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!f)
+        return false;
+
+    const uintmax_t size = fs::file_size(filename);
+    char header[TAR_BLOCK_SIZE];
+    if (!makeTarHeader(fs::path(filename).filename().string(), size,
+                       fs::last_write_time(filename), header)
+        || !xz.write(header, TAR_BLOCK_SIZE))
+    {
+        return false;
+    }
+
+    uintmax_t written = 0;
+    while (written < size) {
+        f.read(&buffer[0], std::min<uintmax_t>(buffer.size(), size - written));
+        if (f.gcount() <= 0 || !xz.write(&buffer[0], f.gcount()))
+            return false;
+        written += f.gcount();
+    }
+
+    const size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE)
+                           % TAR_BLOCK_SIZE;
+    std::vector<char> zeros(padding, 0);
+    return padding == 0 || xz.write(&zeros[0], padding);
+}
+
+bool writeArchive(
+        const std::string& filename,
+        const std::vector<std::string>& inputs,
+        int threadQty)
+{
+    XzFile xz;
+    if (!xz.open(filename, threadQty))
+        return false;
+
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!appendFile(xz, inputs[i], buffer)) {
+            std::cerr << "Can't archive " << inputs[i] << '\n';
+            return false;
+        }
+    }
+
+    // The end of a tar archive is two zero blocks.
+    const std::vector<char> end(2 * TAR_BLOCK_SIZE, 0);
+    return xz.write(&end[0], end.size()) && xz.close();
+}
+
+#else // HAVE_LIBLZMA
+
+uintmax_t getEncoderMemory(int)
+{
+    return 0;
+}
+
+bool writeArchive(
+        const std::string&,
+        const std::vector<std::string>&,
+        int)
+{
+    std::cerr << "Archiving needs a build with liblzma\n";
+    return false;
+}
+
+#endif // HAVE_LIBLZMA
+
+} // anonymous namespace
+
+class ArchiverImpl {
+public:
+    ArchiverImpl(
+            const std::string& directory,
+            int threadQty,
+            MemoryBudget& memoryBudget)
+        : m_directory(directory)
+        , m_threadQty(std::max(threadQty, 1))
+        , m_memoryBudget(memoryBudget)
+        , m_failures(0)
+        , m_isWorking(false)
+        , m_isStopping(false)
+    {
+        while (m_threadQty > 1
+               && getEncoderMemory(m_threadQty) > m_memoryBudget.getBudget())
+        {
+            --m_threadQty;
+        }
+        if (m_threadQty < threadQty) {
+            std::cerr << "Archiving with " << m_threadQty
+                      << " threads to fit the memory budget\n";
+        }
+        m_encoderMemory = getEncoderMemory(m_threadQty);
+
+        fs::create_directories(m_directory);
+        m_thread = std::thread(&ArchiverImpl::workerLoop, this);
+    }
+
+    ~ArchiverImpl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_isStopping = true;
+        }
+        m_queueChanged.notify_all();
+        m_thread.join();
+    }
+
+    void add(const std::string& name, const std::vector<std::string>& filenames)
+    {
+        ArchiveJob job;
+        job.name = name;
+        job.filenames = filenames;
+        std::sort(job.filenames.begin(), job.filenames.end());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(job);
+        m_queueChanged.notify_all();
+    }
+
+    size_t finish()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_queue.empty() || m_isWorking) {
+            m_queueChanged.wait(lock);
+        }
+        size_t failures = m_failures;
+        m_failures = 0;
+        return failures;
+    }
+
+private:
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            while (m_queue.empty() && !m_isStopping) {
+                m_queueChanged.wait(lock);
+            }
+            if (m_queue.empty())
+                return;
+
+            ArchiveJob job = m_queue.front();
+            m_queue.pop_front();
+            m_isWorking = true;
+            lock.unlock();
+
+            const bool isWritten = archive(job);
+
+            lock.lock();
+            m_isWorking = false;
+            if (!isWritten)
+                ++m_failures;
+            m_queueChanged.notify_all();
+        }
+    }
+
+    // Written under a temporary name, so that a finished archive is
+    // never confused with a broken one.
+    bool archive(const ArchiveJob& job)
+    {
+        const fs::path path = fs::path(m_directory) / (job.name + ".tar.xz");
+        const std::string partPath = path.string() + ".part";
+
+        std::cerr << "Archiving " << job.filenames.size() << " files to "
+                  << path << '\n';
+        m_memoryBudget.acquire(m_encoderMemory);
+        const bool isWritten = writeArchive(partPath, job.filenames, m_threadQty);
+        m_memoryBudget.release(m_encoderMemory);
+        if (!isWritten) {
+            std::cerr << "Can't write " << path << '\n';
+            fs::remove(partPath);
+            return false;
+        }
+
+        boost::system::error_code error;
+        fs::rename(partPath, path, error);
+        return !error;
+    }
+
+    const std::string m_directory;
+    int m_threadQty;
+    MemoryBudget& m_memoryBudget;
+    uintmax_t m_encoderMemory;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queueChanged;
+    std::deque<ArchiveJob> m_queue;
+    size_t m_failures;
+    bool m_isWorking;
+    bool m_isStopping;
+};
+
+Archiver::Archiver(
+        const std::string& directory,
+        int threadQty,
+        MemoryBudget& memoryBudget)
+    : m_impl(new ArchiverImpl(directory, threadQty, memoryBudget))
+{}
+
+Archiver::~Archiver()
+{}
+
+void Archiver::add(
+        const std::string& name,
+        const std::vector<std::string>& filenames)
+{
+    m_impl->add(name, filenames);
+}
+
+size_t Archiver::finish()
+{
+    return m_impl->finish();
+}
+
+std::string archiveGroupName(const std::string& filename)
+{
+    const char separator =
+        filename.find('_') != std::string::npos ? '_' : '.';
+    return filename.substr(0, filename.find(separator));
+}
+
+bool isArchivingSupported()
+{
+#ifdef HAVE_LIBLZMA
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+#include <string>
+#include <vector>
+
+class ArchiverImpl;
+class MemoryBudget;
+
+// Packs groups of finished files into <directory>/<name>.tar.xz on a
+// background thread, so that compression of one group overlaps the
+// obfuscation of the next ones. Each archive is compressed with
+// multithreaded LZMA2 at the highest preset when built with liblzma.
+// The encoder memory is reserved from the budget while an archive is
+// written, and the threads are fewer when they don't fit it.
+class Archiver {
+public:
+    Archiver(
+            const std::string& directory,
+            int threadQty,
+            MemoryBudget& memoryBudget);
+    ~Archiver();
+
+    // Queues an archive of the files, stored under their file names.
+    void add(const std::string& name, const std::vector<std::string>& filenames);
+
+    // Waits until all queued archives are written. Returns the number of
+    // archives that failed.
+    size_t finish();
+
+private:
+    boost::scoped_ptr<ArchiverImpl> m_impl;
+};
+
+// Files go to the archive named by the part of their name before the
+// first underscore, or before the first point if there's no underscore.
+std::string archiveGroupName(const std::string& filename);
+
+// False when the build has no liblzma.
+bool isArchivingSupported();
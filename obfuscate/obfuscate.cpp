@@ -4,10 +4,50 @@
 #include <exception>
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <pcl/io/ply_io.h>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "archiver.h"
+#include "batch.h"
+#include "compressed-mesh.h"
+#include "mapped-file.h"
+#include "mesh-cache.h"
+#include "obfuscation-kernel.h"
+#include "ply-header.h"
+#include "run-tasks.h"
+#include "streaming-obfuscation.h"
 
 typedef pcl::PointXYZRGB Point;
 typedef pcl::PointCloud<Point> PointCloud;
+typedef std::vector<int> IndexMap;
+typedef std::vector< ::pcl::Vertices> Polygons;
+
+namespace fs = boost::filesystem;
+
+struct Options {
+    std::string inputFilename;
+    std::string outputFilename;
+    bool isSharingVertices;
+    unsigned threadQty;
+    bool isBenchmark;
+    bool isStreaming;
+    std::string inputDirectory;
+    std::string outputDirectory;
+    uintmax_t memoryBudget;
+    std::string archiveDirectory;
+    int archiveThreadQty;
+    bool isUsingCache;
+    bool isCompressing;
+    int positionBits;
+};
 
 class TIsNotTriangle : public std::exception
 {
@@ -23,164 +63,850 @@ float average(float a, float b, float c)
     return (a + b + c) / 3;
 }
 
-Point operator+(const Point& a, const Point& b)
+// New points keep the default color, as they always had.
+Point makePoint(const float coords[3][OBFUSCATION_BATCH_SIZE], size_t i)
+{
+    Point p;
+    p.x = coords[0][i];
+    p.y = coords[1][i];
+    p.z = coords[2][i];
+    return p;
+}
+
+void set_face(pcl::Vertices& face,
+              size_t index1,
+              size_t index2,
+              size_t index3)
 {
-    Point r;
-    r.x = a.x + b.x;
-    r.y = a.y + b.y;
-    r.z = a.z + b.z;
-    return r;
+    face.vertices.resize(3);
+    face.vertices[0] = index1;
+    face.vertices[1] = index2;
+    face.vertices[2] = index3;
 }
 
-Point operator-(const Point& a, const Point& b)
+const size_t NEW_FACES_PER_FACE = 5;
+
+// Size of the blocks splitting [0, size) into one block per thread.
+size_t getBlockSize(size_t size, unsigned threadQty)
 {
-    Point r;
-    r.x = a.x - b.x;
-    r.y = a.y - b.y;
-    r.z = a.z - b.z;
-    return r;
+    threadQty = std::max(1u, threadQty);
+    return std::max<size_t>(1, (size + threadQty - 1) / threadQty);
 }
 
-Point operator/(const Point& p, double d)
+size_t getBlockQty(size_t size, size_t blockSize)
 {
-    Point r;
-    r.x = p.x / d;
-    r.y = p.y / d;
-    r.z = p.z / d;
-    return r;
+    return (size + blockSize - 1) / blockSize;
 }
 
-Point operator*(double d, const Point& p)
+void checkTriangles(const PointCloud& cloud, const Polygons& polygons)
 {
-    Point r;
-    r.x = d * p.x;
-    r.y = d * p.y;
-    r.z = d * p.z;
-    return r;
+    for (Polygons::const_iterator it = polygons.begin();
+        it != polygons.end();
+        ++it)
+    {
+        if (it->vertices.size() != 3) {
+            throw TIsNotTriangle();
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (it->vertices[i] >= cloud.size()) {
+                throw std::out_of_range("Face refers to a missing vertex");
+            }
+        }
+    }
 }
 
-double norm(const Point& p)
+// Copies every referenced vertex once, keeping their order, and fills the
+// new index of each old vertex (-1 for unreferenced ones). Each block of
+// vertices counts its used ones, and the prefix sums of the counts tell
+// where every block starts in newCloud.
+void copyUsedVertices(
+        const PointCloud& cloud,
+        const Polygons& polygons,
+        unsigned threadQty,
+        PointCloud& newCloud,
+        IndexMap& oldIndexToNew)
 {
-    return std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+    oldIndexToNew.assign(cloud.size(), -1);
+    if (cloud.empty())
+        return;
+
+    for (Polygons::const_iterator it = polygons.begin();
+        it != polygons.end();
+        ++it)
+    {
+        for (int i = 0; i < 3; ++i) {
+            oldIndexToNew[it->vertices[i]] = 0;
+        }
+    }
+
+    const size_t blockSize = getBlockSize(cloud.size(), threadQty);
+    const size_t blockQty = getBlockQty(cloud.size(), blockSize);
+    std::vector<size_t> blockStarts(blockQty + 1, 0);
+
+    runTasks(blockQty, int(threadQty),
+        [&](size_t block)
+        {
+            const size_t begin = block * blockSize;
+            const size_t end = std::min(cloud.size(), begin + blockSize);
+            blockStarts[block + 1] =
+                std::count(oldIndexToNew.begin() + begin,
+                           oldIndexToNew.begin() + end, 0);
+        });
+
+    for (size_t i = 1; i < blockStarts.size(); ++i) {
+        blockStarts[i] += blockStarts[i - 1];
+    }
+    newCloud.resize(blockStarts.back());
+
+    runTasks(blockQty, int(threadQty),
+        [&](size_t block)
+        {
+            const size_t begin = block * blockSize;
+            const size_t end = std::min(cloud.size(), begin + blockSize);
+            size_t newIndex = blockStarts[block];
+            for (size_t i = begin; i < end; ++i) {
+                if (oldIndexToNew[i] == 0) {
+                    newCloud[newIndex] = cloud[i];
+                    oldIndexToNew[i] = newIndex++;
+                }
+            }
+        });
 }
 
-Point cross_product(const Point& u, const Point& v)
+// Face i owns the new vertices from firstNewVertex + verticesPerFace * i
+// and the faces from NEW_FACES_PER_FACE * i, so blocks of faces can be
+// transformed independently and the result doesn't depend on the
+// number of threads. Corners are copied unless oldIndexToNew is given.
+void transformFaces(
+        const PointCloud& cloud,
+        const Polygons& polygons,
+        const IndexMap* oldIndexToNew,
+        size_t firstNewVertex,
+        size_t begin,
+        size_t end,
+        PointCloud& newCloud,
+        Polygons& newPolygons)
 {
-    Point r;
-    r.x = u.y * v.z - u.z * v.y;
-    r.y = u.z * v.x - u.x * v.z;
-    r.z = u.x * v.y - u.y * v.x;
-    return r;
+    const size_t verticesPerFace = oldIndexToNew ? 2 : 5;
+
+    for (size_t first = begin; first < end; first += OBFUSCATION_BATCH_SIZE) {
+        const size_t batchSize =
+            std::min(OBFUSCATION_BATCH_SIZE, end - first);
+
+        TriangleBatch triangles = TriangleBatch();
+        for (size_t j = 0; j < batchSize; ++j) {
+            const std::vector<uint32_t>& vertices = polygons[first + j].vertices;
+            for (int k = 0; k < 3; ++k) {
+                const Point& p = cloud[vertices[k]];
+                triangles.corners[k][0][j] = p.x;
+                triangles.corners[k][1][j] = p.y;
+                triangles.corners[k][2][j] = p.z;
+            }
+        }
+
+        ObfuscationPoints points;
+        calcObfuscationPoints(triangles, ROUND_EVERY_STEP, points);
+
+        for (size_t j = 0; j < batchSize; ++j) {
+            const size_t i = first + j;
+            const std::vector<uint32_t>& vertices = polygons[i].vertices;
+
+            size_t vertex = firstNewVertex + verticesPerFace * i;
+
+            size_t a_index, b_index, c_index;
+            if (oldIndexToNew) {
+                a_index = (*oldIndexToNew)[vertices[0]];
+                b_index = (*oldIndexToNew)[vertices[1]];
+                c_index = (*oldIndexToNew)[vertices[2]];
+            } else {
+                newCloud[vertex] = cloud[vertices[0]];
+                a_index = vertex++;
+                newCloud[vertex] = cloud[vertices[1]];
+                b_index = vertex++;
+                newCloud[vertex] = cloud[vertices[2]];
+                c_index = vertex++;
+            }
+
+            newCloud[vertex] = makePoint(points.m, j);
+            size_t m_index = vertex++;
+            newCloud[vertex] = makePoint(points.d, j);
+            size_t d_index = vertex;
+
+            Polygons::iterator face =
+                newPolygons.begin() + NEW_FACES_PER_FACE * i;
+
+            set_face(*face++, a_index, b_index, c_index);
+
+            set_face(*face++, a_index, m_index, b_index);
+            set_face(*face++, b_index, m_index, c_index);
+            set_face(*face++, c_index, m_index, a_index);
+            set_face(*face, d_index, m_index, c_index);
+        }
+    }
 }
 
-Point CalcM(const Point& a, const Point& b, const Point& c)
+// With isSharingVertices every original vertex is written once and only
+// the new m and d points are appended for each face.
+void transform(
+        const pcl::PolygonMesh& inMesh,
+        pcl::PolygonMesh& outMesh,
+        const Options& options)
 {
-    Point center = (a + b + c) / 3;
+    outMesh.header = inMesh.header;
+
+    PointCloud cloud;
+    pcl::fromPCLPointCloud2(inMesh.cloud, cloud);
+
+    const Polygons& polygons = inMesh.polygons;
+    checkTriangles(cloud, polygons);
 
-    Point u = b - a;
-    Point v = c - a;
-    Point t = c - b;
+    PointCloud newCloud;
+    IndexMap oldIndexToNew;
+    size_t newVertexQty = 5 * polygons.size();
+
+    if (options.isSharingVertices) {
+        copyUsedVertices(cloud, polygons, options.threadQty,
+                         newCloud, oldIndexToNew);
+        newVertexQty = 2 * polygons.size();
+    }
+
+    const size_t firstNewVertex = newCloud.size();
+    newCloud.resize(firstNewVertex + newVertexQty);
+    outMesh.polygons.resize(NEW_FACES_PER_FACE * polygons.size());
+
+    const IndexMap* indexMap =
+        options.isSharingVertices ? &oldIndexToNew : 0;
 
-    Point n = cross_product(u, v);
-    double l = 0.5 * std::min(norm(u),
-                              std::min(norm(v), norm(t)));
-    return center - l * n / norm(n);;
+    const size_t blockSize = getBlockSize(polygons.size(), options.threadQty);
+    runTasks(getBlockQty(polygons.size(), blockSize), int(options.threadQty),
+        [&](size_t block)
+        {
+            const size_t begin = block * blockSize;
+            transformFaces(cloud, polygons, indexMap, firstNewVertex,
+                           begin, std::min(polygons.size(), begin + blockSize),
+                           newCloud, outMesh.polygons);
+        });
+
+    toPCLPointCloud2(newCloud, outMesh.cloud);
 }
 
-Point CalcD(Point a, Point b, Point c)
+bool hasColors(const pcl::PCLPointCloud2& cloud)
 {
-    return (a + b) / 2;
+    for (size_t i = 0; i < cloud.fields.size(); ++i) {
+        if (cloud.fields[i].name == "rgb" || cloud.fields[i].name == "rgba")
+            return true;
+    }
+    return false;
 }
 
-size_t add_vertex(PointCloud& cloud, const Point& p)
+void meshFromCache(const MeshView& view, pcl::PolygonMesh& mesh)
 {
-    cloud.push_back(p);
-    return cloud.size() - 1;
+    PointCloud cloud;
+    cloud.resize(view.vertexQty);
+    for (size_t i = 0; i < view.vertexQty; ++i) {
+        Point& point = cloud[i];
+        point.x = view.positions[3 * i];
+        point.y = view.positions[3 * i + 1];
+        point.z = view.positions[3 * i + 2];
+        if (view.colors) {
+            point.r = view.colors[3 * i];
+            point.g = view.colors[3 * i + 1];
+            point.b = view.colors[3 * i + 2];
+        }
+    }
+    toPCLPointCloud2(cloud, mesh.cloud);
+
+    mesh.polygons.resize(view.faceQty);
+    for (size_t i = 0; i < view.faceQty; ++i) {
+        const size_t begin = view.faceOffsets ? view.faceOffsets[i] : 3 * i;
+        const size_t end = view.faceOffsets ? view.faceOffsets[i + 1] : begin + 3;
+        mesh.polygons[i].vertices.assign(view.indices + begin,
+                                         view.indices + end);
+    }
 }
 
-void add_index(pcl::Vertices& vertices, size_t index)
+// The arrays of a PCL mesh, as the mesh cache and the compressed format
+// take them.
+class MeshArrays {
+public:
+    explicit MeshArrays(const pcl::PolygonMesh& mesh);
+
+    const MeshView& getView() const { return m_view; }
+
+private:
+    std::vector<float> m_positions;
+    std::vector<uint8_t> m_colors;
+    std::vector<uint64_t> m_offsets;
+    std::vector<uint32_t> m_indices;
+    MeshView m_view;
+};
+
+MeshArrays::MeshArrays(const pcl::PolygonMesh& mesh)
 {
-    vertices.vertices.push_back(index);
+    PointCloud cloud;
+    pcl::fromPCLPointCloud2(mesh.cloud, cloud);
+
+    m_positions.resize(3 * cloud.size());
+    m_colors.resize(hasColors(mesh.cloud) ? 3 * cloud.size() : 0);
+    for (size_t i = 0; i < cloud.size(); ++i) {
+        const Point& point = cloud[i];
+        m_positions[3 * i] = point.x;
+        m_positions[3 * i + 1] = point.y;
+        m_positions[3 * i + 2] = point.z;
+        if (!m_colors.empty()) {
+            m_colors[3 * i] = point.r;
+            m_colors[3 * i + 1] = point.g;
+            m_colors[3 * i + 2] = point.b;
+        }
+    }
+
+    bool areTriangles = true;
+    m_offsets.assign(1, 0);
+    for (Polygons::const_iterator it = mesh.polygons.begin();
+        it != mesh.polygons.end();
+        ++it)
+    {
+        areTriangles = areTriangles && it->vertices.size() == 3;
+        m_indices.insert(m_indices.end(),
+                         it->vertices.begin(), it->vertices.end());
+        m_offsets.push_back(m_indices.size());
+    }
+
+    m_view.vertexQty = cloud.size();
+    m_view.positions = m_positions.empty() ? 0 : &m_positions[0];
+    m_view.colors = m_colors.empty() ? 0 : &m_colors[0];
+    m_view.faceQty = mesh.polygons.size();
+    m_view.faceOffsets = areTriangles ? 0 : &m_offsets[0];
+    m_view.cornerQty = m_indices.size();
+    m_view.indices = m_indices.empty() ? 0 : &m_indices[0];
 }
 
-void add_face(pcl::PolygonMesh& mesh,
-              size_t index1,
-              size_t index2,
-              size_t index3)
+// Parses the PLY file once and then reads it from its cache. Returns
+// false when the file can't be loaded.
+bool loadMesh(
+        const std::string& filename,
+        bool isUsingCache,
+        pcl::PolygonMesh& mesh)
 {
-    mesh.polygons.push_back( pcl::Vertices() );
-    pcl::Vertices& vertices = mesh.polygons.back();
+    MeshCache cache;
+    if (isUsingCache && cache.open(filename)) {
+        meshFromCache(cache.getMesh(), mesh);
+        return true;
+    }
+
+    if (pcl::io::loadPLYFile(filename, mesh) < 0)
+        return false;
+    if (isUsingCache) {
+        cache.write(MeshArrays(mesh).getView());
+    }
+    return true;
+}
 
-    add_index(vertices, index1);
-    add_index(vertices, index2);
-    add_index(vertices, index3);
+// Writes binary PLY, or the compressed format with --compress. Throws
+// std::runtime_error when the file can't be written.
+void saveMesh(
+        const std::string& filename,
+        const pcl::PolygonMesh& mesh,
+        const Options& options)
+{
+    if (options.isCompressing) {
+        writeCompressedMesh(filename, MeshArrays(mesh).getView(),
+                            options.positionBits, options.threadQty);
+    } else if (pcl::io::savePLYFileBinary(filename, mesh) < 0) {
+        throw std::runtime_error("can't save " + filename);
+    }
 }
 
-void transform(const pcl::PolygonMesh& inMesh, pcl::PolygonMesh& outMesh)
+// Compares the serialized clouds, so that NaN points of degenerate faces
+// are equal too.
+bool isSameMesh(const pcl::PolygonMesh& mesh1, const pcl::PolygonMesh& mesh2)
 {
-    outMesh.header = inMesh.header;
+    if (mesh1.polygons.size() != mesh2.polygons.size())
+        return false;
+    for (size_t i = 0; i < mesh1.polygons.size(); ++i) {
+        if (mesh1.polygons[i].vertices != mesh2.polygons[i].vertices)
+            return false;
+    }
+    return mesh1.cloud.data == mesh2.cloud.data;
+}
 
-    PointCloud cloud;
-    pcl::fromPCLPointCloud2(inMesh.cloud, cloud);
+double transformSeconds(
+        const pcl::PolygonMesh& inMesh,
+        pcl::PolygonMesh& outMesh,
+        const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    transform(inMesh, outMesh, options);
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    PointCloud newCloud;
+// Runs the transform with 1, 2, 4... up to options.threadQty threads and
+// checks that every run gives the single-threaded result. outMesh gets the
+// result of the last run.
+bool benchmark(
+        const pcl::PolygonMesh& inMesh,
+        pcl::PolygonMesh& outMesh,
+        const Options& options)
+{
+    Options runOptions = options;
+    runOptions.threadQty = 1;
 
-    newCloud.reserve(cloud.size());
+    pcl::PolygonMesh serialMesh;
+    const double serialTime = transformSeconds(inMesh, serialMesh, runOptions);
 
-    typedef std::vector< ::pcl::Vertices> Polygons;
+    std::cout << inMesh.polygons.size() << " faces\n"
+              << "threads\tseconds\tspeedup\n"
+              << 1 << '\t' << serialTime << '\t' << 1 << '\n';
 
-    outMesh.polygons.reserve(inMesh.polygons.size());
+    bool isIdentical = true;
+    outMesh = serialMesh;
 
-    for (Polygons::const_iterator it = inMesh.polygons.begin();
-        it != inMesh.polygons.end();
-        ++it)
+    for (unsigned threadQty = 2;
+         threadQty < 2 * options.threadQty;
+         threadQty *= 2)
     {
-        const int verticesSize = it->vertices.size();
-        if (verticesSize != 3) {
-            throw TIsNotTriangle();
+        runOptions.threadQty = std::min(threadQty, options.threadQty);
+
+        // A fresh mesh every time, so that no run reuses the allocations of
+        // the previous one.
+        outMesh = pcl::PolygonMesh();
+        const double time = transformSeconds(inMesh, outMesh, runOptions);
+        std::cout << runOptions.threadQty << '\t' << time << '\t'
+                  << serialTime / time;
+
+        if (!isSameMesh(serialMesh, outMesh)) {
+            std::cout << "\toutput differs from 1 thread";
+            isIdentical = false;
+        }
+        std::cout << '\n';
+    }
+
+    return isIdentical;
+}
+
+// Rough peak memory of the in-memory path: PCL's binary cloud and the
+// PointCloud copy of every input vertex, and for every face its polygon,
+// the five output vertices and faces, and the output cloud converted back.
+const uintmax_t MEMORY_PER_VERTEX = 2 * sizeof(Point);
+const uintmax_t MEMORY_PER_POLYGON = sizeof(pcl::Vertices) + 32;
+const uintmax_t MEMORY_PER_FACE =
+    MEMORY_PER_POLYGON
+    + NEW_FACES_PER_FACE * (MEMORY_PER_POLYGON + 2 * sizeof(Point));
+
+// The streaming path keeps the vertices and an index per vertex, and
+// a few chunk buffers.
+const uintmax_t STREAMING_BUFFERS = 16 << 20;
+
+struct BatchInput {
+    fs::path path;
+    size_t faceQty;
+    uintmax_t memory;
+    bool isStreaming;
+
+    // Largest first, so that the big files don't start last.
+    bool operator<(const BatchInput& other) const
+    {
+        return memory > other.memory;
+    }
+};
+
+bool estimateMemory(
+        const fs::path& path,
+        uintmax_t memoryBudget,
+        BatchInput& input)
+{
+    try {
+        PlyHeader header;
+        readPlyHeader(path.string(), header);
+        checkTriangleMesh(header, MappedFile(path.string()));
+
+        input.path = path;
+        input.faceQty = header.faceQty();
+        input.memory = MEMORY_PER_VERTEX * header.vertexQty()
+                       + MEMORY_PER_FACE * header.faceQty();
+        input.isStreaming = false;
+
+        if (input.memory > memoryBudget
+            && header.format == PLY_BINARY_LITTLE_ENDIAN)
+        {
+            const PlyElement* vertex = header.findElement("vertex");
+            input.isStreaming = true;
+            input.memory = (vertex->fixedRecordSize() + sizeof(int))
+                           * vertex->count
+                           + STREAMING_BUFFERS;
         }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Skipping " << path << ": " << e.what() << '\n';
+        return false;
+    }
+}
 
-        const Point& a = cloud[it->vertices[0]];
-        const Point& b = cloud[it->vertices[1]];
-        const Point& c = cloud[it->vertices[2]];
+std::vector<BatchInput> collectBatchInputs(const Options& options)
+{
+    std::vector<BatchInput> inputs;
 
+    fs::directory_iterator itEnd;
+    for (fs::directory_iterator dirIt(options.inputDirectory);
+         dirIt != itEnd;
+         ++dirIt)
+    {
+        // Mesh caches of the inputs live next to them.
+        if (dirIt->path().extension() == ".mcache")
+            continue;
+
+        BatchInput input;
+        if (fs::is_regular_file(dirIt->path())
+            && estimateMemory(dirIt->path(), options.memoryBudget, input))
+        {
+            inputs.push_back(input);
+        }
+    }
 
-        Point m = CalcM(a, b, c);
-        Point d = CalcD(a, b, c);
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+}
 
-        size_t a_index = add_vertex(newCloud, a);
-        size_t b_index = add_vertex(newCloud, b);
-        size_t c_index = add_vertex(newCloud, c);
-        size_t m_index = add_vertex(newCloud, m);
-        size_t d_index = add_vertex(newCloud, d);
+// Outputs of every archive group, handed to the archiver as soon as the
+// last file of the group is obfuscated.
+class ArchiveGroups {
+public:
+    explicit ArchiveGroups(const std::vector<BatchInput>& inputs)
+    {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            ++m_remainingQty[groupOf(inputs[i].path)];
+        }
+    }
 
-        add_face(outMesh, a_index, b_index, c_index);
+    // Returns true with the group's name and outputs if this was its last
+    // file. Outputs of failed files are left out.
+    bool finishFile(
+            const fs::path& input,
+            const fs::path& output,
+            bool isObfuscated,
+            std::string& group,
+            std::vector<std::string>& outputs)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        group = groupOf(input);
+        if (isObfuscated)
+            m_outputs[group].push_back(output.string());
+        if (--m_remainingQty[group] > 0)
+            return false;
+
+        outputs.swap(m_outputs[group]);
+        return !outputs.empty();
+    }
 
-        add_face(outMesh, a_index, m_index, b_index);
-        add_face(outMesh, b_index, m_index, c_index);
-        add_face(outMesh, c_index, m_index, a_index);
-        add_face(outMesh, d_index, m_index, c_index);
+private:
+    static std::string groupOf(const fs::path& path)
+    {
+        return archiveGroupName(path.filename().string());
     }
-    toPCLPointCloud2(newCloud, outMesh.cloud);
+
+    std::mutex m_mutex;
+    std::map<std::string, size_t> m_remainingQty;
+    std::map<std::string, std::vector<std::string> > m_outputs;
+};
+
+// Files already run in parallel, so every file is transformed on one
+// thread.
+void obfuscateFile(
+        const BatchInput& input,
+        const std::string& outputFilename,
+        const Options& options)
+{
+    if (input.isStreaming) {
+        obfuscateStreaming(input.path.string(), outputFilename,
+                           options.isSharingVertices);
+        return;
+    }
+
+    pcl::PolygonMesh inMesh;
+    if (!loadMesh(input.path.string(), options.isUsingCache, inMesh))
+        throw std::runtime_error("can't load the mesh");
+
+    Options fileOptions = options;
+    fileOptions.threadQty = 1;
+
+    pcl::PolygonMesh outMesh;
+    transform(inMesh, outMesh, fileOptions);
+    saveMesh(outputFilename, outMesh, fileOptions);
+}
+
+// Streamed files are written as PLY even with --compress.
+fs::path getOutputPath(const BatchInput& input, const Options& options)
+{
+    fs::path path = fs::path(options.outputDirectory) / input.path.filename();
+    if (options.isCompressing && !input.isStreaming) {
+        path.replace_extension(".cmesh");
+    }
+    return path;
+}
+
+void batchWorker(
+        BatchQueue<BatchInput>& queue,
+        MemoryBudget& memoryBudget,
+        ArchiveGroups& archiveGroups,
+        Archiver* archiver,
+        const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    BatchInput input;
+    while (queue.pop(input)) {
+        memoryBudget.acquire(input.memory);
+        const Clock::time_point start = Clock::now();
+
+        BatchReport report;
+        report.filename = input.path.filename().string();
+        report.inputTriangleQty = input.faceQty;
+        report.isStreaming = input.isStreaming;
+        report.estimatedMemory = input.memory;
+
+        const fs::path outputPath = getOutputPath(input, options);
+        try {
+            obfuscateFile(input, outputPath.string(), options);
+            report.outputTriangleQty = NEW_FACES_PER_FACE * input.faceQty;
+        } catch (const std::exception& e) {
+            report.error = e.what();
+        }
+
+        report.seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        report.peakMemory = getPeakMemory();
+        memoryBudget.release(input.memory);
+
+        std::cerr << report.filename << ": "
+                  << (report.error.empty() ? "done" : report.error)
+                  << " in " << report.seconds << " s\n";
+        queue.addReport(report);
+
+        std::string group;
+        std::vector<std::string> outputs;
+        if (archiver
+            && archiveGroups.finishFile(input.path, outputPath,
+                                        report.error.empty(), group, outputs))
+        {
+            archiver->add(group, outputs);
+        }
+    }
+}
+
+// Returns false if any file failed.
+bool obfuscateDirectory(const Options& options)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    fs::create_directories(options.outputDirectory);
+
+    const std::vector<BatchInput> inputs = collectBatchInputs(options);
+    std::cerr << inputs.size() << " meshes to obfuscate with "
+              << options.threadQty << " threads in "
+              << (options.memoryBudget >> 20) << " MB\n";
+
+    BatchQueue<BatchInput> queue(inputs);
+    MemoryBudget memoryBudget(options.memoryBudget);
+    ArchiveGroups archiveGroups(inputs);
+
+    // Groups are compressed while the next files are obfuscated.
+    boost::scoped_ptr<Archiver> archiver;
+    if (!options.archiveDirectory.empty()) {
+        archiver.reset(new Archiver(options.archiveDirectory,
+                                    options.archiveThreadQty, memoryBudget));
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.threadQty; ++i) {
+        threads.push_back(std::thread(batchWorker, std::ref(queue),
+                                      std::ref(memoryBudget),
+                                      std::ref(archiveGroups),
+                                      archiver.get(),
+                                      std::cref(options)));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    const size_t archiveFailureQty = archiver ? archiver->finish() : 0;
+
+    const std::vector<BatchReport> reports = queue.reports();
+    printBatchSummary(std::cout, reports,
+            std::chrono::duration<double>(Clock::now() - start).count());
+    if (archiveFailureQty > 0) {
+        std::cout << archiveFailureQty << " archives failed\n";
+        return false;
+    }
+
+    return isBatchDone(reports);
+}
+
+bool initOptions(Options& options, int argc, char** argv)
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    size_t memoryBudgetMB = 0;
+    desc.add_options()
+        ("help", "Print help message")
+        ("input-file",
+         po::value(&options.inputFilename),
+         "Input filename")
+        ("output-file",
+         po::value(&options.outputFilename),
+         "Output filename")
+        ("input-dir",
+         po::value(&options.inputDirectory),
+         "Obfuscate every PLY file in the directory")
+        ("output-dir",
+         po::value(&options.outputDirectory),
+         "Directory for the files obfuscated from --input-dir")
+        ("memory-budget",
+         po::value(&memoryBudgetMB)->default_value(4096),
+         "Memory in MB the files obfuscated at once from --input-dir may "
+         "take together; larger binary files are streamed")
+        ("archive-dir",
+         po::value(&options.archiveDirectory),
+         "Pack the files from --input-dir into <group>.tar.xz archives in "
+         "this directory, grouped by the name part before the first "
+         "underscore or point")
+        ("archive-threads",
+         po::value(&options.archiveThreadQty)->default_value(2),
+         "Number of LZMA2 compression threads; each takes about 1.3 GB "
+         "at the highest preset, counted in --memory-budget")
+        ("share-vertices",
+         "Write every original vertex once and reuse it in all its faces "
+         "instead of copying it for each face")
+        ("threads",
+         po::value(&options.threadQty)->default_value(
+             std::max(1u, std::thread::hardware_concurrency())),
+         "Number of threads transforming faces")
+        ("benchmark",
+         "Time the transform with 1, 2, 4... up to --threads threads "
+         "and check that all of them give the same output")
+        ("streaming",
+         "Stream a binary little endian PLY file through in chunks instead "
+         "of loading it, for meshes that don't fit in memory")
+        ("no-cache",
+         "Parse the inputs even if they have up to date .mcache files, "
+         "and don't write them")
+        ("compress",
+         "Write the output as a .cmesh file with quantized positions and "
+         "entropy coded arrays instead of binary PLY; files from "
+         "--input-dir are named <name>.cmesh, streamed ones stay PLY")
+        ("position-bits",
+         po::value(&options.positionBits)->default_value(DEFAULT_POSITION_BITS),
+         "Bits per coordinate of the positions in --compress output, "
+         "from 8 to 24")
+        ;
+
+    po::positional_options_description p;
+    p.add("input-file", 1).add("output-file", 1);
+
+    po::variables_map vm;
+
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                    .options(desc)
+                    .positional(p)
+                    .run(),
+                  vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: obfuscate [options] <input-file> <output-file>\n"
+                      << "       obfuscate [options] --input-dir <dir> "
+                         "--output-dir <dir>\n"
+                      << desc << '\n';
+            return false;
+        }
+
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    options.isSharingVertices = vm.count("share-vertices");
+    options.isBenchmark = vm.count("benchmark");
+    options.isStreaming = vm.count("streaming");
+    options.isUsingCache = !vm.count("no-cache");
+    options.isCompressing = vm.count("compress");
+    options.threadQty = std::max(1u, options.threadQty);
+    options.memoryBudget = uintmax_t(memoryBudgetMB) << 20;
+
+    const bool isBatch = vm.count("input-dir") || vm.count("output-dir");
+    if (isBatch
+        ? !vm.count("input-dir") || !vm.count("output-dir")
+        : !vm.count("input-file") || !vm.count("output-file"))
+    {
+        std::cerr << "Give either an input and an output file "
+                     "or --input-dir and --output-dir\n";
+        return false;
+    }
+
+    if (vm.count("archive-dir") && (!isBatch || !isArchivingSupported())) {
+        std::cerr << (isBatch ? "Archiving needs a build with liblzma\n"
+                              : "--archive-dir needs --input-dir\n");
+        return false;
+    }
+
+    if (options.isCompressing && options.isStreaming) {
+        std::cerr << "--compress doesn't work with --streaming\n";
+        return false;
+    }
+    if (options.positionBits < MIN_POSITION_BITS
+        || options.positionBits > MAX_POSITION_BITS)
+    {
+        std::cerr << "--position-bits must be from " << MIN_POSITION_BITS
+                  << " to " << MAX_POSITION_BITS << '\n';
+        return false;
+    }
+
+    return true;
 }
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        std::cerr << "Usage: obfuscate <input-file> <output-file>\n";
+    Options options;
+    if (!initOptions(options, argc, argv))
         return EXIT_FAILURE;
+
+    if (!options.inputDirectory.empty()) {
+        return obfuscateDirectory(options) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    std::string inputFile = argv[1];
-    std::string outputFile = argv[2];
+    if (options.isStreaming) {
+        try {
+            obfuscateStreaming(options.inputFilename, options.outputFilename,
+                               options.isSharingVertices);
+        } catch (const std::exception& e) {
+            std::cerr << options.inputFilename << ": " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
 
     pcl::PolygonMesh inMesh;
-    pcl::io::loadPLYFile(inputFile, inMesh);
+    if (!loadMesh(options.inputFilename, options.isUsingCache, inMesh)) {
+        std::cerr << options.inputFilename << ": can't load the mesh\n";
+        return EXIT_FAILURE;
+    }
     pcl::PolygonMesh outMesh;
 
-    transform(inMesh, outMesh);
+    if (options.isBenchmark) {
+        if (!benchmark(inMesh, outMesh, options))
+            return EXIT_FAILURE;
+    } else {
+        transform(inMesh, outMesh, options);
+    }
 
-    pcl::io::savePLYFileBinary(outputFile, outMesh);
+    try {
+        saveMesh(options.outputFilename, outMesh, options);
+    } catch (const std::exception& e) {
+        std::cerr << options.outputFilename << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,205 @@
+#!/usr/bin/python
+
+"""Publishes every file of a directory and writes "<file> <link>" lines to
+a links file as each file is published, so that a rerun after an
+interruption only publishes what is missing."""
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import subprocess
+import sys
+import threading
+import time
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+
+class YandexDiskBackend(object):
+    """Publishes through the yandex-disk command line client."""
+
+    def publish(self, path):
+        output = subprocess.check_output(["yandex-disk", "publish", path])
+        link = output.decode("utf-8").strip()
+        if not link:
+            raise RuntimeError("yandex-disk printed no link")
+        return link
+
+
+class LocalBackend(object):
+    """Stand-in for testing: makes up links and records them."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.published = []
+
+    def publish(self, path):
+        with self.lock:
+            self.published.append(path)
+        return "local://" + os.path.abspath(path)
+
+
+BACKENDS = {
+    "yandex-disk": YandexDiskBackend,
+    "local": LocalBackend,
+}
+
+
+def read_links(links_filename):
+    """A last line without a newline was cut while being written, and its
+    file is published again."""
+    links = {}
+    if os.path.exists(links_filename):
+        with open(links_filename) as f:
+            for line in f:
+                if not line.endswith("\n"):
+                    break
+                filename, sep, link = line.strip().partition(" ")
+                if link:
+                    links[filename] = link
+    return links
+
+
+def cut_partial_line(links_filename):
+    """Truncates the file after its last newline, so that appended lines
+    don't continue a line cut while being written."""
+    if not os.path.exists(links_filename):
+        return
+    with open(links_filename, "rb+") as f:
+        data = f.read()
+        end = data.rfind(b"\n") + 1
+        if end != len(data):
+            f.truncate(end)
+
+
+class LinksFile(object):
+    """Appends links one line at a time, on disk before the next one."""
+
+    def __init__(self, links_filename):
+        self.lock = threading.Lock()
+        cut_partial_line(links_filename)
+        self.f = open(links_filename, "a")
+
+    def add(self, filename, link):
+        with self.lock:
+            self.f.write("%s %s\n" % (filename, link))
+            self.f.flush()
+            os.fsync(self.f.fileno())
+
+    def close(self):
+        self.f.close()
+
+
+def sort_links(links_filename):
+    links = read_links(links_filename)
+    temp_filename = links_filename + ".part"
+    with open(temp_filename, "w") as f:
+        for filename in sorted(links):
+            f.write("%s %s\n" % (filename, links[filename]))
+    os.rename(temp_filename, links_filename)
+
+
+def link_file(source_dir, target_dir, filename):
+    target = os.path.join(target_dir, filename)
+    if not os.path.exists(target):
+        os.link(os.path.join(source_dir, filename), target)
+
+
+def publish_with_retries(backend, path, retries, backoff):
+    for attempt in range(retries + 1):
+        try:
+            return backend.publish(path)
+        except Exception as e:
+            if attempt == retries:
+                raise
+            delay = backoff * 2 ** attempt * random.uniform(0.5, 1.5)
+            print("%s: %s, retrying in %.1f s" % (path, e, delay),
+                  file=sys.stderr)
+            time.sleep(delay)
+
+
+def worker(jobs, args, backend, links_file, failures):
+    while True:
+        try:
+            filename = jobs.get_nowait()
+        except queue.Empty:
+            return
+
+        try:
+            if args.source:
+                link_file(args.source, args.dirname, filename)
+            link = publish_with_retries(
+                backend, os.path.join(args.dirname, filename),
+                args.retries, args.backoff)
+            links_file.add(filename, link)
+        except Exception as e:
+            print("%s: %s" % (filename, e), file=sys.stderr)
+            failures.append(filename)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("dirname", help="directory with the files to publish")
+    parser.add_argument("--links",
+                        help="links file, <dirname>-links.txt by default")
+    parser.add_argument("--source",
+                        help="hardlink the files of this directory into "
+                             "dirname before publishing them")
+    parser.add_argument("--backend", choices=sorted(BACKENDS),
+                        default="yandex-disk")
+    parser.add_argument("--jobs", type=int, default=4,
+                        help="files published at once")
+    parser.add_argument("--retries", type=int, default=5)
+    parser.add_argument("--backoff", type=float, default=1.0,
+                        help="seconds before the first retry, doubled "
+                             "for every next one")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    args.dirname = os.path.normpath(args.dirname)
+    links_filename = args.links or args.dirname + "-links.txt"
+
+    if args.source and not os.path.isdir(args.dirname):
+        os.makedirs(args.dirname)
+
+    files = os.listdir(args.source or args.dirname)
+    published = read_links(links_filename)
+    jobs = queue.Queue()
+    for filename in sorted(files):
+        if filename not in published:
+            jobs.put(filename)
+
+    print("%d files to publish, %d already published"
+          % (jobs.qsize(), len(files) - jobs.qsize()), file=sys.stderr)
+
+    backend = BACKENDS[args.backend]()
+    links_file = LinksFile(links_filename)
+    failures = []
+
+    threads = [threading.Thread(target=worker,
+                                args=(jobs, args, backend, links_file,
+                                      failures))
+               for i in range(max(args.jobs, 1))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    links_file.close()
+    sort_links(links_filename)
+
+    if failures:
+        print("%d files failed: %s" % (len(failures), " ".join(failures)),
+              file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
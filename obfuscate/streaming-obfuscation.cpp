@@ -0,0 +1,304 @@
+#include "streaming-obfuscation.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <stdint.h>
+
+#include "mapped-file.h"
+#include "obfuscation-kernel.h"
+#include "ply-header.h"
+#include "ply-stream.h"
+
+namespace
+{
+
+const size_t OUTPUT_VERTEX_SIZE = 3 * sizeof(float) + 3;
+const size_t OUTPUT_FACE_SIZE = 1 + 3 * sizeof(int32_t);
+
+const size_t NEW_FACES_PER_FACE = 5;
+
+typedef std::vector<int> IndexMap;
+typedef std::vector<uint32_t> Indices;
+
+const char* COLOR_NAMES[] = { "red", "green", "blue" };
+
+char* writeVertex(
+        const float coords[3],
+        const unsigned char color[3],
+        char* out)
+{
+    std::memcpy(out, coords, 3 * sizeof(float));
+    std::memcpy(out + 3 * sizeof(float), color, 3);
+    return out + OUTPUT_VERTEX_SIZE;
+}
+
+// Appends an input vertex in the output format.
+char* writeVertex(const PlyVertexReader& vertices, size_t index, char* out)
+{
+    float coords[3];
+    unsigned char color[3] = { 0, 0, 0 };
+    for (int axis = 0; axis < 3; ++axis) {
+        coords[axis] = vertices.coord(index, axis);
+    }
+    if (vertices.hasColor()) {
+        for (int i = 0; i < 3; ++i) {
+            color[i] = vertices.color(index, i);
+        }
+    }
+    return writeVertex(coords, color, out);
+}
+
+void writeOutputHeader(std::ostream& s, size_t vertexQty, size_t faceQty)
+{
+    PlyHeader header;
+    header.format = PLY_BINARY_LITTLE_ENDIAN;
+
+    PlyElement vertex;
+    vertex.name = "vertex";
+    vertex.count = vertexQty;
+    PlyProperty property;
+    property.isList = false;
+    property.countType = PLY_UINT8;
+    property.type = PLY_FLOAT32;
+    for (int axis = 0; axis < 3; ++axis) {
+        property.name = std::string(1, "xyz"[axis]);
+        vertex.properties.push_back(property);
+    }
+    property.type = PLY_UINT8;
+    for (int i = 0; i < 3; ++i) {
+        property.name = COLOR_NAMES[i];
+        vertex.properties.push_back(property);
+    }
+    header.elements.push_back(vertex);
+
+    PlyElement face;
+    face.name = "face";
+    face.count = faceQty;
+    property.name = "vertex_indices";
+    property.isList = true;
+    property.countType = PLY_UINT8;
+    property.type = PLY_INT32;
+    face.properties.push_back(property);
+    header.elements.push_back(face);
+
+    writePlyHeader(s, header);
+}
+
+void writeBuffer(std::ostream& s, const std::vector<char>& buffer, char* end)
+{
+    s.write(&buffer[0], end - &buffer[0]);
+    if (!s)
+        throw std::runtime_error("can't write the output file");
+}
+
+// Marks used vertices with 0 and numbers them in their order.
+size_t numberUsedVertices(
+        PlyFaceReader& faces,
+        size_t vertexQty,
+        IndexMap& oldIndexToNew)
+{
+    oldIndexToNew.assign(vertexQty, -1);
+
+    Indices indices;
+    while (faces.readChunk(vertexQty, indices) > 0) {
+        for (size_t i = 0; i < indices.size(); ++i) {
+            oldIndexToNew[indices[i]] = 0;
+        }
+    }
+
+    size_t usedQty = 0;
+    for (size_t i = 0; i < vertexQty; ++i) {
+        if (oldIndexToNew[i] == 0)
+            oldIndexToNew[i] = usedQty++;
+    }
+    return usedQty;
+}
+
+void writeUsedVertices(
+        std::ostream& s,
+        const PlyVertexReader& vertices,
+        const IndexMap& oldIndexToNew)
+{
+    std::vector<char> buffer(PLY_FACE_CHUNK_SIZE * OUTPUT_VERTEX_SIZE);
+    char* out = &buffer[0];
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        if (oldIndexToNew[i] < 0)
+            continue;
+        out = writeVertex(vertices, i, out);
+        if (out == &buffer[0] + buffer.size()) {
+            writeBuffer(s, buffer, out);
+            out = &buffer[0];
+        }
+    }
+    writeBuffer(s, buffer, out);
+}
+
+// Writes the vertices every face adds: its corners unless they are
+// shared, then m and d.
+void writeNewVertices(
+        std::ostream& s,
+        const PlyVertexReader& vertices,
+        PlyFaceReader& faces,
+        bool isSharingVertices)
+{
+    const size_t verticesPerFace = isSharingVertices ? 2 : 5;
+    std::vector<char> buffer(
+            PLY_FACE_CHUNK_SIZE * verticesPerFace * OUTPUT_VERTEX_SIZE);
+    const unsigned char noColor[3] = { 0, 0, 0 };
+
+    Indices indices;
+    size_t faceQty;
+    while ((faceQty = faces.readChunk(vertices.size(), indices)) > 0) {
+        char* out = &buffer[0];
+
+        for (size_t first = 0; first < faceQty;
+             first += OBFUSCATION_BATCH_SIZE)
+        {
+            const size_t batchSize =
+                std::min(OBFUSCATION_BATCH_SIZE, faceQty - first);
+
+            TriangleBatch triangles = TriangleBatch();
+            for (size_t j = 0; j < batchSize; ++j) {
+                for (int k = 0; k < 3; ++k) {
+                    const size_t index = indices[3 * (first + j) + k];
+                    for (int axis = 0; axis < 3; ++axis) {
+                        triangles.corners[k][axis][j] =
+                            vertices.coord(index, axis);
+                    }
+                }
+            }
+
+            ObfuscationPoints points;
+            calcObfuscationPoints(triangles, ROUND_EVERY_STEP, points);
+
+            for (size_t j = 0; j < batchSize; ++j) {
+                if (!isSharingVertices) {
+                    for (int k = 0; k < 3; ++k) {
+                        out = writeVertex(vertices, indices[3 * (first + j) + k], out);
+                    }
+                }
+
+                float m[3], d[3];
+                for (int axis = 0; axis < 3; ++axis) {
+                    m[axis] = points.m[axis][j];
+                    d[axis] = points.d[axis][j];
+                }
+                out = writeVertex(m, noColor, out);
+                out = writeVertex(d, noColor, out);
+            }
+        }
+
+        writeBuffer(s, buffer, out);
+    }
+}
+
+char* writeFace(int32_t index1, int32_t index2, int32_t index3, char* out)
+{
+    const int32_t indices[3] = { index1, index2, index3 };
+    *out = 3;
+    std::memcpy(out + 1, indices, sizeof(indices));
+    return out + OUTPUT_FACE_SIZE;
+}
+
+// The same faces, in the same order, as the in-memory transform.
+void writeFaces(
+        std::ostream& s,
+        size_t vertexQty,
+        PlyFaceReader& faces,
+        const IndexMap* oldIndexToNew,
+        size_t firstNewVertex)
+{
+    const size_t verticesPerFace = oldIndexToNew ? 2 : 5;
+    std::vector<char> buffer(
+            PLY_FACE_CHUNK_SIZE * NEW_FACES_PER_FACE * OUTPUT_FACE_SIZE);
+
+    Indices indices;
+    size_t faceIndex = 0;
+    size_t faceQty;
+    while ((faceQty = faces.readChunk(vertexQty, indices)) > 0) {
+        char* out = &buffer[0];
+
+        for (size_t j = 0; j < faceQty; ++j, ++faceIndex) {
+            size_t vertex = firstNewVertex + verticesPerFace * faceIndex;
+
+            int32_t a, b, c;
+            if (oldIndexToNew) {
+                a = (*oldIndexToNew)[indices[3 * j]];
+                b = (*oldIndexToNew)[indices[3 * j + 1]];
+                c = (*oldIndexToNew)[indices[3 * j + 2]];
+            } else {
+                a = vertex++;
+                b = vertex++;
+                c = vertex++;
+            }
+            const int32_t m = vertex++;
+            const int32_t d = vertex;
+
+            out = writeFace(a, b, c, out);
+
+            out = writeFace(a, m, b, out);
+            out = writeFace(b, m, c, out);
+            out = writeFace(c, m, a, out);
+            out = writeFace(d, m, c, out);
+        }
+
+        writeBuffer(s, buffer, out);
+    }
+}
+
+} // anonymous namespace
+
+void obfuscateStreaming(
+        const std::string& inputFilename,
+        const std::string& outputFilename,
+        bool isSharingVertices)
+{
+    MappedFile file(inputFilename);
+
+    PlyHeader header;
+    readPlyHeader(inputFilename, header);
+    if (header.format != PLY_BINARY_LITTLE_ENDIAN)
+        throw PlyError("streaming needs a binary little endian PLY file");
+    checkTriangleMesh(header, file);
+
+    PlyVertexReader vertices(file, header);
+    PlyFaceReader faces(file, header);
+    const size_t faceQty = header.faceQty();
+
+    IndexMap oldIndexToNew;
+    size_t firstNewVertex = 0;
+    size_t newVertexQty = 5 * faceQty;
+    if (isSharingVertices) {
+        firstNewVertex = numberUsedVertices(faces, vertices.size(),
+                                            oldIndexToNew);
+        newVertexQty = firstNewVertex + 2 * faceQty;
+        faces.rewind();
+    }
+
+    if (newVertexQty > size_t(std::numeric_limits<int32_t>::max()))
+        throw std::runtime_error("too many output vertices for int indices");
+
+    std::ofstream s(outputFilename.c_str(),
+                    std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!s)
+        throw std::runtime_error("can't open " + outputFilename);
+
+    writeOutputHeader(s, newVertexQty, NEW_FACES_PER_FACE * faceQty);
+
+    if (isSharingVertices)
+        writeUsedVertices(s, vertices, oldIndexToNew);
+    writeNewVertices(s, vertices, faces, isSharingVertices);
+
+    faces.rewind();
+    writeFaces(s, vertices.size(), faces,
+               isSharingVertices ? &oldIndexToNew : 0, firstNewVertex);
+
+    s.close();
+    if (!s)
+        throw std::runtime_error("can't write " + outputFilename);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Obfuscates a binary little endian PLY mesh without loading it: the
+// input is mapped, faces are read, transformed and written in fixed-size
+// chunks, and the output header is written first since the output counts
+// are known up front. Memory use depends on the vertex count only.
+//
+// The output has the same vertices and faces as the in-memory transform,
+// with x, y, z as float and red, green, blue as uchar. Throws PlyError or
+// MappedFileError on input errors and std::runtime_error on write errors.
+void obfuscateStreaming(
+        const std::string& inputFilename,
+        const std::string& outputFilename,
+        bool isSharingVertices);